@@ -0,0 +1,81 @@
+#include "Common.h"
+// only include if SERIALBINARY is chosen in "Common.h"
+#ifdef SERIALBINARY
+
+
+#include <string.h>
+#include "BinFrame.h"
+
+
+// *************************************************************************************
+// CRC
+// *************************************************************************************
+////////////////////////////
+// CRC-8, polynomial x^8+x^2+x+1 (0x07), bitwise to keep it out of the RAM/flash budget
+uint8_t binFrameCRC(const uint8_t *data, uint8_t len)
+{
+  uint8_t crc = 0;
+
+  while (len--) {
+    crc ^= *data++;
+    for (uint8_t z=0; z<8; z++)
+      crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+  }
+  return crc;
+}
+
+
+// *************************************************************************************
+// BinFrameParser class
+// *************************************************************************************
+////////////////////////////
+// Constructor
+BinFrameParser::BinFrameParser() : len(0), size(BINFRAME_SIZE), errorSync(0), errorSeq(0) {}
+
+////////////////////////////
+// Drop any partial frame
+void BinFrameParser::Reset(void)
+{
+  len = 0;
+}
+
+////////////////////////////
+// Feed one byte from the stream
+// Bytes before a sync byte are skipped, the sync byte gives the frame size. If a
+//   complete frame fails the CRC, the parser resynchronizes on the next sync byte
+//   inside that frame, so a lost byte costs at most the frame it was part of.
+int8_t BinFrameParser::Feed(uint8_t inByte)
+{
+  uint8_t z;
+
+  if (len == 0) {
+    if (inByte == BINFRAME_SYNC_REQ) size = BINFRAME_SIZE;
+    else if (inByte == BINFRAME_SYNC_SST) size = BINFRAME_SST_SIZE;
+    else return BINFRAME_NONE;
+  }
+  frame[len++] = inByte;
+  if (len < size) return BINFRAME_NONE;
+
+  len = 0;
+  if (binFrameCRC(frame, size-1) == frame[size-1]) return BINFRAME_OK;
+
+  errorSync = frame[0];
+  errorSeq = frame[1];
+  for (z=1; z<size; z++) {
+    if (frame[z] == BINFRAME_SYNC_REQ || frame[z] == BINFRAME_SYNC_SST) {
+      len = size-z;
+      memmove(frame, frame+z, len);
+      size = (frame[0] == BINFRAME_SYNC_REQ) ? BINFRAME_SIZE : BINFRAME_SST_SIZE;
+      if (len >= size) {
+        // a compact frame complete inside the broken one: taken if it passes the CRC
+        //   (the report of the broken frame is lost then, its sender times out)
+        len = 0;
+        if (binFrameCRC(frame, size-1) == frame[size-1]) return BINFRAME_OK;
+      }
+      break;
+    }
+  }
+  return BINFRAME_BADCRC;
+}
+
+#endif // SERIALBINARY
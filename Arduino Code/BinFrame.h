@@ -0,0 +1,84 @@
+#include "Common.h"
+// only include if SERIALBINARY is chosen in "Common.h"
+#ifdef SERIALBINARY
+
+
+#ifndef BINFRAME_H
+#define BINFRAME_H
+
+#include <stdint.h>
+
+// *************************************************************************************
+// binary frame layout (same size in both directions)
+//   [0]    sync byte: BINFRAME_SYNC_REQ (host->Arduino) or BINFRAME_SYNC_RESP (Arduino->host)
+//   [1]    sequence number, echoed in the response
+//   [2]    command (request) or status (response)
+//   [3..5] arguments / return values, 16 bit values little endian
+//   [6]    CRC-8 (polynomial 0x07, init 0x00) over bytes 0..5
+// *************************************************************************************
+#define BINFRAME_SIZE       7
+#define BINFRAME_SYNC_REQ   0xA5
+#define BINFRAME_SYNC_RESP  0x5A
+
+// *************************************************************************************
+// compact set-state frame, for the most frequent command (4 bytes per state change with
+//   the ack, instead of 14 with the frames above or about 11 with SST in ASCII)
+//   [0]    sync byte: BINFRAME_SYNC_SST
+//   [1]    device (bits 0..6), state (bit 7)
+//   [2]    CRC-8 over bytes 0..1
+// answered by a single byte, BINACK_OK or BINACK_NAK (invalid device or CRC). It carries
+//   no sequence number: after a timeout, resynchronize with a full frame (e.g. BINCMD_NOP).
+// *************************************************************************************
+#define BINFRAME_SST_SIZE   3
+#define BINFRAME_SYNC_SST   0xA6
+#define BINACK_OK           0x06
+#define BINACK_NAK          0x15
+
+// commands
+#define BINCMD_NOP    0x00 // ping, no arguments
+#define BINCMD_SST    0x01 // set state: [3] device, [4] state
+#define BINCMD_GST    0x02 // get state: [3] device -> [3] device, [4] state
+#define BINCMD_SSP    0x03 // set position: [3] device, [4..5] position
+#define BINCMD_GND    0x04 // get number of devices -> [3] number
+#define BINCMD_SSM    0x05 // set states of several devices: [3] device mask, [4] states,
+                           //   [5] group: the bits stand for devices 8*group..8*group+7
+#define BINCMD_ASCII  0x7F // leave binary mode, back to ASCII commands
+
+// status codes
+#define BINSTAT_OK      0x00
+#define BINSTAT_BADCMD  0x01 // unknown command
+#define BINSTAT_BADDEV  0x02 // invalid device number
+#define BINSTAT_BADARG  0x03 // invalid argument
+#define BINSTAT_BADCRC  0x04 // CRC mismatch, frame ignored
+
+// return values of BinFrameParser::Feed
+#define BINFRAME_NONE    0 // need more bytes
+#define BINFRAME_OK      1 // complete frame with valid CRC in frame[] (size by frame[0])
+#define BINFRAME_BADCRC -1 // complete frame with invalid CRC, its sync byte in errorSync and
+                           //   the sequence number (full frames) in errorSeq
+
+// CRC-8 over len bytes
+uint8_t binFrameCRC(const uint8_t *data, uint8_t len);
+
+// *************************************************************************************
+// BinFrameParser class
+// Assembles request frames (full and compact) from a byte stream. No Arduino
+//   dependencies, so it can be built and fuzzed on a host (see Host Sim/BinFrameFuzz.cpp).
+// *************************************************************************************
+class BinFrameParser
+{
+private:
+  uint8_t len;
+  uint8_t size; // of the frame being assembled
+public:
+  uint8_t frame[BINFRAME_SIZE];
+  uint8_t errorSync;
+  uint8_t errorSeq;
+  BinFrameParser();
+  void Reset(void);
+  int8_t Feed(uint8_t inByte);
+};
+
+#endif // BINFRAME_H
+
+#endif // SERIALBINARY
@@ -1,9 +1,13 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <stdint.h>
+
 //////////////
 // devices/functionality to use (comment if unused)
 #define SERIALCOMM
+#define SERIALBINARY // binary frame mode, entered with the BIN command (needs SERIALCOMM)
+//#define SERIALEVENTS // state changes reported to the host as "!EV..." lines, enabled with the EVT command (needs SERIALCOMM)
 
 // pick at most one of the displays:
 //#define DISPLAY_LCD
@@ -11,32 +15,104 @@
 
 //#define DIGINPUT
 
-// pick exactly one of the shutter types:
+//#define SEQUENCER // timed shutter sequences played by the Arduino (needs SERIALCOMM)
+
+//#define STATS // timing histograms of loop, serial commands, actuator writes and display (GPF command)
+
+// pick one or both of the shutter types (with both, the SAT command sets the type of each device):
 #define SHUTTER_RCSERVO
 //#define SHUTTER_SOLENOID
+#if !defined SHUTTER_RCSERVO && !defined SHUTTER_SOLENOID
+#error pick at least one shutter type
+#endif
+
+#ifdef HOST_SIM // the host simulation (Host Sim folder) has no display
+#undef DISPLAY_LCD
+#undef DISPLAY_TFT
+#endif
 //////////////
 
 //////////////
 // general definitions
 #define ID_STRING "Arduino Uno Shutter 4.0"
-#define MAXSHUTTERS 4 // max devices in the parameters class
-#define IDLEINTERVAL_S 0 // time in s after which the servo disengages, zero for never
-                         //   only use for servos, not for solenoids (leave at 0 then) 
+#define MAXSHUTTERS 4 // max devices in the parameters class (up to 64)
+                      //   each takes about 32 bytes of RAM, and the EEPROM needs room for two copies
+                      //   plus the presets (see Parameters.cpp), so the EEPROM sets the limit:
+                      //   Uno (1 KB): 5 with MAXPRESETS 4, 11 with 1, 18 with 0
+                      //   Mega (4 KB): 26 with MAXPRESETS 4, 54 with 1, 64 with 0
+#define MAXPRESETS 4 // named parameter sets stored in the EEPROM (see SPS/LPS commands)
+// one bit per device, as narrow as MAXSHUTTERS allows
+#if MAXSHUTTERS <= 8
+typedef uint8_t ShutterMask;
+#elif MAXSHUTTERS <= 16
+typedef uint16_t ShutterMask;
+#elif MAXSHUTTERS <= 32
+typedef uint32_t ShutterMask;
+#elif MAXSHUTTERS <= 64
+typedef uint64_t ShutterMask;
+#else
+#error MAXSHUTTERS too large (64 at most)
+#endif
+#define DEVBIT(dev) ((ShutterMask)1 << (dev)) // bit(dev) is only 32 bits wide
+// what caused a state change (reported by the EVT events)
+typedef enum {
+  SrcSerial = 0,
+  SrcDisplay,
+  SrcDigital,
+  SrcIdle,
+  SrcSequencer
+} StateSource;
+// servo motion profile (see SMP command): trapezoid in PWM counts per servo frame
+typedef struct {
+  uint8_t maxStep; // top speed in counts per frame, 0->jump to the target (no profile)
+  uint8_t accel;   // speed increase per frame, 0->start at maxStep
+  uint8_t brake;   // speed decrease per frame when approaching the target, 0->same as accel
+} MotionProfile;
+// actuator type of a device (see SAT command), index into the driver table (see the sketch)
+#define ACT_RCSERVO 0
+#define ACT_SOLENOID 1
+#define ACT_TYPES 2
+#ifdef SHUTTER_RCSERVO
+#define ACT_DEFAULT ACT_RCSERVO // type of new devices and of devices saved by older versions
+#else
+#define ACT_DEFAULT ACT_SOLENOID
+#endif
+#define IDLEINTERVAL_S 0 // time in s after which the actuators go idle, zero for never
+                         //   servos disengage, solenoids release whether open or closed:
+                         //   an open solenoid shutter then drops back and closes the beam
 //////////////
 
 //////////////
 // module-specific definitions
 #define RCSERVO_BOARDID 0x40 // I2C address of PWM servo board
+#define RCSERVO_BOARDS 1 // stacked servo boards (16 channels each) at RCSERVO_BOARDID, +1, +2, ...
 #define RCSERVO_FREQ 50 // update rate for the servo shield, analog servos run at ~50 Hz 
 
 #define SOLENOID_BOARDID 0x60 // I2C address of motor board
+#define SOLENOID_BOARDS 1 // stacked motor boards (4 motors each) at SOLENOID_BOARDID, +1, +2, ...
+#define SOLENOID_MOTORS 4 // motor ports per board
+#define SOLENOID_HIT_VALUE 255 // force of the hit-and-hold pulse (see SHT command), 255 is full power
+
+// boards of each shutter type, 0 if it's not chosen (the board of a device is set with the SBD command)
+#ifdef SHUTTER_RCSERVO
+#define ACT_RCSERVO_BOARDS RCSERVO_BOARDS
+#else
+#define ACT_RCSERVO_BOARDS 0
+#endif
+#ifdef SHUTTER_SOLENOID
+#define ACT_SOLENOID_BOARDS SOLENOID_BOARDS
+#else
+#define ACT_SOLENOID_BOARDS 0
+#endif
+#define ACT_BOARDS(type) ((type)==ACT_RCSERVO ? ACT_RCSERVO_BOARDS : (type)==ACT_SOLENOID ? ACT_SOLENOID_BOARDS : 0)
+#define SHIELD_I2C_CLOCK 400000 // I2C clock in Hz (PCA9685 handles up to 1 MHz), 100000 is the Wire default
 
 #define SERIAL_BAUDRATE 9600
 #define SERIAL_TERMCHAR 0xA  // can be 0xA (LF) or 0xD  (CR)
 
 #define TFT_BORDERWIDTH 6 // width of the border around buttons (in px) 
 #define TFT_BLOCKING_TIME_MS 100 // time in ms during which a new touch is ignored. Used for debouncing
-// for TFT: easiest if TFT_MAXROWS = MAXSHUTTERS
+// for TFT: with more devices than rows, touching a label shows the next TFT_MAXROWS devices
 #define TFT_MAXROWS 4 // number of rows on the TFT
 #define TFT_DIM_PERIOD_S 60 // time in s after which display dims
 #define TFT_SCREENROTATION  1 // (1: USB conn on left; 3: USB conn on right)
@@ -51,10 +127,17 @@
 #define MAXLABELCHARS_STR "7" // (same number, but as a string for scanf/printf formatting)
 
 #define DIGINPUT_USEPULLUPS 0 // 1->use internal Arduino pullup resistors, 0 if not
-// the total debounce period for the digital inputs is (DIGINPUT_MAX_CHECKS * DIGINPUT_CHECK_INTERVAL_MS) in ms
+// each input is debounced on its own: it is reported once it has been stable at its new level
+//   for (DIGINPUT_MAX_CHECKS * DIGINPUT_CHECK_INTERVAL_MS) ms, independent of the other inputs
 // if not debouncing is required, set DIGINPUT_CHECK_INTERVAL_MS to zero (DIGINPUT_MAX_CHECKS must be >0)
 #define DIGINPUT_CHECK_INTERVAL_MS 0   // interval in ms for the bounce check
-#define DIGINPUT_MAX_CHECKS        10  // number of intervals in a bounce check cycle
+#define DIGINPUT_MAX_CHECKS        10  // number of stable intervals before an input is reported (1-15)
+// 1->low latency: the inputs are also serviced between the display steps of the main loop
+//   and the display follows the shutters afterwards, 0->inputs once per loop pass
+#define DIGINPUT_FASTPATH 1
+
+#define SEQ_MAXEVENTS 16 // events in a sequence (4 bytes plus two ShutterMasks of RAM each)
+#define SEQ_SPIN_US 200 // events due within this time (in us) are waited for in a tight loop
 //////////////
 
 #endif
\ No newline at end of file
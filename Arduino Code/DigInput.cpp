@@ -36,7 +36,7 @@ DigInput::DigInput(){}
 
 ////////////////////////////
 // Initialize stuff
-DigInput::Begin()
+void DigInput::Begin()
 {
 #if SERIAL_DEBUG>0
   Serial.println(F("DigInput Begin."));
@@ -61,25 +61,33 @@ DigInput::Begin()
     OCR1A = (uint16_t)(DIGINPUT_CHECK_INTERVAL_MS*15.625 - 1); // set compare match register (must be <65536)
     TCCR1B |= bit(WGM12); // turn on CTC mode
   }
+  DigInput::highState = PIND & PCINT_MASK; // start from the current levels
   interrupts();
 
   DigInput::status = 0;
+  DigInput::changedPins = 0;
+  ClearLatency();
 }
 
 ////////////////////////////
 // check whether an input has changed
 // returns 1 if something has changed, 0 otherwise
 // pinstate contains the desired shutter configuration in bits 0-3
-uint8_t DigInput::CheckState(uint8_t *pinState)
+// changed flags the inputs (bits 0-3) that have changed
+// edgeTime is the micros() time stamp of the latest edge
+uint8_t DigInput::CheckState(uint8_t *pinState, uint8_t *changed, unsigned long *edgeTime)
 {
   uint8_t flag;
-  uint8_t hs;
+  uint8_t hs, cp;
 
   // copy and clear status flag
   noInterrupts();
   flag = DigInput::status;
   DigInput::status = 0;
   hs = DigInput::highState;
+  cp = DigInput::changedPins;
+  DigInput::changedPins = 0;
+  *edgeTime = DigInput::edgeTime_us;
   interrupts();
 
   if (flag & bit(PIN_SETTLED)) {
@@ -91,6 +99,11 @@ uint8_t DigInput::CheckState(uint8_t *pinState)
     if (hs & bit(CTRL1)) *pinState |= bit(1);
     if (hs & bit(CTRL2)) *pinState |= bit(2);
     if (hs & bit(CTRL3)) *pinState |= bit(3);
+    *changed = 0;
+    if (cp & bit(CTRL0)) *changed |= bit(0);
+    if (cp & bit(CTRL1)) *changed |= bit(1);
+    if (cp & bit(CTRL2)) *changed |= bit(2);
+    if (cp & bit(CTRL3)) *changed |= bit(3);
 //    *pinState = (hs>>4); // shift pins 4-7 to bits 0-3
 #if SERIAL_DEBUG>0
     Serial.print(F("PinState = ")); Serial.println(*pinState);
@@ -101,58 +114,87 @@ uint8_t DigInput::CheckState(uint8_t *pinState)
   }
 }
 
+////////////////////////////
+// add a measured edge-to-actuation time to the statistics
+void DigInput::RecordLatency(unsigned long latency_us)
+{
+  latencyLast_us = latency_us;
+  if (latencyCount==0 || latency_us < latencyMin_us) latencyMin_us = latency_us;
+  if (latency_us > latencyMax_us) latencyMax_us = latency_us;
+  if (latencyCount < 0xFFFF) latencyCount++;
+}
+
+////////////////////////////
+// reset the latency statistics
+void DigInput::ClearLatency(void)
+{
+  latencyCount = 0;
+  latencyLast_us = latencyMin_us = latencyMax_us = 0;
+}
+
 // **********************
 // interrupt service routines
 // **********************
 ////////////////////////////
 // pin change interrupt gets called when any of the monitored pins change
+// With debouncing, the pin change interrupt stays enabled and only makes sure the
+//   timer runs; each pin is then debounced on its own by the timer interrupt.
 ISR(PCINT2_vect){
+  uint8_t pins;
 
   if (DIGINPUT_CHECK_INTERVAL_MS>0) {
-    // stop PC interrupt
-    PCICR &= ~bit(PCIE2);  // disable PCI on port 2
-    // start timer -> this runs the timer for DIGINPUT_CHECK_INTERVAL_MS ms
-    TCNT1 = 0; // reset the timer to zero
-    TIMSK1 |= bit(OCIE1A); // enable timer compare interrupt
-
-    // this ensures that the debounce check runs one full cycle
-    DigInput::state[DigInput::index] = ~(PIND & PCINT_MASK);
-    DigInput::index++;
-    if(DigInput::index>=DIGINPUT_MAX_CHECKS) DigInput::index=0;
+    if (!(TIMSK1 & bit(OCIE1A))) { // start timer -> samples the pins every DIGINPUT_CHECK_INTERVAL_MS ms
+      TCNT1 = 0; // reset the timer to zero
+      TIFR1 = bit(OCF1A); // clear a stale compare flag
+      TIMSK1 |= bit(OCIE1A); // enable timer compare interrupt
+    }
   } else { // no debounce check
-    DigInput::highState = PIND & PCINT_MASK;
+    pins = PIND & PCINT_MASK;
+    DigInput::changedPins |= pins ^ DigInput::highState;
+    DigInput::highState = pins;
+    DigInput::edgeTime_us = micros();
     DigInput::status |= bit(PIN_SETTLED); // set the flag that the pins have finished bouncing
   }
 }
 
 ////////////////////////////
 // timer interrupt gets called when count is met (every DIGINPUT_CHECK_INTERVAL_MS until stopped)
+// A pin settles at a new level once it has differed from its debounced level in
+//   DIGINPUT_MAX_CHECKS consecutive samples; any sample at the old level restarts
+//   its count. All pins are counted in parallel with bitwise operations.
 ISR(TIMER1_COMPA_vect)
 {
-  uint8_t z;
-  uint8_t low, high;
-
-  DigInput::state[DigInput::index] = PIND & PCINT_MASK; // read the port
-  DigInput::index++;
-  // check if the pins have settled (all the entries match, all pins high or all low)
-  high = low = 0xFF;
-  for (z=0; z<DIGINPUT_MAX_CHECKS;z++) {
-    high = high & DigInput::state[z];  // check for all bits high
-    low = low & ~DigInput::state[z];  // check for all bits low
+  uint8_t b;
+  uint8_t diff, carry, settled, running, tmp;
+
+  diff = (PIND & PCINT_MASK) ^ DigInput::highState; // pins away from their debounced level
+
+  // counter++ for pins in diff, counter = 0 for all others
+  carry = diff;
+  for (b=0; b<DIGINPUT_COUNTER_BITS; b++) {
+    tmp = DigInput::counter[b];
+    DigInput::counter[b] = (tmp ^ carry) & diff;
+    carry &= tmp;
   }
-  DigInput::highState = high; // bits that are 1 have settled at high, all others have changed
-  DigInput::lowState = low; // bits that are 1 have settled at low, all others have changed
-  if(DigInput::index>=DIGINPUT_MAX_CHECKS) DigInput::index=0;
 
-  if ( (high | low) == 0xFF ) { // all pins have settled either high or low
-    // set the flag and stop the timer
+  // pins whose counter has reached DIGINPUT_MAX_CHECKS
+  settled = diff;
+  for (b=0; b<DIGINPUT_COUNTER_BITS; b++)
+    settled &= (DIGINPUT_MAX_CHECKS & bit(b)) ? DigInput::counter[b] : ~DigInput::counter[b];
+
+  running = 0;
+  for (b=0; b<DIGINPUT_COUNTER_BITS; b++) {
+    DigInput::counter[b] &= ~settled;
+    running |= DigInput::counter[b];
+  }
+
+  if (settled) {
+    DigInput::highState ^= settled;
+    DigInput::changedPins |= settled;
+    DigInput::edgeTime_us = micros();
     DigInput::status |= bit(PIN_SETTLED); // set the flag that the pins have finished bouncing
-    // stop timer
-    TIMSK1 &= ~bit(OCIE1A); // disable timer compare interrupt
-    // start PC interrupt
-    PCIFR = bit(PCIF2);  // clear the interrupt flag
-    PCICR |= bit(PCIE2);  // enable PCI on port 2
-  } // else: keep going with the timer until settled
+  }
+  if (!running) TIMSK1 &= ~bit(OCIE1A); // all pins settled, stop timer until the next pin change
 }
 
 #endif // DIGINPUT
\ No newline at end of file
@@ -6,18 +6,32 @@
 #ifndef DIGINPUT_H
 #define DIGINPUT_H
 
+#define DIGINPUT_LINES 4 // number of control lines
+#define DIGINPUT_COUNTER_BITS 4 // bit planes of the debounce counters
+#if DIGINPUT_MAX_CHECKS >= (1<<DIGINPUT_COUNTER_BITS)
+#error "DIGINPUT_MAX_CHECKS must be < 16"
+#endif
+
 class DigInput
 {
 //private:
 public:
-  static inline uint8_t status; // status flag (here only bounce finished bit) 
-  static inline uint8_t lowState, highState; // debounced state
-  static inline uint8_t state[DIGINPUT_MAX_CHECKS];
-  static inline uint8_t index;
+  static inline volatile uint8_t status; // status flag (here only bounce finished bit) 
+  static inline volatile uint8_t highState; // debounced state
+  static inline volatile uint8_t changedPins; // pins that settled at a new level since the last CheckState
+  // per-pin debounce counters, stored as bit planes: bit n of counter[b] is bit b
+  //   of the counter of port pin n (a "vertical counter")
+  static inline uint8_t counter[DIGINPUT_COUNTER_BITS];
+  static inline unsigned long edgeTime_us; // micros() when the latest edge was detected (after debouncing)
+  // edge-to-actuation latency statistics
+  static inline uint16_t latencyCount;
+  static inline unsigned long latencyLast_us, latencyMin_us, latencyMax_us;
 
   DigInput();
-  Begin();
-  uint8_t CheckState(uint8_t *pinState);
+  void Begin();
+  uint8_t CheckState(uint8_t *pinState, uint8_t *changed, unsigned long *edgeTime);
+  static void RecordLatency(unsigned long latency_us);
+  static void ClearLatency(void);
 };
 
 #endif // DIGINPUT_H
@@ -61,8 +61,9 @@ LCD::SetNumDevs(int8_t numShutters)
 {
   numDevs = numShutters;
   if (numDevs>0) {
-    currDevice = 0;
-    RefreshDisplay();
+    if (currDevice<0 || currDevice>=numDevs) currDevice = 0;
+    currLabel[0] = '\0';
+    currState = -2;
   } else {
     currDevice = -1;
     char emptyLabel[MAXLABELCHARS+1];
@@ -70,9 +71,10 @@ LCD::SetNumDevs(int8_t numShutters)
     _lcdDev.setCursor(0,0); _lcdDev.print(emptyLabel);
   }
 }
+// devices other than the shown one are ignored
 LCD:: SetDevText(int8_t device, char *label)
 {
-  sprintf(devLabels[device], "%-"MAXLABELCHARS_STR"s", label);
+  if (device==currDevice) sprintf(currLabel, "%-"MAXLABELCHARS_STR"s", label);
 }
 
 ////////////////////////////
@@ -80,7 +82,7 @@ LCD:: SetDevText(int8_t device, char *label)
 LCD::RefreshDisplay()
 {
   if (currDevice>=0) {
-    _lcdDev.setCursor(0,0); _lcdDev.print(devLabels[currDevice]);
+    _lcdDev.setCursor(0,0); _lcdDev.print(currLabel);
     RefreshDev(currDevice);
   }
 }
@@ -90,13 +92,13 @@ LCD::RefreshDisplay()
 LCD::RefreshDev(int8_t device)
 {
   if (device==currDevice) { // only update if actually displayed
-    if (devState[device]==0) {
+    if (currState==0) {
       _lcdDev.setCursor(0,1); _lcdDev.write(ARROW_CHAR);
       _lcdDev.setCursor(9,1); _lcdDev.write(SPACE_CHAR);
-    } else if (devState[device]==1) {
+    } else if (currState==1) {
       _lcdDev.setCursor(0,1); _lcdDev.write(SPACE_CHAR);
       _lcdDev.setCursor(9,1); _lcdDev.write(ARROW_CHAR);
-    } else if (devState[device]==-1) {
+    } else { // idle, manual position or unknown
       _lcdDev.setCursor(0,1); _lcdDev.write(SPACE_CHAR);
       _lcdDev.setCursor(9,1); _lcdDev.write(SPACE_CHAR);
     }
@@ -108,13 +110,14 @@ LCD::RefreshDev(int8_t device)
 // state is on (1), off (0), or undefined (-1)
 LCD::ChangeDevState(int8_t device, int8_t state)
 {
-  devState[device] = state;
+  if (device!=currDevice) return;
+  currState = state;
   RefreshDev(device);
 }
 
 ////////////////////////////
 // Check for buttons
-// return 1 if it was a valid request
+// return 1 if it was a valid request, 2 if another device is shown
 // returns the device that requests the changed state by reference
 int8_t LCD::CheckInput(int8_t *device, int8_t *state)
 {
@@ -147,12 +150,12 @@ int8_t LCD::CheckInput(int8_t *device, int8_t *state)
           if (buttons & BUTTON_UP) {
             currDevice++;
             if (currDevice==numDevs) currDevice=0;
-            RefreshDisplay();
+            return 2;
           }
           if (buttons & BUTTON_DOWN) {
             if (currDevice==0) currDevice=numDevs;
             currDevice--;
-            RefreshDisplay();
+            return 2;
           }
           if (buttons & BUTTON_LEFT) {
             *device = currDevice;
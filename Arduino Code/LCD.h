@@ -9,10 +9,11 @@
 class LCD
 {
 private:
-  char devLabels[MAXSHUTTERS][MAXLABELCHARS+1];
+  // only the shown device is kept, the others are sent again when it changes (see CheckInput)
+  char currLabel[MAXLABELCHARS+1];
   int8_t numDevs = 0;
   int8_t currDevice = 0;
-  int8_t devState[MAXSHUTTERS] = {-2};
+  int8_t currState = -2;
   unsigned long lastButtonTime = 0;
   unsigned int dispTurnoffInterval_s;
   int8_t isDisplayOff = 0;
@@ -27,6 +28,7 @@ public:
   RefreshDisplay();
   RefreshDev(int8_t device);
   ChangeDevState(int8_t device, int8_t state);
+  // returns 1 for a state request, 2 if another device is shown (set the texts and states again)
   int8_t CheckInput(int8_t *device, int8_t *state);
 };
 
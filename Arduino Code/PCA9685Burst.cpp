@@ -0,0 +1,88 @@
+#include "Common.h"
+// only include if one of the PCA9685 based shutter types is chosen in "Common.h"
+#if defined SHUTTER_RCSERVO || defined SHUTTER_SOLENOID
+
+
+#include <Arduino.h>
+#include <Wire.h>
+#include "PCA9685Burst.h"
+
+
+// *************************************************************************************
+// defines
+// *************************************************************************************
+#define PCA9685_MODE1      0x00
+#define PCA9685_PRESCALE   0xFE
+#define PCA9685_LED0_ON_L  0x06 // first channel register, each channel has four (ON_L, ON_H, OFF_L, OFF_H)
+#define MODE1_RESTART      0x80
+#define MODE1_AI           0x20 // register auto-increment
+#define MODE1_SLEEP        0x10
+#define PCA9685_OSC_HZ     25000000UL // internal oscillator
+// channels per I2C transaction: the Wire buffer holds the register address plus four bytes per channel
+#define PCA9685_BURST_CHANNELS  ((BUFFER_LENGTH-1)/4)
+
+
+// *************************************************************************************
+// functions
+// *************************************************************************************
+////////////////////////////
+// Write one register
+static uint8_t pca9685Write8(uint8_t boardId, uint8_t reg, uint8_t value)
+{
+  Wire.beginTransmission(boardId);
+  Wire.write(reg);
+  Wire.write(value);
+  return Wire.endTransmission()==0;
+}
+
+////////////////////////////
+// The prescaler can only be set while the oscillator sleeps; after waking up
+//   the oscillator needs 500 us before the restart
+uint8_t pca9685Begin(uint8_t boardId, uint16_t freq_Hz)
+{
+  uint16_t prescale = (PCA9685_OSC_HZ/2048/freq_Hz + 1)/2 - 1; // rounded
+
+  if (prescale < 3) prescale = 3; // limits of the chip
+  if (prescale > 255) prescale = 255;
+  if (!pca9685Write8(boardId, PCA9685_MODE1, MODE1_SLEEP | MODE1_AI)) return 0;
+  pca9685Write8(boardId, PCA9685_PRESCALE, prescale);
+  pca9685Write8(boardId, PCA9685_MODE1, MODE1_AI);
+  delay(1);
+  pca9685Write8(boardId, PCA9685_MODE1, MODE1_RESTART | MODE1_AI);
+  return 1;
+}
+
+////////////////////////////
+// Each run of adjacent channels goes out as one transaction (split only when
+//   it exceeds the Wire buffer), instead of one transaction per channel
+void pca9685WriteChannels(uint8_t boardId, uint16_t channelMask, const uint16_t *values)
+{
+  uint8_t ch = 0;
+  uint8_t count;
+  uint16_t on, off;
+
+  while (ch < PCA9685_CHANNELS) {
+    if (!(channelMask & bit(ch))) {
+      ch++;
+      continue;
+    }
+    Wire.beginTransmission(boardId);
+    Wire.write(PCA9685_LED0_ON_L + 4*ch);
+    for (count = 0; ch < PCA9685_CHANNELS && (channelMask & bit(ch)) && count < PCA9685_BURST_CHANNELS; ch++, count++) {
+      if (values[ch] >= PCA9685_FULL_ON) {
+        on = PCA9685_FULL_ON;
+        off = 0;
+      } else {
+        on = 0;
+        off = values[ch];
+      }
+      Wire.write(lowByte(on));
+      Wire.write(highByte(on));
+      Wire.write(lowByte(off));
+      Wire.write(highByte(off));
+    }
+    Wire.endTransmission();
+  }
+}
+
+#endif // SHUTTER_RCSERVO || SHUTTER_SOLENOID
@@ -0,0 +1,28 @@
+#include "Common.h"
+// only include if one of the PCA9685 based shutter types is chosen in "Common.h"
+#if defined SHUTTER_RCSERVO || defined SHUTTER_SOLENOID
+
+
+#ifndef PCA9685BURST_H
+#define PCA9685BURST_H
+
+#include <stdint.h>
+
+#define PCA9685_CHANNELS  16
+#define PCA9685_FULL_ON   4096 // channel value for a constant high output
+
+// Wake up a board with the given PWM frequency and register auto-increment
+//   boardId: I2C address; returns 0 if the board did not answer
+// Replaces the begin/setPWMFreq of the Adafruit drivers, which would need one
+//   driver object (and its RAM) per stacked board.
+uint8_t pca9685Begin(uint8_t boardId, uint16_t freq_Hz);
+
+// Write the ON/OFF registers of all channels in channelMask
+//   values: one per channel (indexed by channel number), 0..4095 sets the
+//   off count (on count 0), PCA9685_FULL_ON sets the output constantly high.
+// Needs the register auto-increment (MODE1 AI bit), see pca9685Begin.
+void pca9685WriteChannels(uint8_t boardId, uint16_t channelMask, const uint16_t *values);
+
+#endif // PCA9685BURST_H
+
+#endif // SHUTTER_RCSERVO || SHUTTER_SOLENOID
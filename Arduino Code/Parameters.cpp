@@ -1,9 +1,106 @@
 #include <Arduino.h>
 #include <EEPROM.h>
+#include <stddef.h>
 
 #include "Common.h"
 #include "Parameters.h"
 
+// *************************************************************************************
+// EEPROM layout
+// *************************************************************************************
+// Two slots (A/B), each a header and the shutter records. A save goes to the slot not
+//   holding the loaded image and writes the header last, so after a power loss during
+//   the save the slot fails the CRC and the previous image is read at the next start.
+// The first firmware versions wrote a count byte and the records (up to the label)
+//   at address 0 without a header; such an image is still read (see readLegacy).
+// The presets follow the slots: a header, the name and the records each.
+#define EE_MAGIC 0x5348         // "SH"
+#define EE_LAYOUT_VERSION 1
+// Larger builds reserve 24 bytes per record, so ShutterStruct can still grow a little
+//   without moving slot B and the presets.
+#define EE_SLOT_A 128           // after the legacy image
+#define EE_NAMESIZE (MAXLABELCHARS+1)
+#if MAXSHUTTERS <= 4
+#define EE_SLOTSIZE 192
+#define EE_PRESETSIZE 128
+#else
+#define EE_SLOTSIZE (16 + MAXSHUTTERS*24)
+#define EE_PRESETSIZE (16 + EE_NAMESIZE + MAXSHUTTERS*24)
+#endif
+#define EE_PRESET_A (EE_SLOT_A + 2*EE_SLOTSIZE)
+#define EE_LEGACY_RECORDSIZE 16 // ShutterStruct up to the label
+#define EE_LEGACY_MAXSHUTTERS 4 // the first firmware versions had four shutters at most
+
+static_assert(sizeof(EEHeader) + MAXSHUTTERS*sizeof(ShutterStruct) <= EE_SLOTSIZE,
+              "EEPROM slot too small");
+static_assert(sizeof(EEHeader) + EE_NAMESIZE + MAXSHUTTERS*sizeof(ShutterStruct) <= EE_PRESETSIZE,
+              "EEPROM preset too small");
+static_assert(EE_PRESET_A + MAXPRESETS*EE_PRESETSIZE <= E2END + 1,
+              "slots and presets do not fit the EEPROM, lower MAXPRESETS or MAXSHUTTERS");
+static_assert(1 + EE_LEGACY_MAXSHUTTERS*EE_LEGACY_RECORDSIZE <= EE_SLOT_A, "slots overlap the legacy image");
+static_assert(offsetof(ShutterStruct, hitTime_ms)==EE_LEGACY_RECORDSIZE, "legacy record changed");
+
+////////////////////////////
+// CRC-16, polynomial x^16+x^12+x^5+1 (0x1021), bitwise like binFrameCRC
+static uint16_t eeCRC(uint16_t crc, uint8_t data)
+{
+  crc ^= (uint16_t)data << 8;
+  for (uint8_t bitInd=0; bitInd<8; bitInd++)
+    crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+  return crc;
+}
+
+static uint16_t eeCRCBlock(uint16_t crc, const void *data, uint16_t len)
+{
+  const uint8_t *ptr = (const uint8_t *)data;
+
+  while (len--) crc = eeCRC(crc, *ptr++);
+  return crc;
+}
+
+////////////////////////////
+// CRC of the header part after the crc field (the records are added to it)
+static uint16_t eeHeaderCRC(const EEHeader *header)
+{
+  return eeCRCBlock(0xFFFF, &header->sequence, sizeof(EEHeader) - offsetof(EEHeader, sequence));
+}
+
+////////////////////////////
+// CRC of a stretch of the EEPROM
+static uint16_t eeAreaCRC(uint16_t crc, int address, int16_t len)
+{
+  while (len-- > 0) crc = eeCRC(crc, EEPROM.read(address++));
+  return crc;
+}
+
+////////////////////////////
+// Header that can be read by this code (the CRC is checked with the records)
+//   space: bytes for the records
+static bool eeHeaderValid(const EEHeader *header, int16_t space)
+{
+  return header->magic==EE_MAGIC && header->version==EE_LAYOUT_VERSION
+      && header->numShutters>0 && header->numShutters<=MAXSHUTTERS && header->recordSize>0
+      && header->numShutters*header->recordSize <= space;
+}
+
+////////////////////////////
+// Check a preset; returns the CRC up to the records (0 with numShutters 0 if it's empty)
+static uint16_t eeReadPresetHeader(int8_t preset, EEHeader *header)
+{
+  int address = EE_PRESET_A + preset*EE_PRESETSIZE;
+  uint16_t crc;
+
+  EEPROM.get(address, *header);
+  if (eeHeaderValid(header, EE_PRESETSIZE - sizeof(EEHeader) - EE_NAMESIZE)) {
+    crc = eeAreaCRC(eeHeaderCRC(header), address + sizeof(EEHeader), EE_NAMESIZE);
+    if (eeAreaCRC(crc, address + sizeof(EEHeader) + EE_NAMESIZE,
+                  header->numShutters*header->recordSize) == header->crc)
+      return crc;
+  }
+  header->numShutters = 0;
+  return 0;
+}
+
 
 ////////////////////////////
 // Constructor
@@ -24,19 +121,64 @@ int8_t Parameters::set(int8_t shutter, uint8_t shieldChannel, int8_t digInput, u
     } else {
       selectedShutter=numShuttersDefined;
       numShuttersDefined++;
+      params[selectedShutter].hitTime_ms = 0; // constant drive, see setHitTime
+      memset(&params[selectedShutter].motion, 0, sizeof(MotionProfile)); // no profile
+      params[selectedShutter].board = 0;
+      params[selectedShutter].actuator = ACT_DEFAULT;
     }
   } else if (shutter>=numShuttersDefined) {
     return -1; // shutter not defined
   } else {
     selectedShutter=shutter;
   }
+  paramsChanged();
 
   params[selectedShutter].shieldChannel      = shieldChannel;
   params[selectedShutter].digInput    = digInput;
   params[selectedShutter].posOpen         = posOpen;
   params[selectedShutter].posClosed       = posClosed;
   params[selectedShutter].transitDelay_ms = transitDelay_ms;
-  sprintf(params[selectedShutter].label, "%."MAXLABELCHARS_STR"s", label);
+  sprintf(params[selectedShutter].label, "%." MAXLABELCHARS_STR "s", label);
+  return 0;
+}
+
+////////////////////////////
+// Set the hit-and-hold pulse
+int8_t Parameters::setHitTime(int8_t shutter, uint16_t hitTime_ms)
+{
+  if (shutter<0 || shutter>=numShuttersDefined) return -1;
+  params[shutter].hitTime_ms = hitTime_ms;
+  paramsChanged();
+  return 0;
+}
+
+////////////////////////////
+// Set the motion profile
+int8_t Parameters::setMotion(int8_t shutter, const MotionProfile *motion)
+{
+  if (shutter<0 || shutter>=numShuttersDefined) return -1;
+  params[shutter].motion = *motion;
+  paramsChanged();
+  return 0;
+}
+
+////////////////////////////
+// Set the board of the shield channel
+int8_t Parameters::setBoard(int8_t shutter, uint8_t board)
+{
+  if (shutter<0 || shutter>=numShuttersDefined) return -1;
+  params[shutter].board = board;
+  paramsChanged();
+  return 0;
+}
+
+////////////////////////////
+// Set the actuator type
+int8_t Parameters::setActuator(int8_t shutter, uint8_t actuator)
+{
+  if (shutter<0 || shutter>=numShuttersDefined) return -1;
+  params[shutter].actuator = actuator;
+  paramsChanged();
   return 0;
 }
 
@@ -45,45 +187,244 @@ int8_t Parameters::set(int8_t shutter, uint8_t shieldChannel, int8_t digInput, u
 void Parameters::clear(void)
 {
   numShuttersDefined=0;
+  activePresetInd = -1;
+  savePos = -1; // nothing to save, an unfinished slot fails the CRC
 }
 
 ////////////////////////////
 // Save the info to EEPROM
+// Only prepares the save: a byte write takes 3.3 ms, the whole image would stall the
+//   main loop for a few 100 ms. Update writes it one byte per pass instead, the records
+//   first and the header (with the CRC) last: that write commits the slot.
 int8_t Parameters::saveToEEPROM(void)
 {
-  int eeAddress = 0;
+  if (numShuttersDefined<=0) return -1; // no shutters defined
+  if (savePos>=0 && savePreset>=0) return -2; // a preset is being stored
+
+  saveSlot = (eeSlot==0) ? 1 : 0; // keep the loaded image until this one is complete
+  savePreset = -1;
+  beginSave();
+  return 0;
+}
 
-  if (numShuttersDefined==0) return -1; // no shutters defined
+////////////////////////////
+// Store the shutters as a preset, in the background like saveToEEPROM
+int8_t Parameters::storePreset(int8_t preset, const char *name)
+{
+  if (preset<0 || preset>=MAXPRESETS || numShuttersDefined<=0) return -1;
+  if (savePos>=0 && savePreset!=preset) return -2; // another save runs
 
-  EEPROM.put(eeAddress, numShuttersDefined);
-  eeAddress += sizeof(int8_t);
-  for (int8_t idx=0; idx<numShuttersDefined; idx++){
-    EEPROM.put(eeAddress, params[idx]);
-    eeAddress += sizeof(ShutterStruct);
-  }
+  savePreset = preset;
+  memset(saveName, 0, sizeof(saveName));
+  strncpy(saveName, name, MAXLABELCHARS);
+  beginSave();
   return 0;
 }
 
+////////////////////////////
+// Header and size of the save to saveSlot/savePreset, from the first byte
+void Parameters::beginSave(void)
+{
+  memset(&saveHeader, 0, sizeof(saveHeader));
+  saveHeader.magic = EE_MAGIC;
+  saveHeader.sequence = (savePreset<0) ? eeSequence + 1 : 0;
+  saveHeader.version = EE_LAYOUT_VERSION;
+  saveHeader.recordSize = sizeof(ShutterStruct);
+  saveHeader.numShutters = numShuttersDefined;
+  saveHeader.crc = eeHeaderCRC(&saveHeader);
+  saveSize = numShuttersDefined*sizeof(ShutterStruct) + sizeof(EEHeader);
+  if (savePreset<0) {
+    saveSize += 1; // legacy count byte
+  } else {
+    saveHeader.crc = eeCRCBlock(saveHeader.crc, saveName, EE_NAMESIZE);
+    saveSize += EE_NAMESIZE;
+  }
+  savePos = 0;
+}
+
+////////////////////////////
+// The shutters no longer match a preset; a running save starts over with the new values
+void Parameters::paramsChanged(void)
+{
+  activePresetInd = -1;
+  if (savePos>=0) beginSave();
+}
+
+////////////////////////////
+// Background part of the save
+// Bytes that already hold the value are skipped, at most one write per call. Nothing
+//   is read while a write is running, an AVR EEPROM read would wait for it.
+void Parameters::Update(void)
+{
+  int16_t offset, nameBytes, recordBytes;
+  int base, address;
+  uint8_t data;
+
+  if (savePos<0 || !eeprom_is_ready()) return;
+  recordBytes = numShuttersDefined*sizeof(ShutterStruct);
+  if (savePreset<0) {
+    base = EE_SLOT_A + saveSlot*EE_SLOTSIZE;
+    nameBytes = 0;
+  } else {
+    base = EE_PRESET_A + savePreset*EE_PRESETSIZE;
+    nameBytes = EE_NAMESIZE;
+  }
+  while (savePos<saveSize) {
+    offset = savePos++;
+    if (offset<recordBytes) {
+      address = base + sizeof(EEHeader) + nameBytes + offset;
+      data = ((const uint8_t *)params)[offset];
+      saveHeader.crc = eeCRC(saveHeader.crc, data);
+    } else if ((offset -= recordBytes) < nameBytes) {
+      address = base + sizeof(EEHeader) + offset;
+      data = saveName[offset];
+    } else if ((offset -= nameBytes) < (int16_t)sizeof(EEHeader)) {
+      address = base + offset;
+      data = ((const uint8_t *)&saveHeader)[offset];
+    } else {
+      address = 0; // retire a legacy image, the slots hold the data now
+      data = 0;
+    }
+    if (EEPROM.read(address)!=data) {
+      EEPROM.write(address, data);
+      return;
+    }
+  }
+  if (savePreset<0) {
+    eeSlot = saveSlot;
+    eeSequence = saveHeader.sequence;
+  } else {
+    activePresetInd = savePreset;
+  }
+  savePos = -1;
+}
+
+////////////////////////////
+// Progress of the save
+int8_t Parameters::saveStatus(int16_t *done, int16_t *total)
+{
+  *total = saveSize;
+  if (savePos<0) {
+    *done = saveSize;
+    return 0;
+  }
+  *done = savePos;
+  return 1;
+}
+
 ////////////////////////////
 // Read the info from EEPROM
+// The newer of the two slots is used if it passes the CRC, else the other one
 int8_t Parameters::readFromEEPROM(void)
 {
-  int eeAddress = 0;
-
-  EEPROM.get(eeAddress, numShuttersDefined);
-  if (numShuttersDefined==0 || numShuttersDefined>MAXSHUTTERS) { // no shutters defined
-   numShuttersDefined=0;
-   return -1;
-  } 
-  eeAddress += sizeof(int8_t);
-  for (int8_t idx=0; idx<numShuttersDefined; idx++){
-    EEPROM.get(eeAddress, params[idx]);
-    params[idx].label[MAXLABELCHARS-1]='\0'; // just in case there was garbage in the EEPROM
-    eeAddress += sizeof(ShutterStruct);
+  EEHeader header[2];
+  bool valid[2];
+  int8_t slot;
+
+  numShuttersDefined = 0;
+  eeSlot = -1;
+  eeSequence = 0;
+  for (slot=0; slot<2; slot++) {
+    EEPROM.get(EE_SLOT_A + slot*EE_SLOTSIZE, header[slot]);
+    valid[slot] = eeHeaderValid(&header[slot], EE_SLOTSIZE - sizeof(EEHeader));
   }
+  slot = (valid[1] && (!valid[0] || (int16_t)(header[1].sequence - header[0].sequence) > 0)) ? 1 : 0;
+  for (uint8_t attempt=0; attempt<2; attempt++, slot^=1) {
+    if (valid[slot] && readRecords(EE_SLOT_A + slot*EE_SLOTSIZE + sizeof(EEHeader), &header[slot],
+                                   eeHeaderCRC(&header[slot]))==0) {
+      eeSlot = slot;
+      eeSequence = header[slot].sequence;
+      return 0;
+    }
+  }
+  return readLegacy();
+}
+
+////////////////////////////
+// Read the records of a slot or preset and check the CRC on the way
+//   address: first record, crc: CRC of what comes before
+// Records of an older layout are shorter, the fields added since start at 0 (and the
+//   actuator at the type of this build, the only one there was)
+int8_t Parameters::readRecords(int address, const EEHeader *header, uint16_t crc)
+{
+  uint8_t *record, data;
+
+  for (int8_t idx=0; idx<header->numShutters; idx++){
+    record = (uint8_t *)&params[idx];
+    memset(record, 0, sizeof(ShutterStruct));
+    for (uint8_t byteInd=0; byteInd<header->recordSize; byteInd++) {
+      data = EEPROM.read(address++);
+      crc = eeCRC(crc, data);
+      if (byteInd<sizeof(ShutterStruct)) record[byteInd] = data;
+    }
+    if (header->recordSize<=offsetof(ShutterStruct, actuator)) params[idx].actuator = ACT_DEFAULT;
+    params[idx].label[MAXLABELCHARS]='\0';
+  }
+  if (crc!=header->crc) return -1;
+  numShuttersDefined = header->numShutters;
+  return 0;
+}
+
+////////////////////////////
+// Read an image of the first firmware versions (count byte, then the records)
+int8_t Parameters::readLegacy(void)
+{
+  int8_t count;
+  uint8_t *record;
+
+  EEPROM.get(0, count);
+  if (count<=0 || count>EE_LEGACY_MAXSHUTTERS || count>MAXSHUTTERS) return -1; // no shutters defined (or erased, 0xFF)
+  for (int8_t idx=0; idx<count; idx++){
+    record = (uint8_t *)&params[idx];
+    memset(record, 0, sizeof(ShutterStruct));
+    for (uint8_t byteInd=0; byteInd<EE_LEGACY_RECORDSIZE; byteInd++)
+      record[byteInd] = EEPROM.read(1 + idx*EE_LEGACY_RECORDSIZE + byteInd);
+    params[idx].actuator = ACT_DEFAULT;
+    params[idx].label[MAXLABELCHARS]='\0'; // just in case there was garbage in the EEPROM
+  }
+  numShuttersDefined = count;
   return 0;
 }
 
+////////////////////////////
+// Replace the shutters by a preset
+// Checked completely before, a damaged preset leaves the shutters as they are
+int8_t Parameters::loadPreset(int8_t preset)
+{
+  EEHeader header;
+  uint16_t crc;
+
+  if (preset<0 || preset>=MAXPRESETS) return -1;
+  if (savePos>=0) return -2; // the save would get a mix of both
+  crc = eeReadPresetHeader(preset, &header);
+  if (header.numShutters==0) return -1;
+  readRecords(EE_PRESET_A + preset*EE_PRESETSIZE + sizeof(EEHeader) + EE_NAMESIZE, &header, crc);
+  activePresetInd = preset;
+  return 0;
+}
+
+////////////////////////////
+// Name and number of shutters of a preset
+int8_t Parameters::presetInfo(int8_t preset, char *name)
+{
+  EEHeader header;
+  int address;
+
+  name[0] = '\0';
+  if (preset<0 || preset>=MAXPRESETS) return -1;
+  eeReadPresetHeader(preset, &header);
+  if (header.numShutters==0) return 0;
+  address = EE_PRESET_A + preset*EE_PRESETSIZE + sizeof(EEHeader);
+  for (uint8_t ind=0; ind<EE_NAMESIZE; ind++) name[ind] = EEPROM.read(address + ind);
+  name[MAXLABELCHARS] = '\0';
+  return header.numShutters;
+}
+
+int8_t Parameters::activePreset(void)
+{
+  return activePresetInd;
+}
+
 ////////////////////////////
 // Get the values for the members
 int8_t Parameters::numShutters(void)
@@ -110,13 +451,29 @@ uint16_t Parameters::transitDelay(int8_t shutter)
 {
   return params[shutter].transitDelay_ms;
 }
+uint16_t Parameters::hitTime(int8_t shutter)
+{
+  return params[shutter].hitTime_ms;
+}
+const MotionProfile *Parameters::motion(int8_t shutter)
+{
+  return &params[shutter].motion;
+}
+uint8_t Parameters::board(int8_t shutter)
+{
+  return params[shutter].board;
+}
+uint8_t Parameters::actuator(int8_t shutter)
+{
+  return params[shutter].actuator;
+}
 
 ////////////////////////////
 // Return the label (no special formatting)
 int8_t Parameters::getLabel(int8_t shutter, char* label)
 {
   if (shutter<numShuttersDefined) {
-    sprintf(label, "%."MAXLABELCHARS_STR"s", params[shutter].label);
+    sprintf(label, "%." MAXLABELCHARS_STR "s", params[shutter].label);
     return 0;
   } else {
     return -1;
@@ -128,7 +485,7 @@ int8_t Parameters::getLabel(int8_t shutter, char* label)
 int8_t Parameters::getPrintLabel(int8_t shutter, char* label)
 {
   if (shutter<numShuttersDefined) {
-    sprintf(label, "%-"MAXLABELCHARS_STR"."MAXLABELCHARS_STR"s", params[shutter].label);
+    sprintf(label, "%-" MAXLABELCHARS_STR "." MAXLABELCHARS_STR "s", params[shutter].label);
     return 0;
   } else {
     return -1;
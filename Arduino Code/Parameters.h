@@ -8,12 +8,42 @@ struct ShutterStruct {
   uint16_t posOpen;
   uint16_t transitDelay_ms;
   char label[MAXLABELCHARS+1];
+  uint16_t hitTime_ms; // solenoids: full-power pulse before the force of the new state, 0->off
+  MotionProfile motion; // servos: speed and acceleration limits of a move
+  uint8_t board;        // stacked shield the shieldChannel is on (0->first, at *_BOARDID)
+  uint8_t actuator;     // ACT_RCSERVO or ACT_SOLENOID, the driver of the shieldChannel
+};
+
+// header of an EEPROM slot, followed by numShutters records of recordSize bytes
+struct EEHeader {
+  uint16_t magic;
+  uint16_t crc;        // CRC-16 from sequence to the end of the records
+  uint16_t sequence;   // incremented by every save, the higher one is the newer image
+  uint8_t version;     // layout of the header and the slots
+  uint8_t recordSize;  // sizeof(ShutterStruct) when saved, later fields read as 0
+  int8_t numShutters;
 };
 
 class Parameters
 {
 	int8_t numShuttersDefined = 0;      // shutters in use
   ShutterStruct params[MAXSHUTTERS];
+  int8_t eeSlot = -1;                 // EEPROM slot of the loaded image, -1->none
+  uint16_t eeSequence = 0;            // its save sequence number
+  int8_t activePresetInd = -1;        // preset the shutters were loaded from/stored to, -1->none
+  // save in progress (see Update): records, then the name (presets), then the header,
+  //   then the legacy count byte (slots)
+  int16_t savePos = -1;               // next byte to check, -1->no save running
+  int16_t saveSize = 0;               // bytes to check
+  int8_t saveSlot;
+  int8_t savePreset = -1;             // preset being stored, -1->the save goes to saveSlot
+  char saveName[MAXLABELCHARS+1];     // its name
+  EEHeader saveHeader;                // crc is completed when the records are through
+
+  int8_t readRecords(int address, const EEHeader *header, uint16_t crc);
+  int8_t readLegacy(void);
+  void beginSave(void);
+  void paramsChanged(void);
 
   public:
   Parameters();
@@ -24,13 +54,45 @@ class Parameters
   int8_t set(int8_t shutter, uint8_t shieldChannel, int8_t digInput, uint16_t openPos, uint16_t closePos,
                uint16_t transitDelay_ms, const char* label);
 
+  // set the hit-and-hold pulse of a solenoid (see ShutterStruct)
+  int8_t setHitTime(int8_t shutter, uint16_t hitTime_ms);
+
+  // set the motion profile of a servo (see MotionProfile)
+  int8_t setMotion(int8_t shutter, const MotionProfile *motion);
+
+  // set the board of the shield channel (see ShutterStruct)
+  int8_t setBoard(int8_t shutter, uint8_t board);
+
+  // set the actuator type (ACT_RCSERVO, ACT_SOLENOID) driving the shutter
+  int8_t setActuator(int8_t shutter, uint8_t actuator);
+
   // clear the shutter info
   void clear(void);
 
   // Read/Write the info from/to the EEPROM
+  //   saves alternate between two slots, a broken save keeps the previous image
+  //   saveToEEPROM only starts the save, Update writes it in the background
   int8_t saveToEEPROM(void);
   int8_t readFromEEPROM(void);
 
+  // Write the next byte of a running save if the EEPROM is ready; call from the main loop
+  void Update(void);
+
+  // Progress of the save: returns 1 while running, 0 when done (or none started)
+  //   done, total: bytes checked so far and in all
+  int8_t saveStatus(int16_t *done, int16_t *total);
+
+  // Named presets: complete shutter sets in the EEPROM, next to the saved one
+  //   storePreset writes in the background like saveToEEPROM, loadPreset replaces the
+  //   current shutters at once; both return -1 for an invalid (or empty) preset, -2 while
+  //   another save runs
+  int8_t storePreset(int8_t preset, const char *name);
+  int8_t loadPreset(int8_t preset);
+  // number of shutters in the preset (0->empty), -1 for an invalid index; name gets its name
+  int8_t presetInfo(int8_t preset, char *name);
+  // preset matching the current shutters, -1->none (changed since, or not from a preset)
+  int8_t activePreset(void);
+
   // Return the number of shutters
   int8_t numShutters(void);
 
@@ -40,6 +102,10 @@ class Parameters
   uint16_t posOpen(int8_t shutter);
   uint16_t posClosed(int8_t shutter);
   uint16_t transitDelay(int8_t shutter);
+  uint16_t hitTime(int8_t shutter);
+  const MotionProfile *motion(int8_t shutter);
+  uint8_t board(int8_t shutter);
+  uint8_t actuator(int8_t shutter);
 
   // Return the label (no special formatting)
   int8_t getLabel(int8_t shutter, char* label);
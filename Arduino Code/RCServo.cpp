@@ -5,7 +5,6 @@
 
 #include <Arduino.h>
 #include <Wire.h>
-#include <Adafruit_PWMServoDriver.h>
 #include "RCServo.h"
 
 #define SERIAL_DEBUG  0
@@ -14,11 +13,8 @@
 // *************************************************************************************
 // defines
 // *************************************************************************************
+#define FRAME_US (1000000UL/RCSERVO_FREQ) // the PCA9685 takes a new value once per servo frame
 
-// *************************************************************************************
-// global variables
-// *************************************************************************************
-Adafruit_PWMServoDriver _pwm = Adafruit_PWMServoDriver(RCSERVO_BOARDID);
 
 
 // *************************************************************************************
@@ -32,28 +28,209 @@ RCServo::RCServo()
 
 ////////////////////////////
 // Initialize stuff
-RCServo::Begin()
+void RCServo::Begin()
 {
 #if SERIAL_DEBUG>0
   Serial.println(F("RCServo Begin."));
 #endif      
 
-  // set up PWM chip 
-  _pwm.begin();
-  _pwm.setOscillatorFrequency(25000000);  // Reference frequency of the PWM chip
-  _pwm.setPWMFreq(RCSERVO_FREQ);
+  // set up the PWM chips
+  Wire.begin();
+  Wire.setClock(SHIELD_I2C_CLOCK); // shorter bus time per update
+  for (uint8_t board=0; board<RCSERVO_BOARDS; board++)
+    pca9685Begin(RCSERVO_BOARDID+board, RCSERVO_FREQ);
 
+  for (uint8_t ind=0; ind<MAXSHUTTERS; ind++) {
+    motion[ind].channel = 0xFF;
+    motion[ind].pos = 0;
+  }
 }
 
 ////////////////////////////
 // Action functions
-RCServo::SetShutterValue(uint8_t dev, uint16_t value)
+void RCServo::SetShutterValue(uint8_t board, uint8_t channel, uint16_t value)
+{
+  uint16_t values[PCA9685_CHANNELS];
+
+  if (board >= RCSERVO_BOARDS || channel >= PCA9685_CHANNELS) return;
+  FindMotion(board, channel); // known position for the next profile move
+  values[channel] = value;
+  SetShutterValues(board, bit(channel), values);
+#if defined SERIALCOMM && SERIAL_DEBUG>0
+  Serial.print(F("Setting PWM ")); Serial.print(board); Serial.print("/"); Serial.print(channel);
+  Serial.print(" to "); Serial.print(value); Serial.println(".");
+#endif      
+}
+
+////////////////////////////
+// Set several channels at once
+//   channelMask: bit n set -> update channel n
+//   values: PWM value for each channel (indexed by channel, PCA9685_CHANNELS entries)
+void RCServo::SetShutterValues(uint8_t board, uint16_t channelMask, const uint16_t *values)
 {
-  _pwm.setPWM(dev, 0, value);
+  Motion *m;
+
+  if (board >= RCSERVO_BOARDS) return;
+  for (uint8_t ind=0; ind<MAXSHUTTERS; ind++) {
+    m = &motion[ind];
+    if (m->channel==0xFF || m->board!=board || !(channelMask & bit(m->channel))) continue;
+    movingMask &= ~DEVBIT(ind); // a move in progress would overwrite the value
+    m->pos = values[m->channel];
+  }
+  pca9685WriteChannels(RCSERVO_BOARDID+board, channelMask, values);
 #if defined SERIALCOMM && SERIAL_DEBUG>0
-  Serial.print(F("Setting PWM ")); Serial.print(dev); Serial.print(" to ");
-  Serial.print(0); Serial.print("/"); Serial.print(value); Serial.println(".");
+  Serial.print(F("Setting PWM mask ")); Serial.print(channelMask, BIN); Serial.println(".");
 #endif      
 }
 
+////////////////////////////
+// Set several channels at once, with motion profiles
+// A servo given the new pulse in one step runs at full speed into the end position,
+//   overshoots and rings; along a speed-limited trapezoid it arrives without the
+//   bounce, so the position is reached (and stays) at a known time. The first frame
+//   is written here with the other channels, Update does the rest. Channels at an
+//   unknown position (power-up, idle) and value 0 (servo off) still jump.
+void RCServo::SetShutterValues(uint8_t board, uint16_t channelMask, const uint16_t *values,
+                               const MotionProfile *const *profiles)
+{
+  uint16_t driveValues[PCA9685_CHANNELS];
+  Motion *m;
+
+  if (board >= RCSERVO_BOARDS) return;
+  for (uint8_t ch=0; ch<PCA9685_CHANNELS; ch++) {
+    if (!(channelMask & bit(ch))) continue;
+    driveValues[ch] = values[ch];
+    m = FindMotion(board, ch);
+    if (!m) continue; // no slot left, jump
+    if (values[ch]==0 || profiles[ch]->maxStep==0 || m->pos==0) {
+      movingMask &= ~DEVBIT(m - motion);
+      m->pos = values[ch];
+      continue;
+    }
+    // a reversal starts from rest, a new target in the same direction keeps the speed
+    if (!(movingMask & DEVBIT(m - motion)) || (values[ch] > m->pos) != (m->target > m->pos))
+      m->speed = 0;
+    m->target = values[ch];
+    m->profile = *profiles[ch];
+    movingMask |= DEVBIT(m - motion);
+    StepMotion(m);
+    driveValues[ch] = m->pos;
+  }
+  pca9685WriteChannels(RCSERVO_BOARDID+board, channelMask, driveValues);
+  lastFrame_us = micros();
+}
+
+////////////////////////////
+// Advance the moves in progress by one frame, one write per board
+void RCServo::Update(void)
+{
+  uint16_t values[PCA9685_CHANNELS];
+  uint16_t channelMask;
+  ShutterMask pending;
+  unsigned long now_us;
+  uint8_t board;
+  Motion *m;
+
+  if (!movingMask) return;
+  now_us = micros();
+  if (now_us - lastFrame_us < FRAME_US) return;
+  lastFrame_us = now_us;
+  pending = movingMask;
+  while (pending) {
+    // the board of the first pending slot, with all its other moving channels
+    board = 0xFF;
+    channelMask = 0;
+    for (uint8_t ind=0; ind<MAXSHUTTERS; ind++) {
+      if (!(pending & DEVBIT(ind))) continue;
+      m = &motion[ind];
+      if (board==0xFF) board = m->board;
+      else if (m->board!=board) continue;
+      pending &= ~DEVBIT(ind);
+      StepMotion(m);
+      values[m->channel] = m->pos;
+      channelMask |= bit(m->channel);
+    }
+    pca9685WriteChannels(RCSERVO_BOARDID+board, channelMask, values);
+  }
+}
+
+////////////////////////////
+// Slot of a channel; takes a free slot (or else one at rest) for a new channel
+RCServo::Motion *RCServo::FindMotion(uint8_t board, uint8_t channel)
+{
+  Motion *spare = NULL;
+  Motion *atRest = NULL;
+
+  for (uint8_t ind=0; ind<MAXSHUTTERS; ind++) {
+    if (motion[ind].channel==channel && motion[ind].board==board) return &motion[ind];
+    if (!spare && motion[ind].channel==0xFF) spare = &motion[ind];
+    if (!atRest && !(movingMask & DEVBIT(ind))) atRest = &motion[ind];
+  }
+  if (!spare) spare = atRest;
+  if (spare) {
+    spare->board = board;
+    spare->channel = channel;
+    spare->pos = 0; // position not known yet
+  }
+  return spare;
+}
+
+////////////////////////////
+// Integer square root (floor) for the braking distance
+static uint16_t isqrt32(uint32_t x)
+{
+  uint32_t root = 0, b = 1UL << 30;
+
+  while (b > x) b >>= 2;
+  while (b) {
+    if (x >= root + b) {
+      x -= root + b;
+      root = (root >> 1) + b;
+    } else {
+      root >>= 1;
+    }
+    b >>= 2;
+  }
+  return (uint16_t)root;
+}
+
+////////////////////////////
+// Counts covered while braking from speed v by b per frame: v + (v-b) + ... (terms > 0)
+static uint32_t stopDistance(uint16_t v, uint8_t b)
+{
+  uint16_t frames = (v + b - 1) / b;
+
+  return (uint32_t)frames*v - (uint32_t)b*frames*(frames-1)/2;
+}
+
+////////////////////////////
+// One frame of the trapezoid: accelerate up to maxStep, but never faster than
+//   braking with the brake deceleration still ends on the target (no overshoot)
+void RCServo::StepMotion(Motion *m)
+{
+  uint16_t dist, speed, limit;
+  uint8_t brake;
+
+  dist = (m->target > m->pos) ? m->target - m->pos : m->pos - m->target;
+  speed = m->profile.accel ? m->speed + m->profile.accel : m->profile.maxStep;
+  if (speed > m->profile.maxStep) speed = m->profile.maxStep;
+  brake = m->profile.brake ? m->profile.brake : m->profile.accel;
+  if (brake) {
+    // from speed v the stop takes v + (v-b) + ... = about v*(v+b)/(2b) counts; the
+    //   estimate is exact only for multiples of b, step down to the exact limit
+    limit = isqrt32(2UL*brake*dist + (uint32_t)brake*brake/4) - brake/2;
+    while (limit > 1 && stopDistance(limit, brake) > dist) limit--;
+    if (speed > limit) speed = limit;
+  }
+  if (speed < 1) speed = 1;
+  if (speed >= dist) { // arrived
+    m->pos = m->target;
+    m->speed = 0;
+    movingMask &= ~DEVBIT(m - motion);
+    return;
+  }
+  m->pos = (m->target > m->pos) ? m->pos + speed : m->pos - speed;
+  m->speed = speed;
+}
+
 #endif // SHUTTER_RCSERVO
\ No newline at end of file
@@ -6,12 +6,37 @@
 #ifndef RCSERVO_H
 #define RCSERVO_H
 
+#include "PCA9685Burst.h"
+
 class RCServo
 {
+  // motion profiles: last commanded pulse and current move of the shutter channels
+  struct Motion {
+    uint8_t board;
+    uint8_t channel; // 0xFF->free slot
+    uint16_t pos;    // 0->unknown (after power-up or idle)
+    uint16_t target;
+    uint8_t speed;   // counts in the last frame
+    MotionProfile profile;
+  };
+  Motion motion[MAXSHUTTERS];
+  ShutterMask movingMask = 0; // slots on their way to the target
+  unsigned long lastFrame_us = 0;
+
+  Motion *FindMotion(uint8_t board, uint8_t channel);
+  void StepMotion(Motion *m);
 public:
   RCServo();
-  Begin();
-  SetShutterValue(uint8_t dev, uint16_t value);
+  void Begin();
+  // board: index of the stacked board (0..RCSERVO_BOARDS-1), one write per call
+  void SetShutterValue(uint8_t board, uint8_t channel, uint16_t value);
+  void SetShutterValues(uint8_t board, uint16_t channelMask, const uint16_t *values);
+  // same, but channels with a profile (maxStep>0) move there frame by frame
+  //   profiles: indexed by channel, like values
+  void SetShutterValues(uint8_t board, uint16_t channelMask, const uint16_t *values,
+                        const MotionProfile *const *profiles);
+  // next frame of the moves in progress; call from the main loop
+  void Update(void);
 };
 
 #endif // RCSERVO_H
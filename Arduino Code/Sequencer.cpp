@@ -0,0 +1,150 @@
+#include "Common.h"
+// only include if SEQUENCER is chosen in "Common.h"
+#ifdef SEQUENCER
+
+
+#include <Arduino.h>
+#include "Sequencer.h"
+
+#define SERIAL_DEBUG  0
+
+
+// *************************************************************************************
+// Sequencer class
+// *************************************************************************************
+// The events are scheduled against micros() and polled from loop(), not run from a
+//   timer interrupt: the actuators sit on the I2C bus, and the Wire library cannot be
+//   used inside an ISR. While a sequence runs, loop() skips the display work so the
+//   polling interval stays short, and Check waits for events that are due within
+//   SEQ_SPIN_US in a tight loop.
+////////////////////////////
+// Constructor
+Sequencer::Sequencer(){}
+
+////////////////////////////
+// Remove all events
+void Sequencer::Clear(void)
+{
+  if (state != SeqIdle) return;
+  numEvents = 0;
+}
+
+////////////////////////////
+// Append an event, offsets must not decrease
+int8_t Sequencer::AddEvent(uint32_t offset_us, ShutterMask mask, ShutterMask states)
+{
+  if (state != SeqIdle || numEvents >= SEQ_MAXEVENTS) return -1;
+  if (numEvents > 0 && offset_us < events[numEvents-1].offset_us) return -1;
+  events[numEvents].offset_us = offset_us;
+  events[numEvents].mask = mask;
+  events[numEvents].states = states & mask;
+  actual_us[numEvents] = 0;
+  numEvents++;
+  return 0;
+}
+
+////////////////////////////
+// Set the number of passes, the trigger and the pass length
+int8_t Sequencer::Configure(uint16_t numLoops, uint8_t triggerSource, uint32_t passPeriod_us)
+{
+  if (state != SeqIdle || triggerSource > 4) return -1;
+  loops = numLoops;
+  trigger = triggerSource;
+  period_us = passPeriod_us;
+  return 0;
+}
+
+////////////////////////////
+// Wait for the trigger
+int8_t Sequencer::Arm(void)
+{
+  if (state != SeqIdle || numEvents == 0) return -1;
+  if (period_us > 0 && period_us < events[numEvents-1].offset_us) return -1; // last event outside the pass
+  if (loops != 1 && period_us == 0 && events[numEvents-1].offset_us == 0) return -1; // zero length passes
+  nextEvent = 0;
+  loopCount = 0;
+  state = SeqArmed;
+  return 0;
+}
+
+////////////////////////////
+// Start an armed sequence (software trigger, also works for digital input triggers)
+int8_t Sequencer::Start(void)
+{
+  if (state != SeqArmed) return -1;
+  passStart_us = micros();
+  startTime_ms = millis();
+  state = SeqRunning;
+#if SERIAL_DEBUG>0
+  Serial.print(F("Sequence started at ")); Serial.println(startTime_ms);
+#endif      
+  return 0;
+}
+
+////////////////////////////
+// Stop immediately, the shutters stay where they are
+void Sequencer::Abort(void)
+{
+  state = SeqIdle;
+}
+
+////////////////////////////
+// Start on a rising edge of the trigger input
+//   inputs: state of the digital inputs (bit n -> input n)
+void Sequencer::CheckTrigger(uint8_t inputs)
+{
+  uint8_t rising = inputs & ~lastInputs;
+
+  lastInputs = inputs;
+  if (state == SeqArmed && trigger > 0 && (rising & bit(trigger-1)))
+    Start();
+}
+
+////////////////////////////
+// Check for a due event
+uint8_t Sequencer::Check(ShutterMask *mask, ShutterMask *states)
+{
+  uint32_t elapsed_us;
+  uint32_t passLength_us;
+
+  if (state != SeqRunning) return 0;
+
+  elapsed_us = micros() - passStart_us;
+  if (nextEvent < numEvents) {
+    if (events[nextEvent].offset_us > elapsed_us
+          && events[nextEvent].offset_us - elapsed_us <= SEQ_SPIN_US) {
+      // close enough: wait here rather than risk a slow loop pass
+      while ((elapsed_us = micros() - passStart_us) < events[nextEvent].offset_us);
+    }
+    if (elapsed_us < events[nextEvent].offset_us) return 0;
+    actual_us[nextEvent] = elapsed_us;
+    *mask = events[nextEvent].mask;
+    *states = events[nextEvent].states;
+    nextEvent++;
+    return 1;
+  }
+
+  // all events of this pass done
+  passLength_us = (period_us > 0) ? period_us : events[numEvents-1].offset_us;
+  if (elapsed_us < passLength_us) return 0;
+  loopCount++;
+  if (loops > 0 && loopCount >= loops) {
+    state = SeqIdle;
+    return 0;
+  }
+  passStart_us += passLength_us; // relative to the planned start, so the timing does not drift
+  nextEvent = 0;
+  return 0;
+}
+
+////////////////////////////
+// Planned and actual time of an event in the latest pass (in us after the pass start)
+int8_t Sequencer::EventTiming(uint8_t event, uint32_t *planned_us, uint32_t *executed_us)
+{
+  if (event >= numEvents) return -1;
+  *planned_us = events[event].offset_us;
+  *executed_us = actual_us[event];
+  return 0;
+}
+
+#endif // SEQUENCER
@@ -0,0 +1,73 @@
+#include "Common.h"
+// only include if SEQUENCER is chosen in "Common.h"
+#ifdef SEQUENCER
+
+
+#ifndef SEQUENCER_H
+#define SEQUENCER_H
+
+#include <stdint.h>
+
+typedef enum {
+  SeqIdle = 0,
+  SeqArmed,   // waiting for the trigger
+  SeqRunning
+} SeqStateType;
+
+// one step of a sequence: at offset_us after the start of a pass, set the devices
+//   in mask to states (bit set->open, cleared->close)
+struct SeqEvent {
+  uint32_t offset_us;
+  ShutterMask mask;
+  ShutterMask states;
+};
+
+// *************************************************************************************
+// Sequencer class
+// *************************************************************************************
+class Sequencer
+{
+  SeqEvent events[SEQ_MAXEVENTS];
+  uint32_t actual_us[SEQ_MAXEVENTS]; // when the event ran in the latest pass (us after the pass start)
+  uint8_t numEvents = 0;
+  uint8_t nextEvent = 0;
+  uint16_t loops = 1;      // passes to play, 0 for no limit
+  uint16_t loopCount = 0;  // passes completed
+  uint8_t trigger = 0;     // 0->start command, n->rising edge on digital input n-1
+  uint8_t lastInputs = 0;
+  uint32_t period_us = 0;  // length of a pass, 0->offset of the last event
+  uint32_t passStart_us;
+  uint32_t startTime_ms;
+  SeqStateType state = SeqIdle;
+
+public:
+  Sequencer();
+
+  // edit the sequence (only while idle), return 0 on success, -1 otherwise
+  void Clear(void);
+  int8_t AddEvent(uint32_t offset_us, ShutterMask mask, ShutterMask states);
+  int8_t Configure(uint16_t numLoops, uint8_t triggerSource, uint32_t passPeriod_us);
+
+  // playback control, return 0 on success, -1 otherwise
+  int8_t Arm(void);
+  int8_t Start(void);
+  void Abort(void);
+  // start an armed sequence if its digital input trigger line went high
+  void CheckTrigger(uint8_t inputs);
+
+  // call as often as possible while running
+  // returns 1 and the event by reference if an event is due, 0 otherwise
+  uint8_t Check(ShutterMask *mask, ShutterMask *states);
+
+  // status
+  SeqStateType State(void) { return state; }
+  uint8_t NumEvents(void) { return numEvents; }
+  uint8_t NextEvent(void) { return nextEvent; }
+  uint16_t LoopCount(void) { return loopCount; }
+  uint32_t StartTime(void) { return startTime_ms; }
+  int8_t EventTiming(uint8_t event, uint32_t *planned_us, uint32_t *executed_us);
+};
+
+#endif // SEQUENCER_H
+
+#endif // SEQUENCER
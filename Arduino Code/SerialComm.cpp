@@ -4,6 +4,7 @@
 
 
 #include <Arduino.h>
+#include <limits.h>
 #include "SerialComm.h"
 
 #define SERIAL_DEBUG  0
@@ -12,7 +13,6 @@
 // *************************************************************************************
 // defines
 // *************************************************************************************
-#define MSG_MAXLENGTH  50
 
 // *************************************************************************************
 // global variables
@@ -27,251 +27,1125 @@ SerialComm::SerialComm(){}
 
 ////////////////////////////
 // Initialize stuff
-SerialComm::Begin(Parameters *paramPtr, int8_t *devStatePtr, long timeout_ms = 1000)
+void SerialComm::Begin(Parameters *paramPtr, int8_t *devStatePtr)
 {
   Serial.begin(SERIAL_BAUDRATE);
 #if SERIAL_DEBUG>0
   Serial.println(F("\nSerialComm started."));
 #endif      
-  // note: default time out for readBytesUntil is 1000 ms, set to 100ms
-  Serial.setTimeout(timeout_ms);
   params = paramPtr;
   devState = devStatePtr;
+  lineLen = 0;
+  lineOverflow = 0;
 }
 
 ////////////////////////////
-// Check for serial requests
-SerialComm::CheckAction(SerialActionType *action, int8_t *device, int8_t *state, uint16_t *manPos)
+// Assemble a command line from the bytes received so far
+// Never waits for more bytes: the partial line stays in lineBuf and is
+//   completed on a later call. The Serial RX ring buffer holds anything
+//   that arrives after the term char until the next call.
+// returns the line length once the term char arrives, -1 otherwise
+int8_t SerialComm::ReadLine(void)
 {
-  static char serialData[MSG_MAXLENGTH+1]; // one extra for the null char
-  int8_t tempDev;
-  int8_t tempState;
-  int8_t status;
-  char label[MAXLABELCHARS+1];
-  int8_t shutter;
-  uint8_t shieldChannel;
-  int8_t digInput;
-  uint16_t openPos, closePos, tempPos, transitDelay;
-
-  *action = None;
-
-  if (Serial.available() > 0){
-    // max allowed command size is MSG_MAXLENGTH char, ends with a term char
-    int bytesRead = Serial.readBytesUntil(SERIAL_TERMCHAR, serialData, MSG_MAXLENGTH); // LF or CR
-    // terminate with an end character
-    serialData[bytesRead]='\0';
-    // check for at least some bytes
-    if (bytesRead<3) {    
-      Serial.println(F("Error: Commands needs to be at least 3 characters."));
-      return;
+  int inByte;
+  uint8_t len;
+
+  while ((inByte = Serial.read()) >= 0) {
+    if (inByte == SERIAL_TERMCHAR) {
+      len = lineLen;
+      lineBuf[len] = '\0';
+      lineLen = 0;
+      if (lineOverflow) { // drop the whole line, not just the tail
+        lineOverflow = 0;
+        Serial.println(F("Error: Command too long."));
+        continue;
+      }
+      return len;
     }
+    if (lineLen < MSG_MAXLENGTH)
+      lineBuf[lineLen++] = (char)inByte;
+    else
+      lineOverflow = 1;
+  }
+  return -1;
+}
+
+////////////////////////////
+// Check for serial requests
+void SerialComm::CheckAction(SerialAction *action)
+{
+  int8_t bytesRead;
+  CmdHandler handler;
+#ifdef STATS
+  unsigned long start_us;
+#endif
+
+  action->type = None;
+  req.type = None;
+
+#ifdef SERIALBINARY
+  if (binMode) {
+    CheckBinaryAction();
+    *action = req;
+    return;
+  }
+#endif
+
+  // max allowed command size is MSG_MAXLENGTH char, ends with a term char (LF or CR)
+  bytesRead = ReadLine();
+  if (bytesRead < 0) return;
+#ifdef STATS
+  start_us = micros();
+#endif
+
+  // check for at least some bytes
+  if (bytesRead<3) {    
+    Serial.println(F("Error: Commands needs to be at least 3 characters."));
+    return;
+  }
 #if SERIAL_DEBUG>0
-    Serial.println("---");
-    Serial.println(serialData);
-    Serial.print(F("Bytes received (")); Serial.print(bytesRead); Serial.print(")");
-    for (int q=0; q<bytesRead; q++) {Serial.print(" "); Serial.print(byte(serialData[q])); }
-    Serial.println();
+  Serial.println("---");
+  Serial.println(lineBuf);
+  Serial.print(F("Bytes received (")); Serial.print(bytesRead); Serial.print(")");
+  for (int q=0; q<bytesRead; q++) {Serial.print(" "); Serial.print(byte(lineBuf[q])); }
+  Serial.println();
 #endif      
 
-    /////////////////////
-    // check for ID query
-    if (strncmp(serialData, "*IDN?", 5)  == 0){
-      Serial.println(ID_STRING);
-      return;
-    }
+  if (!FindCommand(&handler)) {
+    Serial.println(F("Error: Unrecognized command"));
+    return;
+  }
+  (this->*handler)(lineBuf+3); // arguments follow the opcode
+  *action = req;
+#ifdef STATS
+  Stats::Record(StatParse, micros() - start_us);
+#endif
+}
 
-    /////////////////////
-    // check for time query
-    if (strncmp(serialData, "GTI", 3)  == 0){
-      Serial.print("TI="); Serial.println(millis());
-      return;
-    }
+////////////////////////////
+// Look up the opcode (first three chars of lineBuf) in the command table
+// The table is sorted, so this is a binary search: at most four probes for
+//   the current command set, independent of the position of the command.
+// returns 1 and the handler by reference if found, 0 otherwise
+int8_t SerialComm::FindCommand(CmdHandler *handler)
+{
+  CmdEntry entry;
+  int8_t lo = 0;
+  int8_t hi = numCmds-1;
+  int8_t mid, cmp;
 
-    /////////////////////
-    // check for numDev query
-    if (strncmp(serialData, "GND", 3)  == 0){
-      Serial.print("ND=");Serial.println(params->numShutters());
-      return;
-    }
-    
-    /////////////////////
-    // check for GetShutterState command
-    if (strncmp(serialData, "GST", 3)  == 0){
-      if (sscanf(serialData, "GST%hhd", &tempDev)!=1) {
-        Serial.println(F("Error: Invalid GST command format."));
-        return;
-      }
-      // check the validity of the device 
-      if (tempDev < 0 || tempDev>=params->numShutters()) {
-        Serial.println(F("Error: Invalid device number."));
-        return;
-      }
-      // return the state
-      Serial.print("ST");Serial.print(tempDev);Serial.print("=");Serial.println(devState[tempDev]);
-      return;
-    }  
-
-    /////////////////////
-    // check for GetDeviceLabel command
-    if (strncmp(serialData, "GDL", 3)  == 0){
-      if (sscanf(serialData, "GDL%hhd", &tempDev)!=1) {
-        Serial.println(F("Error: Invalid GDL command format."));
-        return;
-      }
-      // check the validity of the device 
-      if (tempDev < 0 || tempDev>=params->numShutters()) {
-        Serial.println(F("Error: Invalid device number."));
-        return;
-      }
-      params->getLabel(tempDev, label);
-      Serial.print("DL");Serial.print(tempDev);Serial.print("=");Serial.println(label);
-      return;
-    }  
-
-    /////////////////////
-    // check for GetTransitDelay command
-    if (strncmp(serialData, "GTD", 3)  == 0){
-      if (sscanf(serialData, "GTD%hhd", &tempDev)!=1) {
-        Serial.println(F("Error: Invalid GTD command format."));
-        return;
-      }
-      // check the validity of the device 
-      if (tempDev < 0 || tempDev>=params->numShutters()) {
-        Serial.println(F("Error: Invalid device number."));
-        return;
-      }
-      Serial.print("TD");Serial.print(tempDev);Serial.print("=");Serial.println(params->transitDelay(tempDev));
-      return;
-    }  
-
-    /////////////////////
-    // check for parameter clear
-    if (strncmp(serialData, "CLR", 3)  == 0){
-      params->clear();
-      Serial.println("OK");
-      *action = ParamChange;
-      return;
+  while (lo <= hi) {
+    mid = (lo+hi)/2;
+    memcpy_P(&entry, &cmdTable[mid], sizeof(CmdEntry));
+    cmp = strncmp(lineBuf, entry.op, 3);
+    if (cmp == 0) {
+      *handler = entry.handler;
+      return 1;
     }
+    if (cmp < 0) hi = mid-1;
+    else lo = mid+1;
+  }
+  return 0;
+}
 
-    /////////////////////
-    // check for EEPROM save
-    if (strncmp(serialData, "SAV", 3)  == 0){
-      status = params->saveToEEPROM();
-      if (status==0)
-        Serial.println("OK");
-      else
-        Serial.println(F("Error: Save failed"));
-      return;
-    }
 
-    /////////////////////
-    // check for parameter get
-    if (strncmp(serialData, "GPR", 3)  == 0){
-      if (sscanf(serialData, "GPR%hhd", &tempDev)!=1) {
-        Serial.println(F("Error: Invalid GPR command format."));
-        return;
-      }
-      // check the validity of the device 
-      if (tempDev < 0 || tempDev>=params->numShutters()) {
-        Serial.println(F("Error: Invalid device number."));
-        return;
-      }
-      Serial.print("PR");Serial.print(tempDev);Serial.print(",");
-      Serial.print(params->shieldChannel(tempDev));Serial.print(",");
-      Serial.print(params->digInput(tempDev));Serial.print(",");
-      Serial.print(params->posOpen(tempDev));Serial.print(",");
-      Serial.print(params->posClosed(tempDev));Serial.print(",");
-      Serial.print(params->transitDelay(tempDev));Serial.print(",");
-      params->getLabel(tempDev, label);
-      Serial.println(label);
-      return;
-    }  
-
-    /////////////////////
-    // check for parameter set
-    if (strncmp(serialData, "SPR", 3)  == 0){
-      if (sscanf(serialData, "SPR%hhd,%hhu,%hhd,%u,%u,%u,%"MAXLABELCHARS_STR"s",
-                   &shutter, &shieldChannel, &digInput, &openPos, &closePos, &transitDelay, label)!=7) {
-        Serial.println(F("Error: Invalid SPR command format."));
-        return;
-      }
+// *************************************************************************************
+// argument parsers
+// *************************************************************************************
+// All parsers skip leading blanks and return a pointer to the first char after
+//   the parsed item, or NULL if the item is missing or out of range. A NULL input
+//   is passed through, so calls can be chained and checked once at the end.
+////////////////////////////
+// Parse a decimal integer with optional sign in the range minVal..maxVal
+static const char* parseInt(const char *str, long minVal, long maxVal, long *value)
+{
+  long val = 0;
+  int8_t negative = 0, digit;
+  const char *digits;
+
+  if (!str) return NULL;
+  while (*str == ' ') str++;
+  if (*str == '-' || *str == '+') negative = (*str++ == '-');
+  digits = str;
+  while (*str >= '0' && *str <= '9') {
+    digit = *str++ - '0';
+    if (val > (LONG_MAX - digit)/10) return NULL; // would overflow
+    val = 10*val + digit;
+  }
+  if (str == digits) return NULL;
+  if (negative) val = -val;
+  if (val < minVal || val > maxVal) return NULL;
+  *value = val;
+  return str;
+}
+
+////////////////////////////
+// Parse a device mask: a decimal number as wide as ShutterMask (beyond a long
+//   with more than 31 shutters)
+static const char* parseMask(const char *str, ShutterMask *value)
+{
+  ShutterMask val = 0;
+  const char *digits;
+
+  if (!str) return NULL;
+  while (*str == ' ') str++;
+  digits = str;
+  while (*str >= '0' && *str <= '9') {
+    if (val > ((ShutterMask)~0 - 9)/10) return NULL; // would overflow
+    val = 10*val + (*str++ - '0');
+  }
+  if (str == digits) return NULL;
+  *value = val;
+  return str;
+}
+
+////////////////////////////
+// Check that a mask only holds defined devices
+static bool maskValid(ShutterMask mask, int8_t numShutters)
+{
+  return numShutters >= 8*(int8_t)sizeof(ShutterMask) || !(mask >> numShutters);
+}
+
+////////////////////////////
+// Parse a separator char
+static const char* parseSep(const char *str, char sep)
+{
+  if (!str) return NULL;
+  while (*str == ' ') str++;
+  return (*str == sep) ? str+1 : NULL;
+}
+
+////////////////////////////
+// Parse a label (up to MAXLABELCHARS non-blank chars, anything longer is cut off)
+static const char* parseLabel(const char *str, char *label)
+{
+  uint8_t len = 0;
+
+  if (!str) return NULL;
+  while (*str == ' ') str++;
+  while (*str > ' ') {
+    if (len < MAXLABELCHARS) label[len++] = *str;
+    str++;
+  }
+  label[len] = '\0';
+  return len ? str : NULL;
+}
+
+////////////////////////////
+// Parse a device number and check it against the defined shutters
+// returns 1 if valid, otherwise prints the error and returns 0
+int8_t SerialComm::ParseDevice(const char *args, int8_t *dev)
+{
+  long val;
+
+  if (!parseInt(args, -128, 127, &val)) {
+    PrintFormatError();
+    return 0;
+  }
+  if (val < 0 || val>=params->numShutters()) {
+    Serial.println(F("Error: Invalid device number."));
+    return 0;
+  }
+  *dev = (int8_t)val;
+  return 1;
+}
+
+////////////////////////////
+// Report a malformed command, e.g. "Error: Invalid GST command format."
+void SerialComm::PrintFormatError(void)
+{
+  Serial.print(F("Error: Invalid "));
+  Serial.write((const uint8_t *)lineBuf, 3);
+  Serial.println(F(" command format."));
+}
+
+
+// *************************************************************************************
+// command handlers
+// *************************************************************************************
+// Keep the table sorted by opcode (ASCII order), FindCommand relies on it
+const SerialComm::CmdEntry SerialComm::cmdTable[] PROGMEM = {
+  { "*ID", &SerialComm::CmdIdentify },
+#ifdef SERIALBINARY
+  { "BIN", &SerialComm::CmdBinaryMode },
+#endif
+  { "CLR", &SerialComm::CmdClear },
+#ifdef DIGINPUT
+  { "CLT", &SerialComm::CmdClearLatency },
+#endif
+#ifdef STATS
+  { "CPF", &SerialComm::CmdClearStats },
+#endif
+#ifdef SERIALEVENTS
+  { "EVT", &SerialComm::CmdEvents },
+#endif
+  { "GAT", &SerialComm::CmdGetActuator },
+  { "GBD", &SerialComm::CmdGetBoard },
+  { "GDL", &SerialComm::CmdGetLabel },
+#ifdef SHUTTER_SOLENOID
+  { "GHT", &SerialComm::CmdGetHitTime },
+#endif
+#ifdef DIGINPUT
+  { "GLT", &SerialComm::CmdGetLatency },
+#endif
+#ifdef SHUTTER_RCSERVO
+  { "GMP", &SerialComm::CmdGetMotion },
+#endif
+  { "GND", &SerialComm::CmdGetNumDevices },
+#ifdef STATS
+  { "GPF", &SerialComm::CmdGetStats },
+#endif
+  { "GPR", &SerialComm::CmdGetParameters },
+  { "GPS", &SerialComm::CmdGetPreset },
+  { "GST", &SerialComm::CmdGetState },
+  { "GSV", &SerialComm::CmdGetSaveStatus },
+  { "GTD", &SerialComm::CmdGetTransitDelay },
+  { "GTI", &SerialComm::CmdGetTime },
+  { "LPS", &SerialComm::CmdLoadPreset },
+  { "SAT", &SerialComm::CmdSetActuator },
+  { "SAV", &SerialComm::CmdSave },
+  { "SBD", &SerialComm::CmdSetBoard },
+#ifdef SHUTTER_SOLENOID
+  { "SHT", &SerialComm::CmdSetHitTime },
+#endif
+#ifdef SHUTTER_RCSERVO
+  { "SMP", &SerialComm::CmdSetMotion },
+#endif
+  { "SPR", &SerialComm::CmdSetParameters },
+  { "SPS", &SerialComm::CmdStorePreset },
+#ifdef SEQUENCER
+  { "SQA", &SerialComm::CmdSeqAddEvent },
+  { "SQC", &SerialComm::CmdSeqClear },
+  { "SQG", &SerialComm::CmdSeqGetStatus },
+  { "SQP", &SerialComm::CmdSeqConfigure },
+  { "SQR", &SerialComm::CmdSeqArm },
+  { "SQS", &SerialComm::CmdSeqStart },
+  { "SQT", &SerialComm::CmdSeqGetTiming },
+  { "SQX", &SerialComm::CmdSeqAbort },
+#endif
+  { "SSM", &SerialComm::CmdSetStates },
+  { "SSP", &SerialComm::CmdSetPosition },
+  { "SST", &SerialComm::CmdSetState },
+};
+const uint8_t SerialComm::numCmds = sizeof(SerialComm::cmdTable)/sizeof(SerialComm::CmdEntry);
+
+/////////////////////
+// ID query (*IDN?)
+void SerialComm::CmdIdentify(const char *args)
+{
+  if (strncmp(args, "N?", 2) != 0) {
+    Serial.println(F("Error: Unrecognized command"));
+    return;
+  }
+  Serial.println(ID_STRING);
+}
+
+/////////////////////
+// time query
+void SerialComm::CmdGetTime(const char *args)
+{
+  Serial.print("TI="); Serial.println(millis());
+}
+
+/////////////////////
+// numDev query
+void SerialComm::CmdGetNumDevices(const char *args)
+{
+  Serial.print("ND=");Serial.println(params->numShutters());
+}
+
+/////////////////////
+// GetShutterState command
+void SerialComm::CmdGetState(const char *args)
+{
+  int8_t dev;
+
+  if (!ParseDevice(args, &dev)) return;
+  Serial.print("ST");Serial.print(dev);Serial.print("=");Serial.println(devState[dev]);
+}
+
+/////////////////////
+// GetDeviceLabel command
+void SerialComm::CmdGetLabel(const char *args)
+{
+  int8_t dev;
+  char label[MAXLABELCHARS+1];
+
+  if (!ParseDevice(args, &dev)) return;
+  params->getLabel(dev, label);
+  Serial.print("DL");Serial.print(dev);Serial.print("=");Serial.println(label);
+}
+
+/////////////////////
+// GetTransitDelay command
+void SerialComm::CmdGetTransitDelay(const char *args)
+{
+  int8_t dev;
+
+  if (!ParseDevice(args, &dev)) return;
+  Serial.print("TD");Serial.print(dev);Serial.print("=");Serial.println(params->transitDelay(dev));
+}
+
+/////////////////////
+// parameter clear
+void SerialComm::CmdClear(const char *args)
+{
+  params->clear();
+  Serial.println("OK");
+  req.type = ParamChange;
+}
+
+/////////////////////
+// EEPROM save, written in the background (see GSV); a new SAV during a save starts over
+void SerialComm::CmdSave(const char *args)
+{
+  int8_t result = params->saveToEEPROM();
+
+  if (result==0)
+    Serial.println("OK");
+  else if (result==-2)
+    Serial.println(F("Error: EEPROM busy."));
+  else
+    Serial.println(F("Error: Save failed"));
+}
+
+/////////////////////
+// GetPreset command: GPS<preset>
+//   reply PS<preset>=<name>,<number of shutters>,<active>, empty preset: PS<preset>=,0,0
+//   active 1->the current shutters are this preset (loaded or stored, unchanged since)
+void SerialComm::CmdGetPreset(const char *args)
+{
+  long preset;
+  int8_t numShutters;
+  char name[MAXLABELCHARS+1];
+
+  if (!parseInt(args, -128, 127, &preset)) {
+    PrintFormatError();
+    return;
+  }
+  numShutters = params->presetInfo(preset, name);
+  if (numShutters<0) {
+    Serial.println(F("Error: Invalid preset number."));
+    return;
+  }
+  Serial.print("PS");Serial.print(preset);Serial.print("=");
+  Serial.print(name);Serial.print(",");
+  Serial.print(numShutters);Serial.print(",");
+  Serial.println(params->activePreset()==preset ? 1 : 0);
+}
+
+/////////////////////
+// LoadPreset command: LPS<preset>
+//   replaces all shutters by the preset in one step (not saved, see SAV)
+void SerialComm::CmdLoadPreset(const char *args)
+{
+  long preset;
+  int8_t result;
+
+  if (!parseInt(args, -128, 127, &preset)) {
+    PrintFormatError();
+    return;
+  }
+  result = params->loadPreset(preset);
+  if (result==0) {
+    Serial.println("OK");
+    req.type = ParamChange;
+  } else if (result==-2) {
+    Serial.println(F("Error: EEPROM busy."));
+  } else {
+    Serial.println(F("Error: Invalid or empty preset."));
+  }
+}
+
+/////////////////////
+// StorePreset command: SPS<preset>,<name>
+//   stores the current shutters as a preset, written in the background like SAV (see GSV)
+void SerialComm::CmdStorePreset(const char *args)
+{
+  long preset;
+  char name[MAXLABELCHARS+1];
+  int8_t result;
+
+  args = parseInt(args, -128, 127, &preset);
+  args = parseLabel(parseSep(args, ','), name);
+  if (!args) {
+    PrintFormatError();
+    return;
+  }
+  result = params->storePreset(preset, name);
+  if (result==0)
+    Serial.println("OK");
+  else if (result==-2)
+    Serial.println(F("Error: EEPROM busy."));
+  else
+    Serial.println(F("Error: Invalid preset number or no shutters."));
+}
+
+/////////////////////
+// GetSaveStatus command: GSV
+//   reply SV=<running>,<done>,<total>, running 1 while the save is written, done/total in bytes
+void SerialComm::CmdGetSaveStatus(const char *args)
+{
+  int16_t done, total;
+  int8_t running = params->saveStatus(&done, &total);
+
+  Serial.print("SV=");Serial.print(running);Serial.print(",");
+  Serial.print(done);Serial.print(",");Serial.println(total);
+}
+
+/////////////////////
+// parameter get
+void SerialComm::CmdGetParameters(const char *args)
+{
+  int8_t dev;
+  char label[MAXLABELCHARS+1];
+
+  if (!ParseDevice(args, &dev)) return;
+  Serial.print("PR");Serial.print(dev);Serial.print(",");
+  Serial.print(params->shieldChannel(dev));Serial.print(",");
+  Serial.print(params->digInput(dev));Serial.print(",");
+  Serial.print(params->posOpen(dev));Serial.print(",");
+  Serial.print(params->posClosed(dev));Serial.print(",");
+  Serial.print(params->transitDelay(dev));Serial.print(",");
+  params->getLabel(dev, label);
+  Serial.println(label);
+}
+
+/////////////////////
+// parameter set: SPR<shutter>,<shieldChannel>,<digInput>,<openPos>,<closePos>,<transitDelay>,<label>
+void SerialComm::CmdSetParameters(const char *args)
+{
+  long shutter, shieldChannel, digInput, openPos, closePos, transitDelay;
+  char label[MAXLABELCHARS+1];
+
+  args = parseInt(args, -128, 127, &shutter);
+  args = parseInt(parseSep(args, ','), 0, 255, &shieldChannel);
+  args = parseInt(parseSep(args, ','), -128, 127, &digInput);
+  args = parseInt(parseSep(args, ','), 0, 65535, &openPos);
+  args = parseInt(parseSep(args, ','), 0, 65535, &closePos);
+  args = parseInt(parseSep(args, ','), 0, 65535, &transitDelay);
+  args = parseLabel(parseSep(args, ','), label);
+  if (!args) {
+    PrintFormatError();
+    return;
+  }
 #if SERIAL_DEBUG>0
-      Serial.print(F("shutter="));Serial.print(shutter);
-      Serial.print(F(" shieldChannel="));Serial.print(shieldChannel);
-      Serial.print(F(" digInput="));Serial.print(digInput);
-      Serial.print(F(" openPos="));Serial.print(openPos);
-      Serial.print(F(" closePos="));Serial.print(closePos);
-      Serial.print(F(" transitDelay="));Serial.print(transitDelay);
-      Serial.print(F(" label="));Serial.println(label);
+  Serial.print(F("shutter="));Serial.print(shutter);
+  Serial.print(F(" shieldChannel="));Serial.print(shieldChannel);
+  Serial.print(F(" digInput="));Serial.print(digInput);
+  Serial.print(F(" openPos="));Serial.print(openPos);
+  Serial.print(F(" closePos="));Serial.print(closePos);
+  Serial.print(F(" transitDelay="));Serial.print(transitDelay);
+  Serial.print(F(" label="));Serial.println(label);
 #endif      
-      status = params->set(shutter, shieldChannel, digInput, openPos, closePos, transitDelay, label);
-      if (status==0) {
-        Serial.println("OK");
-      *action = ParamChange;
-      } else {
-        Serial.println(F("Error: Could not set shutter parameters."));
-      }
-      return;
-    }
+  if (params->set(shutter, shieldChannel, digInput, openPos, closePos, transitDelay, label)==0) {
+    Serial.println("OK");
+    req.type = ParamChange;
+  } else {
+    Serial.println(F("Error: Could not set shutter parameters."));
+  }
+}
 
-    /////////////////////
-    // check for SetShutterState command
-    if (strncmp(serialData, "SST", 3)  == 0){
-      if (sscanf(serialData, "SST%hhd,%hhd", &tempDev, &tempState)!=2) {
-        Serial.println(F("Error: Invalid SST command format."));
-        return;
-      }
+/////////////////////
+// SetShutterState command: SST<device>,<state>
+void SerialComm::CmdSetState(const char *args)
+{
+  long dev, state;
+
+  args = parseInt(args, -128, 127, &dev);
+  args = parseInt(parseSep(args, ','), -128, 127, &state);
+  if (!args) {
+    PrintFormatError();
+    return;
+  }
 #if SERIAL_DEBUG>0
-      Serial.print(F("Requesting device "));Serial.print(tempDev);
-      Serial.print(F(" set state to "));Serial.println(tempState);
+  Serial.print(F("Requesting device "));Serial.print(dev);
+  Serial.print(F(" set state to "));Serial.println(state);
 #endif      
-      // check the validity of the device and state 
-      if (tempDev < 0 || tempDev>=params->numShutters()) {
-        Serial.println(F("Error: Invalid device number."));
-        return;
-      }
-      if (tempState<0 || tempState>1) {
-        Serial.println(F("Error: Invalid state."));
-        return;
-      }
-      // change the state
-      *action = StateChange;
-      *device = tempDev;
-      *state = tempState;
-      Serial.println("OK");
-      return;
-    }  
-
-    /////////////////////
-    // check for SetShutterPosition command
-    if (strncmp(serialData, "SSP", 3)  == 0){
-      // check for integer input
-      if (sscanf(serialData, "SSP%hhd,%u", &tempDev, &tempPos)!=2) {
-        Serial.println(F("Error: Invalid SSP command format."));
-        return;
-      }
+  // check the validity of the device and state 
+  if (dev < 0 || dev>=params->numShutters()) {
+    Serial.println(F("Error: Invalid device number."));
+    return;
+  }
+  if (state<0 || state>1) {
+    Serial.println(F("Error: Invalid state."));
+    return;
+  }
+  // change the state
+  req.type = StateChange;
+  req.device = dev;
+  req.state = state;
+  Serial.println("OK");
+}
+
+/////////////////////
+// SetShutterStates command: SSM<mask>,<states>
+//   sets all devices in mask at once, bit n of states is the new state of device n
+void SerialComm::CmdSetStates(const char *args)
+{
+  ShutterMask mask, states;
+
+  args = parseMask(args, &mask);
+  args = parseMask(parseSep(args, ','), &states);
+  if (!args) {
+    PrintFormatError();
+    return;
+  }
+  if (!maskValid(mask, params->numShutters())) {
+    Serial.println(F("Error: Invalid device mask."));
+    return;
+  }
+  req.type = MultiStateChange;
+  req.mask = mask;
+  req.states = states & mask;
+  Serial.println("OK");
+}
+
+/////////////////////
+// SetShutterPosition command: SSP<device>,<position>
+void SerialComm::CmdSetPosition(const char *args)
+{
+  long dev, pos;
+
+  args = parseInt(args, -128, 127, &dev);
+  args = parseInt(parseSep(args, ','), 0, 65535, &pos);
+  if (!args) {
+    PrintFormatError();
+    return;
+  }
 #if SERIAL_DEBUG>0
-      Serial.print(F("Requesting device "));Serial.print(tempDev);
-      Serial.print(F(" set position to "));Serial.println(tempState);
+  Serial.print(F("Requesting device "));Serial.print(dev);
+  Serial.print(F(" set position to "));Serial.println(pos);
 #endif      
-      // check the validity of the device 
-      if (tempDev < 0 || tempDev>=params->numShutters()) {
-        Serial.println(F("Error: Invalid device number."));
-        return;
-      }
-      *action = ManualPos;
-      *device = tempDev;
-      *manPos = tempPos;
-      Serial.println("OK");
+  // check the validity of the device 
+  if (dev < 0 || dev>=params->numShutters()) {
+    Serial.println(F("Error: Invalid device number."));
+    return;
+  }
+  req.type = ManualPos;
+  req.device = dev;
+  req.manPos = pos;
+  Serial.println("OK");
+}
+
+/////////////////////
+// GetBoard command: GBD<device>, reply BD<device>=<board>
+void SerialComm::CmdGetBoard(const char *args)
+{
+  int8_t dev;
+
+  if (!ParseDevice(args, &dev)) return;
+  Serial.print("BD");Serial.print(dev);Serial.print("=");Serial.println(params->board(dev));
+}
+
+/////////////////////
+// SetBoard command: SBD<device>,<board>
+//   the shield channel of the device is on stacked board <board> (0->the first one)
+void SerialComm::CmdSetBoard(const char *args)
+{
+  long dev, board;
+
+  args = parseInt(args, -128, 127, &dev);
+  args = parseInt(parseSep(args, ','), 0, 255, &board);
+  if (!args) {
+    PrintFormatError();
+    return;
+  }
+  if (dev < 0 || dev>=params->numShutters()) {
+    Serial.println(F("Error: Invalid device number."));
+    return;
+  }
+  if (board >= ACT_BOARDS(params->actuator(dev))) {
+    Serial.println(F("Error: Invalid board number."));
+    return;
+  }
+  params->setBoard(dev, board);
+  Serial.println("OK");
+}
+
+/////////////////////
+// GetActuator command: GAT<device>, reply AT<device>=<type>
+void SerialComm::CmdGetActuator(const char *args)
+{
+  int8_t dev;
+
+  if (!ParseDevice(args, &dev)) return;
+  Serial.print("AT");Serial.print(dev);Serial.print("=");Serial.println(params->actuator(dev));
+}
+
+/////////////////////
+// SetActuator command: SAT<device>,<type>
+//   type 0->servo, 1->solenoid, both must be chosen in "Common.h"; the board of the device
+//   must exist for the new type. The sketch first releases the output of the old type
+//   (as the idle state does), then sets the type; the state is unknown until the next
+//   state change.
+void SerialComm::CmdSetActuator(const char *args)
+{
+  long dev, type;
+
+  args = parseInt(args, -128, 127, &dev);
+  args = parseInt(parseSep(args, ','), 0, 255, &type);
+  if (!args) {
+    PrintFormatError();
+    return;
+  }
+  if (dev < 0 || dev>=params->numShutters()) {
+    Serial.println(F("Error: Invalid device number."));
+    return;
+  }
+  if (ACT_BOARDS(type)==0) {
+    Serial.println(F("Error: Invalid actuator type."));
+    return;
+  }
+  if (params->board(dev) >= ACT_BOARDS(type)) {
+    Serial.println(F("Error: Invalid board number."));
+    return;
+  }
+  // change the type
+  req.type = ActuatorChange;
+  req.device = dev;
+  req.actuator = type;
+  Serial.println("OK");
+}
+
+#ifdef SHUTTER_SOLENOID
+/////////////////////
+// GetHitTime command: GHT<device>, reply HT<device>=<ms>
+void SerialComm::CmdGetHitTime(const char *args)
+{
+  int8_t dev;
+
+  if (!ParseDevice(args, &dev)) return;
+  Serial.print("HT");Serial.print(dev);Serial.print("=");Serial.println(params->hitTime(dev));
+}
+
+/////////////////////
+// SetHitTime command: SHT<device>,<ms>
+//   opening starts with a full-power pulse of <ms>, then holds with the open force; 0->off
+void SerialComm::CmdSetHitTime(const char *args)
+{
+  long dev, hitTime;
+
+  args = parseInt(args, -128, 127, &dev);
+  args = parseInt(parseSep(args, ','), 0, 65535, &hitTime);
+  if (!args) {
+    PrintFormatError();
+    return;
+  }
+  if (params->setHitTime(dev, hitTime)==0) {
+    Serial.println("OK");
+  } else {
+    Serial.println(F("Error: Invalid device number."));
+  }
+}
+#endif // SHUTTER_SOLENOID
+
+#ifdef SHUTTER_RCSERVO
+/////////////////////
+// GetMotion command: GMP<device>, reply MP<device>=<maxStep>,<accel>,<brake>
+void SerialComm::CmdGetMotion(const char *args)
+{
+  int8_t dev;
+  const MotionProfile *motion;
+
+  if (!ParseDevice(args, &dev)) return;
+  motion = params->motion(dev);
+  Serial.print("MP");Serial.print(dev);Serial.print("=");
+  Serial.print(motion->maxStep);Serial.print(",");
+  Serial.print(motion->accel);Serial.print(",");
+  Serial.println(motion->brake);
+}
+
+/////////////////////
+// SetMotion command: SMP<device>,<maxStep>,<accel>,<brake>
+//   servo moves limited to maxStep PWM counts per frame, speeding up by accel and slowing
+//   down by brake counts per frame; maxStep 0->off (jump), accel 0->no ramp, brake 0->accel
+void SerialComm::CmdSetMotion(const char *args)
+{
+  long dev, maxStep, accel, brake;
+  MotionProfile motion;
+
+  args = parseInt(args, -128, 127, &dev);
+  args = parseInt(parseSep(args, ','), 0, 255, &maxStep);
+  args = parseInt(parseSep(args, ','), 0, 255, &accel);
+  args = parseInt(parseSep(args, ','), 0, 255, &brake);
+  if (!args) {
+    PrintFormatError();
+    return;
+  }
+  motion.maxStep = maxStep;
+  motion.accel = accel;
+  motion.brake = brake;
+  if (params->setMotion(dev, &motion)==0) {
+    Serial.println("OK");
+  } else {
+    Serial.println(F("Error: Invalid device number."));
+  }
+}
+#endif // SHUTTER_RCSERVO
+
+#ifdef DIGINPUT
+/////////////////////
+// GetLatency command: GLT
+//   reply LT=<count>,<last>,<min>,<max>, digital input edge to actuator write in us
+void SerialComm::CmdGetLatency(const char *args)
+{
+  Serial.print("LT=");Serial.print(DigInput::latencyCount);Serial.print(",");
+  Serial.print(DigInput::latencyLast_us);Serial.print(",");
+  Serial.print(DigInput::latencyMin_us);Serial.print(",");
+  Serial.println(DigInput::latencyMax_us);
+}
+
+/////////////////////
+// ClearLatency command: CLT
+void SerialComm::CmdClearLatency(const char *args)
+{
+  DigInput::ClearLatency();
+  Serial.println("OK");
+}
+#endif // DIGINPUT
+
+#ifdef SERIALEVENTS
+/////////////////////
+// Events command: EVT<0|1>, 1->report every state change (see SendEvent)
+void SerialComm::CmdEvents(const char *args)
+{
+  long on;
+
+  if (!parseInt(args, 0, 1, &on)) {
+    PrintFormatError();
+    return;
+  }
+  eventsOn = on;
+  Serial.println("OK");
+}
+
+////////////////////////////
+// Report a state change: !EV<device>,<state>,<source>,<time in ms>
+//   state as for GST, source see StateSource. The '!' never starts a reply,
+//   so the host can tell the events from the replies to its commands.
+//   Not sent in binary mode.
+void SerialComm::SendEvent(int8_t device, int8_t state, StateSource source)
+{
+  if (!eventsOn) return;
+#ifdef SERIALBINARY
+  if (binMode) return;
+#endif
+  Serial.print(F("!EV"));Serial.print(device);Serial.print(",");
+  Serial.print(state);Serial.print(",");
+  Serial.print((uint8_t)source);Serial.print(",");
+  Serial.println(millis());
+}
+#endif // SERIALEVENTS
+
+#ifdef STATS
+/////////////////////
+// GetStats command: GPF<channel>, channel 0->loop period, 1->serial command,
+//   2->actuator write, 3->display redraw
+//   reply PF<channel>=<count>,<max>,<bucket 0>,...,<bucket 7>, times in us,
+//   bucket limits 16, 64, 256, 1024, 4096, 16384, 65536 us (see Stats.h)
+void SerialComm::CmdGetStats(const char *args)
+{
+  long channel;
+
+  if (!parseInt(args, -128, 127, &channel)) {
+    PrintFormatError();
+    return;
+  }
+  if (channel < 0 || channel >= StatNumChannels) {
+    Serial.println(F("Error: Invalid channel number."));
+    return;
+  }
+  Serial.print("PF");Serial.print(channel);Serial.print("=");
+  Serial.print(Stats::count[channel]);Serial.print(",");
+  Serial.print(Stats::max_us[channel]);
+  for (uint8_t b=0; b<STATS_BUCKETS; b++) {
+    Serial.print(",");Serial.print(Stats::bucket[channel][b]);
+  }
+  Serial.println();
+}
+
+/////////////////////
+// ClearStats command: CPF, resets all histograms
+void SerialComm::CmdClearStats(const char *args)
+{
+  Stats::Clear();
+  Serial.println("OK");
+}
+#endif // STATS
+
+#ifdef SEQUENCER
+/////////////////////
+// Sequence edits need an idle sequencer
+// returns 1 if idle, otherwise prints the error and returns 0
+int8_t SerialComm::CheckSequenceIdle(void)
+{
+  if (sequencer->State() != SeqIdle) {
+    Serial.println(F("Error: Sequence is active."));
+    return 0;
+  }
+  return 1;
+}
+
+/////////////////////
+// SequenceClear command: SQC
+void SerialComm::CmdSeqClear(const char *args)
+{
+  if (!CheckSequenceIdle()) return;
+  sequencer->Clear();
+  Serial.println("OK");
+}
+
+/////////////////////
+// SequenceAddEvent command: SQA<offset_us>,<mask>,<states>
+//   at offset_us after the start of each pass, set the devices in mask to states
+void SerialComm::CmdSeqAddEvent(const char *args)
+{
+  long offset;
+  ShutterMask mask, states;
+
+  args = parseInt(args, 0, 2147483647L, &offset);
+  args = parseMask(parseSep(args, ','), &mask);
+  args = parseMask(parseSep(args, ','), &states);
+  if (!args) {
+    PrintFormatError();
+    return;
+  }
+  if (!CheckSequenceIdle()) return;
+  if (!maskValid(mask, params->numShutters())) {
+    Serial.println(F("Error: Invalid device mask."));
+    return;
+  }
+  if (sequencer->AddEvent(offset, mask, states)==0)
+    Serial.println("OK");
+  else
+    Serial.println(F("Error: Sequence full or event out of order."));
+}
+
+/////////////////////
+// SequenceConfigure command: SQP<loops>,<trigger>,<period_us>
+//   loops: passes to play (0->until aborted)
+//   trigger: 0->SQS command, 1-4->rising edge on digital input 0-3 (only with DIGINPUT)
+//   period_us: length of a pass (0->time of the last event)
+void SerialComm::CmdSeqConfigure(const char *args)
+{
+  long loops, trigger, period;
+
+  args = parseInt(args, 0, 65535, &loops);
+  args = parseInt(parseSep(args, ','), 0, 4, &trigger);
+  args = parseInt(parseSep(args, ','), 0, 2147483647L, &period);
+  if (!args) {
+    PrintFormatError();
+    return;
+  }
+#ifndef DIGINPUT
+  if (trigger) { // no inputs to fire it
+    Serial.println(F("Error: No digital inputs for the trigger."));
+    return;
+  }
+#endif
+  if (!CheckSequenceIdle()) return;
+  sequencer->Configure(loops, trigger, period);
+  Serial.println("OK");
+}
+
+/////////////////////
+// SequenceArm command: SQR
+void SerialComm::CmdSeqArm(const char *args)
+{
+  if (!CheckSequenceIdle()) return;
+  if (sequencer->Arm()==0)
+    Serial.println("OK");
+  else
+    Serial.println(F("Error: Invalid sequence."));
+}
+
+/////////////////////
+// SequenceStart command: SQS
+void SerialComm::CmdSeqStart(const char *args)
+{
+  if (sequencer->Start()==0)
+    Serial.println("OK");
+  else
+    Serial.println(F("Error: Sequence not armed."));
+}
+
+/////////////////////
+// SequenceAbort command: SQX
+void SerialComm::CmdSeqAbort(const char *args)
+{
+  sequencer->Abort();
+  Serial.println("OK");
+}
+
+/////////////////////
+// SequenceGetStatus command: SQG
+//   reply SQ=<state>,<loops done>,<next event>,<num events>,<start time in ms>
+//   state: 0->idle, 1->armed, 2->running
+void SerialComm::CmdSeqGetStatus(const char *args)
+{
+  Serial.print("SQ=");Serial.print(sequencer->State());Serial.print(",");
+  Serial.print(sequencer->LoopCount());Serial.print(",");
+  Serial.print(sequencer->NextEvent());Serial.print(",");
+  Serial.print(sequencer->NumEvents());Serial.print(",");
+  Serial.println(sequencer->StartTime());
+}
+
+/////////////////////
+// SequenceGetTiming command: SQT<event>
+//   reply SQT<event>=<planned>,<actual>, in us after the start of the latest pass
+void SerialComm::CmdSeqGetTiming(const char *args)
+{
+  long event;
+  uint32_t planned, actual;
+
+  if (!parseInt(args, 0, 255, &event)) {
+    PrintFormatError();
+    return;
+  }
+  if (sequencer->EventTiming(event, &planned, &actual)) {
+    Serial.println(F("Error: Invalid event number."));
+    return;
+  }
+  Serial.print("SQT");Serial.print(event);Serial.print("=");
+  Serial.print(planned);Serial.print(",");Serial.println(actual);
+}
+#endif // SEQUENCER
+
+#ifdef SERIALBINARY
+/////////////////////
+// switch to binary frames (see BinFrame.h); BINCMD_ASCII switches back
+void SerialComm::CmdBinaryMode(const char *args)
+{
+  Serial.println("OK");
+  binParser.Reset();
+  binMode = 1;
+}
+
+
+// *************************************************************************************
+// binary mode
+// *************************************************************************************
+////////////////////////////
+// Feed the received bytes to the frame parser, handle at most one frame per call
+void SerialComm::CheckBinaryAction(void)
+{
+  int inByte;
+  int8_t result;
+
+  while ((inByte = Serial.read()) >= 0) {
+    result = binParser.Feed((uint8_t)inByte);
+    if (result == BINFRAME_BADCRC) {
+      if (binParser.errorSync == BINFRAME_SYNC_SST)
+        Serial.write((uint8_t)BINACK_NAK);
+      else
+        SendBinaryResponse(binParser.errorSeq, BINSTAT_BADCRC, 0, 0, 0);
+    } else if (result == BINFRAME_OK) {
+#ifdef STATS
+      unsigned long start_us = micros();
+      HandleBinaryFrame(binParser.frame);
+      Stats::Record(StatParse, micros() - start_us);
+#else
+      HandleBinaryFrame(binParser.frame);
+#endif
       return;
-    }  
-    
-    /////////////////////
-    // if we ever get to here, it was an unrecognized command
-    Serial.println(F("Error: Unrecognized command"));
+    }
+  }
+}
+
+////////////////////////////
+// Execute one request frame and send the response frame (the ack for a compact frame)
+void SerialComm::HandleBinaryFrame(const uint8_t *frame)
+{
+  uint8_t seq = frame[1];
+  uint8_t dev = frame[3];
+
+  if (frame[0] == BINFRAME_SYNC_SST) {
+    dev = frame[1] & 0x7F;
+    if (dev >= params->numShutters()) {
+      Serial.write((uint8_t)BINACK_NAK);
+    } else {
+      req.type = StateChange;
+      req.device = dev;
+      req.state = frame[1] >> 7;
+      Serial.write((uint8_t)BINACK_OK);
+    }
+    return;
+  }
+  switch (frame[2]) {
+    case BINCMD_NOP:
+      SendBinaryResponse(seq, BINSTAT_OK, 0, 0, 0);
+      break;
+    case BINCMD_GND:
+      SendBinaryResponse(seq, BINSTAT_OK, params->numShutters(), 0, 0);
+      break;
+    case BINCMD_SST:
+      if (dev >= params->numShutters()) {
+        SendBinaryResponse(seq, BINSTAT_BADDEV, dev, 0, 0);
+      } else if (frame[4] > 1) {
+        SendBinaryResponse(seq, BINSTAT_BADARG, dev, frame[4], 0);
+      } else {
+        req.type = StateChange;
+        req.device = dev;
+        req.state = frame[4];
+        SendBinaryResponse(seq, BINSTAT_OK, dev, frame[4], 0);
+      }
+      break;
+    case BINCMD_SSM: // [5]: group of eight devices the mask bits stand for
+      if (frame[5] >= (MAXSHUTTERS+7)/8
+          || !maskValid((ShutterMask)frame[3] << 8*frame[5], params->numShutters())) {
+        SendBinaryResponse(seq, BINSTAT_BADDEV, frame[3], frame[4], frame[5]);
+      } else {
+        req.type = MultiStateChange;
+        req.mask = (ShutterMask)frame[3] << 8*frame[5];
+        req.states = (ShutterMask)(frame[4] & frame[3]) << 8*frame[5];
+        SendBinaryResponse(seq, BINSTAT_OK, frame[3], frame[4] & frame[3], frame[5]);
+      }
+      break;
+    case BINCMD_GST:
+      if (dev >= params->numShutters())
+        SendBinaryResponse(seq, BINSTAT_BADDEV, dev, 0, 0);
+      else
+        SendBinaryResponse(seq, BINSTAT_OK, dev, (uint8_t)devState[dev], 0);
+      break;
+    case BINCMD_SSP:
+      if (dev >= params->numShutters()) {
+        SendBinaryResponse(seq, BINSTAT_BADDEV, dev, 0, 0);
+      } else {
+        req.type = ManualPos;
+        req.device = dev;
+        req.manPos = frame[4] | ((uint16_t)frame[5] << 8);
+        SendBinaryResponse(seq, BINSTAT_OK, dev, frame[4], frame[5]);
+      }
+      break;
+    case BINCMD_ASCII:
+      SendBinaryResponse(seq, BINSTAT_OK, 0, 0, 0);
+      binMode = 0;
+      lineLen = 0;
+      lineOverflow = 0;
+      break;
+    default:
+      SendBinaryResponse(seq, BINSTAT_BADCMD, frame[2], 0, 0);
+      break;
+  }
+}
+
+////////////////////////////
+// Send a response frame
+void SerialComm::SendBinaryResponse(uint8_t seq, uint8_t status, uint8_t b0, uint8_t b1, uint8_t b2)
+{
+  uint8_t frame[BINFRAME_SIZE];
 
-  } // if (Serial.available() > 0) 
+  frame[0] = BINFRAME_SYNC_RESP;
+  frame[1] = seq;
+  frame[2] = status;
+  frame[3] = b0;
+  frame[4] = b1;
+  frame[5] = b2;
+  frame[6] = binFrameCRC(frame, BINFRAME_SIZE-1);
+  Serial.write(frame, BINFRAME_SIZE);
 }
+#endif // SERIALBINARY
 
 
 #endif // SERIALCOMM
\ No newline at end of file
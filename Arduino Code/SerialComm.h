@@ -6,14 +6,45 @@
 #define SERIALCOMM_H
 
 #include "Parameters.h"
+#ifdef SERIALBINARY
+#include "BinFrame.h"
+#endif
+#ifdef SEQUENCER
+#include "Sequencer.h"
+#endif
+#ifdef DIGINPUT
+#include "DigInput.h"
+#endif
+#ifdef STATS
+#include "Stats.h"
+#endif
+
+#if MAXSHUTTERS > 32
+#define MSG_MAXLENGTH  64 // max command length, without the term char (SQA with 20-digit masks)
+#else
+#define MSG_MAXLENGTH  50 // max command length, without the term char
+#endif
 
 typedef enum {
   None = 0,
   StateChange,
+  MultiStateChange,
   ManualPos,
-  ParamChange
+  ParamChange,
+  ActuatorChange
 } SerialActionType;
 
+// requested action, filled by SerialComm::CheckAction
+typedef struct {
+  SerialActionType type;
+  int8_t device;     // StateChange, ManualPos, ActuatorChange
+  int8_t state;      // StateChange
+  uint16_t manPos;   // ManualPos
+  uint8_t actuator;  // ActuatorChange: new actuator type
+  ShutterMask mask;  // MultiStateChange: devices to change
+  ShutterMask states; // MultiStateChange: new states (bit set->open)
+} SerialAction;
+
 
 // *************************************************************************************
 // SerialComm class
@@ -21,12 +52,105 @@ typedef enum {
 class SerialComm
 {
 private:
+  // command table entry: three-letter opcode and the handler that parses its arguments
+  typedef void (SerialComm::*CmdHandler)(const char *args);
+  struct CmdEntry {
+    char op[4];
+    CmdHandler handler;
+  };
+  static const CmdEntry cmdTable[];
+  static const uint8_t numCmds;
+
   Parameters *params;
   int8_t *devState;
+  char lineBuf[MSG_MAXLENGTH+1]; // one extra for the null char
+  uint8_t lineLen = 0;
+  uint8_t lineOverflow = 0;
+  // result of the command handler, returned by CheckAction
+  SerialAction req;
+#ifdef SERIALBINARY
+  BinFrameParser binParser;
+  uint8_t binMode = 0;
+#endif
+#ifdef SERIALEVENTS
+  uint8_t eventsOn = 0;
+#endif
+#ifdef SEQUENCER
+  Sequencer *sequencer;
+#endif
+
+  int8_t ReadLine(void);
+  int8_t FindCommand(CmdHandler *handler);
+  int8_t ParseDevice(const char *args, int8_t *dev);
+  void PrintFormatError(void);
+#ifdef SERIALBINARY
+  void CheckBinaryAction(void);
+  void HandleBinaryFrame(const uint8_t *frame);
+  void SendBinaryResponse(uint8_t seq, uint8_t status, uint8_t b0, uint8_t b1, uint8_t b2);
+  void CmdBinaryMode(const char *args);
+#endif
+
+  void CmdIdentify(const char *args);
+  void CmdGetTime(const char *args);
+  void CmdGetNumDevices(const char *args);
+  void CmdGetState(const char *args);
+  void CmdGetLabel(const char *args);
+  void CmdGetTransitDelay(const char *args);
+  void CmdClear(const char *args);
+  void CmdSave(const char *args);
+  void CmdGetSaveStatus(const char *args);
+  void CmdGetPreset(const char *args);
+  void CmdLoadPreset(const char *args);
+  void CmdStorePreset(const char *args);
+  void CmdGetParameters(const char *args);
+  void CmdSetParameters(const char *args);
+  void CmdSetState(const char *args);
+  void CmdSetStates(const char *args);
+  void CmdSetPosition(const char *args);
+  void CmdGetBoard(const char *args);
+  void CmdSetBoard(const char *args);
+  void CmdGetActuator(const char *args);
+  void CmdSetActuator(const char *args);
+#ifdef DIGINPUT
+  void CmdGetLatency(const char *args);
+  void CmdClearLatency(const char *args);
+#endif
+#ifdef SERIALEVENTS
+  void CmdEvents(const char *args);
+#endif
+#ifdef SHUTTER_SOLENOID
+  void CmdGetHitTime(const char *args);
+  void CmdSetHitTime(const char *args);
+#endif
+#ifdef SHUTTER_RCSERVO
+  void CmdGetMotion(const char *args);
+  void CmdSetMotion(const char *args);
+#endif
+#ifdef STATS
+  void CmdGetStats(const char *args);
+  void CmdClearStats(const char *args);
+#endif
+#ifdef SEQUENCER
+  int8_t CheckSequenceIdle(void);
+  void CmdSeqClear(const char *args);
+  void CmdSeqAddEvent(const char *args);
+  void CmdSeqConfigure(const char *args);
+  void CmdSeqArm(const char *args);
+  void CmdSeqStart(const char *args);
+  void CmdSeqAbort(const char *args);
+  void CmdSeqGetStatus(const char *args);
+  void CmdSeqGetTiming(const char *args);
+#endif
 public:
   SerialComm();
-  Begin(Parameters *paramPtr, int8_t *devStatePtr, long timeout_ms = 1000);
-  CheckAction(SerialActionType *action, int8_t *device, int8_t *state, uint16_t *manPos);
+  void Begin(Parameters *paramPtr, int8_t *devStatePtr);
+  void CheckAction(SerialAction *action);
+#ifdef SERIALEVENTS
+  void SendEvent(int8_t device, int8_t state, StateSource source);
+#endif
+#ifdef SEQUENCER
+  void AttachSequencer(Sequencer *seqPtr) { sequencer = seqPtr; }
+#endif
 };
 
 #endif // SERIALCOMM_H
@@ -4,7 +4,7 @@
 // Written for the Arduino platform; controls actuators that serve as
 //   shutters for some laser beams.
 // Uses the Adafruit TFT Touch Shield or the Adafruit LCD dislay
-// Also uses the Adafruit PWM shield or motor shield
+// Also uses the Adafruit PWM shield and/or motor shield
 ///////////////////////////////////////////////////////////////////////
 
 ////////////////////////////
@@ -20,6 +20,8 @@
 #include "LCD.h"
 #include "SerialComm.h"
 #include "DigInput.h"
+#include "Sequencer.h"
+#include "Stats.h"
 
 #define SERIAL_DEBUG  0
 
@@ -28,10 +30,10 @@
 //************************************************
 Parameters _params = Parameters();
 #ifdef SHUTTER_RCSERVO
-RCServo _shutter = RCServo();
+RCServo _servo = RCServo();
 #endif
 #ifdef SHUTTER_SOLENOID
-Solenoid _shutter = Solenoid();
+Solenoid _solenoid = Solenoid();
 #endif
 #ifdef DISPLAY_TFT
 TFT _display = TFT();
@@ -45,9 +47,33 @@ SerialComm _serComm = SerialComm();
 #ifdef DIGINPUT
 DigInput _digInput = DigInput();
 #endif
+#ifdef SEQUENCER
+Sequencer _sequencer = Sequencer();
+#endif
 
 static unsigned long _lastStateChangeTime_ms = 0;
 static int8_t _devState[MAXSHUTTERS];
+#if defined DISPLAY_TFT || defined DISPLAY_LCD
+static ShutterMask _displayPending = 0; // devices with a state change not shown yet
+#endif
+#ifdef DIGINPUT
+static ShutterMask _digInputDevices[DIGINPUT_LINES]; // devices controlled by each input line
+#endif
+#ifdef STATS
+static unsigned long _lastLoopTime_us = 0;
+#endif
+
+// driver table, indexed by the actuator type of a device (ACT_RCSERVO, ACT_SOLENOID)
+// The writes themselves are a switch on the type (see applyStates): direct calls, no
+//   call through a pointer for each batch, and nothing left of it with one type chosen
+struct ActuatorDriver {
+  uint8_t boards;   // stacked boards, 0->type not chosen in "Common.h"
+  uint8_t channels; // outputs per board
+};
+static const ActuatorDriver _drivers[ACT_TYPES] = {
+  { ACT_RCSERVO_BOARDS,  PCA9685_CHANNELS },
+  { ACT_SOLENOID_BOARDS, SOLENOID_MOTORS },
+};
 
 
 //************************************************
@@ -81,18 +107,26 @@ void setup() {
   for(uint8_t ind = 0; ind < sizeof(_devState); ++ind) _devState[ind] = -2;
 
 #ifdef SERIALCOMM
-  _serComm.Begin(&_params, _devState); // default timeout
+  _serComm.Begin(&_params, _devState);
+#endif
+#ifdef SEQUENCER
+  _serComm.AttachSequencer(&_sequencer);
 #endif
 
-  _shutter.Begin();
+#ifdef SHUTTER_RCSERVO
+  _servo.Begin();
+#endif
+#ifdef SHUTTER_SOLENOID
+  _solenoid.Begin();
+#endif
 
   // read parameter info from EEPROM
   _params.readFromEEPROM();
 
-  // in case of erroneous behavior when first using the Arduino, it could be becasue of some strange
-  // values in the EEPROM. To rule that out, comment out the above line and instead use the two lines
-  // below. These save some pre-defined values into the EEPROM. Then revert back to the original
-  //  config and compile/download the code again.
+  // an empty, damaged or foreign EEPROM image fails the checks (see Parameters.cpp), the controller
+  // then starts without shutters. To start with pre-defined values instead, comment out the above
+  // line and use the two lines below, then revert back to the original config and compile/download
+  // the code again.
 //  createDummyParameters();
 //  _params.saveToEEPROM();
 
@@ -104,9 +138,13 @@ void setup() {
 
 // set up the digital inputs
 #ifdef DIGINPUT
+  updateDigInputMap();
   _digInput.Begin();
 #endif
 
+#ifdef STATS
+  _lastLoopTime_us = micros(); // first loop period starts here
+#endif
 }
 
 
@@ -115,7 +153,38 @@ void setup() {
 //************************************************
 void loop() {
 
+#ifdef STATS
+  unsigned long loopTime_us = micros();
+  Stats::Record(StatLoop, loopTime_us - _lastLoopTime_us);
+  _lastLoopTime_us = loopTime_us;
+#endif
+#if defined DIGINPUT && DIGINPUT_FASTPATH>0
+  checkDigitalInput(); // first thing in the loop for the lowest latency
+#endif
+#ifdef SHUTTER_RCSERVO
+  _servo.Update(); // next frame of the moves
+#endif
+#ifdef SHUTTER_SOLENOID
+  _solenoid.Update(); // ends the hit-and-hold pulses
+#endif
+  _params.Update(); // next byte of an EEPROM save
+#ifdef SEQUENCER
+  checkSequencer();
+  if (_sequencer.State() == SeqRunning) {
+    // keep the loop short while a sequence runs: no display, no idle check
+    checkSerialInput();
+#if defined DIGINPUT && DIGINPUT_FASTPATH==0
+    checkDigitalInput();
+#endif
+    return;
+  }
+#endif
+
 #if defined DISPLAY_TFT || defined DISPLAY_LCD
+  updateDisplayStates(); // state changes since the last pass
+#if defined DIGINPUT && DIGINPUT_FASTPATH>0
+  checkDigitalInput(); // again between the (slow) display steps
+#endif
   checkDisplayInput();
 #endif
 #ifdef SERIALCOMM
@@ -140,9 +209,13 @@ void checkDisplayInput(void)
 {
    int8_t device;
    int8_t desiredState;
+   int8_t result;
 
-  if (_display.CheckInput(&device, &desiredState)) {
-    updateState(device, desiredState);
+  result = _display.CheckInput(&device, &desiredState);
+  if (result==1) {
+    updateState(device, desiredState, SrcDisplay);
+  } else if (result==2) { // other devices shown
+    updateDisplayInfo();
   }
 }
 #endif
@@ -153,24 +226,45 @@ void checkDisplayInput(void)
 #ifdef SERIALCOMM
 void checkSerialInput(void)
 {
-  SerialActionType action;
-  int8_t device;
-  int8_t desiredState;
-  uint16_t manualPos;
+  SerialAction action;
 
-  _serComm.CheckAction(&action, &device, &desiredState, &manualPos);
-  if (action == None)
+  _serComm.CheckAction(&action);
+  if (action.type == None)
     return;
-  else if (action == ParamChange){
+  else if (action.type == ParamChange){
+#ifdef DIGINPUT
+    updateDigInputMap();
+#endif
 #if defined DISPLAY_TFT || defined DISPLAY_LCD
     updateDisplayInfo();
 #endif
-  } else if (action == StateChange)
-    updateState(device, desiredState);
-  else if (action == ManualPos) {
-    _shutter.SetShutterValue(_params.shieldChannel(device), manualPos);
+  } else if (action.type == StateChange)
+    updateState(action.device, action.state, SrcSerial);
+  else if (action.type == MultiStateChange)
+    updateStates(action.mask, action.states, SrcSerial);
+  else if (action.type == ManualPos) {
+    switch (_params.actuator(action.device)) {
+#ifdef SHUTTER_RCSERVO
+      case ACT_RCSERVO:
+        _servo.SetShutterValue(_params.board(action.device), _params.shieldChannel(action.device), action.manPos);
+        break;
+#endif
+#ifdef SHUTTER_SOLENOID
+      case ACT_SOLENOID:
+        _solenoid.SetShutterValue(_params.board(action.device), _params.shieldChannel(action.device), action.manPos);
+        break;
+#endif
+    }
     _lastStateChangeTime_ms = millis();
-    _devState[device]=2; // flag for manual set
+    _devState[action.device]=2; // flag for manual set
+#ifdef SERIALEVENTS
+    _serComm.SendEvent(action.device, 2, SrcSerial);
+#endif
+  } else if (action.type == ActuatorChange) {
+    // release the output of the old type, the new driver never writes it again
+    updateState(action.device, -1, SrcSerial);
+    _params.setActuator(action.device, action.actuator);
+    _devState[action.device] = -2; // unknown until the next state change
   }
 
 }
@@ -184,49 +278,84 @@ void checkDigitalInput(void)
 {
 
   uint8_t portState; // byte that defines the bits in the input port (only 0-3 are used)
-  int8_t digInput; // input number for the device (0-3)
-  int8_t newState; // desired state of the device
+  uint8_t changed; // inputs that have changed
+  unsigned long edgeTime_us; // when the edge was detected
+  ShutterMask mask = 0;
+  ShutterMask states = 0;
 
-  if (_digInput.CheckState(&portState))
+  if (_digInput.CheckState(&portState, &changed, &edgeTime_us))
   {
-    // loop through devices
-    for (int8_t dev=0; dev<_params.numShutters(); dev++) {
-      digInput = _params.digInput(dev); 
-      if (digInput==-1) continue; // no digital input defined for this device
-      newState = ( (portState & bit(digInput)) > 0 ? 1 : 0);
-      if (_devState[dev] != newState ) {
-        updateState(dev, newState);
+#ifdef SEQUENCER
+    _sequencer.CheckTrigger(portState);
+#endif
+    // the devices of each line were looked up in advance (updateDigInputMap)
+    for (uint8_t line=0; line<DIGINPUT_LINES; line++) {
+      if (!(changed & bit(line))) continue; // only lines with an edge, the others keep their devices as they are
+      mask |= _digInputDevices[line];
+      if (portState & bit(line)) states |= _digInputDevices[line];
+    }
+    if (updateStates(mask, states, SrcDigital)) {
+      _digInput.RecordLatency(micros() - edgeTime_us);
 #if SERIAL_DEBUG>0
-        Serial.print(F("digInput = ")); Serial.println(digInput);
-        Serial.print(F("portstate = ")); Serial.println(portState);
-        Serial.print(F("Dig update device ")); Serial.print(dev); Serial.print(F(" to ")); Serial.print(newState); Serial.println("");
+      Serial.print(F("portstate = ")); Serial.println(portState);
+      Serial.print(F("Dig update after ")); Serial.print(micros() - edgeTime_us); Serial.println(F(" us"));
 #endif      
-      }
     }
   }
 
 }
+
+////////////////////////////
+// find the devices for each digital input line
+////////////////////////////
+void updateDigInputMap(void)
+{
+  int8_t digInput;
+
+  for (uint8_t line=0; line<DIGINPUT_LINES; line++) _digInputDevices[line] = 0;
+  for (int8_t dev=0; dev<_params.numShutters(); dev++) {
+    digInput = _params.digInput(dev);
+    if (digInput<0 || digInput>=DIGINPUT_LINES) continue; // no digital input defined for this device
+    _digInputDevices[digInput] |= DEVBIT(dev);
+  }
+}
 #endif
 
 ////////////////////////////
-// check for elapsed time to disable the servos
+// play the due events of a running sequence
+////////////////////////////
+#ifdef SEQUENCER
+void checkSequencer(void)
+{
+  ShutterMask mask, states;
+
+  while (_sequencer.Check(&mask, &states)) // several events can share the same time
+    updateStates(mask, states, SrcSequencer);
+}
+#endif
+
+////////////////////////////
+// check for elapsed time to disable the actuators
+//   servos disengage, solenoids release
 ////////////////////////////
 void checkForIdle(void)
 {
   unsigned long currentTime;
+  int8_t states[MAXSHUTTERS];
+  ShutterMask mask = 0;
   currentTime = millis();
 
   if ( IDLEINTERVAL_S > 0 
           && currentTime - _lastStateChangeTime_ms > 1000*(unsigned long)IDLEINTERVAL_S) {
     for (int8_t dev=0; dev<_params.numShutters(); dev++) {
       if (_devState[dev]==-1) continue; // already disabled
-      updateState(dev, -1);
+      states[dev] = -1;
+      mask |= DEVBIT(dev);
 #if SERIAL_DEBUG>0
       Serial.print(F("Setting device ")); Serial.print(dev); Serial.println(" to idle.");
 #endif      
-      _shutter.SetShutterValue(_params.shieldChannel(dev), 0);
-      _devState[dev]=-1;
     }
+    applyStates(mask, states, SrcIdle); // all devices in one batch
   }
 }
 
@@ -240,33 +369,154 @@ void checkForIdle(void)
 ////////////////////////////
 // set the shutters
 ////////////////////////////
-void updateState(int8_t device, int8_t state)
+void updateState(int8_t device, int8_t state, StateSource source)
 {
-  // only update shutter state if needed
-  if (state==_devState[device]) return;
-
-  if (state==0) { // close
-    _shutter.SetShutterValue(_params.shieldChannel(device), _params.posClosed(device));
-  } else if (state==1) { // open
-    _shutter.SetShutterValue(_params.shieldChannel(device), _params.posOpen(device));
-  } else if (state==-1) { // idle
-    _shutter.SetShutterValue(_params.shieldChannel(device), 0);
+  int8_t states[MAXSHUTTERS];
+
+  states[device] = state;
+  applyStates(DEVBIT(device), states, source);
+}
+
+////////////////////////////
+// set several shutters at once
+//   mask: devices to change, states: bit set->open, cleared->close
+//   source: what asked for the change (reported to the host with SERIALEVENTS)
+// returns the devices that actually changed
+////////////////////////////
+ShutterMask updateStates(ShutterMask mask, ShutterMask states, StateSource source)
+{
+  int8_t devStates[MAXSHUTTERS];
+
+  for (int8_t dev=0; dev<_params.numShutters(); dev++)
+    devStates[dev] = (states & DEVBIT(dev)) ? 1 : 0;
+  return applyStates(mask, devStates, source);
+}
+
+////////////////////////////
+// move the shutters in mask to their new state (0->close, 1->open, -1->idle)
+//   states: new state per device, only the entries in mask are used
+//   source: what asked for the change (reported to the host with SERIALEVENTS)
+// The actuators of each board are written in one batch (see SetShutterValues) by the
+//   driver of their type, the (slow) display follows in the next pass of the main loop
+// returns the devices that actually changed; devices without a valid type, board or
+//   channel are not written and keep their state
+////////////////////////////
+ShutterMask applyStates(ShutterMask mask, const int8_t *states, StateSource source)
+{
+  uint16_t values[PCA9685_CHANNELS]; // one per shield channel
+#ifdef SHUTTER_SOLENOID
+  uint16_t hitTimes[PCA9685_CHANNELS]; // hit-and-hold pulse per shield channel
+#endif
+#ifdef SHUTTER_RCSERVO
+  const MotionProfile *profiles[PCA9685_CHANNELS]; // servo motion profile per shield channel
+#endif
+  uint16_t channelMask;
+  ShutterMask changed = 0;
+  ShutterMask pending;
+  uint8_t channel, board = 0, type;
+
+  pending = 0;
+  for (int8_t dev=0; dev<_params.numShutters(); dev++) {
+    // only update shutter state if needed
+    if (!(mask & DEVBIT(dev)) || states[dev]==_devState[dev]) continue;
+    pending |= DEVBIT(dev);
   }
-  _devState[device]=state;
-#if defined DISPLAY_TFT || defined DISPLAY_LCD
-  _display.ChangeDevState(device, state);
+  if (!pending) return 0;
+#ifdef STATS
+  unsigned long start_us = micros();
+#endif
+  // one board per pass: the first pending device picks the type and board, the
+  //   other devices on it go along
+  while (pending) {
+    type = 0xFF;
+    channelMask = 0;
+    for (int8_t dev=0; dev<_params.numShutters(); dev++) {
+      if (!(pending & DEVBIT(dev))) continue;
+      if (type==0xFF) {
+        type = _params.actuator(dev);
+        board = _params.board(dev);
+      } else if (_params.actuator(dev)!=type || _params.board(dev)!=board) continue;
+      pending &= ~DEVBIT(dev);
+      channel = _params.shieldChannel(dev);
+      if (type >= ACT_TYPES || board >= _drivers[type].boards || channel >= _drivers[type].channels)
+        continue; // type not chosen, or no such board or channel: the state stays as it was
+      _devState[dev]=states[dev];
+      changed |= DEVBIT(dev);
+      if (_devState[dev]==0) { // close
+        values[channel] = _params.posClosed(dev);
+      } else if (_devState[dev]==1) { // open
+        values[channel] = _params.posOpen(dev);
+      } else { // idle
+        values[channel] = 0;
+      }
+#ifdef SHUTTER_SOLENOID
+      hitTimes[channel] = _params.hitTime(dev);
+#endif
+#ifdef SHUTTER_RCSERVO
+      profiles[channel] = _params.motion(dev);
 #endif
+      channelMask |= bit(channel);
+    }
+    if (!channelMask) continue;
+    switch (type) {
+#ifdef SHUTTER_RCSERVO
+      case ACT_RCSERVO: _servo.SetShutterValues(board, channelMask, values, profiles); break;
+#endif
+#ifdef SHUTTER_SOLENOID
+      case ACT_SOLENOID: _solenoid.SetShutterValues(board, channelMask, values, hitTimes); break;
+#endif
+    }
+  }
+#ifdef STATS
+  Stats::Record(StatActuator, micros() - start_us);
+#endif
+  // also when no device could be written, or checkForIdle would retry them every pass
   _lastStateChangeTime_ms = millis();
+
+#ifdef SERIALEVENTS
+  // after the actuator write, the serial output must not delay the shutters
+  for (int8_t dev=0; dev<_params.numShutters(); dev++)
+    if (changed & DEVBIT(dev)) _serComm.SendEvent(dev, _devState[dev], source);
+#endif
+#if defined DISPLAY_TFT || defined DISPLAY_LCD
+  _displayPending |= changed; // drawn by the main loop (updateDisplayStates)
+#endif
+  return changed;
 }
 
+////////////////////////////
+// show the pending state changes on the display
+////////////////////////////
+#if defined DISPLAY_TFT || defined DISPLAY_LCD
+void updateDisplayStates(void)
+{
+#ifdef STATS
+  unsigned long start_us = micros();
+#endif
+
+  if (!_displayPending) return;
+  for (int8_t dev=0; dev<_params.numShutters(); dev++)
+    if (_displayPending & DEVBIT(dev)) _display.ChangeDevState(dev, _devState[dev]);
+  _displayPending = 0;
+#ifdef STATS
+  Stats::Record(StatDisplay, micros() - start_us);
+#endif
+}
+#endif
+
 ////////////////////////////
 // update the display
+// The display keeps only the devices it shows (a page on the TFT, one on the LCD)
+//   and ignores the others, so this runs again when it shows other devices
 ////////////////////////////
 #if defined DISPLAY_TFT || defined DISPLAY_LCD
 void updateDisplayInfo(void)
 {
   char label[MAXLABELCHARS+1];
   int8_t numShutters = _params.numShutters();
+#ifdef STATS
+  unsigned long start_us = micros();
+#endif
   _display.SetNumDevs(numShutters);
 
   for (int8_t z = 0; z<numShutters; z++) {
@@ -274,6 +524,11 @@ void updateDisplayInfo(void)
     _display.SetDevText(z, label);
   }
   _display.RefreshDisplay();
+  for (int8_t z = 0; z<numShutters; z++)
+    _display.ChangeDevState(z, _devState[z]);
+#ifdef STATS
+  Stats::Record(StatDisplay, micros() - start_us);
+#endif
 }
 #endif
 
@@ -5,7 +5,6 @@
 
 #include <Arduino.h>
 #include <Wire.h>
-#include <Adafruit_MotorShield.h>
 #include "Solenoid.h"
 
 #define SERIAL_DEBUG  0
@@ -14,12 +13,9 @@
 // *************************************************************************************
 // defines
 // *************************************************************************************
-
-// *************************************************************************************
-// global variables
-// *************************************************************************************
-Adafruit_MotorShield _AFMS = Adafruit_MotorShield(SOLENOID_BOARDID);
-Adafruit_DCMotor* _motorPtr[4]; // four motors per board
+// PCA9685 pins of the motor ports on the shield: PWM, IN1, IN2 (see Adafruit_MotorShield::getMotor)
+static const uint8_t _motorPins[SOLENOID_MOTORS][3] = { {8, 10, 9}, {13, 11, 12}, {2, 4, 3}, {7, 5, 6} };
+#define SOLENOID_PWM_FREQ 1600 // PWM frequency of the motor ports (Adafruit_MotorShield default)
 
 // *************************************************************************************
 // RCServo class
@@ -32,38 +28,40 @@ Solenoid::Solenoid()
 
 ////////////////////////////
 // Initialize stuff
-Solenoid::Begin()
+void Solenoid::Begin()
 {
 #if SERIAL_DEBUG>0
   Serial.println(F("Solenoid Begin."));
 #endif      
 
-  // set up motor board
-  for (uint8_t ind=0; ind<4; ind++) {
-    _motorPtr[ind] = _AFMS.getMotor(ind+1); // motor index is 1-based
-  }
-
-  if (!_AFMS.begin()) {         // create with the default frequency 1.6KHz
+  // set up the motor boards
+  Wire.begin();
+  Wire.setClock(SHIELD_I2C_CLOCK); // shorter bus time per update
+  for (uint8_t board=0; board<SOLENOID_BOARDS; board++) {
+    if (!pca9685Begin(SOLENOID_BOARDID+board, SOLENOID_PWM_FREQ)) {
 #if SERIAL_DEBUG>0
-  Serial.println(F("Could not find Motor Shield. Check wiring."));
+      Serial.println(F("Could not find Motor Shield. Check wiring."));
 #endif      
-    while (1);
+      while (1);
+    }
   }
 
   // Initially, turn all motors off
-  for (uint8_t ind=0; ind<4; ind++) {
-    _motorPtr[ind]->run(RELEASE);
+  uint16_t values[SOLENOID_MOTORS] = {0};
+  for (uint8_t board=0; board<SOLENOID_BOARDS; board++) {
+    hit[board].hitMask = 0;
+    WriteValues(board, bit(SOLENOID_MOTORS)-1, values);
   }
 
 }
 
 ////////////////////////////
 // Action functions
-Solenoid::SetShutterValue(uint8_t dev, uint16_t value)
+void Solenoid::SetShutterValue(uint8_t board, uint8_t dev, uint16_t value)
 {
-  // Make sure the values are in range
-  if (value>255) value = 255;
-  if (dev>3) {
+  uint16_t values[SOLENOID_MOTORS];
+
+  if (board>=SOLENOID_BOARDS || dev>=SOLENOID_MOTORS) {
 #if SERIAL_DEBUG>0
     Serial.println(F("Illegal motor device number (0-3)."));
 #endif      
@@ -71,15 +69,100 @@ Solenoid::SetShutterValue(uint8_t dev, uint16_t value)
   }
 
   // Set the force of the solenoid, from 0 (off) to 255 (max)
-  if (value>0) { 
-    _motorPtr[dev]->setSpeed(value);
-    _motorPtr[dev]->run(FORWARD);
-  } else {
-    _motorPtr[dev]->run(RELEASE);
+  values[dev] = value;
+  SetShutterValues(board, bit(dev), values); // a pulse in progress would overwrite the value
+#if SERIAL_DEBUG>0
+  Serial.print(F("Setting motor ")); Serial.print(board); Serial.print("/"); Serial.print(dev);
+  Serial.print(" to "); Serial.print(value); Serial.println(".");
+#endif      
+}
+
+////////////////////////////
+// Set several motor ports at once
+//   channelMask: bit n set -> update motor n (0-3)
+//   values: force for each motor (indexed by motor, 0 (off) to 255 (max))
+void Solenoid::SetShutterValues(uint8_t board, uint16_t channelMask, const uint16_t *values)
+{
+  if (board>=SOLENOID_BOARDS) return;
+  hit[board].hitMask &= ~channelMask;
+  WriteValues(board, channelMask, values);
+}
+
+////////////////////////////
+// Set several motor ports at once, with hit-and-hold
+//   hitTimes_ms: full-power pulse for each motor (indexed by motor), 0->none
+// A solenoid pulls in fastest at full power but needs much less force to stay put;
+//   the full force for the whole exposure only heats the coil. Update switches to
+//   values[] when the pulse is over, so nothing here waits.
+void Solenoid::SetShutterValues(uint8_t board, uint16_t channelMask, const uint16_t *values,
+                                const uint16_t *hitTimes_ms)
+{
+  uint16_t driveValues[SOLENOID_MOTORS];
+  unsigned long now_ms = millis();
+  HitState *h;
+
+  if (board>=SOLENOID_BOARDS) return;
+  h = &hit[board];
+  h->hitMask &= ~channelMask;
+  for (uint8_t dev=0; dev<SOLENOID_MOTORS; dev++) {
+    if (!(channelMask & bit(dev))) continue;
+    driveValues[dev] = values[dev];
+    if (values[dev]==0 || hitTimes_ms[dev]==0) continue;
+    h->holdValue[dev] = (values[dev]>255) ? 255 : values[dev];
+    h->hitEnd_ms[dev] = now_ms + hitTimes_ms[dev];
+    h->hitMask |= bit(dev);
+    driveValues[dev] = SOLENOID_HIT_VALUE;
+  }
+  WriteValues(board, channelMask, driveValues);
+}
+
+////////////////////////////
+// End the hit pulses that are due, all motors of a board in one write
+void Solenoid::Update(void)
+{
+  uint16_t values[SOLENOID_MOTORS];
+  uint16_t channelMask;
+  unsigned long now_ms = millis();
+  HitState *h;
+
+  for (uint8_t board=0; board<SOLENOID_BOARDS; board++) {
+    h = &hit[board];
+    if (!h->hitMask) continue;
+    channelMask = 0;
+    for (uint8_t dev=0; dev<SOLENOID_MOTORS; dev++) {
+      if (!(h->hitMask & bit(dev)) || (long)(now_ms - h->hitEnd_ms[dev]) < 0) continue;
+      values[dev] = h->holdValue[dev];
+      channelMask |= bit(dev);
+    }
+    if (!channelMask) continue;
+    h->hitMask &= ~channelMask;
+    WriteValues(board, channelMask, values);
+  }
+}
+
+////////////////////////////
+// Write the motor ports
+// The PWM/IN1/IN2 pins of M1+M2 and of M3+M4 are adjacent PCA9685 channels,
+//   so any combination of motors takes at most two I2C transactions
+void Solenoid::WriteValues(uint8_t board, uint16_t channelMask, const uint16_t *values)
+{
+  uint16_t pinValues[PCA9685_CHANNELS];
+  uint16_t pinMask = 0;
+  uint16_t value;
+
+  for (uint8_t dev=0; dev<SOLENOID_MOTORS; dev++) {
+    if (!(channelMask & bit(dev))) continue;
+    value = (values[dev]>255) ? 255 : values[dev];
+    // same as setSpeed + run(FORWARD), or run(RELEASE) for zero
+    pinValues[_motorPins[dev][0]] = value*16;
+    pinValues[_motorPins[dev][1]] = (value>0) ? PCA9685_FULL_ON : 0;
+    pinValues[_motorPins[dev][2]] = 0;
+    pinMask |= bit(_motorPins[dev][0]) | bit(_motorPins[dev][1]) | bit(_motorPins[dev][2]);
   }
+  pca9685WriteChannels(SOLENOID_BOARDID+board, pinMask, pinValues);
 #if SERIAL_DEBUG>0
-  Serial.print(F("Setting motor ")); Serial.print(dev); Serial.print(" to ");
-  Serial.print(value); Serial.println(".");
+  Serial.print(F("Setting motor mask ")); Serial.print(board); Serial.print("/");
+  Serial.print(channelMask, BIN); Serial.println(".");
 #endif      
 }
 
@@ -6,12 +6,29 @@
 #ifndef SOLENOID_H
 #define SOLENOID_H
 
+#include "PCA9685Burst.h"
+
 class Solenoid
 {
+  // hit-and-hold, per board: motors in their full-power pulse, force afterwards and end of the pulse
+  struct HitState {
+    uint8_t hitMask;
+    uint8_t holdValue[SOLENOID_MOTORS];
+    unsigned long hitEnd_ms[SOLENOID_MOTORS];
+  };
+  HitState hit[SOLENOID_BOARDS];
+
+  void WriteValues(uint8_t board, uint16_t channelMask, const uint16_t *values);
 public:
   Solenoid();
-  Begin();
-  SetShutterValue(uint8_t dev, uint16_t value);
+  void Begin();
+  // board: index of the stacked board (0..SOLENOID_BOARDS-1), one write per call
+  void SetShutterValue(uint8_t board, uint8_t dev, uint16_t value);
+  void SetShutterValues(uint8_t board, uint16_t channelMask, const uint16_t *values);
+  // same, but motors with a nonzero force and hitTimes_ms>0 start with a full-power pulse
+  void SetShutterValues(uint8_t board, uint16_t channelMask, const uint16_t *values, const uint16_t *hitTimes_ms);
+  // switch the motors whose pulse is over to their holding force; call from the main loop
+  void Update(void);
 };
 
 #endif // SOLENOID_H
@@ -0,0 +1,42 @@
+#include "Common.h"
+// only include if STATS is defined in "Common.h"
+#ifdef STATS
+
+
+#include <Arduino.h>
+#include "Stats.h"
+
+
+// *************************************************************************************
+// Stats class
+// *************************************************************************************
+// Fixed-bucket timing histograms for the main loop, command parsing, actuator
+//   writes and display redraws. Recording is a handful of compares, so it can
+//   stay enabled in normal operation (micros() has a resolution of 4 us).
+////////////////////////////
+// add a measured duration to the histogram of channel
+void Stats::Record(uint8_t channel, unsigned long duration_us)
+{
+  uint8_t b = 0;
+  unsigned long limit = STATS_FIRST_US;
+
+  if (channel >= StatNumChannels) return;
+  while (b < STATS_BUCKETS-1 && duration_us >= limit) {
+    b++;
+    limit <<= STATS_BUCKET_SHIFT;
+  }
+  if (bucket[channel][b] < 0xFFFF) bucket[channel][b]++;
+  count[channel]++;
+  if (duration_us > max_us[channel]) max_us[channel] = duration_us;
+}
+
+////////////////////////////
+// reset all histograms
+void Stats::Clear(void)
+{
+  memset(bucket, 0, sizeof(bucket));
+  memset(count, 0, sizeof(count));
+  memset(max_us, 0, sizeof(max_us));
+}
+
+#endif // STATS
@@ -0,0 +1,38 @@
+#include "Common.h"
+// only include if STATS is defined in "Common.h"
+#ifdef STATS
+
+
+#ifndef STATS_H
+#define STATS_H
+
+// histogram buckets: bucket 0 is below STATS_FIRST_US, every further bucket is
+//   STATS_BUCKET_FACTOR times wider, the last one takes everything above
+//   (16, 64, 256, 1024, 4096, 16384, 65536 us)
+#define STATS_BUCKETS       8
+#define STATS_FIRST_US      16
+#define STATS_BUCKET_SHIFT  2 // factor 4 between bucket limits
+
+// what is timed
+typedef enum {
+  StatLoop = 0,   // period of the main loop
+  StatParse,      // serial command: complete line (or frame) to the end of its handler
+  StatActuator,   // batch write of the shutter values to the shield
+  StatDisplay,    // display redraw
+  StatNumChannels
+} StatChannel;
+
+class Stats
+{
+public:
+  static inline uint16_t bucket[StatNumChannels][STATS_BUCKETS]; // saturate at 65535
+  static inline uint32_t count[StatNumChannels];
+  static inline unsigned long max_us[StatNumChannels];
+
+  static void Record(uint8_t channel, unsigned long duration_us);
+  static void Clear(void);
+};
+
+#endif // STATS_H
+
+#endif // STATS
@@ -94,11 +94,15 @@ TFT::Begin()
 // Set the members
 TFT::SetNumDevs(int8_t numShutters)
 {
-  numRows = numShutters;
+  numDevs = numShutters;
+  if (firstDev >= numDevs) firstDev = 0;
+  numRows = (numDevs - firstDev > TFT_MAXROWS) ? TFT_MAXROWS : numDevs - firstDev;
 }
+// devices not on the current page are ignored
 TFT::SetDevText(int8_t dev, char *label)
 {
-  tftRowArr[dev]->textElem->SetText(label);
+  if (dev < firstDev || dev >= firstDev+numRows) return;
+  tftRowArr[dev-firstDev]->textElem->SetText(label);
 }
 
 ////////////////////////////
@@ -108,7 +112,7 @@ TFT::RefreshDisplay()
   _tftDev.fillScreen(ILI9341_BLACK);
   for (int8_t z=0; z<numRows; z++)
   {
-    RefreshDev(z);
+    RefreshDev(firstDev+z);
   }
 }
 
@@ -116,24 +120,30 @@ TFT::RefreshDisplay()
 // Refresh only one dev
 TFT::RefreshDev(int8_t dev)
 {
-  tftRowArr[dev]->openBut->Draw();
-  tftRowArr[dev]->textElem->Draw();
-  tftRowArr[dev]->closeBut->Draw();
+  if (dev < firstDev || dev >= firstDev+numRows) return;
+  TFTRow *row = tftRowArr[dev-firstDev];
+  row->openBut->Draw();
+  row->textElem->Draw();
+  row->closeBut->Draw();
 }
 
 ////////////////////////////
 // Set one line to on (1), off (0), or undefined (-1)
-TFT::ChangeDevState(int8_t row, int8_t state)
+TFT::ChangeDevState(int8_t dev, int8_t state)
 {
-  tftRowArr[row]->SetState(state);
-  tftRowArr[row]->openBut->Draw();
-  tftRowArr[row]->closeBut->Draw();
+  if (dev < firstDev || dev >= firstDev+numRows) return;
+  TFTRow *row = tftRowArr[dev-firstDev];
+  row->SetState(state);
+  row->openBut->Draw();
+  row->closeBut->Draw();
 }
 
 ////////////////////////////
 // Check for input
-// return 1 if it was a valid request
+// return 1 if it was a valid request, 2 if the page changed
 // returns the device that requests the changed state by reference
+// With more devices than rows, a touch outside the buttons (label, empty row) shows
+//   the next page
 int8_t TFT::CheckInput(int8_t *device, int8_t *state)
 {
   unsigned long currentTime = millis();
@@ -161,20 +171,23 @@ int8_t TFT::CheckInput(int8_t *device, int8_t *state)
           GetTouchCoordinates(&x, &y);
           int16_t height = _tftDev.height();
           int8_t row = (int8_t) (y / (height/TFT_MAXROWS)); 
-          if (row>=0 && row < numRows)
-            *device = row;
-          else {
-#if SERIAL_DEBUG>0
-            Serial.println(F("Invalid touch row."));
-#endif
-            return 0;
-          }
-          if (tftRowArr[*device]->HasRequestedChange(x, y, state)) {
+          if (row>=0 && row < numRows && tftRowArr[row]->HasRequestedChange(x, y, state)) {
+            *device = firstDev+row;
 #if SERIAL_DEBUG>0
             Serial.print("Device "); Serial.print(*device); Serial.print(" requested state "); Serial.println(*state);
 #endif
             return 1;
           }
+          if (numDevs > TFT_MAXROWS) {
+            firstDev += TFT_MAXROWS;
+            if (firstDev >= numDevs) firstDev = 0;
+            SetNumDevs(numDevs);
+            return 2;
+          }
+#if SERIAL_DEBUG>0
+          Serial.println(F("Invalid touch row."));
+#endif
+          return 0;
         }
       }
     }
@@ -379,7 +392,7 @@ int8_t TFTRow::SetState(int8_t devState)
   } else if (devState==0) { // close 
     openBut->SetInactive();
     closeBut->SetActive();
-    } else if (devState==-1) { // idle 
+    } else { // idle, manual position or unknown
     openBut->SetInactive();
     closeBut->SetInactive();
   }
@@ -59,7 +59,9 @@ class TFT
 {
 private:
   TFTRow **tftRowArr;
-  int8_t numRows = 0;
+  int8_t numDevs = 0;
+  int8_t firstDev = 0; // device in the top row, the rows show a page of TFT_MAXROWS devices
+  int8_t numRows = 0;  // rows in use on this page
   unsigned long lastTouchTime = 0;
   unsigned int dispTurnoffInterval_s;
   int8_t isDisplayOff = 0;
@@ -76,6 +78,7 @@ public:
   RefreshDisplay();
   RefreshDev(int8_t dev);
   ChangeDevState(int8_t dev, int8_t state);
+  // returns 1 for a state request, 2 if the page changed (set the texts and states again)
   int8_t CheckInput(int8_t *device, int8_t *state);
 };
 
@@ -38,7 +38,9 @@ static int _status;
 int main (int argc, char *argv[])
 {
 	char buffer[100];
-	char adrStr[100]; 
+	char adrStr[ARD_ADDRESS_SIZE]; 
+	ARD_ControllerInfo found[1];
+	int numFound;
 	
 	if (InitCVIRTE (0, argv, 0) == 0)
 		return -1;	/* out of memory */
@@ -46,9 +48,17 @@ int main (int argc, char *argv[])
 		return -1;
 	DisplayPanel (_mainPanel);
 
-	// ask for instrument address
-	PromptPopup ("Arduino Interface", "COM address", buffer, 99);
-	sprintf(adrStr, "ASRL%s::INSTR",buffer);
+	// look for a controller, ask for the instrument address if there is none
+	newTextLine (_mainPanel, MAIN_PAN_STATUS_BOX, "Looking for Arduino ... ");
+	if (ARD_ShutterDiscover(NULL, 0, NULL, found, 1, &numFound)==0 && numFound>0) {
+		strcpy(adrStr, found[0].address);
+		appendToTextLine (_mainPanel, MAIN_PAN_STATUS_BOX, adrStr);
+	}
+	else {
+		appendToTextLine (_mainPanel, MAIN_PAN_STATUS_BOX, "none found.");
+		PromptPopup ("Arduino Interface", "COM address", buffer, 99);
+		sprintf(adrStr, "ASRL%s::INSTR",buffer);
+	}
 	
 	// opening connection to Arduino
 	newTextLine (_mainPanel, MAIN_PAN_STATUS_BOX, "Opening connection to Arduino ... ");
@@ -0,0 +1,178 @@
+// *****************************************************************************************
+//
+// Benchmark of the pipelined batches (ARD_Batch*) against one round-trip per command
+//
+//   ./ardbatch_bench <address> [rounds]
+//
+// Sets up BENCH_DEVICES shutters (the parameters of the controller are overwritten), then
+//   times per round: reading state, label and transit delay of every device BENCH_READS
+//   times, and opening and closing every device; each sequentially and as one batch. The
+//   read batch is longer than the 63-byte window of ARD_BatchCommit, so it also checks
+//   that the window keeps the receive buffer of the controller from overrunning (the
+//   host simulation counts dropped bytes, see "Host Sim/batch_bench.py"). Works with a
+//   real controller too.
+// Returns 0 if all commands succeeded and all replies were read back as set up.
+//
+// *****************************************************************************************
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ArdShutter.h"
+
+#define BENCH_DEVICES 4
+#define BENCH_READS 5 // 5 x 4 devices x 3 commands x 5 bytes: 300 bytes, overruns without the batch window
+#define BENCH_READCMDS (BENCH_READS*BENCH_DEVICES)
+
+
+// *****************************************************************************************
+// Internal functions
+// *****************************************************************************************
+static double now_ms(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1e3 + t.tv_nsec/1e6;
+}
+
+////////////////////////////////////////////////////////
+// Check a read back against the setup, returns -1 if it differs
+////////////////////////////////////////////////////////
+static int checkRead(int dev, int delay, const char *label)
+{
+	char expected[16];
+
+	snprintf(expected, sizeof(expected), "Bench%d", dev);
+	if (delay != dev || strcmp(label, expected)) {
+		printf("FAIL: device %d read back as %s, %d ms\n", dev, label, delay);
+		return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////
+// One round of reads, one command at a time / as a batch
+////////////////////////////////////////////////////////
+static int readSequential(ARD_Handle h)
+{
+	int z, dev, state, delay;
+	char label[256];
+
+	for (z=0; z<BENCH_READCMDS; z++) {
+		dev = z % BENCH_DEVICES;
+		if (ARDH_ShutterGetState(h, dev, &state)) return -1;
+		if (ARDH_ShutterGetDeviceLabel(h, dev, label)) return -1;
+		if (ARDH_ShutterGetTransitDelay(h, dev, &delay)) return -1;
+		if (checkRead(dev, delay, label)) return -1;
+	}
+	return 0;
+}
+
+static int readBatch(ARD_Handle h)
+{
+	ARD_Batch b;
+	int z, state[BENCH_READCMDS], delay[BENCH_READCMDS];
+	char label[BENCH_READCMDS][256];
+
+	if (ARDH_BatchBegin(h, &b)) return -1;
+	for (z=0; z<BENCH_READCMDS; z++) {
+		if (ARD_BatchGetState(b, z % BENCH_DEVICES, &state[z]) ||
+				ARD_BatchGetDeviceLabel(b, z % BENCH_DEVICES, label[z]) ||
+				ARD_BatchGetTransitDelay(b, z % BENCH_DEVICES, &delay[z])) {
+			ARD_BatchFree(b);
+			return -1;
+		}
+	}
+	if (ARD_BatchCommit(b)) return -1;
+	for (z=0; z<BENCH_READCMDS; z++)
+		if (checkRead(z % BENCH_DEVICES, delay[z], label[z])) return -1;
+	return 0;
+}
+
+////////////////////////////////////////////////////////
+// One round of state changes (open, then close every device)
+////////////////////////////////////////////////////////
+static int switchSequential(ARD_Handle h)
+{
+	int dev, state;
+
+	for (state=1; state>=0; state--)
+		for (dev=0; dev<BENCH_DEVICES; dev++)
+			if (ARDH_ShutterSetState(h, dev, state)) return -1;
+	return 0;
+}
+
+static int switchBatch(ARD_Handle h)
+{
+	ARD_Batch b;
+	int dev, state;
+
+	if (ARDH_BatchBegin(h, &b)) return -1;
+	for (state=1; state>=0; state--) {
+		for (dev=0; dev<BENCH_DEVICES; dev++) {
+			if (ARD_BatchSetState(b, dev, state)) {
+				ARD_BatchFree(b);
+				return -1;
+			}
+		}
+	}
+	return ARD_BatchCommit(b);
+}
+
+////////////////////////////////////////////////////////
+// Time rounds of one workload, returns ms per round or -1
+////////////////////////////////////////////////////////
+static double timeRounds(ARD_Handle h, int (*round)(ARD_Handle), int rounds)
+{
+	double t0;
+	int z;
+
+	t0 = now_ms();
+	for (z=0; z<rounds; z++)
+		if (round(h)) return -1;
+	return (now_ms() - t0) / rounds;
+}
+
+
+// *****************************************************************************************
+// Main
+// *****************************************************************************************
+int main(int argc, char **argv)
+{
+	ARD_Handle h;
+	int rounds, dev;
+	char label[16];
+	double seqRead, batchRead, seqSwitch, batchSwitch;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <address> [rounds]\n", argv[0]);
+		return 1;
+	}
+	rounds = (argc > 2) ? atoi(argv[2]) : 20;
+	if (rounds < 1) rounds = 1;
+	if (ARDH_Open(argv[1], &h)) return 1;
+
+	ARDH_ShutterClearDev(h);
+	for (dev=0; dev<BENCH_DEVICES; dev++) {
+		snprintf(label, sizeof(label), "Bench%d", dev);
+		if (ARDH_ShutterSetParameters(h, -1, dev, -1, 300, 200, dev, label)) goto fail;
+	}
+
+	seqRead = timeRounds(h, readSequential, rounds);
+	batchRead = timeRounds(h, readBatch, rounds);
+	seqSwitch = timeRounds(h, switchSequential, rounds);
+	batchSwitch = timeRounds(h, switchBatch, rounds);
+	if (seqRead < 0 || batchRead < 0 || seqSwitch < 0 || batchSwitch < 0) goto fail;
+
+	printf("C      read %d devices x %d: %6.1f ms sequential, %6.1f ms batch | "
+				 "switch %d devices: %6.1f ms sequential, %6.1f ms batch\n",
+				 BENCH_DEVICES, BENCH_READS, seqRead, batchRead, BENCH_DEVICES, seqSwitch, batchSwitch);
+	ARDH_Close(h);
+	return 0;
+
+fail:
+	ARDH_Close(h);
+	return 1;
+}
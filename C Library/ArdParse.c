@@ -0,0 +1,216 @@
+// *****************************************************************************************
+//
+// Parser for the response lines of the Arduino Shutter
+//
+// *****************************************************************************************
+#include <limits.h>
+#include "ArdParse.h"
+
+
+// *****************************************************************************************
+// Types
+// *****************************************************************************************
+// read position in a line
+typedef struct {
+	const char *p;
+	const char *end;
+} Cursor;
+
+
+// *****************************************************************************************
+// Internal functions
+// *****************************************************************************************
+////////////////////////////////////////////////////////
+// Set up a cursor on a line without its CR/LF
+////////////////////////////////////////////////////////
+static void cursorInit(Cursor *c, const char *line, unsigned int len)
+{
+	c->p = line;
+	c->end = line + ardParseLineLength(line, len);
+}
+
+////////////////////////////////////////////////////////
+// Consume the literal text lit (case sensitive)
+////////////////////////////////////////////////////////
+static int expectText(Cursor *c, const char *lit)
+{
+	while (*lit) {
+		if (c->p == c->end || *c->p != *lit) return -1;
+		c->p++;
+		lit++;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////
+// Consume a decimal integer with optional sign that fits an int
+////////////////////////////////////////////////////////
+static int expectInt(Cursor *c, int *value)
+{
+	int neg = 0;
+	long long v = 0;
+	const char *start;
+
+	if (c->p < c->end && (*c->p == '-' || *c->p == '+')) neg = (*c->p++ == '-');
+	start = c->p;
+	while (c->p < c->end && *c->p >= '0' && *c->p <= '9') {
+		v = v*10 + (*c->p++ - '0');
+		if (v > (long long)INT_MAX + 1) return -1;
+	}
+	if (c->p == start) return -1;
+	if (neg) v = -v;
+	if (v > INT_MAX || v < INT_MIN) return -1;
+	*value = (int)v;
+	return 0;
+}
+
+////////////////////////////////////////////////////////
+// Consume an unsigned decimal number that fits an unsigned long (32 bit counters)
+////////////////////////////////////////////////////////
+static int expectULong(Cursor *c, unsigned long *value)
+{
+	unsigned long long v = 0;
+	const char *start = c->p;
+
+	while (c->p < c->end && *c->p >= '0' && *c->p <= '9') {
+		v = v*10 + (*c->p++ - '0');
+		if (v > 0xFFFFFFFFULL) return -1;
+	}
+	if (c->p == start) return -1;
+	*value = (unsigned long)v;
+	return 0;
+}
+
+////////////////////////////////////////////////////////
+// Consume the device number and check it
+////////////////////////////////////////////////////////
+static int expectDevice(Cursor *c, int device)
+{
+	int dev;
+
+	if (expectInt(c, &dev) || dev != device) return -1;
+	return 0;
+}
+
+////////////////////////////////////////////////////////
+// Copy the next word (up to a blank or the end of the line), at least one char
+////////////////////////////////////////////////////////
+static int expectWord(Cursor *c, char *str, unsigned int size)
+{
+	unsigned int n = 0;
+
+	if (size == 0) return -1;
+	while (c->p < c->end && *c->p != ' ' && *c->p != '\t') {
+		if (n < size-1) str[n++] = *c->p;
+		c->p++;
+	}
+	str[n] = '\0';
+	return (n > 0) ? 0 : -1;
+}
+
+
+// *****************************************************************************************
+// Exported functions
+// *****************************************************************************************
+unsigned int ardParseLineLength(const char *line, unsigned int len)
+{
+	while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) len--;
+	return len;
+}
+
+int ardParseIsOK(const char *line, unsigned int len)
+{
+	len = ardParseLineLength(line, len);
+	return (len == 2 && line[0] == 'O' && line[1] == 'K') ? 0 : -1;
+}
+
+int ardParseIsError(const char *line, unsigned int len)
+{
+	static const char prefix[] = "error:";
+	unsigned int z;
+
+	if (len < sizeof(prefix)-1) return -1;
+	for (z=0; z<sizeof(prefix)-1; z++)
+		if ((line[z] | 0x20) != prefix[z]) return -1; // ASCII lower case (':' is unchanged)
+	return 0;
+}
+
+int ardParseDeviceInt(const char *line, unsigned int len, const char *tag, int device, int *value)
+{
+	Cursor c;
+	int v;
+
+	cursorInit(&c, line, len);
+	if (expectText(&c, tag) || expectDevice(&c, device) || expectText(&c, "=")
+			|| expectInt(&c, &v) || c.p != c.end)
+		return -1;
+	*value = v;
+	return 0;
+}
+
+int ardParseDeviceString(const char *line, unsigned int len, const char *tag, int device,
+													char *str, unsigned int size)
+{
+	Cursor c;
+
+	cursorInit(&c, line, len);
+	if (expectText(&c, tag) || expectDevice(&c, device) || expectText(&c, "="))
+		return -1;
+	return expectWord(&c, str, size);
+}
+
+int ardParseEvent(const char *line, unsigned int len, int *device, int *state, int *source,
+									unsigned long *time_ms)
+{
+	Cursor c;
+	int dev, st, src;
+	unsigned long t;
+
+	cursorInit(&c, line, len);
+	if (expectText(&c, "!EV") || expectInt(&c, &dev) || expectText(&c, ",")
+			|| expectInt(&c, &st) || expectText(&c, ",") || expectInt(&c, &src)
+			|| expectText(&c, ",") || expectULong(&c, &t) || c.p != c.end)
+		return -1;
+	*device = dev;
+	*state = st;
+	*source = src;
+	*time_ms = t;
+	return 0;
+}
+
+int ardParseParameters(const char *line, unsigned int len, int device, int *values,
+												char *label, unsigned int size)
+{
+	Cursor c;
+	int z;
+
+	cursorInit(&c, line, len);
+	if (expectText(&c, "PR") || expectDevice(&c, device)) return -1;
+	for (z=0; z<5; z++)
+		if (expectText(&c, ",") || expectInt(&c, &values[z])) return -1;
+	if (expectText(&c, ",")) return -1;
+	return expectWord(&c, label, size);
+}
+
+int ardParsePreset(const char *line, unsigned int len, int preset, char *name, unsigned int size,
+										int *numDevices, int *active)
+{
+	Cursor c;
+	unsigned int n = 0;
+	int num, act;
+
+	if (size == 0) return -1;
+	cursorInit(&c, line, len);
+	if (expectText(&c, "PS") || expectDevice(&c, preset) || expectText(&c, "=")) return -1;
+	while (c.p < c.end && *c.p != ',') {
+		if (n < size-1) name[n++] = *c.p;
+		c.p++;
+	}
+	name[n] = '\0';
+	if (expectText(&c, ",") || expectInt(&c, &num) || expectText(&c, ",")
+			|| expectInt(&c, &act) || c.p != c.end)
+		return -1;
+	*numDevices = num;
+	*active = act;
+	return 0;
+}
@@ -0,0 +1,42 @@
+// *****************************************************************************************
+//
+// Parser for the response lines of the Arduino Shutter
+// Single pass over the line, no sscanf, no copies except the requested string field.
+//   A line is given by pointer and length (it need not be null terminated); a trailing
+//   CR/LF is ignored. The functions return 0 if the line matches, -1 otherwise.
+//
+// *****************************************************************************************
+#ifndef ARD_PARSE_H
+#define ARD_PARSE_H
+
+// Length of the line without the trailing CR/LF
+unsigned int ardParseLineLength(const char *line, unsigned int len);
+
+// "OK"
+int ardParseIsOK(const char *line, unsigned int len);
+
+// "Error: ..." (any case)
+int ardParseIsError(const char *line, unsigned int len);
+
+// "<tag><device>=<int>", e.g. "ST0=1" (tag: two letters, device must match)
+int ardParseDeviceInt(const char *line, unsigned int len, const char *tag, int device, int *value);
+
+// "<tag><device>=<string>", e.g. "DL0=Laser1"; str receives at most size-1 chars,
+//   the string ends at the first blank like with scanf("%s")
+int ardParseDeviceString(const char *line, unsigned int len, const char *tag, int device,
+													char *str, unsigned int size);
+
+// "!EV<device>,<state>,<source>,<time_ms>", an unsolicited state-change event
+int ardParseEvent(const char *line, unsigned int len, int *device, int *state, int *source,
+									unsigned long *time_ms);
+
+// "PR<device>,<shieldChannel>,<digIn>,<openPos>,<closedPos>,<transitDelay>,<label>"
+//   values: receives the five numbers
+int ardParseParameters(const char *line, unsigned int len, int device, int *values,
+												char *label, unsigned int size);
+
+// "PS<preset>=<name>,<numDevices>,<active>", the name is empty for an empty preset
+int ardParsePreset(const char *line, unsigned int len, int preset, char *name, unsigned int size,
+										int *numDevices, int *active);
+
+#endif // ARD_PARSE_H
@@ -0,0 +1,233 @@
+// *****************************************************************************************
+//
+// Benchmark of the response parser (ArdParse.c) against the sscanf formats it replaced
+//
+//   ./ardparse_bench [corpus [passes]]
+//
+// The corpus holds response lines recorded from the controller, one per line ('#' starts
+//   a comment line). Every line is parsed by the ArdParse function for its prefix and by
+//   the old sscanf format; both must accept it and give the same values. Then both are
+//   timed over the corpus.
+// Returns 0 if all lines were parsed alike.
+//
+// *****************************************************************************************
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "ArdParse.h"
+
+#define MAXLINES 4096
+#define LINESIZE 256
+#define LABELSIZE 64
+
+
+// *****************************************************************************************
+// Types
+// *****************************************************************************************
+typedef enum {
+	LINE_OK,
+	LINE_ERROR,
+	LINE_EVENT,      // !EVn,...
+	LINE_PARAMETERS, // PRn,...
+	LINE_PRESET,     // PSn=...
+	LINE_STRING,     // DLn=...
+	LINE_INT         // XXn=...
+} LineType;
+
+typedef struct {
+	char text[LINESIZE]; // with the CR/LF sent by the controller
+	unsigned int len;
+	LineType type;
+	char tag[3];
+	int device;
+} Line;
+
+// the values read from a line
+typedef struct {
+	int values[6];
+	unsigned long time_ms;
+	char str[LABELSIZE];
+} Result;
+
+static Line _lines[MAXLINES];
+static int _numLines;
+
+
+// *****************************************************************************************
+// Internal functions
+// *****************************************************************************************
+////////////////////////////////////////////////////////
+// Read the corpus, returns -1 on error
+////////////////////////////////////////////////////////
+static int readCorpus(const char *path)
+{
+	FILE *f;
+	char buf[LINESIZE];
+	Line *l;
+	size_t n;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	while (fgets(buf, sizeof(buf)-2, f)) {
+		n = strcspn(buf, "\r\n");
+		if (n == 0 || buf[0] == '#') continue;
+		if (_numLines == MAXLINES) break;
+		l = &_lines[_numLines++];
+		memcpy(l->text, buf, n);
+		memcpy(l->text+n, "\r\n", 3);
+		l->len = (unsigned int)n+2;
+		l->tag[0] = buf[0];
+		l->tag[1] = buf[1];
+		l->tag[2] = '\0';
+		l->device = atoi(buf+2);
+		if (strncmp(buf, "OK", 2) == 0) l->type = LINE_OK;
+		else if (strncasecmp(buf, "error:", 6) == 0) l->type = LINE_ERROR;
+		else if (strncmp(buf, "!EV", 3) == 0) l->type = LINE_EVENT;
+		else if (strncmp(buf, "PR", 2) == 0) l->type = LINE_PARAMETERS;
+		else if (strncmp(buf, "PS", 2) == 0) l->type = LINE_PRESET;
+		else if (strncmp(buf, "DL", 2) == 0) l->type = LINE_STRING;
+		else l->type = LINE_INT;
+	}
+	fclose(f);
+	return 0;
+}
+
+////////////////////////////////////////////////////////
+// Parse a line with ArdParse, returns 0 if it matches
+////////////////////////////////////////////////////////
+static int parseNew(const Line *l, Result *r)
+{
+	switch (l->type) {
+		case LINE_OK:
+			return ardParseIsOK(l->text, l->len);
+		case LINE_ERROR:
+			return ardParseIsError(l->text, l->len);
+		case LINE_EVENT:
+			return ardParseEvent(l->text, l->len, &r->values[0], &r->values[1], &r->values[2], &r->time_ms);
+		case LINE_PARAMETERS:
+			return ardParseParameters(l->text, l->len, l->device, &r->values[1], r->str, sizeof(r->str));
+		case LINE_PRESET:
+			return ardParsePreset(l->text, l->len, l->device, r->str, sizeof(r->str), &r->values[1], &r->values[2]);
+		case LINE_STRING:
+			return ardParseDeviceString(l->text, l->len, l->tag, l->device, r->str, sizeof(r->str));
+		case LINE_INT:
+			return ardParseDeviceInt(l->text, l->len, l->tag, l->device, &r->values[1]);
+	}
+	return -1;
+}
+
+////////////////////////////////////////////////////////
+// Parse a line the way the library did before ArdParse, returns 0 if it matches
+////////////////////////////////////////////////////////
+static int parseOld(const Line *l, Result *r)
+{
+	char tag[3];
+	int device;
+
+	switch (l->type) {
+		case LINE_OK:
+			return strncmp(l->text, "OK", 2) ? -1 : 0;
+		case LINE_ERROR:
+			return strncasecmp(l->text, "error:", 6) ? -1 : 0;
+		case LINE_EVENT:
+			return sscanf(l->text, "!EV%d,%d,%d,%lu", &r->values[0], &r->values[1], &r->values[2],
+										&r->time_ms) == 4 ? 0 : -1;
+		case LINE_PARAMETERS:
+			if (sscanf(l->text, "PR%d,%d,%d,%d,%d,%d,%63s", &device, &r->values[1], &r->values[2],
+								 &r->values[3], &r->values[4], &r->values[5], r->str) != 7) return -1;
+			return device == l->device ? 0 : -1;
+		case LINE_PRESET:
+			if (sscanf(l->text, "PS%d=,%d,%d", &device, &r->values[1], &r->values[2]) == 3) // empty preset
+				return device == l->device ? 0 : -1;
+			if (sscanf(l->text, "PS%d=%63[^,],%d,%d", &device, r->str, &r->values[1], &r->values[2]) != 4) return -1;
+			return device == l->device ? 0 : -1;
+		case LINE_STRING:
+			if (sscanf(l->text, "%2s%d=%63s", tag, &device, r->str) != 3) return -1;
+			return (strcmp(tag, l->tag) == 0 && device == l->device) ? 0 : -1;
+		case LINE_INT:
+			if (sscanf(l->text, "%2s%d=%d", tag, &device, &r->values[1]) != 3) return -1;
+			return (strcmp(tag, l->tag) == 0 && device == l->device) ? 0 : -1;
+	}
+	return -1;
+}
+
+////////////////////////////////////////////////////////
+static int sameResult(const Result *a, const Result *b)
+{
+	return memcmp(a->values, b->values, sizeof(a->values)) == 0 && a->time_ms == b->time_ms &&
+				 strcmp(a->str, b->str) == 0;
+}
+
+////////////////////////////////////////////////////////
+// Check that both parsers accept every line with the same values
+////////////////////////////////////////////////////////
+static int check(void)
+{
+	Result rNew, rOld;
+	int z, failed = 0;
+
+	for (z=0; z<_numLines; z++) {
+		memset(&rNew, 0, sizeof(rNew));
+		memset(&rOld, 0, sizeof(rOld));
+		if (parseNew(&_lines[z], &rNew)) {
+			printf("FAIL: ArdParse rejected \"%.*s\"\n", (int)_lines[z].len-2, _lines[z].text);
+			failed = 1;
+		} else if (parseOld(&_lines[z], &rOld)) {
+			printf("FAIL: sscanf rejected \"%.*s\"\n", (int)_lines[z].len-2, _lines[z].text);
+			failed = 1;
+		} else if (!sameResult(&rNew, &rOld)) {
+			printf("FAIL: different values for \"%.*s\"\n", (int)_lines[z].len-2, _lines[z].text);
+			failed = 1;
+		}
+	}
+	return failed;
+}
+
+////////////////////////////////////////////////////////
+// Time one parser over the corpus, returns ns per line
+////////////////////////////////////////////////////////
+static double bench(int (*parse)(const Line *, Result *), long passes)
+{
+	struct timespec t0, t1;
+	Result r;
+	volatile int sink = 0;
+	long pass;
+	int z;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (pass=0; pass<passes; pass++)
+		for (z=0; z<_numLines; z++)
+			sink += parse(&_lines[z], &r);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	(void)sink;
+	return ((t1.tv_sec - t0.tv_sec)*1e9 + (t1.tv_nsec - t0.tv_nsec)) / ((double)passes*_numLines);
+}
+
+
+// *****************************************************************************************
+// Main
+// *****************************************************************************************
+int main(int argc, char **argv)
+{
+	const char *corpus = (argc > 1) ? argv[1] : "ArdParseCorpus.txt";
+	long passes = (argc > 2) ? atol(argv[2]) : 20000;
+	double nsNew, nsOld;
+
+	if (readCorpus(corpus)) return 1;
+	if (_numLines == 0 || passes < 1) {
+		printf("No lines in %s\n", corpus);
+		return 1;
+	}
+	if (check()) return 1;
+	nsNew = bench(parseNew, passes);
+	nsOld = bench(parseOld, passes);
+	printf("bench: %d lines x %ld passes, ArdParse %.1f ns/line, sscanf %.1f ns/line (%.1fx)\n",
+				 _numLines, passes, nsNew, nsOld, nsOld/nsNew);
+	return 0;
+}
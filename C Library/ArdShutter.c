@@ -4,9 +4,21 @@
 //
 // *****************************************************************************************
 
+#ifdef _CVI_
 #include <ansi_c.h>
-#include <visa.h>
+#else
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <strings.h>
+#define strnicmp strncasecmp
+#endif
+#endif
 #include "ArdShutter.h"
+#include "ArdTransport.h"
+#include "ArdParse.h"
 
 
 // *****************************************************************************************
@@ -15,25 +27,177 @@
 #define ARD_SHUTTER_RESPONSE	"Arduino Uno Shutter" // beginning of the response string
 #define SERIAL_BAUDRATE	9600
 #define SERIAL_TERMCHAR	0xA
+#define SERIAL_TIMEOUT_MS	1000
+#define CMD_MAXLENGTH	128 // longest command sent by the library, with the term char
+
+// library status codes (the transports use 0 and their own error codes)
+#define ARD_STATUS_TOOLONG	(-1001) // command does not fit CMD_MAXLENGTH
+#define ARD_STATUS_BADREPLY	(-1002) // response does not match the expected format
+
+// binary frame protocol (see BinFrame.h in the Arduino code)
+#define BINFRAME_SIZE				7
+#define BINFRAME_SYNC_REQ		0xA5
+#define BINFRAME_SYNC_RESP	0x5A
+#define BINCMD_NOP					0x00
+#define BINCMD_SST					0x01
+#define BINCMD_GST					0x02
+#define BINCMD_SSP					0x03
+#define BINCMD_GND					0x04
+#define BINCMD_SSM					0x05
+#define BINCMD_ASCII				0x7F
+#define BINSTAT_OK					0x00
+#define BINFRAME_SST_SIZE		3 // compact set-state frame, answered by one ack byte
+#define BINFRAME_SYNC_SST		0xA6
+#define BINACK_OK						0x06
+
+// client-side cache: sized by the GND reply, devices beyond it are read from the controller
+#define CACHE_MASKBITS	64 // devices in an ARD_DeviceMask
+
+// state-change events
+#define EVENT_POLL_MS	10 // the background reader looks for events this often
+
+// background EEPROM save
+#define SAVE_POLL_MS	20
+#define SAVE_TIMEOUT_MS	3000 // a save of all shutters takes about 0.3 s
+
+// pipelined requests
+#define BATCH_WINDOW	63 // unanswered bytes on the line, fits the 64-byte receive buffer of the Uno
+
+// *****************************************************************************************
+// Types
+// *****************************************************************************************
+// mutex that serializes the calls on one handle (VISA locks are per session, not per thread)
+#ifdef _WIN32
+#include <windows.h>
+typedef CRITICAL_SECTION ArdMutex;
+#define mutexInit(m)		InitializeCriticalSection(m)
+#define mutexDestroy(m)	DeleteCriticalSection(m)
+#define mutexLock(m)		EnterCriticalSection(m)
+#define mutexUnlock(m)	LeaveCriticalSection(m)
+typedef HANDLE ArdThread;
+#define threadSleep(ms)	Sleep(ms)
+#else
+#include <pthread.h>
+typedef pthread_mutex_t ArdMutex;
+#define mutexInit(m)		pthread_mutex_init(m, NULL)
+#define mutexDestroy(m)	pthread_mutex_destroy(m)
+#define mutexLock(m)		pthread_mutex_lock(m)
+#define mutexUnlock(m)	pthread_mutex_unlock(m)
+#include <unistd.h>
+typedef pthread_t ArdThread;
+#define threadSleep(ms)	usleep((ms)*1000)
+#endif
+
+// cached parameters and state of one device
+typedef struct {
+	int valid;			// values and label
+	int values[5];	// shieldChannel, digIn, openPos, closedPos, transitDelay_ms
+	char label[256];
+	int stateValid;
+	int state;
+} CacheEntry;
+
+// one connection to a controller
+struct ARD_ShutterHandle {
+	const ArdTransport *transport;
+	void *conn; // transport state
+	long status;
+	int binaryMode;
+	unsigned char binSeq;
+	ArdMutex mutex;
+	// cache (ARDH_ShutterSetCache)
+	int cacheMode;
+	int cacheNumDevices; // -1->not cached
+	int cacheSize; // entries in cache
+	CacheEntry *cache;
+	// events (ARDH_ShutterSubscribeEvents)
+	ARD_EventCallback eventCallback;
+	void *eventUserData;
+	ArdThread eventThread;
+	int eventThreadRunning;
+	volatile int eventStop;
+};
+
+// expected reply of a batch command
+typedef enum {
+	BatchReplyOK = 0,
+	BatchReplyInt,		// "XXn=value"
+	BatchReplyString	// "XXn=string"
+} BatchReplyType;
+
+typedef struct {
+	char cmd[BATCH_WINDOW+1];
+	unsigned int len;
+	BatchReplyType type;
+	char tag[3];
+	int device;
+	void *result; // int* or char*, depending on type
+	unsigned int resultSize; // BatchReplyString: size of the char buffer
+} BatchEntry;
+
+// commands collected by the ARD_Batch functions
+struct ARD_ShutterBatch {
+	ARD_Handle h;
+	int numCmds;
+	BatchEntry cmds[ARD_BATCH_MAXCMDS];
+};
+
+// one port probed by ARD_ShutterDiscover
+typedef struct {
+	ARD_ControllerInfo info; // info.address: the port
+	const ARD_SerialOptions *options;
+	int found;
+	ArdThread thread;
+	int threadRunning;
+} DiscoverProbe;
+
 
 // *****************************************************************************************
 // Global variables
 // *****************************************************************************************
-static ViSession _resManager = 0;
-static ViSession _io = 0;
-static ViStatus _status;
+static ARD_Handle _defaultHandle = NULL; // used by the ARD_ functions
 
 
 // *****************************************************************************************
 // Internal function prototypes
 // *****************************************************************************************
 static void reportError(int line, const char* function, char* description );
-static void reportVisaError(int line, const char* function, ViSession instr, ViStatus errStatus );
+static void reportIOError(int line, const char* function, ARD_Handle h, long errStatus );
 static void reportARDError(int line, const char* function, char* description );
-static int getDeviceParameterInt(ViSession io, const char *cmd, int device, int *param);
-static int getDeviceParameterString(ViSession io, const char *cmd, int device, char *str);
-static int setDeviceParameterInt(ViSession io, const char *cmd, int device, int param);
-static int checkErrorResponse(ViSession io);
+static int lockHandle(ARD_Handle h, const char *function);
+static int unlockHandle(ARD_Handle h, const char *function);
+static long ardPrintf(ARD_Handle h, const char *format, ...);
+static long ardRead(ARD_Handle h, unsigned char *buf, unsigned int size, unsigned int *count);
+static long ardQueryf(ARD_Handle h, const char *cmd, const char *format, ...);
+static int getDeviceParameterInt(ARD_Handle h, const char *cmd, int device, int *param);
+static int getDeviceParameterString(ARD_Handle h, const char *cmd, int device, char *str);
+static int setDeviceParameterInt(ARD_Handle h, const char *cmd, int device, int param);
+static int checkErrorResponse(ARD_Handle h);
+static int getDeviceParameters(ARD_Handle h, int device, int *values, char *label);
+static CacheEntry *cacheParameters(ARD_Handle h, int device);
+static void cacheSetState(ARD_Handle h, int device, int state);
+static void cacheInvalidate(ARD_Handle h);
+static int cacheResize(ARD_Handle h, int numDevices);
+static int cacheHolds(ARD_Handle h, int device);
+static int dispatchEvent(ARD_Handle h, const unsigned char *line, unsigned int len);
+static int eventThreadStart(ARD_Handle h);
+static void eventThreadStop(ARD_Handle h);
+static int cacheFill(ARD_Handle h);
+static int binaryTransaction(ARD_Handle h, int cmd, int b0, int b1, int b2, unsigned char *resp);
+static int binarySetState(ARD_Handle h, int device, int state);
+static unsigned char binaryCRC(const unsigned char *data, int len);
+static int sendCommand(ARD_Handle h, const char *function, const char *cmd);
+static int waitForSave(ARD_Handle h, const char *function);
+static int batchAdd(ARD_Batch b, const char *function, BatchReplyType type, const char *tag,
+										int device, void *result, const char *format, ...);
+static int batchParseReply(const BatchEntry *entry, const char *resp, unsigned int len);
+static int batchGetLabel(ARD_Batch batch, const char *function, int device, char *label, unsigned int size);
+static const ArdTransport *transportFor(const char *address);
+static int openController(const ArdTransport *transport, const char *address,
+													const ARD_SerialOptions *options, int quiet, ARD_Handle *handle);
+static void probeController(DiscoverProbe *p);
+static int probeThreadStart(DiscoverProbe *p);
+static void probeThreadJoin(DiscoverProbe *p);
 
 
 // *****************************************************************************************
@@ -41,136 +205,111 @@ static int checkErrorResponse(ViSession io);
 // *****************************************************************************************
 
 ////////////////////////////////////////////////////////
-// Initialization
+// Open a controller
+//   address: device path (native termios transport) or VISA resource name
+//   handle: receives the handle for the ARDH_ functions
 ////////////////////////////////////////////////////////
-int ARD_ShutterInit(const char *address)
+int ARDH_Open(const char *address, ARD_Handle *handle)
 {
-	unsigned char instrResp[256];
-	ViUInt32 charsRead;
-	int isLocked=0;
+	return ARDH_OpenSerial(address, NULL, handle);
+}
 
-	if (_io != 0) {
-		reportError (__LINE__-2, __func__, "Shutter controller already open.");
-		goto fail;
-	}
-	
-	_status = viOpenDefaultRM(&_resManager);
-	if(_status) {
-		reportError (__LINE__-2, __func__, "Could not get access to the VISA resource manager.");
-		goto fail;
-	}
-	
-	_status = viOpen (_resManager, address, VI_NULL, 1000, &_io);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
-		goto fail;
-	}
 
-	_status = viLock (_io, VI_EXCLUSIVE_LOCK, 5000, VI_NULL, VI_NULL);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
-		goto fail;
-	}
-	isLocked=1;
-	
-	viSetAttribute(_io, VI_ATTR_ASRL_BAUD, SERIAL_BAUDRATE);
-	viSetAttribute(_io, VI_ATTR_ASRL_DATA_BITS, 8);
-	viSetAttribute(_io, VI_ATTR_ASRL_STOP_BITS, VI_ASRL_STOP_ONE);
-	viSetAttribute(_io, VI_ATTR_ASRL_PARITY, VI_ASRL_PAR_NONE);
-	viSetAttribute(_io, VI_ATTR_ASRL_FLOW_CNTRL, VI_ASRL_FLOW_NONE);
-	viSetAttribute(_io, VI_ATTR_TERMCHAR, SERIAL_TERMCHAR);
-	viSetAttribute(_io, VI_ATTR_ASRL_END_IN, VI_ASRL_END_TERMCHAR);
-
-	// give Arduino has time to reset (not needed if reset jumper is shorted)
-//	Delay(1.6);	
-	
-	// ask for identification; here I use printf/read because of the spaces in the return string
-	_status = viPrintf(_io, "*IDN?\n");
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
-		goto fail;
-	}
-	_status = viRead (_io, instrResp, 256, &charsRead);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
-		goto fail;
-	}
-	if (charsRead<2) {
-		reportError (__LINE__-6, __func__, "No ID response received.");
-		goto fail;
-	}
-	instrResp[charsRead-2]='\0';	
-//	printf("%s\n", instrResp);
-	if ( strncmp ((char *)instrResp, ARD_SHUTTER_RESPONSE, strlen(ARD_SHUTTER_RESPONSE)) != 0) {
-		reportError (__LINE__-1, __func__, "Device is not a shutter driver.");
-		goto fail;
-	}
-	
-	_status = viUnlock (_io);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
-		goto fail;
-	}
-	
-	return 0;
-	
-fail:
+////////////////////////////////////////////////////////
+// Open a controller with connection options
+//   the transport is picked by the address: paths (/dev/...) use termios,
+//   everything else VISA
+////////////////////////////////////////////////////////
+int ARDH_OpenSerial(const char *address, const ARD_SerialOptions *options, ARD_Handle *handle)
+{
+	const ArdTransport *transport;
 
-	if (_io) {
-		if (isLocked) viUnlock(_io);
-		ARD_Close();
-		_io=0;
+	*handle = NULL;
+	transport = transportFor(address);
+	if (!transport) {
+		reportError (__LINE__-1, __func__, "No transport for this address.");
+		return -1;
 	}
-	return -1;
+	return ARDH_OpenWithTransport(transport, address, options, handle);
 }
 
 
 ////////////////////////////////////////////////////////
-// Close funct_ion
+// Open a controller over the given transport
 ////////////////////////////////////////////////////////
-int ARD_Close(void)
+int ARDH_OpenWithTransport(const ArdTransport *transport, const char *address,
+													 const ARD_SerialOptions *options, ARD_Handle *handle)
 {
-	if (_io) {
-		_status = viClose(_io);
-		if(_status) {
-			reportVisaError (__LINE__-2, __func__, _io, _status);
-			goto fail;
-		}
-		_io = 0; // set handle to zero
-	}
-	
-	if (_resManager) {
-		_status = viClose(_resManager);
-		if(_status) {
-			reportError (__LINE__-2, __func__, "Unable to close resource manager.");
-			goto fail;
+	return openController(transport, address, options, 0, handle);
+}
+
+
+////////////////////////////////////////////////////////
+// Close a controller and free its handle
+////////////////////////////////////////////////////////
+int ARDH_Close(ARD_Handle h)
+{
+	int result = 0;
+
+	if (!h) return 0;
+	if (h->conn && h->eventCallback) ARDH_ShutterUnsubscribeEvents(h);
+	if (h->conn && h->binaryMode) ARDH_ShutterBinaryMode(h, 0); // leave the controller in ASCII mode for the next session
+
+	if (h->conn) {
+		h->status = h->transport->close(h->conn);
+		if(h->status) {
+			reportIOError (__LINE__-2, __func__, h, h->status);
+			result = -1;
 		}
-		_resManager = 0; // set handle to zero
 	}
 
-	return 0;
-fail:
-	return -1;
+	// the handle is gone either way, a failed close cannot be retried
+	mutexDestroy(&h->mutex);
+	free(h->cache);
+	free(h);
+	return result;
 }
 
 ////////////////////////////////////////////////////////
 // Get number of attached device
 ////////////////////////////////////////////////////////
-int ARD_ShutterGetNumDevices(int *numDevices)
+int ARDH_ShutterGetNumDevices(ARD_Handle h, int *numDevices)
 {
-	if (!_io) {
+	int isLocked=0;
+
+	if (!h || !h->conn) {
 		reportError (__LINE__-2, __func__, "Device not open.");
 		goto fail;
 	}
 
-	_status = viQueryf(_io, "GND\n", "ND=%d", numDevices ); // no return error possible
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
-		goto fail;
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+
+	if ((h->cacheMode & ARD_CACHE_PARAMETERS) && h->cacheNumDevices>=0) {
+		*numDevices = h->cacheNumDevices;
+	} else if (h->binaryMode) {
+		unsigned char resp[BINFRAME_SIZE];
+		if (binaryTransaction(h, BINCMD_GND, 0, 0, 0, resp)) {
+			reportError (__LINE__-1, __func__, "Could not get number of devices.");
+			goto fail;
+		}
+		*numDevices = resp[3];
+	} else {
+		h->status = ardQueryf(h, "GND\n", "ND=%d", numDevices ); // no return error possible
+		if(h->status) {
+			reportIOError (__LINE__-2, __func__, h, h->status);
+			goto fail;
+		}
 	}
+	if (h->cacheMode) cacheResize(h, *numDevices); // out of memory: the new devices stay uncached
+	if (h->cacheMode & ARD_CACHE_PARAMETERS) h->cacheNumDevices = *numDevices;
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
 
 	return 0;
 fail:
+	if (isLocked) unlockHandle(h, NULL);
 	return -1;
 }
 
@@ -178,42 +317,40 @@ fail:
 ////////////////////////////////////////////////////////
 // Clear the device parameters
 ////////////////////////////////////////////////////////
-int ARD_ShutterClearDev(void)
+int ARDH_ShutterClearDev(ARD_Handle h)
 {
 	int isLocked=0;
 
-	if (!_io) {
+	if (!h || !h->conn) {
 		reportError (__LINE__-2, __func__, "Device not open.");
 		goto fail;
 	}
 
-		_status = viLock (_io, VI_EXCLUSIVE_LOCK, 5000, VI_NULL, VI_NULL);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
 		goto fail;
 	}
-	isLocked=1;
 
-	_status = viPrintf(_io, "CLR\n");
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
+	cacheInvalidate(h);
+	h->status = ardPrintf(h, "CLR\n");
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
 		goto fail;
 	}
-	if(checkErrorResponse(_io)!=0) {
+	if(checkErrorResponse(h)!=0) {
 		reportError (__LINE__-1, __func__, "ARD error:");
 		goto fail;
 	}
 
-	_status = viUnlock (_io);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
-		goto fail;
-	}
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
 	
 	return 0;
 
 fail:
-	if (isLocked) viUnlock(_io);
+	if (isLocked) unlockHandle(h, NULL);
 	return -1;
 }
 
@@ -223,37 +360,40 @@ fail:
 //   device: the shutter attached to the Arduino
 //   state: 0->Closed, 1->Open
 ////////////////////////////////////////////////////////
-int ARD_ShutterGetState(int device, int *state)
+int ARDH_ShutterGetState(ARD_Handle h, int device, int *state)
 {
 	int isLocked=0;
 
-	if (!_io) {
+	if (!h || !h->conn) {
 		reportError (__LINE__-2, __func__, "Device not open.");
 		goto fail;
 	}
 
-	_status = viLock (_io, VI_EXCLUSIVE_LOCK, 5000, VI_NULL, VI_NULL);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
-		goto fail;
-	}
+	if (lockHandle(h, __func__)) goto fail;
 	isLocked=1;
 
-	if (getDeviceParameterInt(_io, "ST", device, state)) {
+	if ((h->cacheMode & ARD_CACHE_STATES) && cacheHolds(h, device) && h->cache[device].stateValid) {
+		*state = h->cache[device].state;
+	} else if (h->binaryMode) {
+		unsigned char resp[BINFRAME_SIZE];
+		if (binaryTransaction(h, BINCMD_GST, device, 0, 0, resp)) {
+			reportError (__LINE__-1, __func__, "Could not get shutter state.");
+			goto fail;
+		}
+		*state = (signed char)resp[4];
+	} else if (getDeviceParameterInt(h, "ST", device, state)) {
 		reportError (__LINE__-1, __func__, "Could not get shutter state.");
 		goto fail;
 	}
+	cacheSetState(h, device, *state);
 
-	_status = viUnlock (_io);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
-		goto fail;
-	}
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
 	
 	return 0;
 
 fail:
-	if (isLocked) viUnlock(_io);
+	if (isLocked) unlockHandle(h, NULL);
 	return -1;
 }
 
@@ -262,37 +402,41 @@ fail:
 // Get shutter device label
 //   device: the shutter attached to the Arduino
 ////////////////////////////////////////////////////////
-int ARD_ShutterGetDeviceLabel(int device, char *label)
+int ARDH_ShutterGetDeviceLabel(ARD_Handle h, int device, char *label)
 {
 	int isLocked=0;
 
-	if (!_io) {
+	if (!h || !h->conn) {
 		reportError (__LINE__-2, __func__, "Device not open.");
 		goto fail;
 	}
 
-	_status = viLock (_io, VI_EXCLUSIVE_LOCK, 5000, VI_NULL, VI_NULL);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
 		goto fail;
 	}
-	isLocked=1;
 
-	if (getDeviceParameterString(_io, "DL", device, label)) {
+	if ((h->cacheMode & ARD_CACHE_PARAMETERS) && cacheHolds(h, device)) {
+		CacheEntry *entry = cacheParameters(h, device);
+		if (!entry) {
+			reportError (__LINE__-2, __func__, "Could not get shutter label.");
+			goto fail;
+		}
+		strcpy(label, entry->label);
+	} else if (getDeviceParameterString(h, "DL", device, label)) {
 		reportError (__LINE__-1, __func__, "Could not get shutter label.");
 		goto fail;
 	}
 		
-	_status = viUnlock (_io);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
-		goto fail;
-	}
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
 	
 	return 0;
 
 fail:
-	if (isLocked) viUnlock(_io);
+	if (isLocked) unlockHandle(h, NULL);
 	return -1;
 }
 
@@ -302,23 +446,30 @@ fail:
 //   device: the shutter attached to the Arduino
 //   transit time in ms
 ////////////////////////////////////////////////////////
-int ARD_ShutterGetTransitDelay(int device, int *transDelay_ms)
+int ARDH_ShutterGetTransitDelay(ARD_Handle h, int device, int *transDelay_ms)
 {
 	int isLocked=0;
 
-	if (!_io) {
+	if (!h || !h->conn) {
 		reportError (__LINE__-2, __func__, "Device not open.");
 		goto fail;
 	}
 
-	_status = viLock (_io, VI_EXCLUSIVE_LOCK, 5000, VI_NULL, VI_NULL);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
 		goto fail;
 	}
-	isLocked=1;
 
-	if (getDeviceParameterInt(_io, "TD", device, transDelay_ms)) {
+	if ((h->cacheMode & ARD_CACHE_PARAMETERS) && cacheHolds(h, device)) {
+		CacheEntry *entry = cacheParameters(h, device);
+		if (!entry) {
+			reportError (__LINE__-2, __func__, "Could not get shutter transit delay.");
+			goto fail;
+		}
+		*transDelay_ms = entry->values[4];
+	} else if (getDeviceParameterInt(h, "TD", device, transDelay_ms)) {
 		reportError (__LINE__-1, __func__, "Could not get shutter transit delay.");
 		goto fail;
 	}
@@ -327,16 +478,13 @@ int ARD_ShutterGetTransitDelay(int device, int *transDelay_ms)
 		goto fail;
 	}
 
-	_status = viUnlock (_io);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
-		goto fail;
-	}
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
 	
 	return 0;
 
 fail:
-	if (isLocked) viUnlock(_io);
+	if (isLocked) unlockHandle(h, NULL);
 	return -1;
 }
 
@@ -346,20 +494,16 @@ fail:
 //   device: the shutter attached to the Arduino
 //   state: 0->Closed, 1->Open
 ////////////////////////////////////////////////////////
-int ARD_ShutterSetState(int device, int state)
+int ARDH_ShutterSetState(ARD_Handle h, int device, int state)
 {
 	int isLocked=0;
 
-	if (!_io) {
+	if (!h || !h->conn) {
 		reportError (__LINE__-2, __func__, "Device not open.");
 		goto fail;
 	}
 
-	_status = viLock (_io, VI_EXCLUSIVE_LOCK, 5000, VI_NULL, VI_NULL);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
-		goto fail;
-	}
+	if (lockHandle(h, __func__)) goto fail;
 	isLocked=1;
 
 	// set the shutter state
@@ -367,373 +511,2004 @@ int ARD_ShutterSetState(int device, int state)
 		reportError (__LINE__-2, __func__, "Invalid state (0->Closed, 1->Open).");
 		goto fail;
 	}
-	if (setDeviceParameterInt(_io, "ST", device, state)) {
+	if (h->binaryMode) {
+		if (binarySetState(h, device, state)) {
+			reportError (__LINE__-1, __func__, "Could not set shutter state.");
+			goto fail;
+		}
+	} else if (setDeviceParameterInt(h, "ST", device, state)) {
 		reportError (__LINE__-1, __func__, "Could not set shutter state.");
 		goto fail;
 	}
+	cacheSetState(h, device, state);
 
-	_status = viUnlock (_io);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
-		goto fail;
-	}
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
 	
 	return 0;
 
 fail:
-	if (isLocked) viUnlock(_io);
+	if (isLocked) unlockHandle(h, NULL);
 	return -1;
 }
 	
 
 ////////////////////////////////////////////////////////
-// Set shutter position
-//   device: the shutter attached to the Arduino
-//   position: actuator position
+// Set the states of several shutters in one command
+//   mask: bit n set -> change device n
+//   states: bit n is the new state of device n (0->Closed, 1->Open)
 ////////////////////////////////////////////////////////
-int ARD_ShutterSetPosition(int device, int pos)
+int ARDH_ShutterSetStates(ARD_Handle h, ARD_DeviceMask mask, ARD_DeviceMask states)
 {
 	int isLocked=0;
+	int z;
 
-	if (!_io) {
+	if (!h || !h->conn) {
 		reportError (__LINE__-2, __func__, "Device not open.");
 		goto fail;
 	}
 
-	_status = viLock (_io, VI_EXCLUSIVE_LOCK, 5000, VI_NULL, VI_NULL);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
-		goto fail;
-	}
+	if (lockHandle(h, __func__)) goto fail;
 	isLocked=1;
 
-	// set the shutter position
-	if (pos <0) {
-		reportError (__LINE__-2, __func__, "Invalid position.");
-		goto fail;
-	}
-	if (setDeviceParameterInt(_io, "SP", device, pos)) {
-		reportError (__LINE__-1, __func__, "Could not set shutter position.");
-		goto fail;
+	if (h->binaryMode) {
+		// a frame holds eight devices: the group of the lowest one, the rest must fit in
+		unsigned char resp[BINFRAME_SIZE];
+		int group = 0;
+		while (group<7 && !(mask & ((ARD_DeviceMask)0xFF << 8*group))) group++;
+		if ((mask >> 8*group) > 0xFF) {
+			reportError (__LINE__-1, __func__, "Invalid device mask (binary mode: one group of eight devices only).");
+			goto fail;
+		}
+		if (binaryTransaction(h, BINCMD_SSM, (mask >> 8*group) & 0xFF, (states & mask) >> 8*group, group, resp)) {
+			reportError (__LINE__-1, __func__, "Could not set shutter states.");
+			goto fail;
+		}
+	} else {
+		h->status = ardPrintf(h, "SSM%llu,%llu\n", mask, states & mask);
+		if(h->status) {
+			reportIOError (__LINE__-2, __func__, h, h->status);
+			goto fail;
+		}
+		if(checkErrorResponse(h)!=0) {
+			reportError (__LINE__-1, __func__, "Could not set shutter states.");
+			goto fail;
+		}
 	}
+	for (z=0; z<h->cacheSize && z<CACHE_MASKBITS; z++)
+		if (mask & ((ARD_DeviceMask)1<<z)) cacheSetState(h, z, (int)(states>>z) & 1);
 
-	_status = viUnlock (_io);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
-		goto fail;
-	}
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
 	
 	return 0;
 
 fail:
-	if (isLocked) viUnlock(_io);
+	if (isLocked) unlockHandle(h, NULL);
 	return -1;
 }
 	
 
 ////////////////////////////////////////////////////////
-// Get shutter parameters
+// Set shutter position
 //   device: the shutter attached to the Arduino
-//   shieldChannel: actuator chanel on the shield
-//   digIn: the number of the digital input (-1 for none)
-//   open/closedPos: actuator value for the respective positions
-//   transitDelay_ms: time for the shutter to open/close in ms
-//   label: label to display
+//   position: actuator position
 ////////////////////////////////////////////////////////
-int ARD_ShutterGetParameters(int device, int *shieldChannel, int *digIn, int *openPos, int *closedPos, int *transitDelay_ms, char* label)
+int ARDH_ShutterSetPosition(ARD_Handle h, int device, int pos)
 {
-	unsigned char instrResp[256];
-	ViUInt32 charsRead;
-	int respDev;
 	int isLocked=0;
 
-	if (!_io) {
+	if (!h || !h->conn) {
 		reportError (__LINE__-2, __func__, "Device not open.");
 		goto fail;
 	}
 
-		_status = viLock (_io, VI_EXCLUSIVE_LOCK, 5000, VI_NULL, VI_NULL);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
-		goto fail;
-	}
+	if (lockHandle(h, __func__)) goto fail;
 	isLocked=1;
 
-_status = viPrintf(_io, "GPR%d\n", device);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
-		goto fail;
-	}
-	_status = viRead (_io, instrResp, 256, &charsRead);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
-		goto fail;
-	}
-	if (charsRead<5) { // at least it should return "XX=d"
-		reportError (__LINE__-1, __func__, "No command response received.");
-		goto fail;
-	}
-	// check for response
-	if (strnicmp((char *)instrResp, "Error:", 6)==0){
-		instrResp[charsRead-2]='\0';	
-		reportARDError (__LINE__-2, __func__, (char *)instrResp);
-		goto fail;
-	}
-	if ( sscanf ((char *)instrResp, "PR%d,%d,%d,%d,%d,%d,%s", &respDev, shieldChannel, digIn, openPos, closedPos, transitDelay_ms, label) != 7) {
-		reportError (__LINE__-1, __func__, "Could not read shutter return string.");
-		goto fail;
-	}
-	if (respDev!=device) {
-		reportError (__LINE__-1, __func__, "Responded with wrong device number.");
+	// set the shutter position
+	if (pos <0) {
+		reportError (__LINE__-2, __func__, "Invalid position.");
 		goto fail;
 	}
-	
-	_status = viUnlock (_io);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
+	if (h->binaryMode) {
+		unsigned char resp[BINFRAME_SIZE];
+		if (pos > 0xFFFF || binaryTransaction(h, BINCMD_SSP, device, pos & 0xFF, pos >> 8, resp)) {
+			reportError (__LINE__-1, __func__, "Could not set shutter position.");
+			goto fail;
+		}
+	} else if (setDeviceParameterInt(h, "SP", device, pos)) {
+		reportError (__LINE__-1, __func__, "Could not set shutter position.");
 		goto fail;
 	}
+	cacheSetState(h, device, 2); // flag for manual set
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
 	
 	return 0;
 
 fail:
-	if (isLocked) viUnlock(_io);
+	if (isLocked) unlockHandle(h, NULL);
 	return -1;
 }
-	
+
 
 ////////////////////////////////////////////////////////
-// Set shutter parameters
+// Get the hit-and-hold pulse of a solenoid
 //   device: the shutter attached to the Arduino
-//   shieldChannel: chanel on the shield
-//   digIn: the number of the digital input (-1 for none)
-//   open/closedPos: actuator value for the respective positions
-//   transitDelay_ms: time for the shutter to open/close in ms
-//   label: label to display
+//   hitTime_ms: full-power pulse in ms, 0->off
 ////////////////////////////////////////////////////////
-int ARD_ShutterSetParameters(int device, int shieldChannel, int digInput, int openPos, int closedPos, int transitDelay_ms, const char* label)
+int ARDH_ShutterGetHitTime(ARD_Handle h, int device, int *hitTime_ms)
 {
 	int isLocked=0;
 
-	if (!_io) {
+	if (!h || !h->conn) {
 		reportError (__LINE__-2, __func__, "Device not open.");
 		goto fail;
 	}
 
-		_status = viLock (_io, VI_EXCLUSIVE_LOCK, 5000, VI_NULL, VI_NULL);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
-		goto fail;
-	}
+	if (lockHandle(h, __func__)) goto fail;
 	isLocked=1;
-
-	_status = viPrintf(_io, "SPR%d,%d,%d,%d,%d,%d,%s\n", device, shieldChannel, digInput, openPos, closedPos, transitDelay_ms, label);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
 		goto fail;
 	}
-	if(checkErrorResponse(_io)!=0) {
-		reportError (__LINE__-1, __func__, "ARD error:");
-		goto fail;
-	}
-	
-	_status = viUnlock (_io);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
+
+	if (getDeviceParameterInt(h, "HT", device, hitTime_ms)) {
+		reportError (__LINE__-1, __func__, "Could not get the hit time.");
 		goto fail;
 	}
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
 	
 	return 0;
 
 fail:
-	if (isLocked) viUnlock(_io);
+	if (isLocked) unlockHandle(h, NULL);
 	return -1;
 }
-	
+
 
 ////////////////////////////////////////////////////////
-// Save parameters to EEPROM
+// Set the hit-and-hold pulse of a solenoid
+//   device: the shutter attached to the Arduino
+//   hitTime_ms: full-power pulse in ms, 0->off
 ////////////////////////////////////////////////////////
-int ARD_ShutterSaveToEEPROM(void)
+int ARDH_ShutterSetHitTime(ARD_Handle h, int device, int hitTime_ms)
 {
 	int isLocked=0;
 
-	if (!_io) {
+	if (!h || !h->conn) {
 		reportError (__LINE__-2, __func__, "Device not open.");
 		goto fail;
 	}
-
-		_status = viLock (_io, VI_EXCLUSIVE_LOCK, 5000, VI_NULL, VI_NULL);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
+	if (hitTime_ms<0 || hitTime_ms>0xFFFF) {
+		reportError (__LINE__-1, __func__, "Invalid hit time.");
 		goto fail;
 	}
-	isLocked=1;
 
-	_status = viPrintf(_io, "SAV\n");
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
-		goto fail;
-	}
-	if(checkErrorResponse(_io)!=0) {
-		reportError (__LINE__-1, __func__, "ARD error:");
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
 		goto fail;
 	}
 
-	_status = viUnlock (_io);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, _io, _status);
+	if (setDeviceParameterInt(h, "HT", device, hitTime_ms)) {
+		reportError (__LINE__-1, __func__, "Could not set the hit time.");
 		goto fail;
 	}
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
 	
 	return 0;
 
 fail:
-	if (isLocked) viUnlock(_io);
+	if (isLocked) unlockHandle(h, NULL);
 	return -1;
 }
-	
 
-// *****************************************************************************************
-// Internal (non-exported) functions
-// *****************************************************************************************
+
 ////////////////////////////////////////////////////////
-// Get integer device parameter
+// Get the motion profile of a servo
+//   device: the shutter attached to the Arduino
+//   maxStep: top speed in PWM counts per servo frame, 0->no profile
+//   accel, brake: speed change per frame when starting/stopping
 ////////////////////////////////////////////////////////
-static int getDeviceParameterInt(ViSession io, const char *cmd, int device, int *param)
+int ARDH_ShutterGetMotion(ARD_Handle h, int device, int *maxStep, int *accel, int *brake)
 {
 	unsigned char instrResp[256];
-	ViUInt32 charsRead;
-	char respCmd[3];
-	int respDev, respParam;
+	unsigned int charsRead;
+	int isLocked=0, respDevice;
 
-	_status = viPrintf(io, "G%s%d\n", cmd, device);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, io, _status);
-		goto fail;
-	}
-	_status = viRead (io, instrResp, 256, &charsRead);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, io, _status);
+	if (!h || !h->conn) {
+		reportError (__LINE__-2, __func__, "Device not open.");
 		goto fail;
 	}
-	if (charsRead<5) { // at least it should return "XX=d"
-		reportError (__LINE__-2, __func__, "No command response received.");
+
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
 		goto fail;
 	}
-	// check for response
-	if (strnicmp((char *)instrResp, "Error:", 6)==0){
-		instrResp[charsRead-2]='\0';	
-		reportARDError (__LINE__-2, __func__, (char *)instrResp);
+
+	h->status = ardPrintf(h, "GMP%d\n", device);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
 		goto fail;
 	}
-	if ( sscanf ((char *)instrResp, "%2s%d=%d", respCmd, &respDev, &respParam) != 3) {
-		reportError (__LINE__-2, __func__, "Could not read shutter parameter.");
+	h->status = ardRead (h, instrResp, 255, &charsRead);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
 		goto fail;
 	}
-	if (strnicmp(respCmd, cmd, 2)!=0) {
-		reportError (__LINE__-2, __func__, "Responded with wrong cmd identifier.");
+	if (ardParseIsError((char *)instrResp, charsRead)==0){
+		instrResp[ardParseLineLength((char *)instrResp, charsRead)]='\0';
+		reportARDError (__LINE__-2, __func__, (char *)instrResp);
 		goto fail;
 	}
-	if (respDev!=device) {
-		reportError (__LINE__-2, __func__, "Responded with wrong device number.");
+	instrResp[charsRead]='\0';
+	if (sscanf((char *)instrResp, "MP%d=%d,%d,%d", &respDevice, maxStep, accel, brake)!=4
+			|| respDevice!=device) {
+		reportError (__LINE__-2, __func__, "Could not read the motion profile.");
 		goto fail;
 	}
-	*param = respParam;
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
 
 	return 0;
+
 fail:
+	if (isLocked) unlockHandle(h, NULL);
 	return -1;
 }
 
 
 ////////////////////////////////////////////////////////
-// Get string device parameter
+// Set the motion profile of a servo
+//   device: the shutter attached to the Arduino
+//   maxStep: top speed in PWM counts per servo frame, 0->no profile (jump)
+//   accel: speed increase per frame, 0->start at maxStep
+//   brake: speed decrease per frame before the target, 0->same as accel
 ////////////////////////////////////////////////////////
-static int getDeviceParameterString(ViSession io, const char *cmd, int device, char *str)
+int ARDH_ShutterSetMotion(ARD_Handle h, int device, int maxStep, int accel, int brake)
 {
-	unsigned char instrResp[256];
-	ViUInt32 charsRead;
-	char respCmd[3];
-	int respDev;
+	char cmd[32];
 
-	_status = viPrintf(io, "G%s%d\n", cmd, device);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, io, _status);
-		goto fail;
-	}
-	_status = viRead (io, instrResp, 256, &charsRead);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, io, _status);
-		goto fail;
-	}
-	if (charsRead<5) { // at least it should return "XX=d"
-		reportError (__LINE__-2, __func__, "No command response received.");
-		goto fail;
-	}
-	// check for response
-	if (strnicmp((char *)instrResp, "Error:", 6)==0){
-		instrResp[charsRead-2]='\0';	
-		reportARDError (__LINE__-2, __func__, (char *)instrResp);
-		goto fail;
-	}
-	if ( sscanf ((char *)instrResp, "%2s%d=%s", respCmd, &respDev, str) != 3) {
-		reportError (__LINE__-2, __func__, "Could not read shutter return string.");
-		goto fail;
-	}
-	if (strnicmp(respCmd, cmd, 2)!=0) {
-		reportError (__LINE__-2, __func__, "Responded with wrong cmd identifier.");
-		goto fail;
-	}
-	if (respDev!=device) {
-		reportError (__LINE__-2, __func__, "Responded with wrong device number.");
-		goto fail;
+	if (maxStep<0 || maxStep>255 || accel<0 || accel>255 || brake<0 || brake>255) {
+		reportError (__LINE__-1, __func__, "Invalid motion profile.");
+		return -1;
 	}
-		
-	return 0;
-fail:
-	return -1;
+	sprintf(cmd, "SMP%d,%d,%d,%d", device, maxStep, accel, brake);
+	return sendCommand(h, __func__, cmd);
 }
 
 
 ////////////////////////////////////////////////////////
-// Set int parameter
+// Get the stacked shield board of a shutter
 //   device: the shutter attached to the Arduino
+//   board: 0 for the first board
 ////////////////////////////////////////////////////////
-static int setDeviceParameterInt(ViSession io, const char *cmd, int device, int param)
+int ARDH_ShutterGetBoard(ARD_Handle h, int device, int *board)
 {
-	_status = viPrintf(io, "S%s%d,%d\n", cmd, device, param);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, io, _status);
+	int isLocked=0;
+
+	if (!h || !h->conn) {
+		reportError (__LINE__-2, __func__, "Device not open.");
 		goto fail;
 	}
-	if(checkErrorResponse(io)!=0) {
-		reportError (__LINE__-1, __func__, "ARD error:");
+
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
+		goto fail;
+	}
+
+	if (getDeviceParameterInt(h, "BD", device, board)) {
+		reportError (__LINE__-1, __func__, "Could not get the board.");
 		goto fail;
 	}
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
 	
 	return 0;
+
 fail:
+	if (isLocked) unlockHandle(h, NULL);
 	return -1;
 }
 
 
 ////////////////////////////////////////////////////////
-// Check for an OK response from the device
+// Set the stacked shield board of a shutter
+//   device: the shutter attached to the Arduino
+//   board: 0 for the first board (the controller rejects boards it has not been built for)
 ////////////////////////////////////////////////////////
-static int checkErrorResponse(ViSession io)
+int ARDH_ShutterSetBoard(ARD_Handle h, int device, int board)
 {
-	unsigned char instrResp[256];
-	ViUInt32 charsRead;	
+	int isLocked=0;
 
-	_status = viRead (io, instrResp, 256, &charsRead);
-	if(_status) {
-		reportVisaError (__LINE__-2, __func__, io, _status);
-		return -1;
+	if (!h || !h->conn) {
+		reportError (__LINE__-2, __func__, "Device not open.");
+		goto fail;
+	}
+	if (board<0 || board>255) {
+		reportError (__LINE__-1, __func__, "Invalid board.");
+		goto fail;
+	}
+
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
+		goto fail;
+	}
+
+	if (setDeviceParameterInt(h, "BD", device, board)) {
+		reportError (__LINE__-1, __func__, "Could not set the board.");
+		goto fail;
+	}
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
+	
+	return 0;
+
+fail:
+	if (isLocked) unlockHandle(h, NULL);
+	return -1;
+}
+
+
+////////////////////////////////////////////////////////
+// Get the actuator type of a shutter
+//   device: the shutter attached to the Arduino
+//   type: ARD_ACTUATOR_RCSERVO or ARD_ACTUATOR_SOLENOID
+////////////////////////////////////////////////////////
+int ARDH_ShutterGetActuator(ARD_Handle h, int device, int *type)
+{
+	int isLocked=0;
+
+	if (!h || !h->conn) {
+		reportError (__LINE__-2, __func__, "Device not open.");
+		goto fail;
+	}
+
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
+		goto fail;
+	}
+
+	if (getDeviceParameterInt(h, "AT", device, type)) {
+		reportError (__LINE__-1, __func__, "Could not get the actuator type.");
+		goto fail;
+	}
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
+	
+	return 0;
+
+fail:
+	if (isLocked) unlockHandle(h, NULL);
+	return -1;
+}
+
+
+////////////////////////////////////////////////////////
+// Set the actuator type of a shutter
+//   device: the shutter attached to the Arduino
+//   type: ARD_ACTUATOR_RCSERVO or ARD_ACTUATOR_SOLENOID (the controller rejects types it
+//     has not been built for, and boards the new type does not have)
+////////////////////////////////////////////////////////
+int ARDH_ShutterSetActuator(ARD_Handle h, int device, int type)
+{
+	int isLocked=0;
+
+	if (!h || !h->conn) {
+		reportError (__LINE__-2, __func__, "Device not open.");
+		goto fail;
+	}
+	if (type!=ARD_ACTUATOR_RCSERVO && type!=ARD_ACTUATOR_SOLENOID) {
+		reportError (__LINE__-1, __func__, "Invalid actuator type.");
+		goto fail;
+	}
+
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
+		goto fail;
+	}
+
+	if (setDeviceParameterInt(h, "AT", device, type)) {
+		reportError (__LINE__-1, __func__, "Could not set the actuator type.");
+		goto fail;
+	}
+	cacheSetState(h, device, -2); // the controller forgets the state
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
+	
+	return 0;
+
+fail:
+	if (isLocked) unlockHandle(h, NULL);
+	return -1;
+}
+	
+
+////////////////////////////////////////////////////////
+// Get shutter parameters
+//   device: the shutter attached to the Arduino
+//   shieldChannel: actuator chanel on the shield
+//   digIn: the number of the digital input (-1 for none)
+//   open/closedPos: actuator value for the respective positions
+//   transitDelay_ms: time for the shutter to open/close in ms
+//   label: label to display
+////////////////////////////////////////////////////////
+int ARDH_ShutterGetParameters(ARD_Handle h, int device, int *shieldChannel, int *digIn, int *openPos, int *closedPos, int *transitDelay_ms, char* label)
+{
+	int values[5];
+	int isLocked=0;
+
+	if (!h || !h->conn) {
+		reportError (__LINE__-2, __func__, "Device not open.");
+		goto fail;
+	}
+
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
+		goto fail;
+	}
+
+	if ((h->cacheMode & ARD_CACHE_PARAMETERS) && cacheHolds(h, device)) {
+		CacheEntry *entry = cacheParameters(h, device);
+		if (!entry) {
+			reportError (__LINE__-2, __func__, "Could not get shutter parameters.");
+			goto fail;
+		}
+		memcpy(values, entry->values, sizeof(values));
+		strcpy(label, entry->label);
+	} else if (getDeviceParameters(h, device, values, label)) {
+		reportError (__LINE__-1, __func__, "Could not get shutter parameters.");
+		goto fail;
+	}
+	*shieldChannel = values[0];
+	*digIn = values[1];
+	*openPos = values[2];
+	*closedPos = values[3];
+	*transitDelay_ms = values[4];
+	
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
+	
+	return 0;
+
+fail:
+	if (isLocked) unlockHandle(h, NULL);
+	return -1;
+}
+	
+
+////////////////////////////////////////////////////////
+// Set shutter parameters
+//   device: the shutter attached to the Arduino
+//   shieldChannel: chanel on the shield
+//   digIn: the number of the digital input (-1 for none)
+//   open/closedPos: actuator value for the respective positions
+//   transitDelay_ms: time for the shutter to open/close in ms
+//   label: label to display
+////////////////////////////////////////////////////////
+int ARDH_ShutterSetParameters(ARD_Handle h, int device, int shieldChannel, int digInput, int openPos, int closedPos, int transitDelay_ms, const char* label)
+{
+	int isLocked=0;
+
+	if (!h || !h->conn) {
+		reportError (__LINE__-2, __func__, "Device not open.");
+		goto fail;
+	}
+
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
+		goto fail;
+	}
+
+	// refetched on the next read (the Arduino may cut the label or add a device)
+	if (cacheHolds(h, device)) h->cache[device].valid = 0;
+	else cacheInvalidate(h);
+	h->status = ardPrintf(h, "SPR%d,%d,%d,%d,%d,%d,%s\n", device, shieldChannel, digInput, openPos, closedPos, transitDelay_ms, label);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+	if(checkErrorResponse(h)!=0) {
+		reportError (__LINE__-1, __func__, "ARD error:");
+		goto fail;
+	}
+	
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
+	
+	return 0;
+
+fail:
+	if (isLocked) unlockHandle(h, NULL);
+	return -1;
+}
+	
+
+////////////////////////////////////////////////////////
+// Save parameters to EEPROM
+//   the Arduino writes the EEPROM in the background, this waits until it is done
+////////////////////////////////////////////////////////
+int ARDH_ShutterSaveToEEPROM(ARD_Handle h)
+{
+	int isLocked=0;
+
+	if (!h || !h->conn) {
+		reportError (__LINE__-2, __func__, "Device not open.");
+		goto fail;
+	}
+
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
+		goto fail;
+	}
+
+	h->status = ardPrintf(h, "SAV\n");
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+	if(checkErrorResponse(h)!=0) {
+		reportError (__LINE__-1, __func__, "ARD error:");
+		goto fail;
+	}
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
+
+	return waitForSave(h, __func__);
+
+fail:
+	if (isLocked) unlockHandle(h, NULL);
+	return -1;
+}
+
+
+////////////////////////////////////////////////////////
+// Get a preset
+//   preset: 0..ARD_MAXPRESETS-1
+//   name: receives the name (empty for an empty preset), like a label
+//   numDevices: shutters in the preset, 0->empty
+//   active: 1 if the current shutters are this preset (loaded or stored, unchanged since)
+////////////////////////////////////////////////////////
+int ARDH_ShutterGetPreset(ARD_Handle h, int preset, char *name, int *numDevices, int *active)
+{
+	unsigned char instrResp[256];
+	unsigned int charsRead;
+	int isLocked=0;
+
+	if (!h || !h->conn) {
+		reportError (__LINE__-2, __func__, "Device not open.");
+		goto fail;
+	}
+
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
+		goto fail;
+	}
+
+	h->status = ardPrintf(h, "GPS%d\n", preset);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+	h->status = ardRead (h, instrResp, 255, &charsRead);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+	if (ardParseIsError((char *)instrResp, charsRead)==0){
+		instrResp[ardParseLineLength((char *)instrResp, charsRead)]='\0';
+		reportARDError (__LINE__-2, __func__, (char *)instrResp);
+		goto fail;
+	}
+	if (ardParsePreset((char *)instrResp, charsRead, preset, name, sizeof(instrResp), numDevices, active)) {
+		reportError (__LINE__-1, __func__, "Could not read the preset.");
+		goto fail;
+	}
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
+
+	return 0;
+
+fail:
+	if (isLocked) unlockHandle(h, NULL);
+	return -1;
+}
+
+
+////////////////////////////////////////////////////////
+// Replace all shutters by a preset, in one command
+//   preset: 0..ARD_MAXPRESETS-1, must not be empty
+////////////////////////////////////////////////////////
+int ARDH_ShutterLoadPreset(ARD_Handle h, int preset)
+{
+	int isLocked=0;
+
+	if (!h || !h->conn) {
+		reportError (__LINE__-2, __func__, "Device not open.");
+		goto fail;
+	}
+
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
+		goto fail;
+	}
+
+	cacheInvalidate(h);
+	h->status = ardPrintf(h, "LPS%d\n", preset);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+	if(checkErrorResponse(h)!=0) {
+		reportError (__LINE__-1, __func__, "ARD error:");
+		goto fail;
+	}
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
+
+	return 0;
+
+fail:
+	if (isLocked) unlockHandle(h, NULL);
+	return -1;
+}
+
+
+////////////////////////////////////////////////////////
+// Store the current shutters as a preset
+//   preset: 0..ARD_MAXPRESETS-1, name: up to 7 characters like a label
+//   the Arduino writes the EEPROM in the background, this waits until it is done
+////////////////////////////////////////////////////////
+int ARDH_ShutterStorePreset(ARD_Handle h, int preset, const char *name)
+{
+	char cmd[CMD_MAXLENGTH];
+
+	if (snprintf(cmd, sizeof(cmd), "SPS%d,%s", preset, name) >= (int)sizeof(cmd)) {
+		reportError (__LINE__-1, __func__, "Invalid preset name.");
+		return -1;
+	}
+	if (sendCommand(h, __func__, cmd)) return -1;
+	return waitForSave(h, __func__);
+}
+
+
+////////////////////////////////////////////////////////
+// Get the progress of the EEPROM save
+//   running: 1 while the save is written, 0 when done
+//   done, total: bytes written (or found unchanged) so far and in all
+////////////////////////////////////////////////////////
+int ARDH_ShutterGetSaveStatus(ARD_Handle h, int *running, int *done, int *total)
+{
+	int isLocked=0;
+
+	if (!h || !h->conn) {
+		reportError (__LINE__-2, __func__, "Device not open.");
+		goto fail;
+	}
+
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
+		goto fail;
+	}
+
+	h->status = ardQueryf(h, "GSV\n", "SV=%d,%d,%d", running, done, total);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
+
+	return 0;
+
+fail:
+	if (isLocked) unlockHandle(h, NULL);
+	return -1;
+}
+	
+
+////////////////////////////////////////////////////////
+// Switch between the ASCII commands and the binary frame protocol
+//   enable: 1->binary frames, 0->ASCII
+////////////////////////////////////////////////////////
+int ARDH_ShutterBinaryMode(ARD_Handle h, int enable)
+{
+	unsigned char resp[BINFRAME_SIZE];
+	int isLocked=0;
+
+	if (!h || !h->conn) {
+		reportError (__LINE__-2, __func__, "Device not open.");
+		goto fail;
+	}
+
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if ((enable!=0) == h->binaryMode) { // already there
+		isLocked=0;
+		return unlockHandle(h, __func__) ? -1 : 0;
+	}
+
+	if (enable) {
+		h->status = ardPrintf(h, "BIN\n");
+		if(h->status) {
+			reportIOError (__LINE__-2, __func__, h, h->status);
+			goto fail;
+		}
+		if(checkErrorResponse(h)!=0) {
+			reportError (__LINE__-1, __func__, "ARD error:");
+			goto fail;
+		}
+		h->binaryMode = 1; // frames may contain the term char, binaryTransaction reads them by size
+	} else {
+		if (binaryTransaction(h, BINCMD_ASCII, 0, 0, 0, resp)) {
+			reportError (__LINE__-1, __func__, "Could not leave binary mode.");
+			goto fail;
+		}
+		h->binaryMode = 0;
+	}
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
+
+	return 0;
+
+fail:
+	if (isLocked) unlockHandle(h, NULL);
+	return -1;
+}
+
+
+////////////////////////////////////////////////////////
+// Get the digital input edge-to-actuation latency statistics
+//   count: number of edges that moved a shutter
+//   last/min/max_us: latency in us
+////////////////////////////////////////////////////////
+int ARDH_ShutterGetLatency(ARD_Handle h, int *count, unsigned long *last_us, unsigned long *min_us, unsigned long *max_us)
+{
+	int isLocked=0;
+
+	if (!h || !h->conn) {
+		reportError (__LINE__-2, __func__, "Device not open.");
+		goto fail;
+	}
+
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
+		goto fail;
+	}
+
+	h->status = ardQueryf(h, "GLT\n", "LT=%d,%lu,%lu,%lu", count, last_us, min_us, max_us);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
+
+	return 0;
+
+fail:
+	if (isLocked) unlockHandle(h, NULL);
+	return -1;
+}
+
+
+////////////////////////////////////////////////////////
+// Reset the latency statistics
+////////////////////////////////////////////////////////
+int ARDH_ShutterClearLatency(ARD_Handle h)
+{
+	return sendCommand(h, __func__, "CLT");
+}
+
+
+////////////////////////////////////////////////////////
+// Get a timing histogram
+//   channel: one of the ARD_STATS_ channels
+//   count: number of measurements
+//   max_us: longest measurement in us
+//   buckets: ARD_STATS_BUCKETS counts, see ARD_ShutterStatsBucketLimit
+////////////////////////////////////////////////////////
+int ARDH_ShutterGetStats(ARD_Handle h, int channel, unsigned long *count, unsigned long *max_us, unsigned int *buckets)
+{
+	unsigned char instrResp[256];
+	unsigned int charsRead;
+	int isLocked=0;
+	int respChannel;
+
+	if (!h || !h->conn) {
+		reportError (__LINE__-2, __func__, "Device not open.");
+		goto fail;
+	}
+
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
+		goto fail;
+	}
+
+	h->status = ardPrintf(h, "GPF%d\n", channel);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+	h->status = ardRead (h, instrResp, 255, &charsRead);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+	instrResp[charsRead]='\0';
+	if (ardParseIsError((char *)instrResp, charsRead)==0){
+		reportARDError (__LINE__-1, __func__, (char *)instrResp);
+		goto fail;
+	}
+	if (sscanf((char *)instrResp, "PF%d=%lu,%lu,%u,%u,%u,%u,%u,%u,%u,%u", &respChannel, count, max_us,
+			&buckets[0], &buckets[1], &buckets[2], &buckets[3],
+			&buckets[4], &buckets[5], &buckets[6], &buckets[7]) != 3+ARD_STATS_BUCKETS
+			|| respChannel != channel) {
+		reportError (__LINE__-4, __func__, "Could not read histogram.");
+		goto fail;
+	}
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
+
+	return 0;
+
+fail:
+	if (isLocked) unlockHandle(h, NULL);
+	return -1;
+}
+
+
+////////////////////////////////////////////////////////
+// Reset all timing histograms
+////////////////////////////////////////////////////////
+int ARDH_ShutterClearStats(ARD_Handle h)
+{
+	return sendCommand(h, __func__, "CPF");
+}
+
+
+////////////////////////////////////////////////////////
+// Upper limit of a histogram bucket in us (16, 64, ... 65536),
+//   0 for the last bucket, which has no upper limit
+////////////////////////////////////////////////////////
+unsigned long ARD_ShutterStatsBucketLimit(int bucket)
+{
+	if (bucket < 0 || bucket >= ARD_STATS_BUCKETS-1) return 0;
+	return 16UL << (2*bucket);
+}
+
+
+////////////////////////////////////////////////////////
+// Sequencer: remove all events
+////////////////////////////////////////////////////////
+int ARDH_ShutterSeqClear(ARD_Handle h)
+{
+	return sendCommand(h, __func__, "SQC");
+}
+
+
+////////////////////////////////////////////////////////
+// Sequencer: append an event
+//   offset_us: time after the start of each pass, must not decrease
+//   mask: bit n set -> change device n
+//   states: bit n is the new state of device n (0->Closed, 1->Open)
+////////////////////////////////////////////////////////
+int ARDH_ShutterSeqAddEvent(ARD_Handle h, unsigned long offset_us, ARD_DeviceMask mask, ARD_DeviceMask states)
+{
+	char cmd[64];
+
+	sprintf(cmd, "SQA%lu,%llu,%llu", offset_us, mask, states & mask);
+	return sendCommand(h, __func__, cmd);
+}
+
+
+////////////////////////////////////////////////////////
+// Sequencer: set number of passes, trigger and pass length
+//   loops: passes to play, 0 until aborted
+//   trigger: 0->ARD_ShutterSeqStart, 1-4->rising edge on digital input 0-3
+//   period_us: length of a pass, 0 for the time of the last event
+////////////////////////////////////////////////////////
+int ARDH_ShutterSeqConfigure(ARD_Handle h, int loops, int trigger, unsigned long period_us)
+{
+	char cmd[64];
+
+	sprintf(cmd, "SQP%d,%d,%lu", loops, trigger, period_us);
+	return sendCommand(h, __func__, cmd);
+}
+
+
+////////////////////////////////////////////////////////
+// Sequencer: wait for the trigger
+////////////////////////////////////////////////////////
+int ARDH_ShutterSeqArm(ARD_Handle h)
+{
+	return sendCommand(h, __func__, "SQR");
+}
+
+
+////////////////////////////////////////////////////////
+// Sequencer: start an armed sequence
+////////////////////////////////////////////////////////
+int ARDH_ShutterSeqStart(ARD_Handle h)
+{
+	return sendCommand(h, __func__, "SQS");
+}
+
+
+////////////////////////////////////////////////////////
+// Sequencer: stop, the shutters stay where they are
+////////////////////////////////////////////////////////
+int ARDH_ShutterSeqAbort(ARD_Handle h)
+{
+	return sendCommand(h, __func__, "SQX");
+}
+
+
+////////////////////////////////////////////////////////
+// Sequencer: get status
+//   state: 0->idle, 1->armed, 2->running
+//   loopsDone: completed passes
+//   nextEvent: index of the next event in the current pass
+////////////////////////////////////////////////////////
+int ARDH_ShutterSeqGetStatus(ARD_Handle h, int *state, int *loopsDone, int *nextEvent)
+{
+	int isLocked=0;
+	int numEvents;
+	unsigned long startTime_ms;
+
+	if (!h || !h->conn) {
+		reportError (__LINE__-2, __func__, "Device not open.");
+		goto fail;
+	}
+
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
+		goto fail;
+	}
+
+	h->status = ardQueryf(h, "SQG\n", "SQ=%d,%d,%d,%d,%lu", state, loopsDone, nextEvent, &numEvents, &startTime_ms);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
+
+	return 0;
+
+fail:
+	if (isLocked) unlockHandle(h, NULL);
+	return -1;
+}
+
+
+////////////////////////////////////////////////////////
+// Sequencer: get the timing of an event in the latest pass
+//   planned_us: offset of the event
+//   actual_us: time the event was executed
+//   both in us after the start of the pass
+////////////////////////////////////////////////////////
+int ARDH_ShutterSeqGetTiming(ARD_Handle h, int event, unsigned long *planned_us, unsigned long *actual_us)
+{
+	unsigned char instrResp[256];
+	unsigned int charsRead;
+	int isLocked=0;
+	int respEvent;
+
+	if (!h || !h->conn) {
+		reportError (__LINE__-2, __func__, "Device not open.");
+		goto fail;
+	}
+
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
+		goto fail;
+	}
+
+	h->status = ardPrintf(h, "SQT%d\n", event);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+	h->status = ardRead (h, instrResp, 255, &charsRead);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+	instrResp[charsRead]='\0';
+	if (ardParseIsError((char *)instrResp, charsRead)==0){
+		reportARDError (__LINE__-1, __func__, (char *)instrResp);
+		goto fail;
+	}
+	if (sscanf((char *)instrResp, "SQT%d=%lu,%lu", &respEvent, planned_us, actual_us) != 3
+			|| respEvent != event) {
+		reportError (__LINE__-2, __func__, "Could not read event timing.");
+		goto fail;
+	}
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
+
+	return 0;
+
+fail:
+	if (isLocked) unlockHandle(h, NULL);
+	return -1;
+}
+
+
+////////////////////////////////////////////////////////
+// Subscribe to the state-change events
+//   callback: called for each event, userData is passed on
+////////////////////////////////////////////////////////
+int ARDH_ShutterSubscribeEvents(ARD_Handle h, ARD_EventCallback callback, void *userData)
+{
+	int isLocked=0;
+
+	if (!h || !h->conn) {
+		reportError (__LINE__-2, __func__, "Device not open.");
+		goto fail;
+	}
+	if (!callback) {
+		reportError (__LINE__-1, __func__, "No callback.");
+		goto fail;
+	}
+
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
+		goto fail;
+	}
+
+	if (!h->eventCallback) {
+		h->status = ardPrintf(h, "EVT1\n");
+		if(h->status) {
+			reportIOError (__LINE__-2, __func__, h, h->status);
+			goto fail;
+		}
+		if(checkErrorResponse(h)!=0) {
+			reportError (__LINE__-1, __func__, "Could not enable the events.");
+			goto fail;
+		}
+	}
+	h->eventCallback = callback;
+	h->eventUserData = userData;
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
+
+	// without it, the events only arrive together with replies
+	if (!h->eventThreadRunning && h->transport->available && eventThreadStart(h)) {
+		reportError (__LINE__-1, __func__, "Could not start the event reader.");
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	if (isLocked) unlockHandle(h, NULL);
+	return -1;
+}
+
+
+////////////////////////////////////////////////////////
+// Stop the state-change events
+////////////////////////////////////////////////////////
+int ARDH_ShutterUnsubscribeEvents(ARD_Handle h)
+{
+	int isLocked=0;
+
+	if (!h || !h->conn) {
+		reportError (__LINE__-2, __func__, "Device not open.");
+		goto fail;
+	}
+
+	eventThreadStop(h);
+
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+
+	h->eventCallback = NULL;
+	h->eventUserData = NULL;
+	if (!h->binaryMode) {
+		h->status = ardPrintf(h, "EVT0\n");
+		if(h->status) {
+			reportIOError (__LINE__-2, __func__, h, h->status);
+			goto fail;
+		}
+		if(checkErrorResponse(h)!=0) {
+			reportError (__LINE__-1, __func__, "Could not disable the events.");
+			goto fail;
+		}
+	}
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
+
+	return 0;
+
+fail:
+	if (isLocked) unlockHandle(h, NULL);
+	return -1;
+}
+
+
+////////////////////////////////////////////////////////
+// Switch the client-side cache on or off
+//   mode: ARD_CACHE_ flags; switching on reads all devices once
+////////////////////////////////////////////////////////
+int ARDH_ShutterSetCache(ARD_Handle h, int mode)
+{
+	int isLocked=0;
+
+	if (!h || !h->conn) {
+		reportError (__LINE__-1, __func__, "Device not open.");
+		goto fail;
+	}
+
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+
+	cacheInvalidate(h);
+	h->cacheMode = mode & (ARD_CACHE_PARAMETERS | ARD_CACHE_STATES);
+	if (h->cacheMode && cacheFill(h)) {
+		h->cacheMode = 0;
+		reportError (__LINE__-2, __func__, "Could not fill the cache.");
+		goto fail;
+	}
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
+
+	return 0;
+
+fail:
+	if (isLocked) unlockHandle(h, NULL);
+	return -1;
+}
+
+
+////////////////////////////////////////////////////////
+// Drop the cached values, they are read again when needed
+////////////////////////////////////////////////////////
+int ARDH_ShutterInvalidateCache(ARD_Handle h)
+{
+	if (!h || !h->conn) {
+		reportError (__LINE__-1, __func__, "Device not open.");
+		return -1;
+	}
+	mutexLock(&h->mutex);
+	cacheInvalidate(h);
+	mutexUnlock(&h->mutex);
+	return 0;
+}
+
+
+////////////////////////////////////////////////////////
+// Start a batch of pipelined commands
+//   batch: receives the batch for the ARD_Batch functions
+////////////////////////////////////////////////////////
+int ARDH_BatchBegin(ARD_Handle h, ARD_Batch *batch)
+{
+	*batch = NULL;
+	if (!h || !h->conn) {
+		reportError (__LINE__-1, __func__, "Device not open.");
+		return -1;
+	}
+	*batch = calloc(1, sizeof(struct ARD_ShutterBatch));
+	if (!*batch) {
+		reportError (__LINE__-2, __func__, "Out of memory.");
+		return -1;
+	}
+	(*batch)->h = h;
+	return 0;
+}
+
+
+////////////////////////////////////////////////////////
+// Add commands to a batch
+////////////////////////////////////////////////////////
+int ARD_BatchGetState(ARD_Batch batch, int device, int *state)
+{
+	return batchAdd(batch, __func__, BatchReplyInt, "ST", device, state, "GST%d\n", device);
+}
+
+int ARD_BatchGetDeviceLabel(ARD_Batch batch, int device, char *label)
+{
+	return batchGetLabel(batch, __func__, device, label, 256);
+}
+
+int ARD_BatchGetTransitDelay(ARD_Batch batch, int device, int *transDelay_ms)
+{
+	return batchAdd(batch, __func__, BatchReplyInt, "TD", device, transDelay_ms, "GTD%d\n", device);
+}
+
+int ARD_BatchSetState(ARD_Batch batch, int device, int state)
+{
+	return batchAdd(batch, __func__, BatchReplyOK, "", 0, NULL, "SST%d,%d\n", device, state);
+}
+
+int ARD_BatchSetStates(ARD_Batch batch, ARD_DeviceMask mask, ARD_DeviceMask states)
+{
+	return batchAdd(batch, __func__, BatchReplyOK, "", 0, NULL, "SSM%llu,%llu\n", mask, states);
+}
+
+int ARD_BatchSetPosition(ARD_Batch batch, int device, int pos)
+{
+	return batchAdd(batch, __func__, BatchReplyOK, "", 0, NULL, "SSP%d,%d\n", device, pos);
+}
+
+
+////////////////////////////////////////////////////////
+// Send the commands of a batch and read the replies
+//   A new command is written as soon as the unanswered ones leave room in the
+//   receive buffer of the Arduino, so the line stays busy in both directions.
+////////////////////////////////////////////////////////
+int ARD_BatchCommit(ARD_Batch batch)
+{
+	unsigned char instrResp[256];
+	unsigned int charsRead, inFlight=0;
+	int sent=0, done, errors=0, setCmds=0;
+	int isLocked=0;
+	ARD_Handle h;
+
+	if (!batch) {
+		reportError (__LINE__-1, __func__, "No batch.");
+		return -1;
+	}
+	h = batch->h;
+	if (!h->conn) {
+		reportError (__LINE__-1, __func__, "Device not open.");
+		goto fail;
+	}
+
+	if (lockHandle(h, __func__)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
+		goto fail;
+	}
+
+	for (done=0; done<batch->numCmds; done++) {
+		while (sent<batch->numCmds && inFlight+batch->cmds[sent].len<=BATCH_WINDOW) {
+			h->status = h->transport->write(h->conn, batch->cmds[sent].cmd, batch->cmds[sent].len);
+			if(h->status) {
+				reportIOError (__LINE__-2, __func__, h, h->status);
+				goto fail;
+			}
+			inFlight += batch->cmds[sent].len;
+			sent++;
+		}
+		h->status = ardRead (h, instrResp, 255, &charsRead);
+		if(h->status) {
+			reportIOError (__LINE__-2, __func__, h, h->status);
+			goto fail;
+		}
+		inFlight -= batch->cmds[done].len;
+		if (batch->cmds[done].type==BatchReplyOK) setCmds=1;
+		if (batchParseReply(&batch->cmds[done], (char *)instrResp, charsRead)) {
+			instrResp[ardParseLineLength((char *)instrResp, charsRead)]='\0';
+			if (ardParseIsError((char *)instrResp, charsRead)==0)
+				reportARDError (__LINE__-3, __func__, (char *)instrResp);
+			else
+				reportError (__LINE__-5, __func__, "Could not read shutter return string.");
+			errors++;
+		}
+	}
+
+	// the states are read again after set commands
+	if (setCmds)
+		for (done=0; done<h->cacheSize; done++) h->cache[done].stateValid = 0;
+
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
+
+	free(batch);
+	return errors ? -1 : 0;
+
+fail:
+	if (isLocked) {
+		cacheInvalidate(h); // unknown which commands arrived
+		unlockHandle(h, NULL);
+	}
+	free(batch);
+	return -1;
+}
+
+
+////////////////////////////////////////////////////////
+// Free a batch without sending it
+////////////////////////////////////////////////////////
+void ARD_BatchFree(ARD_Batch batch)
+{
+	free(batch);
+}
+
+
+////////////////////////////////////////////////////////
+// Find the controllers on the serial ports
+//   probes all candidates at once, so the whole search takes about one timeout
+////////////////////////////////////////////////////////
+int ARD_ShutterDiscover(const char *const *candidates, int numCandidates,
+												const ARD_SerialOptions *options, ARD_ControllerInfo *found,
+												int maxFound, int *numFound)
+{
+	const ArdTransport *transport = NULL;
+	char (*ports)[ARD_ADDRESS_SIZE] = NULL;
+	DiscoverProbe *probes = NULL;
+	ARD_SerialOptions opt = {0};
+	int numProbes = 0;
+	int i;
+
+	*numFound = 0;
+	if (options) opt = *options;
+	opt.cache = ARD_CACHE_OFF; // the handles are closed right away
+
+	probes = calloc(ARD_DISCOVER_MAXPORTS, sizeof(DiscoverProbe));
+	if (!probes) {
+		reportError (__LINE__-2, __func__, "Out of memory.");
+		goto fail;
+	}
+	if (candidates) {
+		if (numCandidates > ARD_DISCOVER_MAXPORTS) {
+			reportError (__LINE__-1, __func__, "Too many candidate ports.");
+			goto fail;
+		}
+		for (i=0; i<numCandidates; i++)
+			snprintf(probes[i].info.address, ARD_ADDRESS_SIZE, "%s", candidates[i]);
+		numProbes = numCandidates;
+	}
+	else {
+		// the native transport lists the same ports as VISA, so only one of them is asked
+#ifdef ARD_WITH_TERMIOS
+		transport = &ARD_TransportTermios;
+#else
+		transport = &ARD_TransportVisa;
+#endif
+		ports = calloc(ARD_DISCOVER_MAXPORTS, ARD_ADDRESS_SIZE);
+		if (!ports) {
+			reportError (__LINE__-2, __func__, "Out of memory.");
+			goto fail;
+		}
+		if (transport->find && transport->find(ports, ARD_DISCOVER_MAXPORTS, &numProbes)) {
+			reportError (__LINE__-1, __func__, "Could not list the serial ports.");
+			goto fail;
+		}
+		for (i=0; i<numProbes; i++)
+			memcpy(probes[i].info.address, ports[i], ARD_ADDRESS_SIZE);
+	}
+
+	// one thread per port; a port whose thread cannot be started is probed afterwards
+	for (i=0; i<numProbes; i++) {
+		probes[i].options = &opt;
+		probeThreadStart(&probes[i]);
+	}
+	for (i=0; i<numProbes; i++) {
+		if (probes[i].threadRunning)
+			probeThreadJoin(&probes[i]);
+		else
+			probeController(&probes[i]);
+	}
+
+	for (i=0; i<numProbes && *numFound<maxFound; i++)
+		if (probes[i].found) found[(*numFound)++] = probes[i].info;
+
+	free(ports);
+	free(probes);
+	return 0;
+
+fail:
+	free(ports);
+	free(probes);
+	return -1;
+}
+
+
+// *****************************************************************************************
+// Single-controller functions: the ARD_ functions work on a default handle
+// *****************************************************************************************
+////////////////////////////////////////////////////////
+// Initialization (opens the default handle)
+////////////////////////////////////////////////////////
+int ARD_ShutterInit(const char *address)
+{
+	if (_defaultHandle) {
+		reportError (__LINE__-1, __func__, "Shutter controller already open.");
+		return -1;
+	}
+	return ARDH_Open(address, &_defaultHandle);
+}
+
+////////////////////////////////////////////////////////
+// Close the default handle
+////////////////////////////////////////////////////////
+int ARD_Close(void)
+{
+	int result;
+
+	result = ARDH_Close(_defaultHandle);
+	_defaultHandle = NULL;
+	return result;
+}
+
+int ARD_ShutterGetNumDevices(int *numDevices)
+{
+	return ARDH_ShutterGetNumDevices(_defaultHandle, numDevices);
+}
+
+int ARD_ShutterClearDev(void)
+{
+	return ARDH_ShutterClearDev(_defaultHandle);
+}
+
+int ARD_ShutterGetState(int device, int *state)
+{
+	return ARDH_ShutterGetState(_defaultHandle, device, state);
+}
+
+int ARD_ShutterGetDeviceLabel(int device, char *label)
+{
+	return ARDH_ShutterGetDeviceLabel(_defaultHandle, device, label);
+}
+
+int ARD_ShutterGetTransitDelay(int device, int *transDelay_ms)
+{
+	return ARDH_ShutterGetTransitDelay(_defaultHandle, device, transDelay_ms);
+}
+
+int ARD_ShutterSetState(int device, int state)
+{
+	return ARDH_ShutterSetState(_defaultHandle, device, state);
+}
+
+int ARD_ShutterSetStates(ARD_DeviceMask mask, ARD_DeviceMask states)
+{
+	return ARDH_ShutterSetStates(_defaultHandle, mask, states);
+}
+
+int ARD_ShutterSetPosition(int device, int pos)
+{
+	return ARDH_ShutterSetPosition(_defaultHandle, device, pos);
+}
+
+int ARD_ShutterGetHitTime(int device, int *hitTime_ms)
+{
+	return ARDH_ShutterGetHitTime(_defaultHandle, device, hitTime_ms);
+}
+
+int ARD_ShutterSetHitTime(int device, int hitTime_ms)
+{
+	return ARDH_ShutterSetHitTime(_defaultHandle, device, hitTime_ms);
+}
+
+int ARD_ShutterGetMotion(int device, int *maxStep, int *accel, int *brake)
+{
+	return ARDH_ShutterGetMotion(_defaultHandle, device, maxStep, accel, brake);
+}
+
+int ARD_ShutterSetMotion(int device, int maxStep, int accel, int brake)
+{
+	return ARDH_ShutterSetMotion(_defaultHandle, device, maxStep, accel, brake);
+}
+
+int ARD_ShutterGetBoard(int device, int *board)
+{
+	return ARDH_ShutterGetBoard(_defaultHandle, device, board);
+}
+
+int ARD_ShutterSetBoard(int device, int board)
+{
+	return ARDH_ShutterSetBoard(_defaultHandle, device, board);
+}
+
+int ARD_ShutterGetActuator(int device, int *type)
+{
+	return ARDH_ShutterGetActuator(_defaultHandle, device, type);
+}
+
+int ARD_ShutterSetActuator(int device, int type)
+{
+	return ARDH_ShutterSetActuator(_defaultHandle, device, type);
+}
+
+int ARD_ShutterGetParameters(int device, int *shieldChannel, int *digIn, int *openPos, int *closedPos, int *transitDelay_ms, char* label)
+{
+	return ARDH_ShutterGetParameters(_defaultHandle, device, shieldChannel, digIn, openPos, closedPos, transitDelay_ms, label);
+}
+
+int ARD_ShutterSetParameters(int device, int shieldChannel, int digInput, int openPos, int closedPos, int transitDelay_ms, const char* label)
+{
+	return ARDH_ShutterSetParameters(_defaultHandle, device, shieldChannel, digInput, openPos, closedPos, transitDelay_ms, label);
+}
+
+int ARD_ShutterSaveToEEPROM(void)
+{
+	return ARDH_ShutterSaveToEEPROM(_defaultHandle);
+}
+
+int ARD_ShutterGetSaveStatus(int *running, int *done, int *total)
+{
+	return ARDH_ShutterGetSaveStatus(_defaultHandle, running, done, total);
+}
+
+int ARD_ShutterGetPreset(int preset, char *name, int *numDevices, int *active)
+{
+	return ARDH_ShutterGetPreset(_defaultHandle, preset, name, numDevices, active);
+}
+
+int ARD_ShutterLoadPreset(int preset)
+{
+	return ARDH_ShutterLoadPreset(_defaultHandle, preset);
+}
+
+int ARD_ShutterStorePreset(int preset, const char *name)
+{
+	return ARDH_ShutterStorePreset(_defaultHandle, preset, name);
+}
+
+int ARD_ShutterBinaryMode(int enable)
+{
+	return ARDH_ShutterBinaryMode(_defaultHandle, enable);
+}
+
+int ARD_ShutterGetLatency(int *count, unsigned long *last_us, unsigned long *min_us, unsigned long *max_us)
+{
+	return ARDH_ShutterGetLatency(_defaultHandle, count, last_us, min_us, max_us);
+}
+
+int ARD_ShutterClearLatency(void)
+{
+	return ARDH_ShutterClearLatency(_defaultHandle);
+}
+
+int ARD_ShutterGetStats(int channel, unsigned long *count, unsigned long *max_us, unsigned int *buckets)
+{
+	return ARDH_ShutterGetStats(_defaultHandle, channel, count, max_us, buckets);
+}
+
+int ARD_ShutterClearStats(void)
+{
+	return ARDH_ShutterClearStats(_defaultHandle);
+}
+
+int ARD_ShutterSeqClear(void)
+{
+	return ARDH_ShutterSeqClear(_defaultHandle);
+}
+
+int ARD_ShutterSeqAddEvent(unsigned long offset_us, ARD_DeviceMask mask, ARD_DeviceMask states)
+{
+	return ARDH_ShutterSeqAddEvent(_defaultHandle, offset_us, mask, states);
+}
+
+int ARD_ShutterSeqConfigure(int loops, int trigger, unsigned long period_us)
+{
+	return ARDH_ShutterSeqConfigure(_defaultHandle, loops, trigger, period_us);
+}
+
+int ARD_ShutterSeqArm(void)
+{
+	return ARDH_ShutterSeqArm(_defaultHandle);
+}
+
+int ARD_ShutterSeqStart(void)
+{
+	return ARDH_ShutterSeqStart(_defaultHandle);
+}
+
+int ARD_ShutterSeqAbort(void)
+{
+	return ARDH_ShutterSeqAbort(_defaultHandle);
+}
+
+int ARD_ShutterSeqGetStatus(int *state, int *loopsDone, int *nextEvent)
+{
+	return ARDH_ShutterSeqGetStatus(_defaultHandle, state, loopsDone, nextEvent);
+}
+
+int ARD_ShutterSeqGetTiming(int event, unsigned long *planned_us, unsigned long *actual_us)
+{
+	return ARDH_ShutterSeqGetTiming(_defaultHandle, event, planned_us, actual_us);
+}
+
+int ARD_ShutterSubscribeEvents(ARD_EventCallback callback, void *userData)
+{
+	return ARDH_ShutterSubscribeEvents(_defaultHandle, callback, userData);
+}
+
+int ARD_ShutterUnsubscribeEvents(void)
+{
+	return ARDH_ShutterUnsubscribeEvents(_defaultHandle);
+}
+
+int ARD_ShutterSetCache(int mode)
+{
+	return ARDH_ShutterSetCache(_defaultHandle, mode);
+}
+
+int ARD_ShutterInvalidateCache(void)
+{
+	return ARDH_ShutterInvalidateCache(_defaultHandle);
+}
+
+int ARD_BatchBegin(ARD_Batch *batch)
+{
+	return ARDH_BatchBegin(_defaultHandle, batch);
+}
+
+
+// *****************************************************************************************
+// Internal (non-exported) functions
+// *****************************************************************************************
+////////////////////////////////////////////////////////
+// Get exclusive access to a controller: first among the threads of this
+//   process (mutex), then among processes (transport lock, e.g. VISA)
+//   function: name of the calling function, for the error reports (NULL->no report)
+////////////////////////////////////////////////////////
+static int lockHandle(ARD_Handle h, const char *function)
+{
+	mutexLock(&h->mutex);
+	if (!h->transport->lock) return 0;
+	h->status = h->transport->lock(h->conn);
+	if(h->status) {
+		if (function) reportIOError (__LINE__-2, function, h, h->status);
+		mutexUnlock(&h->mutex);
+		return -1;
+	}
+	return 0;
+}
+
+
+////////////////////////////////////////////////////////
+// Release the locks taken by lockHandle
+//   function: name of the calling function, NULL to skip the error report
+//     (clean-up after an error that was already reported)
+////////////////////////////////////////////////////////
+static int unlockHandle(ARD_Handle h, const char *function)
+{
+	long status = 0;
+
+	if (h->transport->unlock) status = h->transport->unlock(h->conn);
+	mutexUnlock(&h->mutex);
+	if(status && function) {
+		reportIOError (__LINE__-3, function, h, status);
+		return -1;
+	}
+	return 0;
+}
+
+
+////////////////////////////////////////////////////////
+// Send a formatted command
+////////////////////////////////////////////////////////
+static long ardPrintf(ARD_Handle h, const char *format, ...)
+{
+	char cmd[CMD_MAXLENGTH];
+	va_list args;
+	int len;
+
+	va_start(args, format);
+	len = vsnprintf(cmd, sizeof(cmd), format, args);
+	va_end(args);
+	if (len < 0 || len >= (int)sizeof(cmd)) return ARD_STATUS_TOOLONG;
+	return h->transport->write(h->conn, cmd, (unsigned int)len);
+}
+
+
+////////////////////////////////////////////////////////
+// Read one response line (up to and including the term char)
+//   event lines in front of it are passed to dispatchEvent
+////////////////////////////////////////////////////////
+static long ardRead(ARD_Handle h, unsigned char *buf, unsigned int size, unsigned int *count)
+{
+	long status;
+
+	// events can arrive between the replies, they are handed on and skipped
+	do {
+		status = h->transport->read(h->conn, buf, size, 1, count);
+	} while (!status && dispatchEvent(h, buf, *count)==0);
+	return status;
+}
+
+
+////////////////////////////////////////////////////////
+// Send a command and scan the response line
+//   returns ARD_STATUS_BADREPLY if not a single field could be scanned
+////////////////////////////////////////////////////////
+static long ardQueryf(ARD_Handle h, const char *cmd, const char *format, ...)
+{
+	char resp[256];
+	unsigned int count;
+	va_list args;
+	long status;
+	int fields;
+
+	status = h->transport->write(h->conn, cmd, (unsigned int)strlen(cmd));
+	if (status) return status;
+	status = ardRead(h, (unsigned char *)resp, sizeof(resp)-1, &count);
+	if (status) return status;
+	resp[count] = '\0';
+	va_start(args, format);
+	fields = vsscanf(resp, format, args);
+	va_end(args);
+	return (fields > 0) ? 0 : ARD_STATUS_BADREPLY;
+}
+
+
+////////////////////////////////////////////////////////
+// Send a command that is answered with OK
+//   function: name of the calling function, for the error reports
+////////////////////////////////////////////////////////
+static int sendCommand(ARD_Handle h, const char *function, const char *cmd)
+{
+	int isLocked=0;
+
+	if (!h || !h->conn) {
+		reportError (__LINE__-2, function, "Device not open.");
+		goto fail;
+	}
+
+	if (lockHandle(h, function)) goto fail;
+	isLocked=1;
+	if (h->binaryMode) {
+		reportError (__LINE__-1, function, "Not available in binary mode.");
+		goto fail;
+	}
+
+	h->status = ardPrintf(h, "%s\n", cmd);
+	if(h->status) {
+		reportIOError (__LINE__-2, function, h, h->status);
+		goto fail;
+	}
+	if(checkErrorResponse(h)!=0) {
+		reportError (__LINE__-1, function, "ARD error:");
+		goto fail;
+	}
+
+	isLocked=0;
+	if (unlockHandle(h, function)) goto fail;
+
+	return 0;
+
+fail:
+	if (isLocked) unlockHandle(h, NULL);
+	return -1;
+}
+
+
+////////////////////////////////////////////////////////
+// Wait until the Arduino has written a save (SAV, SPS) to the EEPROM
+//   other calls can go on meanwhile, the controller keeps running during the save
+////////////////////////////////////////////////////////
+static int waitForSave(ARD_Handle h, const char *function)
+{
+	int running, done, total, waited_ms=0;
+
+	while (1) {
+		if (ARDH_ShutterGetSaveStatus(h, &running, &done, &total)) return -1;
+		if (!running) return 0;
+		if (waited_ms>=SAVE_TIMEOUT_MS) {
+			reportError (__LINE__-1, function, "Save did not finish.");
+			return -1;
+		}
+		threadSleep(SAVE_POLL_MS);
+		waited_ms += SAVE_POLL_MS;
+	}
+}
+
+
+////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////
+// Get integer device parameter
+////////////////////////////////////////////////////////
+static int getDeviceParameterInt(ARD_Handle h, const char *cmd, int device, int *param)
+{
+	unsigned char instrResp[256];
+	unsigned int charsRead;
+
+	h->status = ardPrintf(h, "G%s%d\n", cmd, device);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+	h->status = ardRead (h, instrResp, 255, &charsRead);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+	if (charsRead<5) { // at least it should return "XX=d"
+		reportError (__LINE__-2, __func__, "No command response received.");
+		goto fail;
+	}
+	// check for response
+	if (ardParseIsError((char *)instrResp, charsRead)==0){
+		instrResp[ardParseLineLength((char *)instrResp, charsRead)]='\0';
+		reportARDError (__LINE__-2, __func__, (char *)instrResp);
+		goto fail;
+	}
+	// checks the cmd identifier and the device number, too
+	if (ardParseDeviceInt((char *)instrResp, charsRead, cmd, device, param)) {
+		reportError (__LINE__-1, __func__, "Could not read shutter parameter.");
+		goto fail;
+	}
+
+	return 0;
+fail:
+	return -1;
+}
+
+
+////////////////////////////////////////////////////////
+// Get string device parameter
+////////////////////////////////////////////////////////
+static int getDeviceParameterString(ARD_Handle h, const char *cmd, int device, char *str)
+{
+	unsigned char instrResp[256];
+	unsigned int charsRead;
+
+	h->status = ardPrintf(h, "G%s%d\n", cmd, device);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+	h->status = ardRead (h, instrResp, 255, &charsRead);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+	if (charsRead<5) { // at least it should return "XX=d"
+		reportError (__LINE__-2, __func__, "No command response received.");
+		goto fail;
+	}
+	// check for response
+	if (ardParseIsError((char *)instrResp, charsRead)==0){
+		instrResp[ardParseLineLength((char *)instrResp, charsRead)]='\0';
+		reportARDError (__LINE__-2, __func__, (char *)instrResp);
+		goto fail;
+	}
+	// checks the cmd identifier and the device number, too
+	if (ardParseDeviceString((char *)instrResp, charsRead, cmd, device, str, sizeof(instrResp))) {
+		reportError (__LINE__-1, __func__, "Could not read shutter return string.");
+		goto fail;
+	}
+		
+	return 0;
+fail:
+	return -1;
+}
+
+
+////////////////////////////////////////////////////////
+// Get all parameters of a device (GPR)
+//   values: shieldChannel, digIn, openPos, closedPos, transitDelay_ms
+//   label: at least 256 chars
+////////////////////////////////////////////////////////
+static int getDeviceParameters(ARD_Handle h, int device, int *values, char *label)
+{
+	unsigned char instrResp[256];
+	unsigned int charsRead;
+
+	h->status = ardPrintf(h, "GPR%d\n", device);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+	h->status = ardRead (h, instrResp, 255, &charsRead);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+	if (charsRead<5) { // at least it should return "XX=d"
+		reportError (__LINE__-1, __func__, "No command response received.");
+		goto fail;
+	}
+	// check for response
+	if (ardParseIsError((char *)instrResp, charsRead)==0){
+		instrResp[ardParseLineLength((char *)instrResp, charsRead)]='\0';
+		reportARDError (__LINE__-2, __func__, (char *)instrResp);
+		goto fail;
+	}
+	if (ardParseParameters((char *)instrResp, charsRead, device, values, label, sizeof(instrResp))) {
+		reportError (__LINE__-1, __func__, "Could not read shutter return string.");
+		goto fail;
+	}
+
+	return 0;
+fail:
+	return -1;
+}
+
+
+////////////////////////////////////////////////////////
+// Set int parameter
+//   device: the shutter attached to the Arduino
+////////////////////////////////////////////////////////
+static int setDeviceParameterInt(ARD_Handle h, const char *cmd, int device, int param)
+{
+	h->status = ardPrintf(h, "S%s%d,%d\n", cmd, device, param);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+	if(checkErrorResponse(h)!=0) {
+		reportError (__LINE__-1, __func__, "ARD error:");
+		goto fail;
+	}
+	
+	return 0;
+fail:
+	return -1;
+}
+
+
+////////////////////////////////////////////////////////
+// Check for an OK response from the device
+////////////////////////////////////////////////////////
+static int checkErrorResponse(ARD_Handle h)
+{
+	unsigned char instrResp[256];
+	unsigned int charsRead;	
+
+	h->status = ardRead (h, instrResp, 255, &charsRead);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		return -1;
 	}
 	// check for errors
-	if ( strncmp ((char *)instrResp, "OK", 2) != 0) {
-		instrResp[charsRead-2]='\0';	
+	if (ardParseIsOK((char *)instrResp, charsRead) != 0) {
+		instrResp[ardParseLineLength((char *)instrResp, charsRead)]='\0';
 		reportARDError (__LINE__-2, __func__, (char *)instrResp);
 		return -1;
 	}
@@ -742,6 +2517,102 @@ static int checkErrorResponse(ViSession io)
 }
 
 
+////////////////////////////////////////////////////////
+// Send one binary request frame and read the response frame
+//   resp: BINFRAME_SIZE bytes, valid if the function returns 0
+////////////////////////////////////////////////////////
+static int binaryTransaction(ARD_Handle h, int cmd, int b0, int b1, int b2, unsigned char *resp)
+{
+	unsigned char req[BINFRAME_SIZE];
+	unsigned int count;
+	char desc[64];
+
+	req[0] = BINFRAME_SYNC_REQ;
+	req[1] = ++h->binSeq;
+	req[2] = (unsigned char)cmd;
+	req[3] = (unsigned char)b0;
+	req[4] = (unsigned char)b1;
+	req[5] = (unsigned char)b2;
+	req[6] = binaryCRC(req, BINFRAME_SIZE-1);
+
+	h->status = h->transport->write(h->conn, req, BINFRAME_SIZE);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		return -1;
+	}
+	// skip stale responses (e.g. from a request that timed out) by their sequence number
+	do {
+		h->status = h->transport->read(h->conn, resp, BINFRAME_SIZE, 0, &count);
+		if(h->status) {
+			reportIOError (__LINE__-2, __func__, h, h->status);
+			return -1;
+		}
+		if (count!=BINFRAME_SIZE || resp[0]!=BINFRAME_SYNC_RESP
+				|| binaryCRC(resp, BINFRAME_SIZE-1)!=resp[BINFRAME_SIZE-1]) {
+			reportError (__LINE__-2, __func__, "Invalid response frame.");
+			return -1;
+		}
+	} while (resp[1]!=h->binSeq);
+
+	if (resp[2]!=BINSTAT_OK) {
+		sprintf(desc, "Binary command 0x%02X failed with status %d.", cmd, resp[2]);
+		reportARDError (__LINE__-2, __func__, desc);
+		return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////
+// Set a state with the compact frame: 3 bytes out, one ack byte back
+//   (the most frequent command; the full frame would take 14 bytes)
+////////////////////////////////////////////////////////
+static int binarySetState(ARD_Handle h, int device, int state)
+{
+	unsigned char req[BINFRAME_SST_SIZE], ack;
+	unsigned int count;
+
+	if (device<0 || device>0x7F) {
+		reportError (__LINE__-1, __func__, "Invalid device number.");
+		return -1;
+	}
+	req[0] = BINFRAME_SYNC_SST;
+	req[1] = (unsigned char)(device | (state ? 0x80 : 0));
+	req[2] = binaryCRC(req, BINFRAME_SST_SIZE-1);
+
+	h->status = h->transport->write(h->conn, req, BINFRAME_SST_SIZE);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		return -1;
+	}
+	h->status = h->transport->read(h->conn, &ack, 1, 0, &count);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		return -1;
+	}
+	if (count!=1 || ack!=BINACK_OK) {
+		reportARDError (__LINE__-1, __func__, "Compact set-state frame rejected (invalid device or CRC).");
+		return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////
+// CRC-8 (polynomial 0x07, init 0) of the binary frames
+////////////////////////////////////////////////////////
+static unsigned char binaryCRC(const unsigned char *data, int len)
+{
+	unsigned char crc = 0;
+	int z;
+
+	while (len--) {
+		crc ^= *data++;
+		for (z=0; z<8; z++)
+			crc = (crc & 0x80) ? (unsigned char)((crc << 1) ^ 0x07) : (unsigned char)(crc << 1);
+	}
+	return crc;
+}
+
+
 ////////////////////////////////////////////////////////
 // Report a generic error within this module
 ////////////////////////////////////////////////////////
@@ -754,18 +2625,19 @@ static void reportError(int line, const char* function, char* description )
 }
 
 ////////////////////////////////////////////////////////
-// Report a VISA-generated error within this module
+// Report a transport (VISA, termios) error within this module
 ////////////////////////////////////////////////////////
-static void reportVisaError(int line, const char* function, ViSession instr, ViStatus errStatus )
+static void reportIOError(int line, const char* function, ARD_Handle h, long errStatus )
 {
 	char desc[256];
 
-	_status = viStatusDesc (instr, errStatus, desc);
-	if (!_status)
-		printf("\nVisa error in function %s (line %i of file %s): %s\n", function, line, __FILE__, desc );
+	if (errStatus == ARD_STATUS_TOOLONG)
+		strcpy(desc, "Command too long.");
+	else if (errStatus == ARD_STATUS_BADREPLY)
+		strcpy(desc, "Unexpected response.");
 	else
-		printf("\nVisa error in function %s (line %i of file %s), but could not get function description.\n",
-					 function, line, __FILE__);
+		h->transport->errorDesc(h->conn, errStatus, desc, sizeof(desc));
+	printf("\n%s error in function %s (line %i of file %s): %s\n", h->transport->name, function, line, __FILE__, desc );
 }
 
 ////////////////////////////////////////////////////////
@@ -776,3 +2648,424 @@ static void reportARDError(int line, const char* function, char* description )
 	printf("\nArduino returned error in function %s (line %i of file %s): %s\n", function, line, __FILE__, description );
 }
 
+
+////////////////////////////////////////////////////////
+// Append a command to a batch
+//   type, tag, device: expected reply, result: where to store its value
+////////////////////////////////////////////////////////
+static int batchAdd(ARD_Batch b, const char *function, BatchReplyType type, const char *tag,
+										int device, void *result, const char *format, ...)
+{
+	BatchEntry *entry;
+	va_list args;
+	int len;
+
+	if (!b) {
+		reportError (__LINE__-1, function, "No batch.");
+		return -1;
+	}
+	if (b->numCmds>=ARD_BATCH_MAXCMDS) {
+		reportError (__LINE__-1, function, "Batch is full.");
+		return -1;
+	}
+	entry = &b->cmds[b->numCmds];
+	va_start(args, format);
+	len = vsnprintf(entry->cmd, sizeof(entry->cmd), format, args);
+	va_end(args);
+	if (len < 0 || len >= (int)sizeof(entry->cmd)) {
+		reportError (__LINE__-4, function, "Command too long.");
+		return -1;
+	}
+	entry->len = (unsigned int)len;
+	entry->type = type;
+	strncpy(entry->tag, tag, sizeof(entry->tag)-1);
+	entry->device = device;
+	entry->result = result;
+	entry->resultSize = 0;
+	b->numCmds++;
+	return 0;
+}
+
+
+////////////////////////////////////////////////////////
+// Append a GDL command to a batch
+//   size: size of the label buffer, longer labels are cut off
+////////////////////////////////////////////////////////
+static int batchGetLabel(ARD_Batch batch, const char *function, int device, char *label, unsigned int size)
+{
+	if (batchAdd(batch, function, BatchReplyString, "DL", device, label, "GDL%d\n", device)) return -1;
+	batch->cmds[batch->numCmds-1].resultSize = size;
+	return 0;
+}
+
+
+////////////////////////////////////////////////////////
+// Check the reply to a batch command and store its value
+////////////////////////////////////////////////////////
+static int batchParseReply(const BatchEntry *entry, const char *resp, unsigned int len)
+{
+	switch (entry->type) {
+		case BatchReplyInt:
+			return ardParseDeviceInt(resp, len, entry->tag, entry->device, (int *)entry->result);
+		case BatchReplyString:
+			return ardParseDeviceString(resp, len, entry->tag, entry->device, (char *)entry->result, entry->resultSize);
+		default:
+			return ardParseIsOK(resp, len);
+	}
+}
+
+
+////////////////////////////////////////////////////////
+// Get the cached parameters of a device, read them with GPR if needed
+//   returns NULL on error (already reported)
+////////////////////////////////////////////////////////
+static CacheEntry *cacheParameters(ARD_Handle h, int device)
+{
+	CacheEntry *entry;
+
+	if (!cacheHolds(h, device)) {
+		reportError (__LINE__-1, __func__, "Invalid device number.");
+		return NULL;
+	}
+	entry = &h->cache[device];
+	if (!entry->valid) {
+		if (getDeviceParameters(h, device, entry->values, entry->label)) return NULL;
+		entry->valid = 1;
+	}
+	return entry;
+}
+
+
+////////////////////////////////////////////////////////
+// Note a state that was set successfully
+////////////////////////////////////////////////////////
+static void cacheSetState(ARD_Handle h, int device, int state)
+{
+	if (!cacheHolds(h, device)) return;
+	h->cache[device].state = state;
+	h->cache[device].stateValid = 1;
+}
+
+
+////////////////////////////////////////////////////////
+// Drop all cached values
+////////////////////////////////////////////////////////
+static void cacheInvalidate(ARD_Handle h)
+{
+	int z;
+
+	h->cacheNumDevices = -1;
+	for (z=0; z<h->cacheSize; z++) {
+		h->cache[z].valid = 0;
+		h->cache[z].stateValid = 0;
+	}
+}
+
+
+////////////////////////////////////////////////////////
+// Make room for numDevices devices, the new entries are empty
+//   returns -1 if out of memory (the cache keeps its size)
+////////////////////////////////////////////////////////
+static int cacheResize(ARD_Handle h, int numDevices)
+{
+	CacheEntry *cache;
+
+	if (numDevices <= h->cacheSize) return 0;
+	cache = realloc(h->cache, numDevices*sizeof(CacheEntry));
+	if (!cache) {
+		reportError (__LINE__-2, __func__, "Out of memory.");
+		return -1;
+	}
+	memset(cache + h->cacheSize, 0, (numDevices - h->cacheSize)*sizeof(CacheEntry));
+	h->cache = cache;
+	h->cacheSize = numDevices;
+	return 0;
+}
+
+
+////////////////////////////////////////////////////////
+// 1 if the device has a cache entry
+////////////////////////////////////////////////////////
+static int cacheHolds(ARD_Handle h, int device)
+{
+	return device>=0 && device<h->cacheSize;
+}
+
+
+////////////////////////////////////////////////////////
+// Read the number of devices and the parameters (and states) of all devices
+//   the handle must be locked and in ASCII mode
+////////////////////////////////////////////////////////
+static int cacheFill(ARD_Handle h)
+{
+	int numDevices, dev;
+
+	if (h->binaryMode) {
+		reportError (__LINE__-1, __func__, "Not available in binary mode.");
+		return -1;
+	}
+	h->status = ardQueryf(h, "GND\n", "ND=%d", &numDevices);
+	if(h->status) {
+		reportIOError (__LINE__-2, __func__, h, h->status);
+		return -1;
+	}
+	if (cacheResize(h, numDevices)) return -1;
+	for (dev=0; dev<numDevices; dev++) {
+		if ((h->cacheMode & ARD_CACHE_PARAMETERS) && !cacheParameters(h, dev)) return -1;
+		if (h->cacheMode & ARD_CACHE_STATES) {
+			if (getDeviceParameterInt(h, "ST", dev, &h->cache[dev].state)) return -1;
+			h->cache[dev].stateValid = 1;
+		}
+	}
+	if (h->cacheMode & ARD_CACHE_PARAMETERS) h->cacheNumDevices = numDevices;
+	return 0;
+}
+
+
+////////////////////////////////////////////////////////
+// Hand an event line to the callback and the cache
+//   returns -1 if the line is not an event
+////////////////////////////////////////////////////////
+static int dispatchEvent(ARD_Handle h, const unsigned char *line, unsigned int len)
+{
+	ARD_Event event;
+
+	if (len==0 || line[0]!='!') return -1;
+	if (ardParseEvent((const char *)line, len, &event.device, &event.state, &event.source, &event.time_ms))
+		return 0; // garbled event, skip it as well
+	cacheSetState(h, event.device, event.state);
+	if (h->eventCallback) h->eventCallback(h, &event, h->eventUserData);
+	return 0;
+}
+
+
+////////////////////////////////////////////////////////
+// Background reader: looks for events while no command is running
+////////////////////////////////////////////////////////
+static void eventReader(ARD_Handle h)
+{
+	unsigned char line[256];
+	unsigned int count;
+	long status;
+
+	while (!h->eventStop) {
+		threadSleep(EVENT_POLL_MS);
+		if (lockHandle(h, __func__)) continue;
+		// only ASCII lines can be events; in binary mode the bytes belong to the commands
+		if (!h->binaryMode && h->transport->available(h->conn, &count)==0 && count>0) {
+			status = h->transport->read(h->conn, line, sizeof(line)-1, 1, &count);
+			if (status)
+				reportIOError (__LINE__-2, __func__, h, status);
+			else
+				dispatchEvent(h, line, count); // anything else is a late reply, dropped
+		}
+		unlockHandle(h, NULL);
+	}
+}
+
+#ifdef _WIN32
+static DWORD WINAPI eventReaderThread(LPVOID arg)
+{
+	eventReader((ARD_Handle)arg);
+	return 0;
+}
+#else
+static void *eventReaderThread(void *arg)
+{
+	eventReader((ARD_Handle)arg);
+	return NULL;
+}
+#endif
+
+
+////////////////////////////////////////////////////////
+// Start / stop the background reader
+////////////////////////////////////////////////////////
+static int eventThreadStart(ARD_Handle h)
+{
+	h->eventStop = 0;
+#ifdef _WIN32
+	h->eventThread = CreateThread(NULL, 0, eventReaderThread, h, 0, NULL);
+	if (!h->eventThread) return -1;
+#else
+	if (pthread_create(&h->eventThread, NULL, eventReaderThread, h)) return -1;
+#endif
+	h->eventThreadRunning = 1;
+	return 0;
+}
+
+static void eventThreadStop(ARD_Handle h)
+{
+	if (!h->eventThreadRunning) return;
+	h->eventStop = 1;
+#ifdef _WIN32
+	WaitForSingleObject(h->eventThread, INFINITE);
+	CloseHandle(h->eventThread);
+#else
+	pthread_join(h->eventThread, NULL);
+#endif
+	h->eventThreadRunning = 0;
+}
+
+
+////////////////////////////////////////////////////////
+// Transport for an address: paths (/dev/...) use termios, everything else VISA
+////////////////////////////////////////////////////////
+static const ArdTransport *transportFor(const char *address)
+{
+	const ArdTransport *transport = NULL;
+
+#ifdef ARD_WITH_TERMIOS
+	if (address[0] == '/') transport = &ARD_TransportTermios;
+#endif
+#ifdef ARD_WITH_VISA
+	if (!transport) transport = &ARD_TransportVisa;
+#endif
+	return transport;
+}
+
+
+////////////////////////////////////////////////////////
+// Open a controller and check its ID (ARDH_OpenWithTransport)
+//   quiet: no error reports up to the ID check and a short default timeout,
+//     for probing ports that may not be controllers (ARD_ShutterDiscover)
+////////////////////////////////////////////////////////
+static int openController(const ArdTransport *transport, const char *address,
+													const ARD_SerialOptions *options, int quiet, ARD_Handle *handle)
+{
+	unsigned char instrResp[256];
+	unsigned int charsRead;
+	int isLocked=0;
+	ARD_Handle h;
+	ARD_SerialOptions opt = {0};
+
+	*handle = NULL;
+	if (options) opt = *options;
+	if (opt.baud <= 0) opt.baud = SERIAL_BAUDRATE;
+	if (opt.timeout_ms <= 0) opt.timeout_ms = quiet ? ARD_DISCOVER_TIMEOUT_MS : SERIAL_TIMEOUT_MS;
+
+	h = calloc(1, sizeof(struct ARD_ShutterHandle));
+	if (!h) {
+		reportError (__LINE__-2, __func__, "Out of memory.");
+		return -1;
+	}
+	mutexInit(&h->mutex);
+	h->transport = transport;
+	
+	h->status = transport->open(address, &opt, &h->conn);
+	if(h->status) {
+		if (!quiet) reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+
+	if (lockHandle(h, quiet ? NULL : __func__)) goto fail;
+	isLocked=1;
+	
+	// ask for identification; here I use printf/read because of the spaces in the return string
+	h->status = ardPrintf(h, "*IDN?\n");
+	if(h->status) {
+		if (!quiet) reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+	h->status = ardRead (h, instrResp, 255, &charsRead);
+	if(h->status) {
+		if (!quiet) reportIOError (__LINE__-2, __func__, h, h->status);
+		goto fail;
+	}
+	if (charsRead<2) {
+		if (!quiet) reportError (__LINE__-6, __func__, "No ID response received.");
+		goto fail;
+	}
+	instrResp[ardParseLineLength((char *)instrResp, charsRead)]='\0';
+//	printf("%s\n", instrResp);
+	if ( strncmp ((char *)instrResp, ARD_SHUTTER_RESPONSE, strlen(ARD_SHUTTER_RESPONSE)) != 0) {
+		if (!quiet) reportError (__LINE__-1, __func__, "Device is not a shutter driver.");
+		goto fail;
+	}
+	
+	isLocked=0;
+	if (unlockHandle(h, __func__)) goto fail;
+	
+	cacheInvalidate(h);
+	if (opt.cache && ARDH_ShutterSetCache(h, opt.cache)) goto fail;
+
+	*handle = h;
+	return 0;
+	
+fail:
+
+	if (isLocked) unlockHandle(h, NULL);
+	ARDH_Close(h);
+	return -1;
+}
+
+
+////////////////////////////////////////////////////////
+// Probe one port for a controller and read its devices
+////////////////////////////////////////////////////////
+static void probeController(DiscoverProbe *p)
+{
+	const ArdTransport *transport;
+	ARD_Handle h;
+	ARD_Batch batch;
+	int numLabels, device;
+
+	transport = transportFor(p->info.address);
+	if (!transport || openController(transport, p->info.address, p->options, 1, &h)) return;
+
+	if (ARDH_ShutterGetNumDevices(h, &p->info.numDevices)) goto done;
+	numLabels = p->info.numDevices;
+	if (numLabels > ARD_DISCOVER_MAXDEVICES) numLabels = ARD_DISCOVER_MAXDEVICES;
+	if (numLabels > 0) {
+		// the labels in one pipelined batch
+		if (ARDH_BatchBegin(h, &batch)) goto done;
+		for (device=0; device<numLabels; device++)
+			batchGetLabel(batch, __func__, device, p->info.labels[device], sizeof(p->info.labels[device]));
+		if (ARD_BatchCommit(batch)) goto done;
+	}
+	p->found = 1;
+
+done:
+	ARDH_Close(h);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI probeThread(LPVOID arg)
+{
+	probeController((DiscoverProbe *)arg);
+	return 0;
+}
+#else
+static void *probeThread(void *arg)
+{
+	probeController((DiscoverProbe *)arg);
+	return NULL;
+}
+#endif
+
+
+////////////////////////////////////////////////////////
+// Start / wait for the thread of a probe
+////////////////////////////////////////////////////////
+static int probeThreadStart(DiscoverProbe *p)
+{
+#ifdef _WIN32
+	p->thread = CreateThread(NULL, 0, probeThread, p, 0, NULL);
+	if (!p->thread) return -1;
+#else
+	if (pthread_create(&p->thread, NULL, probeThread, p)) return -1;
+#endif
+	p->threadRunning = 1;
+	return 0;
+}
+
+static void probeThreadJoin(DiscoverProbe *p)
+{
+#ifdef _WIN32
+	WaitForSingleObject(p->thread, INFINITE);
+	CloseHandle(p->thread);
+#else
+	pthread_join(p->thread, NULL);
+#endif
+	p->threadRunning = 0;
+}
@@ -3,6 +3,14 @@
 // Header file for the utility functions for the Arduino
 //
 // *****************************************************************************************
+#ifndef ARD_SHUTTER_H
+#define ARD_SHUTTER_H
+
+// one bit per device, bit n -> device n
+//   64 bits for the largest firmware build; how many devices a controller really has is set
+//   by MAXSHUTTERS in its Common.h (4 by default) and limited by its EEPROM: an Uno takes
+//   5 shutters with 4 presets, 11 with 1, 18 with none; a Mega 26, 54 and 64 (MAXPRESETS 0)
+typedef unsigned long long ARD_DeviceMask;
 
 
 // *****************************************************************************************
@@ -39,11 +47,50 @@ int ARD_ShutterGetDeviceLabel(int device, char *label);
 //   transit time in ms
 int ARD_ShutterGetTransitDelay(int device, int *transDelay_ms);
 
+// Set the states of several shutters in one command (they move together)
+//   mask: bit n set -> change device n (up to the number of devices, see ARD_DeviceMask);
+//     bits of missing devices make the command fail; in binary mode all devices
+//     must be in one group of eight (0-7, 8-15, ...)
+//   states: bit n is the new state of device n (0->Closed, 1->Open)
+int ARD_ShutterSetStates(ARD_DeviceMask mask, ARD_DeviceMask states);
+
 // Set shutter position
 //   device: the shutter attached to the Arduino
 //   position: PWM value
 int ARD_ShutterSetPosition(int device, int PWMVal);
 
+// Get / set the hit-and-hold pulse of a solenoid shutter (SHUTTER_SOLENOID only)
+//   device: the shutter attached to the Arduino
+//   hitTime_ms: a change to a nonzero force starts with this long a full-power
+//     pulse, then holds with the force of the state (openPos); 0->constant force
+int ARD_ShutterGetHitTime(int device, int *hitTime_ms);
+int ARD_ShutterSetHitTime(int device, int hitTime_ms);
+
+// Get / set the motion profile of a servo shutter (SHUTTER_RCSERVO only)
+//   device: the shutter attached to the Arduino
+//   maxStep: top speed in PWM counts per servo frame (20 ms), 0->no profile, the servo
+//     gets the new position at once
+//   accel: speed increase per frame, 0->start at maxStep
+//   brake: speed decrease per frame before the target, 0->same as accel
+int ARD_ShutterGetMotion(int device, int *maxStep, int *accel, int *brake);
+int ARD_ShutterSetMotion(int device, int maxStep, int accel, int brake);
+
+// Get / set the stacked shield board of a shutter (several servo or motor boards)
+//   device: the shutter attached to the Arduino
+//   board: 0 for the first board (RCSERVO_BOARDID/SOLENOID_BOARDID), 1 for the next
+//     address, ...; the shield channel of the parameters is on this board
+int ARD_ShutterGetBoard(int device, int *board);
+int ARD_ShutterSetBoard(int device, int board);
+
+// Get / set the actuator type of a shutter (controllers built for servos and solenoids)
+//   device: the shutter attached to the Arduino
+//   type: ARD_ACTUATOR_RCSERVO or ARD_ACTUATOR_SOLENOID; the state is unknown (-2) after
+//     a change until the next ARD_ShutterSetState
+#define ARD_ACTUATOR_RCSERVO  0
+#define ARD_ACTUATOR_SOLENOID 1
+int ARD_ShutterGetActuator(int device, int *type);
+int ARD_ShutterSetActuator(int device, int type);
+
 // Get shutter parameters
 //   device: the shutter attached to the Arduino
 //   shieldChannel: actuator chanel on the shield
@@ -65,4 +112,248 @@ int ARD_ShutterSetParameters(int device, int PWMChannel, int digInput, int openP
 														 int closedPos, int transitDelay_ms, const char* label);
 
 // Save parameters to EEPROM
+//   the controller writes the EEPROM in the background (shutters stay responsive),
+//   the call returns when it is done
 int ARD_ShutterSaveToEEPROM(void);
+
+// Progress of the EEPROM save
+//   running: 1 while the save is written, 0 when done
+//   done, total: bytes written (or found unchanged) so far and in all
+int ARD_ShutterGetSaveStatus(int *running, int *done, int *total);
+
+#define ARD_MAXPRESETS 4 // MAXPRESETS of the Arduino code
+// Named presets: complete shutter sets stored in the EEPROM of the Arduino
+//   preset: 0..ARD_MAXPRESETS-1
+//   ARD_ShutterGetPreset: name receives the name (like a label, empty for an empty preset),
+//     numDevices the number of shutters (0->empty), active is 1 if the current shutters
+//     are this preset (loaded or stored, unchanged since)
+//   ARD_ShutterLoadPreset: replaces all shutters by the preset in one command (not saved,
+//     see ARD_ShutterSaveToEEPROM)
+//   ARD_ShutterStorePreset: stores the current shutters, name up to 7 characters; waits
+//     until the EEPROM is written
+int ARD_ShutterGetPreset(int preset, char *name, int *numDevices, int *active);
+int ARD_ShutterLoadPreset(int preset);
+int ARD_ShutterStorePreset(int preset, const char *name);
+
+// Switch between the ASCII commands and the binary frame protocol
+//   enable: 1->binary frames, 0->ASCII
+//   In binary mode only ARD_ShutterGetNumDevices, ARD_ShutterGetState,
+//   ARD_ShutterSetState(s) and ARD_ShutterSetPosition are available.
+int ARD_ShutterBinaryMode(int enable);
+
+// Get the digital input edge-to-actuation latency statistics (needs DIGINPUT in the Arduino code)
+//   count: number of edges that moved a shutter
+//   last/min/max_us: latency in us
+int ARD_ShutterGetLatency(int *count, unsigned long *last_us, unsigned long *min_us, unsigned long *max_us);
+
+// Reset the latency statistics
+int ARD_ShutterClearLatency(void);
+
+// Timing histograms (needs STATS in the Arduino code)
+#define ARD_STATS_LOOP      0 // period of the main loop
+#define ARD_STATS_PARSE     1 // serial command handling
+#define ARD_STATS_ACTUATOR  2 // actuator write
+#define ARD_STATS_DISPLAY   3 // display redraw
+#define ARD_STATS_BUCKETS   8
+// Get the histogram of a channel
+//   count: number of measurements, max_us: longest measurement
+//   buckets: array of ARD_STATS_BUCKETS counts
+int ARD_ShutterGetStats(int channel, unsigned long *count, unsigned long *max_us, unsigned int *buckets);
+
+// Reset all histograms
+int ARD_ShutterClearStats(void);
+
+// Upper limit of a bucket in us, 0 for the last (open-ended) bucket
+unsigned long ARD_ShutterStatsBucketLimit(int bucket);
+
+// Sequencer (needs SEQUENCER in the Arduino code): the Arduino plays a list of timed
+//   events on its own, independent of the host timing.
+// Remove all events
+int ARD_ShutterSeqClear(void);
+
+// Append an event
+//   offset_us: time after the start of each pass, must not decrease
+//   mask: bit n set -> change device n
+//   states: bit n is the new state of device n (0->Closed, 1->Open)
+int ARD_ShutterSeqAddEvent(unsigned long offset_us, ARD_DeviceMask mask, ARD_DeviceMask states);
+
+// Set number of passes, trigger and pass length
+//   loops: passes to play, 0 until aborted
+//   trigger: 0->ARD_ShutterSeqStart, 1-4->rising edge on digital input 0-3 (firmware built with DIGINPUT)
+//   period_us: length of a pass, 0 for the time of the last event
+int ARD_ShutterSeqConfigure(int loops, int trigger, unsigned long period_us);
+
+// Wait for the trigger / start an armed sequence / stop
+int ARD_ShutterSeqArm(void);
+int ARD_ShutterSeqStart(void);
+int ARD_ShutterSeqAbort(void);
+
+// Get status
+//   state: 0->idle, 1->armed, 2->running
+//   loopsDone: completed passes
+//   nextEvent: index of the next event in the current pass
+int ARD_ShutterSeqGetStatus(int *state, int *loopsDone, int *nextEvent);
+
+// Get planned and actual time of an event in the latest pass, in us after the pass start
+int ARD_ShutterSeqGetTiming(int event, unsigned long *planned_us, unsigned long *actual_us);
+
+// Handle-based functions: one handle per controller, so a process can drive several
+//   controllers. Calls on one handle are serialized, calls on different handles can run
+//   in parallel threads. Each ARDH_ function works like the ARD_ function of the same
+//   name; the ARD_ functions use a default handle opened by ARD_ShutterInit.
+typedef struct ARD_ShutterHandle *ARD_Handle;
+
+// Connection options, zero fields select the default
+typedef struct {
+	long baud;					// baud rate, default 9600 (SERIAL_BAUDRATE of the Arduino code)
+	int lowLatency;			// termios: 1->ask the USB serial driver for low latency (default), -1->leave as is
+	int resetDelay_ms;	// wait after opening (the Uno resets on open unless the reset jumper is shorted)
+	int timeout_ms;			// read timeout, default 1000 ms
+	int cache;					// ARD_CACHE_ flags, see ARDH_ShutterSetCache
+} ARD_SerialOptions;
+
+// Open a controller, handle receives the handle (NULL on failure)
+//   address: device path (/dev/ttyACM0, native termios transport) or VISA resource name
+int ARDH_Open(const char *address, ARD_Handle *handle);
+
+// Same with connection options (options may be NULL)
+int ARDH_OpenSerial(const char *address, const ARD_SerialOptions *options, ARD_Handle *handle);
+
+// Same over a user-supplied transport (see ArdTransport.h)
+struct ArdTransport;
+int ARDH_OpenWithTransport(const struct ArdTransport *transport, const char *address,
+													 const ARD_SerialOptions *options, ARD_Handle *handle);
+
+// Close a controller; the handle is freed even if closing the connection fails
+int ARDH_Close(ARD_Handle h);
+
+int ARDH_ShutterGetNumDevices(ARD_Handle h, int *numDevices);
+int ARDH_ShutterClearDev(ARD_Handle h);
+int ARDH_ShutterGetState(ARD_Handle h, int device, int *state);
+int ARDH_ShutterGetDeviceLabel(ARD_Handle h, int device, char *label);
+int ARDH_ShutterGetTransitDelay(ARD_Handle h, int device, int *transDelay_ms);
+int ARDH_ShutterSetState(ARD_Handle h, int device, int state);
+int ARDH_ShutterSetStates(ARD_Handle h, ARD_DeviceMask mask, ARD_DeviceMask states);
+int ARDH_ShutterSetPosition(ARD_Handle h, int device, int pos);
+int ARDH_ShutterGetHitTime(ARD_Handle h, int device, int *hitTime_ms);
+int ARDH_ShutterSetHitTime(ARD_Handle h, int device, int hitTime_ms);
+int ARDH_ShutterGetMotion(ARD_Handle h, int device, int *maxStep, int *accel, int *brake);
+int ARDH_ShutterSetMotion(ARD_Handle h, int device, int maxStep, int accel, int brake);
+int ARDH_ShutterGetBoard(ARD_Handle h, int device, int *board);
+int ARDH_ShutterSetBoard(ARD_Handle h, int device, int board);
+int ARDH_ShutterGetActuator(ARD_Handle h, int device, int *type);
+int ARDH_ShutterSetActuator(ARD_Handle h, int device, int type);
+int ARDH_ShutterGetParameters(ARD_Handle h, int device, int *shieldChannel, int *digIn, int *openPos, int *closedPos, int *transitDelay_ms, char* label);
+int ARDH_ShutterSetParameters(ARD_Handle h, int device, int shieldChannel, int digInput, int openPos, int closedPos, int transitDelay_ms, const char* label);
+int ARDH_ShutterSaveToEEPROM(ARD_Handle h);
+int ARDH_ShutterGetSaveStatus(ARD_Handle h, int *running, int *done, int *total);
+int ARDH_ShutterGetPreset(ARD_Handle h, int preset, char *name, int *numDevices, int *active);
+int ARDH_ShutterLoadPreset(ARD_Handle h, int preset);
+int ARDH_ShutterStorePreset(ARD_Handle h, int preset, const char *name);
+int ARDH_ShutterBinaryMode(ARD_Handle h, int enable);
+int ARDH_ShutterGetLatency(ARD_Handle h, int *count, unsigned long *last_us, unsigned long *min_us, unsigned long *max_us);
+int ARDH_ShutterClearLatency(ARD_Handle h);
+int ARDH_ShutterGetStats(ARD_Handle h, int channel, unsigned long *count, unsigned long *max_us, unsigned int *buckets);
+int ARDH_ShutterClearStats(ARD_Handle h);
+int ARDH_ShutterSeqClear(ARD_Handle h);
+int ARDH_ShutterSeqAddEvent(ARD_Handle h, unsigned long offset_us, ARD_DeviceMask mask, ARD_DeviceMask states);
+int ARDH_ShutterSeqConfigure(ARD_Handle h, int loops, int trigger, unsigned long period_us);
+int ARDH_ShutterSeqArm(ARD_Handle h);
+int ARDH_ShutterSeqStart(ARD_Handle h);
+int ARDH_ShutterSeqAbort(ARD_Handle h);
+int ARDH_ShutterSeqGetStatus(ARD_Handle h, int *state, int *loopsDone, int *nextEvent);
+int ARDH_ShutterSeqGetTiming(ARD_Handle h, int event, unsigned long *planned_us, unsigned long *actual_us);
+
+// State-change events (needs SERIALEVENTS in the Arduino code): the controller reports every
+//   change of a shutter state, whatever caused it, so the host does not need to poll.
+//   A background thread reads the events while no command is running; events that arrive
+//   during a command are delivered by that call. The callback runs with the handle locked
+//   and must not call ARDH_ functions of the same handle. The cached states (ARD_CACHE_STATES)
+//   follow the events. Not available in binary mode.
+#define ARD_EVENT_SERIAL		0 // sources of a state change
+#define ARD_EVENT_DISPLAY		1
+#define ARD_EVENT_DIGITAL		2
+#define ARD_EVENT_IDLE			3
+#define ARD_EVENT_SEQUENCER	4
+typedef struct {
+	int device;
+	int state;							// as for ARD_ShutterGetState, 2->position set manually
+	int source;							// ARD_EVENT_ source
+	unsigned long time_ms;	// controller time (millis) of the change
+} ARD_Event;
+typedef void (*ARD_EventCallback)(ARD_Handle h, const ARD_Event *event, void *userData);
+
+// Start / stop the events; a second subscribe replaces the callback
+int ARD_ShutterSubscribeEvents(ARD_EventCallback callback, void *userData);
+int ARDH_ShutterSubscribeEvents(ARD_Handle h, ARD_EventCallback callback, void *userData);
+int ARD_ShutterUnsubscribeEvents(void);
+int ARDH_ShutterUnsubscribeEvents(ARD_Handle h);
+
+// Client-side cache: the get functions answer from a copy of the device table instead of
+//   asking the controller. Switching it on reads all devices once (GND, GPR, GST) and sizes
+//   the copy from GND; devices added later are read from the controller. The
+//   copy follows the set functions of this handle and is dropped by ARD_ShutterClearDev.
+//   ARD_CACHE_STATES is only correct while this handle is the only source of state
+//   changes (no display, digital inputs, sequencer or idle timeout), or while the
+//   events are subscribed.
+#define ARD_CACHE_OFF					0
+#define ARD_CACHE_PARAMETERS	1 // number of devices, labels, transit delays, parameters
+#define ARD_CACHE_STATES			2 // shutter states
+int ARD_ShutterSetCache(int mode);
+int ARDH_ShutterSetCache(ARD_Handle h, int mode);
+
+// Drop the cached values (e.g. after the settings were changed elsewhere)
+int ARD_ShutterInvalidateCache(void);
+int ARDH_ShutterInvalidateCache(ARD_Handle h);
+
+// Pipelined requests: the commands of a batch are written back-to-back and the replies
+//   are matched in the same order, instead of one round-trip per command. The library
+//   keeps at most 63 bytes of unanswered commands on the line (the serial receive
+//   buffer of the Uno is 64 bytes). The results are filled in by ARD_BatchCommit.
+//   Not available in binary mode.
+typedef struct ARD_ShutterBatch *ARD_Batch;
+#define ARD_BATCH_MAXCMDS	64
+
+// Start a batch on the default handle / on a controller
+int ARD_BatchBegin(ARD_Batch *batch);
+int ARDH_BatchBegin(ARD_Handle h, ARD_Batch *batch);
+
+// Add commands; the pointers must stay valid until ARD_BatchCommit
+int ARD_BatchGetState(ARD_Batch batch, int device, int *state);
+int ARD_BatchGetDeviceLabel(ARD_Batch batch, int device, char *label);
+int ARD_BatchGetTransitDelay(ARD_Batch batch, int device, int *transDelay_ms);
+int ARD_BatchSetState(ARD_Batch batch, int device, int state);
+int ARD_BatchSetStates(ARD_Batch batch, ARD_DeviceMask mask, ARD_DeviceMask states);
+int ARD_BatchSetPosition(ARD_Batch batch, int device, int pos);
+
+// Send the commands and read all replies; frees the batch
+//   returns -1 if any command failed (each failure is reported), the other results are valid
+int ARD_BatchCommit(ARD_Batch batch);
+
+// Free a batch without sending it
+void ARD_BatchFree(ARD_Batch batch);
+
+// Discovery: find the controllers without knowing their addresses. All candidate ports
+//   are probed at the same time, one thread each, with a short read timeout
+//   (options->timeout_ms, default ARD_DISCOVER_TIMEOUT_MS); ports that do not answer with
+//   the ID of a shutter driver are skipped without an error message. The Uno resets when
+//   its port is opened unless the reset jumper is shorted, set options->resetDelay_ms then.
+#define ARD_ADDRESS_SIZE					256
+#define ARD_DISCOVER_MAXPORTS			32
+#define ARD_DISCOVER_MAXDEVICES		8
+#define ARD_DISCOVER_TIMEOUT_MS		250
+#define ARD_DISCOVER_LABELSIZE		16 // the Arduino code keeps 7 characters (MAXLABELCHARS)
+typedef struct {
+	char address[ARD_ADDRESS_SIZE];	// for ARD_ShutterInit / ARDH_OpenSerial
+	int numDevices;
+	char labels[ARD_DISCOVER_MAXDEVICES][ARD_DISCOVER_LABELSIZE]; // longer labels are cut off
+} ARD_ControllerInfo;
+
+// Find controllers, numFound receives the number of entries filled in found
+//   candidates: addresses to probe, NULL -> every serial port the transport lists
+//   (/dev/ttyACM*, /dev/ttyUSB*, ... with termios, ASRL?*::INSTR with VISA)
+int ARD_ShutterDiscover(const char *const *candidates, int numCandidates,
+												const ARD_SerialOptions *options, ARD_ControllerInfo *found,
+												int maxFound, int *numFound);
+
+#endif // ARD_SHUTTER_H
@@ -0,0 +1,60 @@
+// *****************************************************************************************
+//
+// Transport layer for the Arduino Shutter library
+// A transport moves bytes between the library and one controller. ArdShutter.c only
+//   talks to the controller through these functions, so a new connection type only
+//   needs a new ArdTransport (see ArdTransportTermios.c, ArdTransportVisa.c).
+//
+// *****************************************************************************************
+#ifndef ARD_TRANSPORT_H
+#define ARD_TRANSPORT_H
+
+#include "ArdShutter.h"
+
+// the transports built into the library
+//   (on Linux, VISA can be added with -DARD_WITH_VISA, see the Makefile)
+#if defined _CVI_ || defined _WIN32
+#ifndef ARD_WITH_VISA
+#define ARD_WITH_VISA // VISA is the only transport on Windows
+#endif
+#else
+#define ARD_WITH_TERMIOS
+#endif
+
+// status codes of the transports: 0 -> success, everything else is an error
+//   that errorDesc can describe (VISA status, negative errno for termios)
+#define ARD_TRANSPORT_TIMEOUT	(-110) // same as -ETIMEDOUT on Linux
+
+typedef struct ArdTransport {
+	const char *name;
+	// open the connection, conn receives the transport state (passed to all other functions)
+	//   options: never NULL, zero fields mean defaults
+	long (*open)(const char *address, const ARD_SerialOptions *options, void **conn);
+	// close the connection and free conn
+	long (*close)(void *conn);
+	// write all len bytes
+	long (*write)(void *conn, const void *data, unsigned int len);
+	// read up to size bytes; untilTermChar: stop after the term char (ASCII lines),
+	//   otherwise wait for all size bytes (binary frames)
+	long (*read)(void *conn, void *buf, unsigned int size, int untilTermChar, unsigned int *count);
+	// exclusive access among processes around every command, may be NULL
+	long (*lock)(void *conn);
+	long (*unlock)(void *conn);
+	// text for a status code returned by the functions above
+	void (*errorDesc)(void *conn, long status, char *desc, int size);
+	// number of received bytes that are waiting to be read, without blocking; may be NULL
+	//   (needed for the background event reader, see ARDH_ShutterSubscribeEvents)
+	long (*available)(void *conn, unsigned int *count);
+	// list the serial ports this transport can open, count receives the number of entries
+	//   filled in addresses; may be NULL (needed by ARD_ShutterDiscover)
+	long (*find)(char (*addresses)[ARD_ADDRESS_SIZE], int size, int *count);
+} ArdTransport;
+
+#ifdef ARD_WITH_VISA
+extern const ArdTransport ARD_TransportVisa;
+#endif
+#ifdef ARD_WITH_TERMIOS
+extern const ArdTransport ARD_TransportTermios;
+#endif
+
+#endif // ARD_TRANSPORT_H
@@ -0,0 +1,306 @@
+// *****************************************************************************************
+//
+// Native POSIX serial transport for the Arduino Shutter library (Linux, macOS)
+// Talks to /dev/ttyACM* or /dev/ttyUSB* directly: raw mode, no flow control.
+//   Reads go through a small buffer, so a response line usually costs a single
+//   poll/read pair instead of one system call per byte.
+//
+// *****************************************************************************************
+#include "ArdTransport.h"
+#ifdef ARD_WITH_TERMIOS
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
+
+
+// *****************************************************************************************
+// Defines
+// *****************************************************************************************
+#define SERIAL_TERMCHAR	0xA
+#define READ_BUFSIZE		256
+// device names of USB serial ports (Arduino boards, FTDI and CH340 adapters)
+static const char *const portPatterns[] = {
+	"/dev/ttyACM*", "/dev/ttyUSB*", "/dev/cu.usbmodem*", "/dev/cu.usbserial*"
+};
+
+
+// *****************************************************************************************
+// Types
+// *****************************************************************************************
+typedef struct {
+	int fd;
+	int timeout_ms;
+	unsigned char buf[READ_BUFSIZE]; // bytes received, not yet returned
+	unsigned int head, tail;
+} TermiosConn;
+
+
+// *****************************************************************************************
+// Internal functions
+// *****************************************************************************************
+////////////////////////////////////////////////////////
+// Map a baud rate to the termios constant, 0 if not supported
+////////////////////////////////////////////////////////
+static speed_t baudConstant(long baud)
+{
+	switch (baud) {
+	case 9600:		return B9600;
+	case 19200:		return B19200;
+	case 38400:		return B38400;
+	case 57600:		return B57600;
+	case 115200:	return B115200;
+	case 230400:	return B230400;
+#ifdef B500000
+	case 500000:	return B500000;
+#endif
+#ifdef B1000000
+	case 1000000:	return B1000000;
+#endif
+#ifdef B2000000
+	case 2000000:	return B2000000;
+#endif
+	default:			return 0;
+	}
+}
+
+////////////////////////////////////////////////////////
+// Milliseconds of a monotonic clock
+////////////////////////////////////////////////////////
+static long long nowMs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+////////////////////////////////////////////////////////
+// Fill the read buffer, waiting until the deadline
+////////////////////////////////////////////////////////
+static long fillBuffer(TermiosConn *c, long long deadline)
+{
+	struct pollfd pfd;
+	ssize_t n;
+	int wait_ms;
+
+	if (c->head == c->tail) c->head = c->tail = 0;
+	for (;;) {
+		wait_ms = (int)(deadline - nowMs());
+		if (wait_ms < 0) return ARD_TRANSPORT_TIMEOUT;
+		pfd.fd = c->fd;
+		pfd.events = POLLIN;
+		n = poll(&pfd, 1, wait_ms);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) return -errno;
+		if (n == 0) return ARD_TRANSPORT_TIMEOUT;
+		n = read(c->fd, c->buf + c->tail, READ_BUFSIZE - c->tail);
+		if (n < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+		if (n < 0) return -errno;
+		if (n == 0) return -EIO; // device gone
+		c->tail += (unsigned int)n;
+		return 0;
+	}
+}
+
+
+// *****************************************************************************************
+// Transport functions
+// *****************************************************************************************
+////////////////////////////////////////////////////////
+// Open and configure the serial port
+////////////////////////////////////////////////////////
+static long termiosOpen(const char *address, const ARD_SerialOptions *options, void **conn)
+{
+	TermiosConn *c;
+	struct termios tio;
+	speed_t speed;
+	long status;
+
+	*conn = NULL;
+	speed = baudConstant(options->baud);
+	if (!speed) return -EINVAL;
+	c = calloc(1, sizeof(TermiosConn));
+	if (!c) return -ENOMEM;
+	c->timeout_ms = options->timeout_ms;
+
+	c->fd = open(address, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (c->fd < 0) goto fail;
+	// one process per controller (the VISA transport locks around every command instead)
+	if (flock(c->fd, LOCK_EX | LOCK_NB) < 0) goto fail;
+
+	if (tcgetattr(c->fd, &tio) < 0) goto fail;
+	cfmakeraw(&tio);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cflag &= ~(CSTOPB | CRTSCTS | HUPCL); // 8N1, no flow control, keep DTR (no reset) on close
+	tio.c_iflag &= ~(IXON | IXOFF | IXANY);
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+	if (tcsetattr(c->fd, TCSANOW, &tio) < 0) goto fail;
+
+#ifdef __linux__
+	if (options->lowLatency >= 0) {
+		// USB serial adapters (FTDI) otherwise hold back received bytes for up to 16 ms;
+		//   not every driver supports it (ttyACM, pty), so failures are ignored
+		struct serial_struct ser;
+		if (ioctl(c->fd, TIOCGSERIAL, &ser) == 0) {
+			ser.flags |= ASYNC_LOW_LATENCY;
+			ioctl(c->fd, TIOCSSERIAL, &ser);
+		}
+	}
+#endif
+
+	if (options->resetDelay_ms > 0) usleep((useconds_t)options->resetDelay_ms * 1000);
+	tcflush(c->fd, TCIOFLUSH); // drop the boot output and anything stale
+
+	*conn = c;
+	return 0;
+
+fail:
+	status = -errno;
+	if (c->fd >= 0) close(c->fd);
+	free(c);
+	return status;
+}
+
+////////////////////////////////////////////////////////
+// Close the port
+////////////////////////////////////////////////////////
+static long termiosClose(void *conn)
+{
+	TermiosConn *c = conn;
+	long status = 0;
+
+	if (close(c->fd) < 0) status = -errno;
+	free(c);
+	return status;
+}
+
+////////////////////////////////////////////////////////
+// Write all bytes
+////////////////////////////////////////////////////////
+static long termiosWrite(void *conn, const void *data, unsigned int len)
+{
+	TermiosConn *c = conn;
+	const unsigned char *p = data;
+	struct pollfd pfd;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(c->fd, p, len);
+		if (n > 0) {
+			p += n;
+			len -= (unsigned int)n;
+			continue;
+		}
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 && errno != EAGAIN) return -errno;
+		// output buffer full
+		pfd.fd = c->fd;
+		pfd.events = POLLOUT;
+		n = poll(&pfd, 1, c->timeout_ms);
+		if (n == 0) return ARD_TRANSPORT_TIMEOUT;
+		if (n < 0 && errno != EINTR) return -errno;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////
+// Read a line (untilTermChar) or exactly size bytes
+////////////////////////////////////////////////////////
+static long termiosRead(void *conn, void *buf, unsigned int size, int untilTermChar, unsigned int *count)
+{
+	TermiosConn *c = conn;
+	unsigned char *out = buf;
+	long long deadline = nowMs() + c->timeout_ms;
+	unsigned char ch;
+	long status;
+
+	*count = 0;
+	while (*count < size) {
+		if (c->head == c->tail) {
+			status = fillBuffer(c, deadline);
+			if (status) return status;
+		}
+		ch = c->buf[c->head++];
+		out[(*count)++] = ch;
+		if (untilTermChar && ch == SERIAL_TERMCHAR) break;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////
+// Bytes waiting in the read buffer and in the driver
+////////////////////////////////////////////////////////
+static long termiosAvailable(void *conn, unsigned int *count)
+{
+	TermiosConn *c = conn;
+	int pending = 0;
+
+	if (ioctl(c->fd, FIONREAD, &pending) < 0) return -errno;
+	*count = (c->tail - c->head) + (unsigned int)pending;
+	return 0;
+}
+
+////////////////////////////////////////////////////////
+// List the USB serial ports
+////////////////////////////////////////////////////////
+static long termiosFind(char (*addresses)[ARD_ADDRESS_SIZE], int size, int *count)
+{
+	glob_t g;
+	size_t i, p;
+
+	*count = 0;
+	for (p=0; p<sizeof(portPatterns)/sizeof(portPatterns[0]); p++) {
+		if (glob(portPatterns[p], 0, NULL, &g) != 0) continue; // no match
+		for (i=0; i<g.gl_pathc && *count<size; i++)
+			snprintf(addresses[(*count)++], ARD_ADDRESS_SIZE, "%s", g.gl_pathv[i]);
+		globfree(&g);
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////
+// Describe a status code
+////////////////////////////////////////////////////////
+static void termiosErrorDesc(void *conn, long status, char *desc, int size)
+{
+	if (status == ARD_TRANSPORT_TIMEOUT)
+		snprintf(desc, size, "Timeout.");
+	else if (status == -EWOULDBLOCK)
+		snprintf(desc, size, "Port is in use by another process.");
+	else if (status == -EINVAL)
+		snprintf(desc, size, "Invalid port settings (unsupported baud rate?).");
+	else
+		snprintf(desc, size, "%s", strerror((int)-status));
+}
+
+
+const ArdTransport ARD_TransportTermios = {
+	"termios",
+	termiosOpen,
+	termiosClose,
+	termiosWrite,
+	termiosRead,
+	NULL,
+	NULL,
+	termiosErrorDesc,
+	termiosAvailable,
+	termiosFind,
+};
+
+#endif // ARD_WITH_TERMIOS
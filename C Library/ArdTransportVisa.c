@@ -0,0 +1,225 @@
+// *****************************************************************************************
+//
+// VISA transport for the Arduino Shutter library (NI-VISA or compatible)
+//
+// *****************************************************************************************
+#include "ArdTransport.h"
+#ifdef ARD_WITH_VISA
+
+#ifdef _CVI_
+#include <ansi_c.h>
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#endif
+#include <visa.h>
+
+
+// *****************************************************************************************
+// Defines
+// *****************************************************************************************
+#define SERIAL_TERMCHAR	0xA
+#define VISA_LOCK_TIMEOUT_MS	5000
+
+
+// *****************************************************************************************
+// Types
+// *****************************************************************************************
+typedef struct {
+	ViSession resManager;
+	ViSession io;
+} VisaConn;
+
+
+// *****************************************************************************************
+// Transport functions
+// *****************************************************************************************
+////////////////////////////////////////////////////////
+// Open the resource and set up the serial port
+////////////////////////////////////////////////////////
+static long visaOpen(const char *address, const ARD_SerialOptions *options, void **conn)
+{
+	VisaConn *c;
+	ViStatus status;
+
+	*conn = NULL;
+	c = calloc(1, sizeof(VisaConn));
+	if (!c) return VI_ERROR_ALLOC;
+
+	status = viOpenDefaultRM(&c->resManager);
+	if (status < VI_SUCCESS) goto fail;
+	status = viOpen (c->resManager, (ViRsrc)address, VI_NULL, 1000, &c->io);
+	if (status < VI_SUCCESS) goto fail;
+
+	viSetAttribute(c->io, VI_ATTR_ASRL_BAUD, options->baud);
+	viSetAttribute(c->io, VI_ATTR_ASRL_DATA_BITS, 8);
+	viSetAttribute(c->io, VI_ATTR_ASRL_STOP_BITS, VI_ASRL_STOP_ONE);
+	viSetAttribute(c->io, VI_ATTR_ASRL_PARITY, VI_ASRL_PAR_NONE);
+	viSetAttribute(c->io, VI_ATTR_ASRL_FLOW_CNTRL, VI_ASRL_FLOW_NONE);
+	viSetAttribute(c->io, VI_ATTR_TERMCHAR, SERIAL_TERMCHAR);
+	viSetAttribute(c->io, VI_ATTR_TERMCHAR_EN, VI_TRUE); // line mode, see visaRead
+	viSetAttribute(c->io, VI_ATTR_ASRL_END_IN, VI_ASRL_END_TERMCHAR);
+	viSetAttribute(c->io, VI_ATTR_TMO_VALUE, options->timeout_ms);
+
+	// give Arduino time to reset (not needed if reset jumper is shorted)
+	if (options->resetDelay_ms > 0) {
+		ViUInt32 count;
+		char junk[64];
+		viSetAttribute(c->io, VI_ATTR_TMO_VALUE, options->resetDelay_ms);
+		while (viRead(c->io, (ViBuf)junk, sizeof(junk), &count) >= VI_SUCCESS) ; // until the timeout
+		viSetAttribute(c->io, VI_ATTR_TMO_VALUE, options->timeout_ms);
+	}
+
+	*conn = c;
+	return 0;
+
+fail:
+	if (c->io) viClose(c->io);
+	if (c->resManager) viClose(c->resManager);
+	free(c);
+	return status;
+}
+
+////////////////////////////////////////////////////////
+// Close the resource and the resource manager
+////////////////////////////////////////////////////////
+static long visaClose(void *conn)
+{
+	VisaConn *c = conn;
+	ViStatus status, rmStatus;
+
+	status = viClose(c->io);
+	rmStatus = viClose(c->resManager);
+	free(c);
+	if (status < VI_SUCCESS) return status;
+	return (rmStatus < VI_SUCCESS) ? rmStatus : 0;
+}
+
+////////////////////////////////////////////////////////
+// Write all bytes
+////////////////////////////////////////////////////////
+static long visaWrite(void *conn, const void *data, unsigned int len)
+{
+	VisaConn *c = conn;
+	ViUInt32 count;
+	ViStatus status;
+
+	status = viWrite(c->io, (ViBuf)data, len, &count);
+	return (status < VI_SUCCESS) ? status : 0;
+}
+
+////////////////////////////////////////////////////////
+// Read a line (untilTermChar) or exactly size bytes
+////////////////////////////////////////////////////////
+static long visaRead(void *conn, void *buf, unsigned int size, int untilTermChar, unsigned int *count)
+{
+	VisaConn *c = conn;
+	ViUInt32 n;
+	ViStatus status;
+
+	// binary frames may contain the term char, so those reads must not stop on it; the
+	//   line mode is restored right after, the session is never left in binary reads
+	if (!untilTermChar) {
+		viSetAttribute(c->io, VI_ATTR_TERMCHAR_EN, VI_FALSE);
+		viSetAttribute(c->io, VI_ATTR_ASRL_END_IN, VI_ASRL_END_NONE);
+	}
+	status = viRead(c->io, (ViBuf)buf, size, &n);
+	if (!untilTermChar) {
+		viSetAttribute(c->io, VI_ATTR_TERMCHAR_EN, VI_TRUE);
+		viSetAttribute(c->io, VI_ATTR_ASRL_END_IN, VI_ASRL_END_TERMCHAR);
+	}
+	*count = n;
+	return (status < VI_SUCCESS) ? status : 0;
+}
+
+////////////////////////////////////////////////////////
+// Lock the resource against other processes
+////////////////////////////////////////////////////////
+static long visaLock(void *conn)
+{
+	VisaConn *c = conn;
+	ViStatus status;
+
+	status = viLock(c->io, VI_EXCLUSIVE_LOCK, VISA_LOCK_TIMEOUT_MS, VI_NULL, VI_NULL);
+	return (status < VI_SUCCESS) ? status : 0;
+}
+
+static long visaUnlock(void *conn)
+{
+	VisaConn *c = conn;
+	ViStatus status;
+
+	status = viUnlock(c->io);
+	return (status < VI_SUCCESS) ? status : 0;
+}
+
+////////////////////////////////////////////////////////
+// Bytes waiting in the receive buffer of the serial port
+////////////////////////////////////////////////////////
+static long visaAvailable(void *conn, unsigned int *count)
+{
+	VisaConn *c = conn;
+	ViUInt32 n = 0;
+	ViStatus status;
+
+	status = viGetAttribute(c->io, VI_ATTR_ASRL_AVAIL_NUM, &n);
+	*count = n;
+	return (status < VI_SUCCESS) ? status : 0;
+}
+
+////////////////////////////////////////////////////////
+// List the serial resources
+////////////////////////////////////////////////////////
+static long visaFind(char (*addresses)[ARD_ADDRESS_SIZE], int size, int *count)
+{
+	ViSession resManager, findList;
+	ViUInt32 numFound = 0;
+	ViChar desc[VI_FIND_BUFLEN];
+	ViStatus status;
+
+	*count = 0;
+	status = viOpenDefaultRM(&resManager);
+	if (status < VI_SUCCESS) return status;
+	status = viFindRsrc(resManager, "ASRL?*::INSTR", &findList, &numFound, desc);
+	if (status < VI_SUCCESS) {
+		viClose(resManager);
+		return 0; // nothing found is not an error
+	}
+	while (numFound-- > 0 && *count < size) {
+		snprintf(addresses[(*count)++], ARD_ADDRESS_SIZE, "%s", desc);
+		if (numFound > 0 && viFindNext(findList, desc) < VI_SUCCESS) break;
+	}
+	viClose(findList);
+	viClose(resManager);
+	return 0;
+}
+
+////////////////////////////////////////////////////////
+// Describe a status code
+////////////////////////////////////////////////////////
+static void visaErrorDesc(void *conn, long status, char *desc, int size)
+{
+	VisaConn *c = conn;
+	char visaDesc[256];
+
+	if (c && viStatusDesc(c->io, (ViStatus)status, visaDesc) >= VI_SUCCESS)
+		snprintf(desc, size, "%s", visaDesc);
+	else
+		snprintf(desc, size, "VISA status 0x%08lX.", (unsigned long)status);
+}
+
+
+const ArdTransport ARD_TransportVisa = {
+	"Visa",
+	visaOpen,
+	visaClose,
+	visaWrite,
+	visaRead,
+	visaLock,
+	visaUnlock,
+	visaErrorDesc,
+	visaAvailable,
+	visaFind,
+};
+
+#endif // ARD_WITH_VISA
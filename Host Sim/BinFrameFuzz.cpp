@@ -0,0 +1,154 @@
+// Fuzz test and benchmark of BinFrameParser (Arduino Code/BinFrame.cpp) on the host
+//
+//   ./binframe_fuzz [frames [seed]]
+//
+// Fuzz: a stream of random full and compact request frames with noise between them;
+//   some frames are damaged (byte flipped, dropped or inserted). Every undamaged frame
+//   must come out of the parser, in order, and everything the parser accepts must pass
+//   the CRC. A damaged frame that happens to pass the CRC (1 in 256) is only counted.
+// Bench: parser time per byte for a stream of valid frames.
+// Returns 0 if the fuzz test passed.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "Common.h"
+#include "BinFrame.h"
+
+#ifndef SERIALBINARY
+#error SERIALBINARY must be chosen in "Common.h"
+#endif
+
+#define RECOVERY_GAP 64 // clean bytes after a damaged frame, the parser is in sync again then
+
+static uint32_t _rng;
+
+static uint32_t rnd(void)
+{
+  _rng ^= _rng << 13;
+  _rng ^= _rng >> 17;
+  _rng ^= _rng << 5;
+  return _rng;
+}
+
+static uint8_t noiseByte(void)
+{
+  uint8_t b;
+
+  do b = rnd(); while (b == BINFRAME_SYNC_REQ || b == BINFRAME_SYNC_SST);
+  return b;
+}
+
+////////////////////////////
+// a random valid request frame, full or compact
+static std::vector<uint8_t> makeFrame(void)
+{
+  std::vector<uint8_t> f;
+
+  if (rnd() & 1) {
+    f.push_back(BINFRAME_SYNC_SST);
+    f.push_back(rnd());
+    f.push_back(binFrameCRC(f.data(), 2));
+  } else {
+    f.push_back(BINFRAME_SYNC_REQ);
+    for (int z=1; z<BINFRAME_SIZE-1; z++) f.push_back(rnd());
+    f.push_back(binFrameCRC(f.data(), BINFRAME_SIZE-1));
+  }
+  return f;
+}
+
+static size_t frameSize(const uint8_t *frame)
+{
+  return frame[0] == BINFRAME_SYNC_SST ? BINFRAME_SST_SIZE : BINFRAME_SIZE;
+}
+
+////////////////////////////
+static int fuzz(long numFrames)
+{
+  std::vector<uint8_t> stream;
+  std::vector<std::vector<uint8_t> > expected; // undamaged frames, in order
+  std::vector<std::vector<uint8_t> > decoded;
+  BinFrameParser parser;
+  long damaged = 0, crcErrors = 0, falseAccepts = 0;
+  size_t next = 0;
+  int8_t result;
+
+  for (long n=0; n<numFrames; n++) {
+    std::vector<uint8_t> f = makeFrame();
+    int gap = rnd() % 4;
+    if (rnd() % 8 == 0) { // damage it
+      size_t pos = 1 + rnd() % (f.size()-1);
+      switch (rnd() % 3) {
+        case 0: f[pos] ^= 1 << (rnd() % 8); break;
+        case 1: f.erase(f.begin() + pos); break;
+        default: f.insert(f.begin() + pos, (uint8_t)rnd()); break;
+      }
+      damaged++;
+      gap = RECOVERY_GAP;
+    } else {
+      expected.push_back(f);
+    }
+    stream.insert(stream.end(), f.begin(), f.end());
+    for (int z=0; z<gap; z++) stream.push_back(noiseByte());
+  }
+
+  for (size_t z=0; z<stream.size(); z++) {
+    result = parser.Feed(stream[z]);
+    if (result == BINFRAME_BADCRC) crcErrors++;
+    if (result != BINFRAME_OK) continue;
+    size_t size = frameSize(parser.frame);
+    if (binFrameCRC(parser.frame, size-1) != parser.frame[size-1]) {
+      printf("FAIL: accepted a frame with a bad CRC at byte %zu\n", z);
+      return 1;
+    }
+    decoded.push_back(std::vector<uint8_t>(parser.frame, parser.frame + size));
+  }
+
+  // the undamaged frames must be a subsequence of the decoded ones
+  for (size_t z=0; z<decoded.size(); z++) {
+    if (next < expected.size() && decoded[z] == expected[next]) next++;
+    else falseAccepts++;
+  }
+  printf("fuzz: %ld frames (%ld damaged), %zu bytes, %zu decoded, %ld CRC errors, %ld damaged frames accepted\n",
+         numFrames, damaged, stream.size(), decoded.size(), crcErrors, falseAccepts);
+  if (next != expected.size()) {
+    printf("FAIL: undamaged frame %zu of %zu not decoded\n", next, expected.size());
+    return 1;
+  }
+  return 0;
+}
+
+////////////////////////////
+static void bench(long numFrames)
+{
+  std::vector<uint8_t> stream;
+  BinFrameParser parser;
+  struct timespec t0, t1;
+  long frames = 0;
+  double ns;
+
+  for (long n=0; n<numFrames; n++) {
+    std::vector<uint8_t> f = makeFrame();
+    stream.insert(stream.end(), f.begin(), f.end());
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (size_t z=0; z<stream.size(); z++)
+    if (parser.Feed(stream[z]) == BINFRAME_OK) frames++;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  ns = (t1.tv_sec - t0.tv_sec)*1e9 + (t1.tv_nsec - t0.tv_nsec);
+  printf("bench: %ld frames, %zu bytes in %.1f ms, %.1f ns/byte\n",
+         frames, stream.size(), ns/1e6, ns/stream.size());
+}
+
+int main(int argc, char **argv)
+{
+  long numFrames = (argc > 1) ? atol(argv[1]) : 200000;
+
+  _rng = (argc > 2) ? strtoul(argv[2], NULL, 0) : 0x5EED1234;
+  if (!_rng) _rng = 1;
+  if (fuzz(numFrames)) return 1;
+  bench(numFrames);
+  return 0;
+}
@@ -0,0 +1,180 @@
+// *************************************************************************************
+// Host simulation of the shutter controller
+// Runs the unmodified sketch as a Linux process. Serial is a pseudo terminal,
+//   so ARD_ShutterInit()/Shutter() can be pointed at it like at a real board.
+//
+// usage: shutter_sim [options]
+//   -l <path>   symlink the serial pty to <path> (e.g. /tmp/ttyShutter)
+//   -F <fd>     use the inherited descriptor <fd> (socket, pipe) instead of a pty
+//   -c <path>   symlink a control pty to <path>; accepts lines "PIN <n> <0|1>"
+//                 (drive a digital input, D0-D7) and "TIME" (print micros())
+//   -C <fd>     use the inherited descriptor <fd> as the control port
+//   -e <file>   back the EEPROM with <file> (kept between runs)
+//   -t <file>   write the I2C/PWM/pin trace to <file>
+//   -s          stepped clock: time only advances by simulated costs and -k
+//   -k <us>     advance the clock by <us> per loop() pass (stepped mode)
+//   -f          fast UART: do not limit the serial port to the baud rate
+//   -b <baud>   run the serial port at <baud> instead of the rate the sketch asks for
+//   -n <count>  exit after <count> loop() passes (0: run forever)
+// *************************************************************************************
+#define _GNU_SOURCE 1
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <stdarg.h>
+#include <termios.h>
+#include <unistd.h>
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "Wire.h"
+#include "SimHost.h"
+
+// the sketch itself
+#include "SketchProtos.h"
+#include "ShutterDriverUniversal.ino"
+
+
+static int _baudPacing = 1;
+static unsigned long _baudRate = 0;
+static int _ctlFd = -1;
+static char _ctlLine[64];
+static size_t _ctlLen = 0;
+static volatile sig_atomic_t _quit = 0;
+
+int SimHostBaudPacing(void) { return _baudPacing; }
+unsigned long SimHostBaudRate(void) { return _baudRate; }
+
+void SimHostTrace(const char *fmt, ...)
+{
+  char buf[128];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+  TwoWire::SimTrace("%s", buf);
+}
+
+// open a raw pseudo terminal, return the master fd, optionally symlink the slave
+static int openPty(const char *linkPath, const char *what)
+{
+  int master, slave;
+  struct termios tio;
+  const char *name;
+
+  master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) || unlockpt(master) || !(name = ptsname(master))) {
+    perror("pty");
+    exit(1);
+  }
+  // keep the slave open, so the master does not see EIO while no host is connected
+  slave = open(name, O_RDWR | O_NOCTTY);
+#ifdef TIOCGPTPEER
+  if (slave < 0) slave = ioctl(master, TIOCGPTPEER, O_RDWR | O_NOCTTY);
+#endif
+  if (slave >= 0 && tcgetattr(slave, &tio) == 0) {
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+  }
+  fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+  // containers may not show the /dev/pts node; the /proc link to our slave fd still opens it
+  if (slave >= 0 && access(name, F_OK) != 0) {
+    static char procName[64];
+    snprintf(procName, sizeof(procName), "/proc/%d/fd/%d", (int)getpid(), slave);
+    name = procName;
+  }
+  if (linkPath) {
+    unlink(linkPath);
+    if (symlink(name, linkPath)) perror(linkPath);
+  }
+  fprintf(stderr, "%s port: %s%s%s\n", what, name, linkPath ? " -> " : "", linkPath ? linkPath : "");
+  return master;
+}
+
+void SimHostPoll(void)
+{
+  char c;
+  if (_ctlFd < 0) return;
+  while (::read(_ctlFd, &c, 1) == 1) {
+    if (c != '\n' && c != '\r') {
+      if (_ctlLen < sizeof(_ctlLine) - 1) _ctlLine[_ctlLen++] = c;
+      continue;
+    }
+    _ctlLine[_ctlLen] = '\0';
+    _ctlLen = 0;
+    unsigned pin, level;
+    char reply[48];
+    if (sscanf(_ctlLine, "PIN %u %u", &pin, &level) == 2 && pin < 8) {
+      SimSetPin(pin, level);
+      snprintf(reply, sizeof(reply), "OK\r\n");
+    } else if (strcmp(_ctlLine, "TIME") == 0) {
+      snprintf(reply, sizeof(reply), "%lu\r\n", micros());
+    } else if (_ctlLine[0] == '\0') {
+      continue;
+    } else {
+      snprintf(reply, sizeof(reply), "Error\r\n");
+    }
+    if (::write(_ctlFd, reply, strlen(reply)) < 0) {}
+  }
+}
+
+static void onSignal(int sig) { (void)sig; _quit = 1; }
+
+int main(int argc, char **argv)
+{
+  const char *serialLink = NULL, *ctlLink = NULL;
+  unsigned long tick_us = 0, maxPasses = 0, passes = 0;
+  int opt, serialFd = -1;
+
+  while ((opt = getopt(argc, argv, "l:F:c:C:e:t:sk:fb:n:")) != -1) {
+    switch (opt) {
+    case 'l': serialLink = optarg; break;
+    case 'F': serialFd = atoi(optarg); break;
+    case 'c': ctlLink = optarg; break;
+    case 'C': _ctlFd = atoi(optarg); fcntl(_ctlFd, F_SETFL, fcntl(_ctlFd, F_GETFL) | O_NONBLOCK); break;
+    case 'e': EEPROM.SimAttachFile(optarg); break;
+    case 't': TwoWire::SimOpenTrace(optarg); break;
+    case 's': SimSetSteppedClock(1); break;
+    case 'k': tick_us = strtoul(optarg, NULL, 0); break;
+    case 'f': _baudPacing = 0; break;
+    case 'b': _baudRate = strtoul(optarg, NULL, 0); break;
+    case 'n': maxPasses = strtoul(optarg, NULL, 0); break;
+    default:
+      fprintf(stderr, "usage: %s [-l serial_link | -F fd] [-c control_link | -C fd] [-e eeprom_file] "
+                      "[-t trace_file] [-s] [-k tick_us] [-f] [-b baud] [-n passes]\n", argv[0]);
+      return 1;
+    }
+  }
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  if (serialFd >= 0) {
+    fcntl(serialFd, F_SETFL, fcntl(serialFd, F_GETFL) | O_NONBLOCK);
+    SimSerialAttach(serialFd);
+  } else {
+    SimSerialAttach(openPty(serialLink, "serial"));
+  }
+  if (ctlLink) _ctlFd = openPty(ctlLink, "control");
+
+  // the shield boards on the I2C bus
+#ifdef SHUTTER_RCSERVO
+  for (uint8_t board = 0; board < RCSERVO_BOARDS; board++) new SimPCA9685(RCSERVO_BOARDID + board);
+#endif
+#ifdef SHUTTER_SOLENOID
+  for (uint8_t board = 0; board < SOLENOID_BOARDS; board++) new SimPCA9685(SOLENOID_BOARDID + board);
+#endif
+
+  setup();
+  while (!_quit && (maxPasses == 0 || passes < maxPasses)) {
+    SimPoll();
+    loop();
+    passes++;
+    if (tick_us) SimAdvance(tick_us);
+    else if (!(passes & 0x3FF)) usleep(200); // do not spin a core at 100 %
+  }
+
+  fprintf(stderr, "%lu loop passes, %lu I2C transactions, %lu EEPROM writes, %lu serial bytes dropped\n",
+          passes, TwoWire::SimTransactionCount(), EEPROM.SimWriteCount(), SimSerialDropped());
+  if (serialLink) unlink(serialLink);
+  if (ctlLink) unlink(ctlLink);
+  return 0;
+}
@@ -0,0 +1,22 @@
+// Prototypes of the functions in ShutterDriverUniversal.ino
+// The Arduino IDE generates these automatically; the host build has to declare them.
+//   Keep in sync with the sketch.
+#ifndef SKETCH_PROTOS_H
+#define SKETCH_PROTOS_H
+
+#include "Common.h"
+
+void createDummyParameters(void);
+void checkDisplayInput(void);
+void checkSerialInput(void);
+void checkDigitalInput(void);
+void updateDigInputMap(void);
+void checkForIdle(void);
+void checkSequencer(void);
+void updateState(int8_t device, int8_t state, StateSource source);
+ShutterMask updateStates(ShutterMask mask, ShutterMask states, StateSource source);
+ShutterMask applyStates(ShutterMask mask, const int8_t *states, StateSource source);
+void updateDisplayStates(void);
+void updateDisplayInfo(void);
+
+#endif // SKETCH_PROTOS_H
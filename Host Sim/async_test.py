@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+""" Test of the asyncio library (Python Library/ard_shutter_async.py) against the host simulation
+
+Starts two shutter_sim instances on their ptys and drives both from one event loop:
+parameters, single and pipelined concurrent calls, set_states, an invalid device and the
+call latencies. Fails if a reply is wrong or the simulated UART dropped a byte.
+Then a scripted controller on a pty pair loses one reply and sends another one late;
+the calls after each timeout must get their own replies again. Builds shutter_sim first.
+
+    ./async_test.py
+
+Returns 0 if all checks passed.
+"""
+import asyncio
+import os
+import sys
+import tempfile
+import tty
+import types
+
+from sim_helpers import PYTHON_LIBRARY, build, bytes_dropped, check, report, start_sim, stop_sim
+
+DEVICES = 4  # servos of the default build
+CONCURRENT = 40  # more queries than fit the receive buffer at once
+TIMEOUT_S = 0.3  # of the calls in the lost reply test
+LOST, LATE = 'GST1', 'GST4'  # the scripted controller never answers LOST, answers LATE late
+
+
+async def setup(shutter, label):
+    """ Clears a controller and configures DEVICES shutters on it
+    """
+    check(await shutter.clear(), f'{label}: clear')
+    for dev in range(DEVICES):
+        ok = await shutter.set_parameters(-1, {'shieldChannel': dev, 'digInput': -1, 'openPos': 300,
+                                               'closedPos': 200, 'transDelay_ms': 10 + dev,
+                                               'label': f'{label}{dev}'})
+        check(ok, f'{label}: set_parameters of device {dev}')
+    check(await shutter.get_num_devices() == DEVICES, f'{label}: number of devices')
+
+
+async def exercise(shutter, label):
+    """ Runs the checks on one configured controller
+    """
+    results = await asyncio.gather(*[shutter.set_state(dev, dev % 2) for dev in range(DEVICES)])
+    check(all(results), f'{label}: concurrent set_state')
+    states = await asyncio.gather(*[shutter.check_state(dev) for dev in range(DEVICES)])
+    check(states == [dev % 2 for dev in range(DEVICES)], f'{label}: states {states}')
+
+    changes = {0: 1, 1: 0, 2: 1}
+    check(await shutter.set_states(changes), f'{label}: set_states')
+    expected = [changes.get(dev, dev % 2) for dev in range(DEVICES)]
+    states = await asyncio.gather(*[shutter.check_state(dev) for dev in range(DEVICES)])
+    check(states == expected, f'{label}: states after set_states {states}')
+
+    last = DEVICES - 1
+    params = await shutter.get_parameters(last)
+    check(params.get('label') == f'{label}{last}' and params.get('transDelay_ms') == 10 + last,
+          f'{label}: get_parameters {params}')
+    name, delay = await asyncio.gather(shutter.get_device_label(last), shutter.get_transit_delay(last))
+    check(name == f'{label}{last}' and delay == 10 + last, f'{label}: label/delay {name} {delay}')
+
+    check(await shutter.check_state(DEVICES + 3) is None, f'{label}: invalid device accepted')  # logs an error
+
+    queries = [shutter.check_state(z % DEVICES) for z in range(CONCURRENT)]
+    states = await asyncio.gather(*queries)
+    check(states == [expected[z % DEVICES] for z in range(CONCURRENT)], f'{label}: pipelined queries')
+
+    latency = shutter.get_call_latency('GST')
+    check(latency['count'] >= CONCURRENT + 2*DEVICES + 1 and latency['min_ms'] > 0,
+          f'{label}: call latency {latency}')
+
+
+async def run(link_a, link_b):
+    from ard_shutter_async import AsyncShutter
+
+    async with AsyncShutter(link_a) as a, AsyncShutter(link_b) as b:
+        await asyncio.gather(setup(a, 'A'), setup(b, 'B'))
+        await asyncio.gather(exercise(a, 'A'), exercise(b, 'B'))
+
+
+class ScriptedController:
+    """ Answers *IDN? and GST<n> on the master side of a pty pair, in order, like the
+    controller; drops the reply to LOST and sends the one to LATE after the timeout
+    """
+
+    def __init__(self):
+        self.master, self.slave = os.openpty()
+        tty.setraw(self.slave)
+        self.port = f'/proc/{os.getpid()}/fd/{self.slave}'  # /dev/pts may not show in a container
+        self.lines = asyncio.Queue()
+        self.buf = b''
+        asyncio.get_running_loop().add_reader(self.master, self.on_readable)
+        self.task = asyncio.get_running_loop().create_task(self.answer())
+
+    def on_readable(self):
+        self.buf += os.read(self.master, 256)
+        while b'\n' in self.buf:
+            line, self.buf = self.buf.split(b'\n', 1)
+            self.lines.put_nowait(line.decode().strip())
+
+    async def answer(self):
+        while True:
+            line = await self.lines.get()
+            if line == '*IDN?':
+                reply = 'Arduino Uno Shutter'
+            elif line.startswith('GST'):
+                reply = f'ST{line[3:]}={int(line[3:]) % 2}'
+                if line == LOST:
+                    continue
+                if line == LATE:
+                    await asyncio.sleep(1.5 * TIMEOUT_S)  # after the timeout, before the end of the resync
+            else:
+                reply = 'Error: Unrecognized command'
+            os.write(self.master, reply.encode() + b'\r\n')
+
+    def close(self):
+        asyncio.get_running_loop().remove_reader(self.master)
+        self.task.cancel()
+        os.close(self.master)
+        os.close(self.slave)
+
+
+async def run_lost_reply():
+    from ard_shutter_async import AsyncShutter
+
+    controller = ScriptedController()
+    try:
+        async with AsyncShutter(controller.port, timeout=TIMEOUT_S) as s:
+            for lost in (LOST, LATE):
+                check(await s.check_state(int(lost[3:])) is None, f'{lost}: reply not lost')
+                states = await asyncio.gather(*[s.check_state(dev) for dev in (2, 3, 5, 6)])
+                check(states == [0, 1, 1, 0], f'after {lost}: states {states}')
+            check(s._in_flight == 0, f'after the timeouts: {s._in_flight} bytes in flight')
+    finally:
+        controller.close()
+
+
+def main():
+    build()
+    sys.path.insert(0, PYTHON_LIBRARY)
+    try:
+        import pyvisa  # noqa: F401, only the imported ard_shutter needs it
+    except ImportError:
+        sys.modules['pyvisa'] = types.ModuleType('pyvisa')  # AsyncShutter does not use VISA
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        sims = [start_sim(tmpdir, name) for name in ('A', 'B')]
+        try:
+            asyncio.run(asyncio.wait_for(run(sims[0][1], sims[1][1]), 30))
+        except Exception as e:
+            check(False, f'{type(e).__name__}: {e}')
+        finally:
+            for proc, link in sims:
+                err = stop_sim(proc)
+                check(bytes_dropped(err) == 0, f'{link}: {err.strip()}')
+
+    try:
+        asyncio.run(asyncio.wait_for(run_lost_reply(), 30))
+    except Exception as e:
+        check(False, f'lost reply: {type(e).__name__}: {e}')
+
+    return report()
+
+
+if __name__ == '__main__':
+    sys.exit(main())
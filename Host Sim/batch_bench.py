@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+""" Benchmark of the pipelined batches against the host simulation
+
+Starts shutter_sim at several baud rates and times the batches of the C library
+(ARD_Batch*, "C Library/ardbatch_bench") and of the Python library (Shutter.batch)
+against one round-trip per command. Builds shutter_sim and ardbatch_bench first.
+The EEPROM of the simulation is a temporary file, so every run starts alike.
+The read batches are longer than the 63-byte batch window; the run fails if a reply
+is wrong or the simulated UART dropped a byte.
+
+    ./batch_bench.py [rounds [baud ...]]
+
+The Python part needs pyvisa and pyvisa-py (with pyserial); it is skipped without them
+or if the library does not import.
+"""
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+from sim_helpers import C_LIBRARY, PYTHON_LIBRARY, build, bytes_dropped, check, report, start_sim, stop_sim
+
+BAUD_RATES = [9600, 19200, 57600, 115200]
+DEVICES = 4
+READS = 5  # reads of every device per round, as in ardbatch_bench
+
+
+def time_rounds(func, rounds):
+    """ Returns the time of one call of func in ms, averaged over rounds calls
+    """
+    t0 = time.perf_counter()
+    for _ in range(rounds):
+        func()
+    return (time.perf_counter() - t0) * 1e3 / rounds
+
+
+def bench_python(ard_shutter, link, rounds):
+    """ Times Shutter.batch against single commands, prints one line
+
+    Arguments:
+      ard_shutter: the imported Python library
+      link: serial port of the simulation
+      rounds: repetitions of every workload
+    """
+    shutter = ard_shutter.Shutter(f'ASRL{link}::INSTR')
+    shutter.clear()
+    for dev in range(DEVICES):
+        shutter.set_parameters(-1, {'shieldChannel': dev, 'digInput': -1, 'openPos': 300,
+                                    'closedPos': 200, 'transDelay_ms': dev, 'label': f'Bench{dev}'})
+
+    def check_params(dev, params):
+        params = params or {}
+        check(params.get('label') == f'Bench{dev}' and params.get('transDelay_ms') == dev,
+              f'Python: device {dev} read back as {params}')
+
+    def read_sequential():
+        for z in range(READS * DEVICES):
+            shutter.check_state(z % DEVICES)
+            check_params(z % DEVICES, shutter.get_parameters(z % DEVICES))
+
+    def read_batch():
+        with shutter.batch() as b:
+            results = [(b.check_state(z % DEVICES), b.get_parameters(z % DEVICES))
+                       for z in range(READS * DEVICES)]
+        for z, (_, params) in enumerate(results):
+            check_params(z % DEVICES, params.value)
+
+    def switch_sequential():
+        for state in (1, 0):
+            for dev in range(DEVICES):
+                shutter.set_state(dev, state)
+
+    def switch_batch():
+        with shutter.batch() as b:
+            for state in (1, 0):
+                for dev in range(DEVICES):
+                    b.set_state(dev, state)
+
+    times = [time_rounds(f, rounds) for f in
+             (read_sequential, read_batch, switch_sequential, switch_batch)]
+    print(f'Python read {DEVICES} devices x {READS}: {times[0]:6.1f} ms sequential, {times[1]:6.1f} ms batch | '
+          f'switch {DEVICES} devices: {times[2]:6.1f} ms sequential, {times[3]:6.1f} ms batch')
+    del shutter
+
+
+def main():
+    rounds = int(sys.argv[1]) if len(sys.argv) > 1 else 20
+    bauds = [int(b) for b in sys.argv[2:]] or BAUD_RATES
+
+    build()
+    build(C_LIBRARY, 'ardbatch_bench')
+    sys.path.insert(0, PYTHON_LIBRARY)
+    try:
+        import ard_shutter
+    except Exception as e:  # missing pyvisa, or a Python the library does not run on
+        print(f'Python library skipped: {type(e).__name__}: {e}')
+        ard_shutter = None
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        for baud in bauds:
+            print(f'--- {baud} baud, {rounds} rounds')
+            sys.stdout.flush()
+            proc, link = start_sim(tmpdir, baud, ['-b', str(baud)])
+            try:
+                check(subprocess.run([os.path.join(C_LIBRARY, 'ardbatch_bench'), link,
+                                      str(rounds)]).returncode == 0, f'{baud} baud: ardbatch_bench')
+                if ard_shutter:
+                    try:
+                        bench_python(ard_shutter, link, rounds)
+                    except Exception as e:  # e.g. a timeout after lost bytes
+                        check(False, f'{baud} baud: Python {type(e).__name__}: {e}')
+            finally:
+                err = stop_sim(proc)
+            check(bytes_dropped(err) == 0, f'{baud} baud: {err.strip()}')
+    return report()
+
+
+if __name__ == '__main__':
+    sys.exit(main())
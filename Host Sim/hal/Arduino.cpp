@@ -0,0 +1,470 @@
+// *************************************************************************************
+// Simulated Arduino core: virtual clock, pins, Serial over a pseudo terminal,
+//   in-memory EEPROM and the interrupt dispatcher
+// *************************************************************************************
+#define _GNU_SOURCE 1
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "SimHost.h"
+
+
+// *************************************************************************************
+// virtual clock
+// *************************************************************************************
+// micros() = real time since start (unless stepped) + simulated costs (I2C, EEPROM, UART)
+static int _stepped = 0;
+static uint64_t _startReal_us = 0;
+static uint64_t _offset_us = 0;
+
+static uint64_t realMicros(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static uint64_t simMicros(void)
+{
+  if (!_startReal_us) _startReal_us = realMicros();
+  return (_stepped ? 0 : realMicros() - _startReal_us) + _offset_us;
+}
+
+// time on the serial wire: the real time, the simulated costs do not speed up the UART
+static uint64_t wireMicros(void)
+{
+  uint64_t now = simMicros();
+  return _stepped ? now : realMicros() - _startReal_us;
+}
+
+void SimSetSteppedClock(int stepped) { _stepped = stepped; }
+void SimAdvance(unsigned long us) { _offset_us += us; }
+
+unsigned long millis(void) { return (unsigned long)(simMicros() / 1000); }
+unsigned long micros(void) { return (unsigned long)simMicros(); }
+
+void delay(unsigned long ms)
+{
+  uint64_t until = simMicros() + (uint64_t)ms * 1000;
+  if (_stepped) { SimAdvance(ms * 1000); SimPoll(); return; }
+  while (simMicros() < until) {
+    SimPoll();
+    usleep(100);
+  }
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  if (_stepped) { SimAdvance(us); return; }
+  uint64_t until = simMicros() + us;
+  while (simMicros() < until) {}
+}
+
+
+// *************************************************************************************
+// interrupts and AVR registers
+// *************************************************************************************
+volatile uint8_t PCICR, PCMSK2, PCIFR, PIND;
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+volatile uint16_t TCNT1, OCR1A;
+volatile uint8_t TCCR2A, TCCR2B, TIMSK2, OCR2A, TCNT2;
+
+extern "C" void PCINT2_vect(void) __attribute__((weak));
+extern "C" void TIMER1_COMPA_vect(void) __attribute__((weak));
+
+static int _intEnabled = 1;
+static int _inPoll = 0;
+static uint8_t _timer1Armed = 0;
+static uint64_t _timer1Next_us = 0;
+
+void noInterrupts(void) { _intEnabled = 0; }
+void interrupts(void) { _intEnabled = 1; }
+
+static unsigned long timer1Period_us(void)
+{
+  static const uint16_t prescale[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+  uint16_t ps = prescale[TCCR1B & 0x07];
+  if (!ps) return 0;
+  return (unsigned long)(((uint32_t)OCR1A + 1) * ps / 16); // 16 MHz clock
+}
+
+void SimPoll(void)
+{
+  if (!_intEnabled || _inPoll) return;
+  _inPoll = 1; // ISRs do not nest
+  SimHostPoll();
+  Serial.pump();
+  // pin change interrupt
+  if ((PCIFR & bit(PCIF2)) && (PCICR & bit(PCIE2))) {
+    PCIFR &= ~bit(PCIF2);
+    if (PCINT2_vect) PCINT2_vect();
+  }
+  // timer1 compare match
+  if (TIMSK1 & bit(OCIE1A)) {
+    unsigned long period = timer1Period_us();
+    uint64_t now = simMicros();
+    if (!_timer1Armed) {
+      _timer1Armed = 1;
+      _timer1Next_us = now + period;
+    }
+    while (period && now >= _timer1Next_us && (TIMSK1 & bit(OCIE1A))) {
+      _timer1Next_us += period;
+      if (TIMER1_COMPA_vect) TIMER1_COMPA_vect();
+    }
+  } else {
+    _timer1Armed = 0;
+  }
+  _inPoll = 0;
+}
+
+
+// *************************************************************************************
+// digital pins
+// *************************************************************************************
+static uint8_t _pinLevel[20];
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  if (pin < 8 && mode == INPUT_PULLUP && !(_pinLevel[pin] & 0x80)) SimSetPin(pin, HIGH);
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  if (pin < sizeof(_pinLevel)) _pinLevel[pin] = val ? 1 : 0;
+}
+
+int digitalRead(uint8_t pin)
+{
+  if (pin < 8) return (PIND >> pin) & 1;
+  return pin < sizeof(_pinLevel) ? (_pinLevel[pin] & 1) : LOW;
+}
+
+void SimSetPin(uint8_t pin, uint8_t level)
+{
+  uint8_t old = PIND;
+  if (pin >= 8) return;
+  _pinLevel[pin] = 0x80 | (level ? 1 : 0); // 0x80: driven externally
+  if (level) PIND |= bit(pin);
+  else PIND &= ~bit(pin);
+  if ((old ^ PIND) & PCMSK2) PCIFR |= bit(PCIF2);
+  SimHostTrace("PIN %u %u", pin, level ? 1 : 0);
+}
+
+
+// *************************************************************************************
+// Print / Stream
+// *************************************************************************************
+size_t Print::write(const uint8_t *buf, size_t len)
+{
+  size_t n = 0;
+  while (len--) n += write(*buf++);
+  return n;
+}
+
+size_t Print::print(long n, int base)
+{
+  if (n < 0 && base == DEC) return print('-') + print((unsigned long)-n, base);
+  return print((unsigned long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+  return print((unsigned long long)n, base);
+}
+
+size_t Print::print(long long n, int base)
+{
+  if (n < 0 && base == DEC) return print('-') + print((unsigned long long)-n, base);
+  return print((unsigned long long)n, base);
+}
+
+size_t Print::print(unsigned long long n, int base)
+{
+  char buf[8 * sizeof(long long) + 1];
+  char *str = &buf[sizeof(buf) - 1];
+  *str = '\0';
+  if (base < 2) base = 10;
+  do {
+    char c = n % base;
+    n /= base;
+    *--str = c < 10 ? c + '0' : c + 'A' - 10;
+  } while (n);
+  return write(str);
+}
+
+size_t Print::print(double n, int digits)
+{
+  char buf[40];
+  snprintf(buf, sizeof(buf), "%.*f", digits, n);
+  return write(buf);
+}
+
+int Stream::timedRead(void)
+{
+  unsigned long start = millis();
+  do {
+    int c = read();
+    if (c >= 0) return c;
+    SimPoll();
+  } while (millis() - start < _timeout);
+  return -1;
+}
+
+size_t Stream::readBytesUntil(char terminator, char *buffer, size_t length)
+{
+  size_t index = 0;
+  while (index < length) {
+    int c = timedRead();
+    if (c < 0 || c == terminator) break;
+    *buffer++ = (char)c;
+    index++;
+  }
+  return index;
+}
+
+
+// *************************************************************************************
+// HardwareSerial on a pseudo terminal
+// *************************************************************************************
+// Bytes written by the host enter the 64-byte RX ring at the configured baud
+//   rate; bytes that do not fit are dropped, like on the real UART. Written bytes
+//   wait in a queue and reach the host at the baud rate; writes block once more
+//   than a TX buffer's worth is still on the wire. Both run on the wire clock
+//   (real time, or the simulated time with a stepped clock).
+HardwareSerial Serial;
+
+static int _ptyFd = -1;
+static uint8_t _staging[4096];
+static size_t _stagingLen = 0;
+static uint8_t _txQueue[4096];
+static size_t _txQueueLen = 0;
+static uint64_t _rxLast_us = 0;
+static uint64_t _txBusyUntil_us = 0; // wire time at which the last queued byte is out
+static unsigned long _rxDropped = 0;
+
+// write to the pty, wait while the host does not read
+static void ptyWrite(const uint8_t *buf, size_t len)
+{
+  size_t done = 0;
+  if (_ptyFd < 0) return;
+  while (done < len) {
+    ssize_t n = ::write(_ptyFd, buf + done, len - done);
+    if (n > 0) done += n;
+    else if (n < 0 && errno != EAGAIN && errno != EIO) break;
+    else { struct pollfd p = {_ptyFd, POLLOUT, 0}; poll(&p, 1, 10); if (n < 0 && errno == EIO) break; }
+  }
+}
+
+static int baudPaced(unsigned long baud) { return SimHostBaudPacing() && baud; }
+
+// 10 bits per byte, rounded up: the simulation is never faster than the wire
+static unsigned long byteTime(unsigned long baud) { return (10000000UL + baud - 1) / baud; }
+
+void HardwareSerial::begin(unsigned long baud)
+{
+  _baud = SimHostBaudRate() ? SimHostBaudRate() : baud;
+  _rxHead = _rxTail = 0;
+  _rxLast_us = wireMicros();
+}
+
+void HardwareSerial::end(void) { _baud = 0; }
+
+void HardwareSerial::fill(void)
+{
+  uint64_t now;
+  size_t allowed, z;
+
+  now = wireMicros();
+  if (!_stagingLen) _rxLast_us = now; // the wire was idle, new bytes start now
+  if (_ptyFd >= 0 && _stagingLen < sizeof(_staging)) {
+    ssize_t n = ::read(_ptyFd, _staging + _stagingLen, sizeof(_staging) - _stagingLen);
+    if (n > 0) _stagingLen += n;
+  }
+  if (!_stagingLen) return;
+  if (baudPaced(_baud)) {
+    allowed = (size_t)((now - _rxLast_us) * _baud / 10000000ULL);
+    if (!allowed) return;
+    _rxLast_us += (uint64_t)allowed * 10000000ULL / _baud;
+  } else {
+    allowed = _stagingLen;
+  }
+  if (allowed > _stagingLen) allowed = _stagingLen;
+  for (z = 0; z < allowed; z++) {
+    uint8_t next = (_rxHead + 1) % SERIAL_RX_BUFFER_SIZE;
+    if (next == _rxTail) { _rxDropped++; continue; } // overrun
+    _rx[_rxHead] = _staging[z];
+    _rxHead = next;
+  }
+  memmove(_staging, _staging + allowed, _stagingLen - allowed);
+  _stagingLen -= allowed;
+}
+
+int HardwareSerial::available(void)
+{
+  fill();
+  return (SERIAL_RX_BUFFER_SIZE + _rxHead - _rxTail) % SERIAL_RX_BUFFER_SIZE;
+}
+
+int HardwareSerial::peek(void)
+{
+  fill();
+  return _rxHead == _rxTail ? -1 : _rx[_rxTail];
+}
+
+int HardwareSerial::read(void)
+{
+  int c;
+  fill();
+  if (_rxHead == _rxTail) return -1;
+  c = _rx[_rxTail];
+  _rxTail = (_rxTail + 1) % SERIAL_RX_BUFFER_SIZE;
+  return c;
+}
+
+// pass the queued bytes that are through the wire on to the host
+void HardwareSerial::pump(void)
+{
+  unsigned long byteTime_us;
+  uint64_t now;
+  size_t onWire, out;
+
+  if (!_txQueueLen) return;
+  onWire = 0;
+  if (baudPaced(_baud)) {
+    byteTime_us = byteTime(_baud);
+    now = wireMicros();
+    if (_txBusyUntil_us > now) onWire = (size_t)((_txBusyUntil_us - now + byteTime_us - 1) / byteTime_us);
+  }
+  if (onWire >= _txQueueLen) return;
+  out = _txQueueLen - onWire;
+  ptyWrite(_txQueue, out);
+  memmove(_txQueue, _txQueue + out, _txQueueLen - out);
+  _txQueueLen -= out;
+}
+
+// wait until the wire clock reaches until_us: simulated with a stepped clock, real otherwise
+void HardwareSerial::waitWire(uint64_t until_us)
+{
+  uint64_t now = wireMicros();
+  if (now >= until_us) return;
+  if (_stepped) {
+    SimAdvance(until_us - now);
+    pump();
+    return;
+  }
+  while (wireMicros() < until_us) {
+    SimPoll(); // interrupts keep running while print() waits for the UART
+    pump();
+    usleep(50);
+  }
+}
+
+int HardwareSerial::availableForWrite(void)
+{
+  uint64_t now = wireMicros();
+  unsigned long byteTime_us;
+  if (!baudPaced(_baud) || _txBusyUntil_us <= now) return 63;
+  byteTime_us = byteTime(_baud);
+  long left = 63 - (long)((_txBusyUntil_us - now) / byteTime_us);
+  return left > 0 ? (int)left : 0;
+}
+
+void HardwareSerial::flush(void)
+{
+  if (baudPaced(_baud)) waitWire(_txBusyUntil_us);
+  pump();
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t len)
+{
+  unsigned long byteTime_us;
+  size_t done = 0, chunk;
+  uint64_t now;
+
+  if (!baudPaced(_baud)) {
+    pump();
+    ptyWrite(buf, len);
+    return len;
+  }
+  byteTime_us = byteTime(_baud);
+  while (done < len) {
+    // the AVR TX buffer holds 64 bytes, beyond that print() waits for the UART
+    chunk = len - done < 64 ? len - done : 64;
+    now = wireMicros();
+    if (_txBusyUntil_us < now) _txBusyUntil_us = now;
+    _txBusyUntil_us += (uint64_t)chunk * byteTime_us;
+    if (_txQueueLen + chunk > sizeof(_txQueue)) pump();
+    memcpy(_txQueue + _txQueueLen, buf + done, chunk);
+    _txQueueLen += chunk;
+    done += chunk;
+    if (_txBusyUntil_us > now + 64ULL * byteTime_us) waitWire(_txBusyUntil_us - 64ULL * byteTime_us);
+  }
+  pump();
+  return len;
+}
+
+void SimSerialAttach(int fd) { _ptyFd = fd; }
+unsigned long SimSerialDropped(void) { return _rxDropped; }
+
+
+// *************************************************************************************
+// EEPROM
+// *************************************************************************************
+EEPROMClass EEPROM;
+
+static uint8_t _eeprom[E2END + 1];
+static int _eepromInit = 0;
+static int _eepromFd = -1;
+static uint64_t _eepromBusyUntil_us = 0;
+
+static void eepromInit(void)
+{
+  if (_eepromInit) return;
+  memset(_eeprom, 0xFF, sizeof(_eeprom)); // erased state
+  _eepromInit = 1;
+}
+
+void EEPROMClass::SimAttachFile(const char *path)
+{
+  eepromInit();
+  _eepromFd = open(path, O_RDWR | O_CREAT, 0644);
+  if (_eepromFd < 0) { perror(path); return; }
+  if (pread(_eepromFd, _eeprom, sizeof(_eeprom), 0) != (ssize_t)sizeof(_eeprom)) {
+    memset(_eeprom, 0xFF, sizeof(_eeprom));
+    if (pwrite(_eepromFd, _eeprom, sizeof(_eeprom), 0) < 0) perror(path);
+  }
+}
+
+uint8_t EEPROMClass::read(int idx)
+{
+  eepromInit();
+  return _eeprom[idx & E2END];
+}
+
+void EEPROMClass::write(int idx, uint8_t val)
+{
+  uint64_t now;
+  eepromInit();
+  // an AVR EEPROM write takes 3.3 ms and a new one waits for the previous
+  now = simMicros();
+  if (_eepromBusyUntil_us > now) SimAdvance(_eepromBusyUntil_us - now);
+  _eepromBusyUntil_us = simMicros() + SIM_EEPROM_WRITE_US;
+  _eeprom[idx & E2END] = val;
+  writeCount++;
+  if (_eepromFd >= 0 && pwrite(_eepromFd, &val, 1, idx & E2END) < 0) perror("eeprom");
+}
+
+int eeprom_is_ready(void)
+{
+  return simMicros() >= _eepromBusyUntil_us;
+}
@@ -0,0 +1,160 @@
+// *************************************************************************************
+// Simulated Arduino core for the host build of the shutter firmware
+// Only the subset used by the sketch is provided. Time comes from SimClock,
+//   Serial is a pseudo terminal, the AVR port/timer registers are plain bytes
+//   that SimPoll() turns into interrupt calls.
+// *************************************************************************************
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "avr/pgmspace.h"
+#include "avr/interrupt.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW  0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define bit(b) (1UL << (b))
+#define bitRead(value, b) (((value) >> (b)) & 0x01)
+#define lowByte(w) ((uint8_t) ((w) & 0xff))
+#define highByte(w) ((uint8_t) ((w) >> 8))
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+#define DEC 10
+#define HEX 16
+
+// time base (see SimClock in Arduino.cpp)
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+// digital pins (D0-D7 are mirrored into PIND)
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+// flash strings are ordinary strings on the host
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+// *************************************************************************************
+// Print / HardwareSerial
+// *************************************************************************************
+class Print
+{
+public:
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buf, size_t len);
+  size_t write(const char *str) { return write((const uint8_t *)str, strlen(str)); }
+  size_t print(const __FlashStringHelper *s) { return write((const char *)s); }
+  size_t print(const char *s) { return write(s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(long long n, int base = DEC);
+  size_t print(unsigned long long n, int base = DEC);
+  size_t print(double n, int digits = 2);
+  size_t println(void) { return write("\r\n"); }
+  template <typename T> size_t println(T v) { size_t n = print(v); return n + println(); }
+  template <typename T> size_t println(T v, int f) { size_t n = print(v, f); return n + println(); }
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available(void) = 0;
+  virtual int read(void) = 0;
+  virtual int peek(void) = 0;
+  void setTimeout(unsigned long timeout) { _timeout = timeout; }
+  size_t readBytesUntil(char terminator, char *buffer, size_t length);
+protected:
+  unsigned long _timeout = 1000;
+  int timedRead(void);
+};
+
+#define SERIAL_RX_BUFFER_SIZE 64
+
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long baud);
+  void end(void);
+  int available(void) override;
+  int read(void) override;
+  int peek(void) override;
+  int availableForWrite(void);
+  void flush(void);
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buf, size_t len) override;
+  using Print::write;
+  operator bool() { return true; }
+  unsigned long baud(void) { return _baud; }
+  void pump(void); // simulation: pass the bytes through the wire on to the host
+private:
+  void fill(void);
+  void waitWire(uint64_t until_us);
+  unsigned long _baud = 0;
+  uint8_t _rx[SERIAL_RX_BUFFER_SIZE];
+  uint8_t _rxHead = 0, _rxTail = 0;
+};
+
+extern HardwareSerial Serial;
+
+// *************************************************************************************
+// AVR registers used by DigInput
+// *************************************************************************************
+extern volatile uint8_t PCICR, PCMSK2, PCIFR, PIND;
+extern volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+extern volatile uint16_t TCNT1, OCR1A;
+extern volatile uint8_t TCCR2A, TCCR2B, TIMSK2, OCR2A, TCNT2;
+
+#define PCIE2  2
+#define PCIF2  2
+#define CS10   0
+#define CS11   1
+#define CS12   2
+#define WGM12  3
+#define OCIE1A 1
+#define OCF1A  1
+#define WGM21  1
+#define CS22   2
+#define OCIE2A 1
+#define PCINT16 0
+#define PCINT17 1
+#define PCINT18 2
+#define PCINT19 3
+#define PCINT20 4
+#define PCINT21 5
+#define PCINT22 6
+#define PCINT23 7
+
+// *************************************************************************************
+// simulation hooks (not part of the Arduino API)
+// *************************************************************************************
+// Run pending "interrupts" (pin changes, timer compare matches). Called by the
+//   simulation main loop between loop() passes and from delay().
+void SimPoll(void);
+// Set a simulated input level on D0-D7
+void SimSetPin(uint8_t pin, uint8_t level);
+// Virtual clock control: in stepped mode time only moves via SimAdvance()
+void SimSetSteppedClock(int stepped);
+void SimAdvance(unsigned long us);
+
+#endif // SIM_ARDUINO_H
@@ -0,0 +1,38 @@
+// Simulated EEPROM library: a RAM image, optionally backed by a file so that
+//   parameters survive a restart of the simulated controller
+#ifndef SIM_EEPROM_H
+#define SIM_EEPROM_H
+
+#include <stdint.h>
+#include <string.h>
+#include "avr/eeprom.h"
+
+class EEPROMClass
+{
+public:
+  uint8_t read(int idx);
+  void write(int idx, uint8_t val);
+  void update(int idx, uint8_t val) { if (read(idx) != val) write(idx, val); }
+  uint16_t length(void) { return E2END + 1; }
+  template <typename T> T &get(int idx, T &t)
+  {
+    uint8_t *ptr = (uint8_t *)&t;
+    for (size_t z = 0; z < sizeof(T); z++) ptr[z] = read(idx + z);
+    return t;
+  }
+  template <typename T> const T &put(int idx, const T &t)
+  {
+    const uint8_t *ptr = (const uint8_t *)&t;
+    for (size_t z = 0; z < sizeof(T); z++) update(idx + z, ptr[z]);
+    return t;
+  }
+  // simulation hooks
+  void SimAttachFile(const char *path);
+  unsigned long SimWriteCount(void) { return writeCount; }
+private:
+  unsigned long writeCount = 0;
+};
+
+extern EEPROMClass EEPROM;
+
+#endif // SIM_EEPROM_H
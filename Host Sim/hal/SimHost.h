@@ -0,0 +1,14 @@
+// Glue between the simulated Arduino core and the simulation main program
+#ifndef SIM_HOST_H
+#define SIM_HOST_H
+
+#define SIM_EEPROM_WRITE_US 3300 // duration of one EEPROM byte write on the AVR
+
+void SimHostPoll(void);            // handle control-port input
+int SimHostBaudPacing(void);       // 1 if the UART is rate limited to the baud rate
+unsigned long SimHostBaudRate(void); // baud rate given with -b, 0: the one of Serial.begin
+void SimHostTrace(const char *fmt, ...);
+void SimSerialAttach(int fd);
+unsigned long SimSerialDropped(void);
+
+#endif // SIM_HOST_H
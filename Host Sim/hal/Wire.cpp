@@ -0,0 +1,118 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "Arduino.h"
+#include "Wire.h"
+
+TwoWire Wire;
+
+static SimI2CDevice *_devices[128];
+static FILE *_trace = NULL;
+static unsigned long _transactions = 0;
+
+void TwoWire::SimRegister(uint8_t addr, SimI2CDevice *dev) { _devices[addr & 0x7F] = dev; }
+unsigned long TwoWire::SimTransactionCount(void) { return _transactions; }
+
+void TwoWire::SimOpenTrace(const char *path)
+{
+  _trace = fopen(path, "w");
+  if (!_trace) perror(path);
+}
+
+void TwoWire::SimTrace(const char *fmt, ...)
+{
+  va_list args;
+  if (!_trace) return;
+  fprintf(_trace, "%lu ", micros());
+  va_start(args, fmt);
+  vfprintf(_trace, fmt, args);
+  va_end(args);
+  fputc('\n', _trace);
+  fflush(_trace);
+}
+
+void TwoWire::beginTransmission(uint8_t addr)
+{
+  txAddr = addr;
+  txLen = 0;
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+  if (txLen >= BUFFER_LENGTH) return 0; // same silent truncation as on the AVR
+  txBuf[txLen++] = data;
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t len)
+{
+  size_t n = 0;
+  while (len--) n += write(*data++);
+  return n;
+}
+
+uint8_t TwoWire::endTransmission(bool sendStop)
+{
+  (void)sendStop;
+  _transactions++;
+  SimTrace("I2C 0x%02X %u", txAddr, txLen);
+  // wire time: start + address + data bytes, 9 clocks each
+  SimAdvance(WireTime_us(txLen));
+  if (!_devices[txAddr & 0x7F]) return 2; // NACK on address
+  _devices[txAddr & 0x7F]->Receive(txBuf, txLen);
+  return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t addr, uint8_t len, uint8_t sendStop)
+{
+  (void)sendStop;
+  if (len > BUFFER_LENGTH) len = BUFFER_LENGTH;
+  _transactions++;
+  SimAdvance(WireTime_us(len));
+  rxPos = 0;
+  rxLen = _devices[addr & 0x7F] ? _devices[addr & 0x7F]->Transmit(rxBuf, len) : 0;
+  return rxLen;
+}
+
+// *************************************************************************************
+// PCA9685 register model
+// *************************************************************************************
+#define PCA9685_MODE1 0x00
+#define MODE1_AI      0x20
+
+static SimPCA9685 *_pca[128];
+
+SimPCA9685::SimPCA9685(uint8_t addr) : addr(addr)
+{
+  memset(reg, 0, sizeof(reg));
+  reg[PCA9685_MODE1] = 0x11; // power-on default: sleep, ALLCALL
+  _pca[addr & 0x7F] = this;
+  TwoWire::SimRegister(addr, this);
+}
+
+SimPCA9685 *SimPCA9685::Get(uint8_t addr) { return _pca[addr & 0x7F]; }
+
+void SimPCA9685::Receive(const uint8_t *data, uint8_t len)
+{
+  uint16_t before[16][2];
+  if (len == 0) return;
+  for (uint8_t ch = 0; ch < 16; ch++) { before[ch][0] = On(ch); before[ch][1] = Off(ch); }
+  ptr = data[0];
+  for (uint8_t z = 1; z < len; z++) {
+    reg[ptr] = data[z];
+    if (reg[PCA9685_MODE1] & MODE1_AI) ptr++; // without AI every byte lands in the same register
+  }
+  for (uint8_t ch = 0; ch < 16; ch++) {
+    if (On(ch) != before[ch][0] || Off(ch) != before[ch][1])
+      TwoWire::SimTrace("PWM 0x%02X %u %u %u", addr, ch, On(ch), Off(ch));
+  }
+}
+
+uint8_t SimPCA9685::Transmit(uint8_t *data, uint8_t len)
+{
+  for (uint8_t z = 0; z < len; z++) {
+    data[z] = reg[ptr];
+    if (reg[PCA9685_MODE1] & MODE1_AI) ptr++;
+  }
+  return len;
+}
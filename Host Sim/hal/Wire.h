@@ -0,0 +1,67 @@
+// Simulated Wire library. Every transaction is forwarded to the device model
+//   registered for its address (see SimI2CDevice) and written to the trace.
+#ifndef SIM_WIRE_H
+#define SIM_WIRE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BUFFER_LENGTH 32 // same as the AVR TwoWire buffer
+
+class SimI2CDevice
+{
+public:
+  virtual ~SimI2CDevice() {}
+  virtual void Receive(const uint8_t *data, uint8_t len) = 0;
+  virtual uint8_t Transmit(uint8_t *data, uint8_t len) { (void)data; (void)len; return 0; }
+};
+
+class TwoWire
+{
+public:
+  void begin(void) { clock_hz = 100000; }
+  void setClock(uint32_t clock) { clock_hz = clock; }
+  void beginTransmission(uint8_t addr);
+  size_t write(uint8_t data);
+  size_t write(const uint8_t *data, size_t len);
+  uint8_t endTransmission(bool sendStop = true);
+  uint8_t requestFrom(uint8_t addr, uint8_t len, uint8_t sendStop = 1);
+  int available(void) { return rxLen - rxPos; }
+  int read(void) { return rxPos < rxLen ? rxBuf[rxPos++] : -1; }
+
+  // simulation hooks
+  static void SimRegister(uint8_t addr, SimI2CDevice *dev);
+  static void SimOpenTrace(const char *path);
+  static void SimTrace(const char *fmt, ...);
+  static unsigned long SimTransactionCount(void);
+private:
+  uint8_t txAddr = 0;
+  uint8_t txBuf[BUFFER_LENGTH];
+  uint8_t txLen = 0;
+  uint8_t rxBuf[BUFFER_LENGTH];
+  uint8_t rxLen = 0, rxPos = 0;
+  uint32_t clock_hz = 100000;
+  unsigned long WireTime_us(uint8_t bytes) { return ((unsigned long)bytes + 1) * 9000000UL / clock_hz + 10; }
+};
+
+extern TwoWire Wire;
+
+// *************************************************************************************
+// PCA9685 register model (used by the PWM servo board and the motor shield)
+// *************************************************************************************
+class SimPCA9685 : public SimI2CDevice
+{
+public:
+  SimPCA9685(uint8_t addr);
+  void Receive(const uint8_t *data, uint8_t len) override;
+  uint8_t Transmit(uint8_t *data, uint8_t len) override;
+  uint16_t On(uint8_t ch) { return reg[6+4*ch] | (reg[7+4*ch] << 8); }
+  uint16_t Off(uint8_t ch) { return reg[8+4*ch] | (reg[9+4*ch] << 8); }
+  static SimPCA9685 *Get(uint8_t addr);
+private:
+  uint8_t addr;
+  uint8_t reg[256];
+  uint8_t ptr = 0;
+};
+
+#endif // SIM_WIRE_H
@@ -0,0 +1,14 @@
+// Simulated avr/eeprom.h
+#ifndef SIM_AVR_EEPROM_H
+#define SIM_AVR_EEPROM_H
+
+#include <stdint.h>
+
+#ifndef E2END // e.g. make DEFINES=-DE2END=0xFFF for the 4 kB of the ATmega2560
+#define E2END 0x3FF // 1 kB, as on the ATmega328P
+#endif
+
+// true once the previous byte write has finished (see SIM_EEPROM_WRITE_US)
+int eeprom_is_ready(void);
+
+#endif // SIM_AVR_EEPROM_H
@@ -0,0 +1,12 @@
+// Simulated avr/interrupt.h: an ISR is an ordinary function that SimPoll() calls
+#ifndef SIM_INTERRUPT_H
+#define SIM_INTERRUPT_H
+
+#define ISR(vector) extern "C" void vector(void)
+#define cli() noInterrupts()
+#define sei() interrupts()
+
+void noInterrupts(void);
+void interrupts(void);
+
+#endif // SIM_INTERRUPT_H
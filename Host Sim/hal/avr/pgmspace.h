@@ -0,0 +1,20 @@
+// Simulated avr/pgmspace.h: program memory is ordinary memory on the host
+#ifndef SIM_PGMSPACE_H
+#define SIM_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define pgm_read_ptr(addr) (*(void * const *)(addr))
+#define memcpy_P memcpy
+#define strncmp_P strncmp
+#define strcmp_P strcmp
+#define strlen_P strlen
+
+#endif // SIM_PGMSPACE_H
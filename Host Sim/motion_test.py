@@ -0,0 +1,176 @@
+#!/usr/bin/env python3
+""" Check of the servo motion profiles (SMP) against the I2C trace of the host simulation
+
+Runs shutter_sim with a stepped clock and a trace, moves a servo back and forth with
+several profiles and checks the PWM values written to the channel, frame by frame:
+never past the target (no overshoot), monotonic, speed up by at most accel, slow down by
+at most brake, at most maxStep per frame, frames RCSERVO_FREQ apart, and arrival on the
+target in the frame computed from the profile. Builds shutter_sim first.
+
+    ./motion_test.py
+
+Returns 0 if all checks passed.
+"""
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+from sim_helpers import build, check, open_raw, report, start_sim, stop_sim
+
+FRAME_US = 20000  # 1/RCSERVO_FREQ
+FRAME_SLACK_US = 500  # stepped clock: the frame starts in the first loop pass after FRAME_US
+CLOSED, OPEN = 200, 500
+PCA9685_ADDR = '0x40'
+CHANNEL = '0'
+# (maxStep, accel, brake)
+PROFILES = [(20, 4, 4), (25, 3, 5), (13, 2, 9), (30, 7, 0), (50, 0, 0), (255, 1, 1), (0, 0, 0)]
+
+
+def stop_distance(speed, brake):
+    """ Counts covered while braking from speed by brake per frame
+    """
+    dist = 0
+    while speed > 0:
+        dist += speed
+        speed -= brake
+    return dist
+
+
+def expected_move(start, target, profile):
+    """ Computes the PWM value of every frame of a move from the profile
+
+    Each frame speeds up by accel (up to maxStep), but never beyond the speed from which
+    braking by brake per frame still stops on the target; the last frame lands on it.
+    Arguments:
+      start, target: PWM values
+      profile: (maxStep, accel, brake), maxStep 0->jump, accel 0->no ramp, brake 0->accel
+    """
+    max_step, accel, brake = profile
+    brake = brake or accel
+    if max_step == 0:
+        return [target]
+    pos, speed, frames = start, 0, []
+    while True:
+        dist = abs(target - pos)
+        speed = min(max_step, speed + accel) if accel else max_step
+        if brake:
+            while speed > 1 and stop_distance(speed, brake) > dist:
+                speed -= 1
+        speed = max(speed, 1)
+        if speed >= dist:
+            frames.append(target)
+            return frames
+        pos += speed if target > pos else -speed
+        frames.append(pos)
+
+
+class Sim:
+    """ shutter_sim with a trace file; commands over its pty
+    """
+
+    def __init__(self, tmpdir):
+        self.trace = os.path.join(tmpdir, 'trace')
+        self.proc, link = start_sim(tmpdir, '', ['-t', self.trace, '-s', '-k', '50'],
+                                    stderr=subprocess.DEVNULL, setup_s=0)
+        self.fd = open_raw(link)
+        self.buf = b''
+
+    def command(self, cmd):
+        """ Sends a command and returns its reply line
+        """
+        os.write(self.fd, cmd.encode() + b'\n')
+        while b'\n' not in self.buf:
+            self.buf += os.read(self.fd, 256)
+        line, self.buf = self.buf.split(b'\n', 1)
+        return line.decode().strip()
+
+    def pwm_writes(self):
+        """ Returns the list of (time_us, value) written to the servo channel so far
+        """
+        writes = []
+        with open(self.trace) as f:
+            for line in f:
+                fields = line.split()
+                if fields[1:4] == ['PWM', PCA9685_ADDR, CHANNEL]:
+                    writes.append((int(fields[0]), int(fields[5])))
+        return writes
+
+    def move(self, state, frames):
+        """ Sets the state and returns the PWM writes of the move
+
+        Arguments:
+          state: 0->closed, 1->open
+          frames: expected length of the move, to know how long to wait
+        """
+        before = len(self.pwm_writes())
+        check(self.command(f'SST0,{state}') == 'OK', f'SST0,{state}')
+        deadline = time.time() + 5
+        while time.time() < deadline:  # the stepped clock runs faster than real time
+            if len(self.pwm_writes()) - before >= frames:
+                break
+            time.sleep(0.05)
+        time.sleep(0.2)  # a wrong profile may write more frames
+        return self.pwm_writes()[before:]
+
+    def close(self):
+        os.close(self.fd)
+        stop_sim(self.proc)
+
+
+def check_move(writes, start, target, profile):
+    """ Checks the PWM writes of one move
+
+    Arguments:
+      writes: list of (time_us, value)
+      start, target: PWM values
+      profile: (maxStep, accel, brake)
+    """
+    what = f'{profile} {start}->{target}'
+    max_step, accel, brake = profile
+    brake = brake or accel
+    values = [value for _, value in writes]
+    expected = expected_move(start, target, profile)
+    direction = 1 if target > start else -1
+
+    check(values and values[-1] == target, f'{what}: ends at {values[-1:]}, not on the target')
+    check(all((value - target) * direction <= 0 for value in values), f'{what}: overshoot {values}')
+    steps = [(b - a) * direction for a, b in zip([start] + values, values)]
+    check(all(step > 0 for step in steps), f'{what}: not monotonic {values}')
+    if max_step:
+        check(all(step <= max_step for step in steps), f'{what}: step above maxStep {steps}')
+        if accel:
+            check(all(b - a <= accel for a, b in zip([0] + steps, steps)), f'{what}: accel {steps}')
+        if brake:
+            check(all(a - b <= brake for a, b in zip(steps, steps[1:-1])), f'{what}: brake {steps}')
+    check(values == expected, f'{what}: frames {values}, computed {expected}')
+    times = [t for t, _ in writes]
+    gaps = [b - a for a, b in zip(times, times[1:])]
+    check(all(FRAME_US <= gap <= FRAME_US + FRAME_SLACK_US for gap in gaps),
+          f'{what}: frame intervals {gaps}')
+
+
+def main():
+    build()
+    with tempfile.TemporaryDirectory() as tmpdir:
+        sim = Sim(tmpdir)
+        try:
+            check(sim.command('CLR') == 'OK', 'CLR')
+            check(sim.command(f'SPR-1,{CHANNEL},-1,{OPEN},{CLOSED},0,M') == 'OK', 'SPR')
+            check(sim.command('SMP0,20,4,4') == 'OK', 'SMP')
+            writes = sim.move(0, 1)
+            check([v for _, v in writes] == [CLOSED], f'first move does not jump: {writes}')
+            for profile in PROFILES:
+                check(sim.command('SMP0,{},{},{}'.format(*profile)) == 'OK', f'SMP0 {profile}')
+                for state, start, target in ((1, CLOSED, OPEN), (0, OPEN, CLOSED)):
+                    frames = len(expected_move(start, target, profile))
+                    check_move(sim.move(state, frames), start, target, profile)
+        finally:
+            sim.close()
+
+    return report()
+
+
+if __name__ == '__main__':
+    sys.exit(main())
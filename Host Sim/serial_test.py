@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+""" Check of the simulated UART: baud rate pacing and receive overruns
+
+Runs shutter_sim with the real clock at BAUD and times replies of known length: one GPR
+and a pipelined burst of them must take at least the time their bytes need on the wire,
+and not much more. A second simulation gets more commands at once than the 64-byte
+receive buffer takes while the sketch waits for its replies to go out, and must report
+dropped bytes. Builds shutter_sim first.
+
+    ./serial_test.py
+
+Returns 0 if all checks passed.
+"""
+import os
+import select
+import sys
+import tempfile
+import time
+
+from sim_helpers import build, bytes_dropped, check, open_raw, report, start_sim, stop_sim
+
+BAUD = 9600
+BYTE_S = 10 / BAUD  # start, 8 data and stop bit
+SLACK_S = 0.05  # scheduling of the simulation and of this script
+LABEL = 'Serial0'
+PIPELINED = 8  # 8 x "GPR0\n" fits the receive buffer
+OVERRUN = 30  # 30 x "GPR0\n" does not, while the replies keep the sketch waiting
+
+
+def read_lines(fd, count, timeout_s=5):
+    """ Reads count lines, returns (lines, time of the last byte)
+    """
+    buf = b''
+    last = None
+    deadline = time.monotonic() + timeout_s
+    while buf.count(b'\n') < count and time.monotonic() < deadline:
+        if select.select([fd], [], [], 0.1)[0]:
+            buf += os.read(fd, 1024)
+            last = time.monotonic()
+    return buf.decode(errors='replace').splitlines(), last
+
+
+def command(fd, cmd):
+    """ Sends one command and returns its reply line
+    """
+    os.write(fd, cmd.encode() + b'\n')
+    lines, _ = read_lines(fd, 1)
+    return lines[0].strip() if lines else ''
+
+
+def timed(fd, cmd, count):
+    """ Sends count copies of cmd at once, returns (reply lines, seconds to the last reply byte)
+    """
+    t0 = time.monotonic()
+    os.write(fd, (cmd + '\n').encode() * count)
+    lines, last = read_lines(fd, count)
+    return lines, (last or time.monotonic()) - t0
+
+
+def check_timing(fd):
+    """ Checks the duration of single and pipelined replies of known length
+    """
+    check(command(fd, 'CLR') == 'OK', 'CLR')
+    check(command(fd, f'SPR-1,0,-1,300,200,10,{LABEL}') == 'OK', 'SPR')
+    reply = command(fd, 'GPR0')
+    check(reply.startswith('PR0,') and reply.endswith(LABEL), f'GPR0: {reply}')
+    reply_bytes = len(reply) + 2  # CR LF
+
+    # the command comes in on the wire, then the reply goes out
+    lines, elapsed = timed(fd, 'GPR0', 1)
+    wire = (len('GPR0\n') + reply_bytes) * BYTE_S
+    check(len(lines) == 1, f'single GPR0: {lines}')
+    check(wire <= elapsed <= wire + SLACK_S,
+          f'single GPR0 ({reply_bytes} bytes) took {elapsed*1e3:.1f} ms, on the wire {wire*1e3:.1f} ms')
+
+    # pipelined: the replies queue up behind each other on the wire
+    lines, elapsed = timed(fd, 'GPR0', PIPELINED)
+    wire = (len('GPR0\n') + PIPELINED * reply_bytes) * BYTE_S
+    check(len(lines) == PIPELINED and all(line.strip() == reply for line in lines),
+          f'pipelined GPR0: {lines}')
+    check(wire <= elapsed <= wire + SLACK_S,
+          f'{PIPELINED} pipelined GPR0 ({PIPELINED*reply_bytes} bytes) took {elapsed*1e3:.1f} ms, '
+          f'on the wire {wire*1e3:.1f} ms')
+
+
+def main():
+    build()
+    with tempfile.TemporaryDirectory() as tmpdir:
+        proc, link = start_sim(tmpdir, 'Timing', ['-b', str(BAUD)])
+        fd = open_raw(link)
+        try:
+            check_timing(fd)
+        finally:
+            os.close(fd)
+            err = stop_sim(proc)
+        check(bytes_dropped(err) == 0, f'timing: {err.strip()}')
+
+        proc, link = start_sim(tmpdir, 'Overrun', ['-b', str(BAUD)])
+        fd = open_raw(link)
+        try:
+            check(command(fd, 'CLR') == 'OK', 'CLR')
+            check(command(fd, f'SPR-1,0,-1,300,200,10,{LABEL}') == 'OK', 'SPR')
+            timed(fd, 'GPR0', OVERRUN)
+        finally:
+            os.close(fd)
+            err = stop_sim(proc)
+        dropped = bytes_dropped(err)
+        check(dropped is not None and dropped > 0, f'overrun not detected: {err.strip()}')
+        print(f'{OVERRUN} GPR0 at once: {dropped} bytes dropped')
+
+    return report()
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,87 @@
+""" Helpers shared by the test and benchmark scripts of the host simulation
+
+Builds and starts shutter_sim, opens its serial pty and records the results of checks.
+"""
+import os
+import re
+import subprocess
+import time
+import tty
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SIM = os.path.join(HERE, 'shutter_sim')
+C_LIBRARY = os.path.join(HERE, '..', 'C Library')
+PYTHON_LIBRARY = os.path.join(HERE, '..', 'Python Library')
+
+failures = []
+
+
+def check(condition, what):
+    """ Records a failed check
+
+    Arguments:
+      condition: result of the check
+      what: description for the report
+    """
+    if not condition:
+        failures.append(what)
+        print(f'FAIL: {what}')
+
+
+def report():
+    """ Prints the overall result, returns the exit code of the script
+    """
+    print('FAILED' if failures else 'OK')
+    return 1 if failures else 0
+
+
+def build(directory=HERE, target='shutter_sim'):
+    """ Builds a make target (shutter_sim by default)
+    """
+    subprocess.run(['make', '-s', '-C', directory, target], check=True)
+
+
+def start_sim(tmpdir, name, args=(), stderr=subprocess.PIPE, setup_s=0.2):
+    """ Starts shutter_sim with a fresh EEPROM, returns (process, link path)
+
+    Arguments:
+      tmpdir: directory for the link and the EEPROM file
+      name: tells several simulations in one directory apart
+      args: further shutter_sim options, e.g. ['-b', '9600']
+      stderr: where the summary of the simulation goes (read it with stop_sim)
+      setup_s: time for setup() of the sketch (0 for a stepped clock)
+    """
+    link = os.path.join(tmpdir, f'tty{name}')
+    proc = subprocess.Popen([SIM, '-l', link, '-e', os.path.join(tmpdir, f'eeprom{name}'), *args],
+                            stderr=stderr, text=True)
+    for _ in range(100):
+        if os.path.exists(link):
+            break
+        time.sleep(0.02)
+    time.sleep(setup_s)
+    return proc, link
+
+
+def stop_sim(proc):
+    """ Stops a simulation, returns what it wrote to stderr ('' if not captured)
+    """
+    proc.terminate()
+    _, err = proc.communicate()
+    return err or ''
+
+
+def bytes_dropped(err):
+    """ Returns the serial bytes the simulated UART dropped, from the stderr of stop_sim
+
+    Returns None if the summary line is missing.
+    """
+    match = re.search(r'(\d+) serial bytes dropped', err)
+    return int(match.group(1)) if match else None
+
+
+def open_raw(link):
+    """ Opens the serial pty of a simulation in raw mode, returns the descriptor
+    """
+    fd = os.open(link, os.O_RDWR | os.O_NOCTTY)
+    tty.setraw(fd)
+    return fd
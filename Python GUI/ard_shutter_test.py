@@ -1,6 +1,6 @@
 import tkinter as tk
 from ard_shutter_panel import Panel
-from ard_shutter import Shutter
+from ard_shutter import Shutter, discover
 import logging, sys
 
 
@@ -74,8 +74,12 @@ panel.bind_button('stateCheck', state_check)
 panel.bind_button('paramGet', param_get)
 panel.bind_button('paramSet', param_set)
 
-# open the shutter
-shutter = Shutter('ASRL4::INSTR')
+# open the first shutter controller found
+controllers = discover()
+if not controllers:
+    logging.error('No shutter controller found.')
+    sys.exit(1)
+shutter = Shutter(controllers[0].address)
 
 # run the GUI
 window.mainloop()
@@ -2,6 +2,119 @@ import pyvisa
 import sys
 import re
 import logging
+import threading
+import queue
+import asyncio
+import collections
+import concurrent.futures
+import time
+
+# binary frame protocol (see BinFrame.h in the Arduino code)
+BINFRAME_SIZE = 7
+BINFRAME_SYNC_REQ = 0xA5
+BINFRAME_SYNC_RESP = 0x5A
+BINFRAME_SYNC_SST = 0xA6  # compact set-state frame (3 bytes), answered by one ack byte
+BINACK_OK = 0x06
+BINCMD_SST = 0x01
+BINCMD_GST = 0x02
+BINCMD_SSP = 0x03
+BINCMD_GND = 0x04
+BINCMD_SSM = 0x05
+BINCMD_ASCII = 0x7F
+BINSTAT_OK = 0x00
+
+# timing histogram channels (GPF command) and bucket upper limits in us
+STATS_CHANNELS = ['loop', 'parse', 'actuator', 'display']
+STATS_BUCKET_LIMITS_US = [16, 64, 256, 1024, 4096, 16384, 65536, None]
+
+# state-change events (EVT command), sources in the order of their numbers
+EVENT_SOURCES = ['serial', 'display', 'digital', 'idle', 'sequencer']
+EVENT_POLL_S = 0.01  # the background reader looks for events this often
+Event = collections.namedtuple('Event', ['device', 'state', 'source', 'time_ms'])
+
+# client-side cache (Shutter.set_cache), flags
+CACHE_OFF = 0
+CACHE_PARAMETERS = 1  # number of devices, labels, transit delays, parameters
+CACHE_STATES = 2      # shutter states
+
+# actuator types (GAT, SAT)
+ACTUATOR_RCSERVO = 0
+ACTUATOR_SOLENOID = 1
+
+# pipelined commands: unanswered bytes on the line (the Uno has a 64-byte receive buffer)
+BATCH_WINDOW = 63
+
+# background EEPROM save (SAV, GSV)
+SAVE_POLL_S = 0.02
+SAVE_TIMEOUT_S = 3.0  # a save of all shutters takes about 0.3 s
+
+# named presets (GPS, LPS, SPS)
+MAXPRESETS = 4  # MAXPRESETS of the Arduino code
+
+# discovery
+DISCOVER_TIMEOUT_MS = 250  # read timeout of each probed port
+ControllerInfo = collections.namedtuple('ControllerInfo', ['address', 'num_devices', 'labels'])
+
+
+def _crc8(data):
+    """CRC-8 (polynomial 0x07, init 0) used by the binary frames"""
+    crc = 0
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+def discover(candidates=None, timeout_ms=DISCOVER_TIMEOUT_MS):
+    """ Finds the shutter controllers on the serial ports
+
+    Probes all candidates at the same time (one thread each), so the search takes about one
+    timeout. Ports that do not answer with the ID of a shutter controller are skipped.
+    The Uno resets when its port is opened unless the reset jumper is shorted; raise
+    timeout_ms then.
+    Arguments:
+      candidates: VISA resource IDs to probe, None->all serial resources ('ASRL?*::INSTR')
+      timeout_ms: read timeout of each probe
+    Returns a list of ControllerInfo(address, num_devices, labels) tuples in the order of
+      the candidates; pass the address to Shutter.
+    """
+    if candidates is None:
+        rm = pyvisa.ResourceManager('@py')
+        candidates = rm.list_resources('ASRL?*::INSTR')
+        rm.close()
+    logging.info(f'Probing {len(candidates)} ports for shutter controllers.')
+    if not candidates:
+        return []
+    with concurrent.futures.ThreadPoolExecutor(len(candidates)) as pool:
+        found = pool.map(lambda address: _probe(address, timeout_ms), candidates)
+    return [info for info in found if info]
+
+
+def _probe(address, timeout_ms):
+    """ Checks one port for a controller (see discover), None if there is none
+    """
+    rm = pyvisa.ResourceManager('@py')
+    try:
+        inst = rm.open_resource(address, timeout=timeout_ms, baud_rate=9600,
+                                read_termination='\n', write_termination='\n')
+    except Exception:
+        logging.info(f'Could not open {address}.')
+        rm.close()
+        return
+    try:
+        if not inst.query('*IDN?').startswith('Arduino Uno Shutter'):
+            return
+        num = int(re.search(r'\d+', inst.query('GND')).group())
+        labels = [inst.query(f'GDL{device}').rstrip('\r\n').split('=', 1)[1]
+                  for device in range(num)]
+        return ControllerInfo(address, num, labels)
+    except Exception:
+        logging.info(f'No shutter controller at {address}.')
+        return
+    finally:
+        inst.close()
+        rm.close()
+
 
 class InstrumentError(Exception):
     """Exception to indicate an error while communicating with the Arduino"""
@@ -14,18 +127,39 @@ class Shutter:
     Instance variables (private):
       _rm: visa handle to resource manager
       _inst: visa handle to instrument
+      _binary: True while the binary frame protocol is active
+      _seq: sequence number of the last binary frame
+      _cache_mode: CACHE_ flags
+      _cache_num_devices, _cache_params, _cache_states: cached values (None/missing->unknown)
+      _lock: serializes the commands and the background event reader
+      _events: queue of received Event tuples
+      _event_thread, _event_stop: background event reader
     Methods:
       get_num_devices: get # of shutters. This can change during operation
       get(set)_state(dev): get(set) the state (open-1, close-0) of shutter # dev
+      set_states(states): set the states of several shutters at once
       get_device_label(dev): get the label of shutter # dev
       get_transit_delay(dev): get the transit delay in ms of shutter # dev
       set_position(dev): set the actuator position of shutter # dev
+      get(set)_hit_time(dev): hit-and-hold pulse of solenoid shutter # dev
+      get(set)_motion(dev): speed and acceleration limits of servo shutter # dev
+      get(set)_board(dev): stacked driver board of shutter # dev
+      get(set)_actuator(dev): actuator type (servo or solenoid) of shutter # dev
       get(set)_parameters(dev): get(set) the device parms of shutter # dev
       save: saves parameters to EEPROM
+      get_save_status: progress of the save
+      get_preset(s), load_preset, store_preset: named shutter sets stored on the controller
       clear: clears the device paramters and sets the num sutters to zero
+      get_latency/clear_latency: digital input edge-to-actuation latency statistics
+      seq_*: on-device sequencer (upload events, arm/start/abort, status, timing)
+      enter(exit)_binary_mode: switch to (from) the binary frame protocol. Only
+        get_num_devices, check_state, set_state(s) and set_position work in binary mode.
+      batch: collects commands and sends them pipelined (see Batch)
+      set_cache/invalidate_cache: answer the get methods from a local copy
+      subscribe(unsubscribe)_events: state-change events, see get_event/next_event
     """
     
-    def __init__(self, address):
+    def __init__(self, address, cache=CACHE_OFF):
         """ Connects to the shutter controller
 
         Opens the resource manager, then the device. Terminates if the device cannot 
@@ -33,6 +167,7 @@ class Shutter:
         throws an exception if it's the wrong device.
         Arguments:
           address: a VISA Resource ID, like 'ASRL3::INSTR'
+          cache: CACHE_ flags, see set_cache
         """
         logging.info('Initializing instrument.')
         try:
@@ -49,16 +184,26 @@ class Shutter:
             print(e)
             sys.exit(1)
         logging.info(f'Instrument: {self._inst}')
+        self._binary = False
+        self._seq = 0
+        self._lock = threading.RLock()
+        self._events = queue.Queue()
+        self._event_thread = None
+        self._event_stop = threading.Event()
+        self._cache_mode = CACHE_OFF
+        self.invalidate_cache()
         self._inst.read_termination = '\n'
         self._inst.write_termination = '\n'
         self._inst.baud_rate = 9600
         logging.info('Requesting ID from instrument')
-        resp = self._inst.query('*IDN?').rstrip('\r\n')
+        resp = self._query('*IDN?')
         if not resp.startswith('Arduino Uno Shutter'):
             self._inst.close()
             self._rm.close()
             raise InstrumentError(
                 f"Wrong ID response. Expected 'Arduino Uno Shutter', got '{resp}'.")
+        if cache:
+            self.set_cache(cache)
 
 
     def __del__(self):
@@ -68,6 +213,10 @@ class Shutter:
         The deletes the attributes (just in case).
         """
         if hasattr(self, '_inst'):
+            if self._event_thread:
+                self.unsubscribe_events()
+            if self._binary:
+                self.exit_binary_mode()
             logging.info('Closing instrument.')
             self._inst.close()
             delattr(self, '_inst')
@@ -87,11 +236,20 @@ class Shutter:
         Sends the query and interprets the response. Sends back an integer.
         """
         logging.info('Checking the number of devices.')
-        resp = self._inst.query('GND').rstrip('\r\n')
-        if resp.startswith('Error'):
-            logging.error(f"Invalid response. Expected a number, got '{resp}'.")
-            return    
-        return int(re.search(r'\d+', resp).group())
+        if self._cache_mode & CACHE_PARAMETERS and self._cache_num_devices is not None:
+            return self._cache_num_devices
+        if self._binary:
+            frame = self._binary_query(BINCMD_GND)
+            num = frame[3] if frame else None
+        else:
+            resp = self._query('GND')
+            if resp.startswith('Error'):
+                logging.error(f"Invalid response. Expected a number, got '{resp}'.")
+                return    
+            num = int(re.search(r'\d+', resp).group())
+        if self._cache_mode & CACHE_PARAMETERS:
+            self._cache_num_devices = num
+        return num
 
 
     def check_state(self, device):
@@ -102,12 +260,21 @@ class Shutter:
           device: the selected shutter number (zero-based index)
         """
         logging.info('Checking the device state.')
-        resp = self._inst.query(f'GST{device}').rstrip('\r\n')
-        if resp.startswith('Error'):
-            logging.error(f"Invalid response. Expected a number, got '{resp}'.")
-            return    
-        num = resp.split('=')[1]
-        return int(num)
+        if self._cache_mode & CACHE_STATES and device in self._cache_states:
+            return self._cache_states[device]
+        if self._binary:
+            frame = self._binary_query(BINCMD_GST, device)
+            if not frame:
+                return
+            state = int.from_bytes(frame[4:5], 'little', signed=True)
+        else:
+            resp = self._query(f'GST{device}')
+            if resp.startswith('Error'):
+                logging.error(f"Invalid response. Expected a number, got '{resp}'.")
+                return    
+            state = int(resp.split('=')[1])
+        self._cache_states[device] = state
+        return state
 
 
     def get_parameters(self, device):
@@ -118,7 +285,51 @@ class Shutter:
           device: the selected shutter number (zero-based index)
         """
         logging.info('Getting device parameters.')
-        resp = self._inst.query(f'GPR{device}').rstrip('\r\n').rstrip('\r\n')
+        if self._cache_mode & CACHE_PARAMETERS and device in self._cache_params:
+            return dict(self._cache_params[device])
+        resp = self._query(f'GPR{device}')
+        params = self._parse_parameters(resp)
+        if params and self._cache_mode & CACHE_PARAMETERS:
+            self._cache_params[device] = dict(params)
+        return params
+
+
+    def get_device_label(self, device):
+        """ Gets the label of the given device
+
+        Arguments:
+          device: the selected shutter number (zero-based index)
+        """
+        if self._cache_mode & CACHE_PARAMETERS:
+            return self.get_parameters(device).get('label')
+        logging.info('Getting the device label.')
+        resp = self._query(f'GDL{device}')
+        if not resp.startswith(f'DL{device}='):
+            logging.error(f"Invalid response. Expected 'DL{device}=...', got '{resp}'.")
+            return
+        return resp.split('=', 1)[1]
+
+
+    def get_transit_delay(self, device):
+        """ Gets the transit delay of the given device in ms
+
+        Arguments:
+          device: the selected shutter number (zero-based index)
+        """
+        if self._cache_mode & CACHE_PARAMETERS:
+            return self.get_parameters(device).get('transDelay_ms')
+        logging.info('Getting the transit delay.')
+        resp = self._query(f'GTD{device}')
+        if not resp.startswith(f'TD{device}='):
+            logging.error(f"Invalid response. Expected 'TD{device}=...', got '{resp}'.")
+            return
+        return int(resp.split('=')[1])
+
+
+    @staticmethod
+    def _parse_parameters(resp):
+        """ Interprets the 'PR...' response of GPR as a dictionary
+        """
         if not resp.startswith('PR'):
             logging.error(f"Invalid response. Expected 'PR...', got '{resp}'.")
             return {}
@@ -146,13 +357,18 @@ class Shutter:
           params: The parameters as a dictionary.
         """
         logging.info('Setting device parameters.')
-        resp = self._inst.query(f'SPR{device},'\
-                                +f'{params['shieldChannel']},'\
-                                +f'{params['digInput']},'\
-                                +f'{params['openPos']},'\
-                                +f'{params['closedPos']},'\
-                                +f'{params['transDelay_ms']},'\
-                                +f'{params['label']}').rstrip('\r\n')
+        # read again when needed (the Arduino may cut the label or add a device)
+        if device<0:
+            self.invalidate_cache()
+        else:
+            self._cache_params.pop(device, None)
+        resp = self._query(f'SPR{device},'\
+                          +f'{params["shieldChannel"]},'\
+                          +f'{params["digInput"]},'\
+                          +f'{params["openPos"]},'\
+                          +f'{params["closedPos"]},'\
+                          +f'{params["transDelay_ms"]},'\
+                          +f'{params["label"]}')
         if resp!='OK':
             logging.error(f"Invalid response. Expected 'OK', got '{resp}'.")
 
@@ -166,9 +382,47 @@ class Shutter:
           state: 0->close, 1->open
         """
         logging.info('Setting shutter state.')
-        resp = self._inst.query(f'SST{device},{state}').rstrip('\r\n')
+        if self._binary:
+            if self._binary_set_state(device, state):
+                self._cache_states[device] = state
+            return
+        resp = self._query(f'SST{device},{state}')
         if resp!='OK':
             logging.error(f"Invalid response. Expected 'OK', got '{resp}'.")
+            return
+        self._cache_states[device] = state
+
+
+    def set_states(self, states):
+        """ Sets the states of several devices at once
+
+        All shutters in the dictionary move together (one command, one pass of actuator writes).
+        Arguments:
+          states: dictionary {device: state}, state 0->close, 1->open
+        """
+        logging.info('Setting shutter states.')
+        mask = 0
+        bits = 0
+        for device, state in states.items():
+            mask |= 1 << device
+            if state:
+                bits |= 1 << device
+        if self._binary:
+            # a binary frame carries one group of eight devices
+            group = 0
+            while mask and not (mask >> (8*group)) & 0xFF:
+                group += 1
+            if mask >> (8*group+8):
+                logging.error('Invalid device mask (binary mode: one group of eight devices only).')
+                return
+            if self._binary_query(BINCMD_SSM, mask >> (8*group), bits >> (8*group), group):
+                self._cache_states.update({dev: int(bool(st)) for dev, st in states.items()})
+            return
+        resp = self._query(f'SSM{mask},{bits}')
+        if resp!='OK':
+            logging.error(f"Invalid response. Expected 'OK', got '{resp}'.")
+            return
+        self._cache_states.update({dev: int(bool(st)) for dev, st in states.items()})
 
 
     def set_position(self, device, position):
@@ -180,9 +434,127 @@ class Shutter:
           position: position for the actuator
         """
         logging.info('Setting actuator position.')
-        resp = self._inst.query(f'SSP{device},{position}').rstrip('\r\n')
+        if self._binary:
+            if self._binary_query(BINCMD_SSP, device, position & 0xFF, position >> 8):
+                self._cache_states[device] = 2  # flag for manual set
+            return
+        resp = self._query(f'SSP{device},{position}')
         if resp!='OK':
             logging.error(f"Invalid response. Expected 'OK', got '{resp}'.")
+            return
+        self._cache_states[device] = 2  # flag for manual set
+
+
+    def get_hit_time(self, device):
+        """ Gets the hit-and-hold pulse of a solenoid shutter in ms (0->off)
+
+        Arguments:
+          device: the selected shutter number (zero-based index)
+        """
+        logging.info('Getting the hit time.')
+        resp = self._query(f'GHT{device}')
+        if not resp.startswith(f'HT{device}='):
+            logging.error(f"Invalid response. Expected 'HT{device}=...', got '{resp}'.")
+            return
+        return int(resp.split('=')[1])
+
+
+    def set_hit_time(self, device, hit_time_ms):
+        """ Sets the hit-and-hold pulse of a solenoid shutter (SHUTTER_SOLENOID only)
+
+        Opening then starts with a full-power pulse of hit_time_ms and holds with the open
+        force (openPos) afterwards: fast pull-in, less heat in the coil.
+        Arguments:
+          device: the selected shutter number (zero-based index)
+          hit_time_ms: pulse length in ms, 0->constant force
+        """
+        logging.info('Setting the hit time.')
+        self._command(f'SHT{device},{hit_time_ms}')
+
+
+    def get_motion(self, device):
+        """ Gets the motion profile of a servo shutter as a dictionary (see set_motion)
+
+        Arguments:
+          device: the selected shutter number (zero-based index)
+        """
+        logging.info('Getting the motion profile.')
+        resp = self._query(f'GMP{device}')
+        if not resp.startswith(f'MP{device}='):
+            logging.error(f"Invalid response. Expected 'MP{device}=...', got '{resp}'.")
+            return {}
+        numbers = [int(n) for n in resp.split('=')[1].split(',')]
+        return dict(zip(['max_step', 'accel', 'brake'], numbers))
+
+
+    def set_motion(self, device, max_step, accel=0, brake=0):
+        """ Sets the motion profile of a servo shutter (SHUTTER_RCSERVO only)
+
+        A state change then moves the servo along a ramp, one step per servo frame (20 ms),
+        instead of sending it to the new position at once; it arrives without overshoot.
+        Arguments:
+          device: the selected shutter number (zero-based index)
+          max_step: top speed in PWM counts per frame, 0->no profile
+          accel: speed increase per frame, 0->start at max_step
+          brake: speed decrease per frame before the target, 0->same as accel
+        """
+        logging.info('Setting the motion profile.')
+        self._command(f'SMP{device},{max_step},{accel},{brake}')
+
+
+    def get_board(self, device):
+        """ Gets the driver board of a device (0->first board)
+
+        Arguments:
+          device: the selected shutter number (zero-based index)
+        """
+        logging.info('Getting the board.')
+        resp = self._query(f'GBD{device}')
+        if not resp.startswith(f'BD{device}='):
+            logging.error(f"Invalid response. Expected 'BD{device}=...', got '{resp}'.")
+            return
+        return int(resp.split('=')[1])
+
+
+    def set_board(self, device, board):
+        """ Sets the driver board of a device
+
+        Stacked boards sit at consecutive I2C addresses; the channel (actuator) number
+        counts on the selected board.
+        Arguments:
+          device: the selected shutter number (zero-based index)
+          board: board number, 0 to the number of boards compiled in minus one
+        """
+        logging.info('Setting the board.')
+        self._command(f'SBD{device},{board}')
+
+
+    def get_actuator(self, device):
+        """ Gets the actuator type of a device (ACTUATOR_RCSERVO or ACTUATOR_SOLENOID)
+
+        Arguments:
+          device: the selected shutter number (zero-based index)
+        """
+        logging.info('Getting the actuator type.')
+        resp = self._query(f'GAT{device}')
+        if not resp.startswith(f'AT{device}='):
+            logging.error(f"Invalid response. Expected 'AT{device}=...', got '{resp}'.")
+            return
+        return int(resp.split('=')[1])
+
+
+    def set_actuator(self, device, actuator):
+        """ Sets the actuator type of a device
+
+        Needs a controller built for both types. The state is unknown (-2) until the next
+        set_state.
+        Arguments:
+          device: the selected shutter number (zero-based index)
+          actuator: ACTUATOR_RCSERVO or ACTUATOR_SOLENOID
+        """
+        logging.info('Setting the actuator type.')
+        if self._command(f'SAT{device},{actuator}'):
+            self._cache_states[device] = -2
 
 
     def clear(self):
@@ -191,7 +563,8 @@ class Shutter:
         Sets the number of devices to zero
         """
         logging.info('Clearing the device parameters.')
-        resp = self._inst.query('CLR').rstrip('\r\n')
+        self.invalidate_cache()
+        resp = self._query('CLR')
         if resp!='OK':
             logging.error(f"Invalid response. Expected 'OK', got '{resp}'.")
 
@@ -199,9 +572,625 @@ class Shutter:
     def save(self):
         """ Saves the current parameters to EEPROM
 
-        Only writes to the EEPROM if the number of devices is > 0
+        Only writes to the EEPROM if the number of devices is > 0. The controller writes
+        in the background and keeps running the shutters; this waits until it is done.
+        Returns True on success.
         """
         logging.info('Saving the device parameters to EEPROM.')
-        resp = self._inst.query('SAV').rstrip('\r\n')
+        resp = self._query('SAV')
         if resp!='OK':
-            logging.error(f"Invalid response. Expected 'OK', got '{resp}'.")
\ No newline at end of file
+            logging.error(f"Invalid response. Expected 'OK', got '{resp}'.")
+            return False
+        return self._wait_for_save()
+
+
+    def get_save_status(self):
+        """ Gets the progress of the EEPROM save
+
+        Returns a dictionary: running (True while the save is written), done and total
+          (bytes written or found unchanged so far, and in all)
+        """
+        resp = self._query('GSV')
+        if not resp.startswith('SV='):
+            logging.error(f"Invalid response. Expected 'SV=...', got '{resp}'.")
+            return {}
+        return Shutter._parse_save_status(resp)
+
+
+    @staticmethod
+    def _parse_save_status(resp):
+        """ Interprets the GSV reply
+        """
+        running, done, total = (int(n) for n in resp[3:].split(','))
+        return {'running': bool(running), 'done': done, 'total': total}
+
+
+    def _wait_for_save(self):
+        """ Polls the save status until the controller has written the EEPROM
+        """
+        deadline = time.monotonic() + SAVE_TIMEOUT_S
+        while True:
+            status = self.get_save_status()
+            if not status:
+                return False
+            if not status['running']:
+                return True
+            if time.monotonic() > deadline:
+                logging.error('Save did not finish.')
+                return False
+            time.sleep(SAVE_POLL_S)
+
+
+    def get_preset(self, preset):
+        """ Gets a preset as a dictionary: name, num_devices (0->empty) and active (True if
+        the current shutters are this preset, loaded or stored and unchanged since)
+
+        Arguments:
+          preset: preset number, 0..MAXPRESETS-1
+        """
+        resp = self._query(f'GPS{preset}')
+        if not resp.startswith(f'PS{preset}='):
+            logging.error(f"Invalid response. Expected 'PS{preset}=...', got '{resp}'.")
+            return {}
+        return Shutter._parse_preset(resp)
+
+
+    def get_presets(self):
+        """ Gets all presets as a list of dictionaries (see get_preset)
+        """
+        return [self.get_preset(preset) for preset in range(MAXPRESETS)]
+
+
+    @staticmethod
+    def _parse_preset(resp):
+        """ Interprets the GPS reply
+        """
+        name, num_devices, active = resp.split('=', 1)[1].rsplit(',', 2)
+        return {'name': name, 'num_devices': int(num_devices), 'active': active=='1'}
+
+
+    def load_preset(self, preset):
+        """ Replaces all shutters by a stored preset, in one command
+
+        The shutters are not saved (see save). Returns True on success.
+        Arguments:
+          preset: preset number, 0..MAXPRESETS-1
+        """
+        logging.info(f'Loading preset {preset}.')
+        self.invalidate_cache()
+        resp = self._query(f'LPS{preset}')
+        if resp!='OK':
+            logging.error(f"Invalid response. Expected 'OK', got '{resp}'.")
+            return False
+        return True
+
+
+    def store_preset(self, preset, name):
+        """ Stores the current shutters as a preset, waits until the EEPROM is written
+
+        Returns True on success.
+        Arguments:
+          preset: preset number, 0..MAXPRESETS-1
+          name: up to 7 characters, like a label
+        """
+        logging.info(f'Storing preset {preset}.')
+        resp = self._query(f'SPS{preset},{name}')
+        if resp!='OK':
+            logging.error(f"Invalid response. Expected 'OK', got '{resp}'.")
+            return False
+        return self._wait_for_save()
+
+
+    def get_latency(self):
+        """ Gets the digital input edge-to-actuation latency statistics
+
+        Returns a dictionary with count (edges that moved a shutter), last_us, min_us and max_us.
+        """
+        logging.info('Getting the digital input latency.')
+        resp = self._query('GLT')
+        if not resp.startswith('LT='):
+            logging.error(f"Invalid response. Expected 'LT=...', got '{resp}'.")
+            return {}
+        numbers = [int(n) for n in resp[3:].split(',')]
+        return dict(zip(['count', 'last_us', 'min_us', 'max_us'], numbers))
+
+
+    def clear_latency(self):
+        """ Resets the latency statistics
+        """
+        logging.info('Clearing the digital input latency.')
+        self._command('CLT')
+
+
+    def get_stats(self, channel):
+        """ Gets a timing histogram
+
+        Arguments:
+          channel: index or name from STATS_CHANNELS ('loop', 'parse', 'actuator', 'display')
+        Returns a dictionary with count, max_us and buckets, a list of
+          (upper limit in us or None for the last bucket, count) pairs.
+        """
+        if isinstance(channel, str):
+            channel = STATS_CHANNELS.index(channel)
+        logging.info(f'Getting the timing histogram of channel {channel}.')
+        resp = self._query(f'GPF{channel}')
+        return self._parse_stats(channel, resp)
+
+
+    @staticmethod
+    def _parse_stats(channel, resp):
+        """ Interprets the 'PF...' response of GPF as a dictionary
+        """
+        prefix = f'PF{channel}='
+        if not resp.startswith(prefix):
+            logging.error(f"Invalid response. Expected '{prefix}...', got '{resp}'.")
+            return {}
+        numbers = [int(n) for n in resp[len(prefix):].split(',')]
+        return {'count': numbers[0], 'max_us': numbers[1],
+                'buckets': list(zip(STATS_BUCKET_LIMITS_US, numbers[2:]))}
+
+
+    def get_all_stats(self):
+        """ Gets the timing histograms of all channels as a dictionary {name: histogram}
+        """
+        return {name: self.get_stats(channel) for channel, name in enumerate(STATS_CHANNELS)}
+
+
+    def clear_stats(self):
+        """ Resets all timing histograms
+        """
+        logging.info('Clearing the timing histograms.')
+        self._command('CPF')
+
+
+    def seq_clear(self):
+        """ Removes all events of the on-device sequence
+        """
+        logging.info('Clearing the sequence.')
+        self._command('SQC')
+
+
+    def seq_add_event(self, offset_us, states):
+        """ Appends an event to the on-device sequence
+
+        Arguments:
+          offset_us: time after the start of each pass in us, must not decrease
+          states: dictionary {device: state}, state 0->close, 1->open
+        """
+        logging.info('Adding a sequence event.')
+        mask = 0
+        bits = 0
+        for device, state in states.items():
+            mask |= 1 << device
+            if state:
+                bits |= 1 << device
+        self._command(f'SQA{offset_us},{mask},{bits}')
+
+
+    def seq_configure(self, loops=1, trigger=0, period_us=0):
+        """ Sets how the sequence is played
+
+        Arguments:
+          loops: passes to play, 0 until aborted
+          trigger: 0->seq_start, 1-4->rising edge on digital input 0-3 (firmware built with DIGINPUT)
+          period_us: length of a pass, 0 for the time of the last event
+        """
+        logging.info('Configuring the sequence.')
+        self._command(f'SQP{loops},{trigger},{period_us}')
+
+
+    def seq_arm(self):
+        """ Waits for the trigger of the sequence
+        """
+        logging.info('Arming the sequence.')
+        self._command('SQR')
+
+
+    def seq_start(self):
+        """ Starts the armed sequence
+        """
+        logging.info('Starting the sequence.')
+        self._command('SQS')
+
+
+    def seq_abort(self):
+        """ Stops the sequence, the shutters stay where they are
+        """
+        logging.info('Aborting the sequence.')
+        self._command('SQX')
+
+
+    def seq_status(self):
+        """ Gets the sequencer status
+
+        Returns a dictionary with state (0->idle, 1->armed, 2->running), loops_done,
+        next_event, num_events and start_time_ms.
+        """
+        logging.info('Getting the sequence status.')
+        resp = self._query('SQG')
+        if not resp.startswith('SQ='):
+            logging.error(f"Invalid response. Expected 'SQ=...', got '{resp}'.")
+            return {}
+        numbers = [int(n) for n in resp[3:].split(',')]
+        keys = ['state', 'loops_done', 'next_event', 'num_events', 'start_time_ms']
+        return dict(zip(keys, numbers))
+
+
+    def seq_timing(self, event):
+        """ Gets the timing of an event in the latest pass
+
+        Returns (planned, actual) in us after the start of the pass.
+        Arguments:
+          event: index of the event (zero-based)
+        """
+        logging.info('Getting the sequence event timing.')
+        resp = self._query(f'SQT{event}')
+        if not resp.startswith(f'SQT{event}='):
+            logging.error(f"Invalid response. Expected 'SQT{event}=...', got '{resp}'.")
+            return
+        planned, actual = resp.split('=')[1].split(',')
+        return int(planned), int(actual)
+
+
+    def subscribe_events(self):
+        """ Starts the state-change events (needs SERIALEVENTS in the Arduino code)
+
+        The controller then reports every change of a shutter state, whatever caused it.
+        A background thread reads the events while no command runs; they are queued
+        as Event(device, state, source, time_ms) tuples, source is a name from
+        EVENT_SOURCES and time_ms the controller time. Read them with get_event or
+        next_event. The cached states (CACHE_STATES) follow the events.
+        """
+        logging.info('Subscribing to the state-change events.')
+        if self._binary:
+            logging.error('Events are not available in binary mode.')
+            return
+        if self._event_thread:
+            return
+        if not self._command('EVT1'):
+            return
+        self._event_stop.clear()
+        self._event_thread = threading.Thread(target=self._event_reader, daemon=True)
+        self._event_thread.start()
+
+
+    def unsubscribe_events(self):
+        """ Stops the state-change events; queued events can still be read
+        """
+        logging.info('Unsubscribing from the state-change events.')
+        if not self._event_thread:
+            return
+        self._event_stop.set()
+        self._event_thread.join()
+        self._event_thread = None
+        if not self._binary:
+            self._command('EVT0')
+
+
+    def get_event(self, timeout=None):
+        """ Gets the next state-change event, None if there is none within timeout (in s)
+        """
+        try:
+            return self._events.get(timeout=timeout)
+        except queue.Empty:
+            return
+
+
+    async def next_event(self):
+        """ Waits for the next state-change event without blocking the asyncio loop
+        """
+        return await asyncio.get_running_loop().run_in_executor(None, self._events.get)
+
+
+    def set_cache(self, mode):
+        """ Switches the client-side cache on or off
+
+        The get methods then answer from a local copy of the device table. Switching it on
+        reads all devices once; the copy follows the set methods and is dropped by clear.
+        CACHE_STATES is only correct while this host is the only source of state changes
+        (no display, digital inputs, sequencer or idle timeout).
+        Arguments:
+          mode: CACHE_ flags (CACHE_OFF, CACHE_PARAMETERS, CACHE_STATES)
+        """
+        logging.info(f'Setting the cache mode to {mode}.')
+        self._cache_mode = CACHE_OFF
+        self.invalidate_cache()
+        if self._binary and mode & CACHE_PARAMETERS:
+            logging.error('Cannot fill the parameter cache in binary mode.')
+            return
+        num = self.get_num_devices()
+        if num is None:
+            return
+        for device in range(num):
+            if mode & CACHE_PARAMETERS:
+                params = self.get_parameters(device)
+                if not params:
+                    self.invalidate_cache()
+                    return
+                self._cache_params[device] = params
+            if mode & CACHE_STATES:
+                self.check_state(device)
+        if mode & CACHE_PARAMETERS:
+            self._cache_num_devices = num
+        self._cache_mode = mode
+
+
+    def invalidate_cache(self):
+        """ Drops the cached values, they are read again when needed
+        """
+        self._cache_num_devices = None
+        self._cache_params = {}
+        self._cache_states = {}
+
+
+    def batch(self):
+        """ Starts a batch of pipelined commands
+
+        Use it as a context manager; the commands are sent when the block ends:
+            with shutter.batch() as b:
+                states = [b.check_state(dev) for dev in range(4)]
+            print([s.value for s in states])
+        Not available in binary mode.
+        """
+        return Batch(self)
+
+
+    def _pipeline(self, commands):
+        """ Writes the commands back-to-back and reads the replies in the same order
+
+        A command is written as soon as the unanswered ones fit the receive buffer of the
+        Arduino, so the line is busy in both directions. Returns the list of replies.
+        """
+        replies = []
+        sent = 0
+        in_flight = 0
+        with self._lock:
+            for cmd in commands:
+                while sent<len(commands) and in_flight+len(commands[sent])+1<=BATCH_WINDOW:
+                    self._inst.write(commands[sent])
+                    in_flight += len(commands[sent])+1
+                    sent += 1
+                replies.append(self._read_reply())
+                in_flight -= len(cmd)+1
+        return replies
+
+
+    def _command(self, cmd):
+        """ Sends a command that is answered with 'OK'
+
+        Returns True on success.
+        """
+        resp = self._query(cmd)
+        if resp!='OK':
+            logging.error(f"Invalid response. Expected 'OK', got '{resp}'.")
+            return False
+        return True
+
+
+    def _query(self, cmd):
+        """ Sends a command and returns the reply line without the line end
+        """
+        with self._lock:
+            self._inst.write(cmd)
+            return self._read_reply()
+
+
+    def _read_reply(self):
+        """ Reads the next reply line; events in front of it are queued and skipped
+        """
+        while True:
+            resp = self._inst.read().rstrip('\r\n')
+            if not self._dispatch_event(resp):
+                return resp
+
+
+    def _dispatch_event(self, line):
+        """ Queues an event line ('!EV<device>,<state>,<source>,<time_ms>')
+
+        Returns False if the line is not an event.
+        """
+        if not line.startswith('!'):
+            return False
+        event = self._parse_event(line)
+        if event:
+            self._cache_states[event.device] = event.state
+            self._events.put(event)
+        return True
+
+
+    @staticmethod
+    def _parse_event(line):
+        """ Interprets an event line as an Event tuple, None if it's invalid
+        """
+        m = re.fullmatch(r'!EV(\d+),(-?\d+),(\d+),(\d+)', line)
+        if not m:
+            logging.error(f"Invalid event '{line}'.")
+            return
+        device, state, source, time_ms = (int(n) for n in m.groups())
+        if source < len(EVENT_SOURCES):
+            source = EVENT_SOURCES[source]
+        return Event(device, state, source, time_ms)
+
+
+    def _event_reader(self):
+        """ Background thread: reads the events that arrive while no command runs
+        """
+        while not self._event_stop.wait(EVENT_POLL_S):
+            with self._lock:
+                # only ASCII lines can be events; in binary mode the bytes belong to the commands
+                if self._binary or not self._inst.bytes_in_buffer:
+                    continue
+                line = self._inst.read().rstrip('\r\n')
+                self._dispatch_event(line)  # anything else is a late reply, dropped
+
+
+    def enter_binary_mode(self):
+        """ Switches to the binary frame protocol
+
+        Each command is then a fixed 7-byte frame instead of an ASCII line; set_state
+        uses a 3-byte frame answered by a single byte.
+        """
+        logging.info('Entering binary mode.')
+        if self._binary:
+            return
+        resp = self._query('BIN')
+        if resp!='OK':
+            logging.error(f"Invalid response. Expected 'OK', got '{resp}'.")
+            return
+        self._binary = True
+
+
+    def exit_binary_mode(self):
+        """ Switches back to the ASCII commands
+        """
+        logging.info('Exiting binary mode.')
+        if not self._binary:
+            return
+        if self._binary_query(BINCMD_ASCII) is not None:
+            self._binary = False
+
+
+    def _binary_set_state(self, device, state):
+        """ Sets a state with the compact frame (3 bytes out, one ack byte back)
+
+        Returns True on success.
+        """
+        if not 0 <= device <= 0x7F:
+            logging.error('Invalid device number.')
+            return False
+        with self._lock:
+            req = bytes([BINFRAME_SYNC_SST, (device & 0x7F) | (0x80 if state else 0)])
+            self._inst.write_raw(req + bytes([_crc8(req)]))
+            ack = self._inst.read_bytes(1)
+        if ack[0]!=BINACK_OK:
+            logging.error(f"Compact set-state frame rejected (ack 0x{ack[0]:02X}).")
+            return False
+        return True
+
+
+    def _binary_query(self, cmd, b0=0, b1=0, b2=0):
+        """ Sends one binary request frame and reads the response frame
+
+        Returns the response frame, or None on error.
+        """
+        with self._lock:
+            self._seq = (self._seq + 1) & 0xFF
+            req = bytes([BINFRAME_SYNC_REQ, self._seq, cmd, b0 & 0xFF, b1 & 0xFF, b2 & 0xFF])
+            self._inst.write_raw(req + bytes([_crc8(req)]))
+            while True:
+                resp = self._inst.read_bytes(BINFRAME_SIZE)
+                if resp[0]!=BINFRAME_SYNC_RESP or _crc8(resp[:-1])!=resp[-1]:
+                    logging.error(f"Invalid response frame '{resp.hex()}'.")
+                    return
+                if resp[1]==self._seq:  # skip stale responses
+                    break
+        if resp[2]!=BINSTAT_OK:
+            logging.error(f"Binary command 0x{cmd:02X} failed with status {resp[2]}.")
+            return
+        return resp
+
+
+class BatchResult:
+    """Reply to one command of a batch
+
+    Instance variables:
+      value: the result (None for set commands and on error), valid after the batch is sent
+      ok: True if the reply was as expected
+    """
+
+    def __init__(self):
+        self.value = None
+        self.ok = False
+
+
+class Batch:
+    """Commands for a Shutter that are sent pipelined, see Shutter.batch
+
+    The methods take the same arguments as the Shutter methods of the same name and
+    return a BatchResult that is filled in when the batch is sent.
+    """
+
+    def __init__(self, shutter):
+        self._shutter = shutter
+        self._entries = []
+
+
+    def __enter__(self):
+        return self
+
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        if exc_type is None:
+            self.send()
+        return False
+
+
+    def get_num_devices(self):
+        return self._add('GND', lambda resp: int(resp[3:]), 'ND=')
+
+
+    def check_state(self, device):
+        prefix = f'ST{device}='
+        return self._add(f'GST{device}', lambda resp: int(resp[len(prefix):]), prefix)
+
+
+    def get_parameters(self, device):
+        return self._add(f'GPR{device}', lambda resp: Shutter._parse_parameters(resp) or None, 'PR')
+
+
+    def set_state(self, device, state):
+        return self._add(f'SST{device},{state}')
+
+
+    def set_states(self, states):
+        mask = 0
+        bits = 0
+        for device, state in states.items():
+            mask |= 1 << device
+            if state:
+                bits |= 1 << device
+        return self._add(f'SSM{mask},{bits}')
+
+
+    def set_position(self, device, position):
+        return self._add(f'SSP{device},{position}')
+
+
+    def send(self):
+        """ Sends the commands and fills in the results (called at the end of the with block)
+        """
+        if not self._entries:
+            return
+        if self._shutter._binary:
+            logging.error('Batches are not available in binary mode.')
+            return
+        logging.info(f'Sending a batch of {len(self._entries)} commands.')
+        entries, self._entries = self._entries, []
+        if any(parse is None for _, parse, _, _ in entries):
+            self._shutter._cache_states = {}  # read again after set commands
+        replies = self._shutter._pipeline([cmd for cmd, _, _, _ in entries])
+        for (cmd, parse, prefix, result), resp in zip(entries, replies):
+            if parse is None:
+                if resp!='OK':
+                    logging.error(f"Invalid response to '{cmd}'. Expected 'OK', got '{resp}'.")
+                    continue
+            else:
+                if not resp.startswith(prefix):
+                    logging.error(f"Invalid response to '{cmd}'. Expected '{prefix}...', got '{resp}'.")
+                    continue
+                try:
+                    result.value = parse(resp)
+                except ValueError:
+                    logging.error(f"Invalid response to '{cmd}', got '{resp}'.")
+                    continue
+                if result.value is None:
+                    continue
+            result.ok = True
+
+
+    def _add(self, cmd, parse=None, prefix=''):
+        """ Queues a command; parse converts the reply, None for commands answered with 'OK'
+        """
+        result = BatchResult()
+        self._entries.append((cmd, parse, prefix, result))
+        return result
@@ -0,0 +1,508 @@
+import asyncio
+import collections
+import logging
+import os
+import termios
+import time
+import tty
+
+from ard_shutter import (InstrumentError, Shutter, STATS_CHANNELS, BATCH_WINDOW, SAVE_POLL_S,
+                         SAVE_TIMEOUT_S, MAXPRESETS)
+
+
+DEFAULT_TIMEOUT_S = 2.0  # same as the VISA default
+
+
+class AsyncShutter:
+    """Represents an Arduino shutter controller on an asyncio event loop
+
+    Talks to a serial port (or a pty, e.g. the one of the Host Sim) directly, without
+    VISA, and only with the ASCII commands. A call writes its command at once if it
+    fits the receive buffer of the Arduino next to the unanswered ones (see BATCH_WINDOW),
+    so concurrent calls are pipelined; the replies come back in order. Each controller
+    has its own port, several can share one loop. POSIX only, use Shutter on Windows.
+    After a timeout all unanswered calls return None, and the next calls wait until the
+    replies are in step again.
+    Instance variables (private):
+      _port: path of the serial device
+      _fd: file descriptor of the open port (None->closed)
+      _loop: loop the port is registered with
+      _rbuf, _wbuf: partial input line, unwritten output
+      _pending: deque of (future, opcode, length, write time) of the unanswered commands
+      _in_flight: bytes of the unanswered commands
+      _window: condition to wait for space in the receive buffer
+      _syncing: future of the ID reply while the replies are resynchronised after a
+        timeout (see _resync), None otherwise
+      _events: queue of received Event tuples
+      _latency: per-opcode round-trip statistics
+    Methods (coroutines unless noted):
+      connect/close: open (check the ID)/close the port, also 'async with AsyncShutter(port)'
+      get_num_devices, check_state, get_parameters, get_device_label, get_transit_delay,
+      set_parameters, set_state, set_states, set_position, clear, save,
+      get_latency, clear_latency, get_stats, clear_stats, get_save_status,
+      get_preset(s), load_preset, store_preset: as in Shutter
+      subscribe(unsubscribe)_events, next_event: state-change events
+      get_call_latency: (plain method) round-trip times of the calls
+    """
+
+    def __init__(self, port, baud_rate=9600, timeout=DEFAULT_TIMEOUT_S):
+        """ Prepares the controller object, connect opens the port
+
+        Arguments:
+          port: serial device, like '/dev/ttyACM0'
+          baud_rate: must match SERIAL_BAUDRATE of the Arduino code
+          timeout: seconds to wait for a reply
+        """
+        self._port = port
+        self._baud_rate = baud_rate
+        self._timeout = timeout
+        self._fd = None
+        self._loop = None
+        self._rbuf = bytearray()
+        self._wbuf = bytearray()
+        self._pending = collections.deque()
+        self._in_flight = 0
+        self._window = None
+        self._syncing = None
+        self._events = None
+        self._latency = {}
+
+
+    async def __aenter__(self):
+        await self.connect()
+        return self
+
+
+    async def __aexit__(self, exc_type, exc_value, traceback):
+        await self.close()
+        return False
+
+
+    async def connect(self):
+        """ Opens the port and checks the ID response
+
+        Throws an exception if it's the wrong device.
+        """
+        logging.info(f'Opening {self._port}.')
+        self._loop = asyncio.get_running_loop()
+        self._window = asyncio.Condition()
+        self._events = asyncio.Queue()
+        self._fd = os.open(self._port, os.O_RDWR | os.O_NOCTTY | os.O_NONBLOCK)
+        try:
+            tty.setraw(self._fd)
+            attr = termios.tcgetattr(self._fd)
+            speed = getattr(termios, f'B{self._baud_rate}')
+            attr[4] = attr[5] = speed
+            termios.tcsetattr(self._fd, termios.TCSANOW, attr)
+        except termios.error:
+            pass  # not a tty (e.g. a pipe), nothing to configure
+        self._loop.add_reader(self._fd, self._on_readable)
+        logging.info('Requesting ID from instrument')
+        resp = await self._query('*IDN?')
+        if resp is None or not resp.startswith('Arduino Uno Shutter'):
+            await self.close()
+            raise InstrumentError(
+                f"Wrong ID response. Expected 'Arduino Uno Shutter', got '{resp}'.")
+
+
+    async def close(self):
+        """ Closes the port; unanswered calls return None
+        """
+        if self._fd is None:
+            return
+        logging.info(f'Closing {self._port}.')
+        self._loop.remove_reader(self._fd)
+        self._loop.remove_writer(self._fd)
+        os.close(self._fd)
+        self._fd = None
+        self._fail_pending()
+        self._rbuf.clear()
+        self._wbuf.clear()
+        if self._syncing is not None and not self._syncing.done():
+            self._syncing.set_result(False)
+
+
+    async def get_num_devices(self):
+        """ Gets the numer of attached shutters
+        """
+        resp = await self._query('GND')
+        if not self._check_prefix(resp, 'ND='):
+            return
+        return int(resp[3:])
+
+
+    async def check_state(self, device):
+        """ Gets the state of the given device
+
+        Returns the state of the device: -1->inactive, 0->closed, 1->open, 2-> manual set
+        Arguments:
+          device: the selected shutter number (zero-based index)
+        """
+        resp = await self._query(f'GST{device}')
+        if not self._check_prefix(resp, f'ST{device}='):
+            return
+        return int(resp.split('=')[1])
+
+
+    async def get_parameters(self, device):
+        """ Gets the parameters for the given device as a dictionary
+        """
+        resp = await self._query(f'GPR{device}')
+        if resp is None:
+            return {}
+        return Shutter._parse_parameters(resp)
+
+
+    async def get_device_label(self, device):
+        """ Gets the label of the given device
+        """
+        resp = await self._query(f'GDL{device}')
+        if not self._check_prefix(resp, f'DL{device}='):
+            return
+        return resp.split('=', 1)[1]
+
+
+    async def get_transit_delay(self, device):
+        """ Gets the transit delay of the given device in ms
+        """
+        resp = await self._query(f'GTD{device}')
+        if not self._check_prefix(resp, f'TD{device}='):
+            return
+        return int(resp.split('=')[1])
+
+
+    async def set_parameters(self, device, params):
+        """ Sets the parameters (dictionary as from get_parameters) for the given device
+        """
+        keys = ['shieldChannel', 'digInput', 'openPos', 'closedPos', 'transDelay_ms', 'label']
+        return await self._command(f'SPR{device},' + ','.join(str(params[k]) for k in keys))
+
+
+    async def set_state(self, device, state):
+        """ Opens (state 1)/closes (state 0) the given device, returns True on success
+        """
+        return await self._command(f'SST{device},{state}')
+
+
+    async def set_states(self, states):
+        """ Sets the states of several devices at once
+
+        Arguments:
+          states: dictionary {device: state}, state 0->close, 1->open
+        """
+        mask = 0
+        bits = 0
+        for device, state in states.items():
+            mask |= 1 << device
+            if state:
+                bits |= 1 << device
+        return await self._command(f'SSM{mask},{bits}')
+
+
+    async def set_position(self, device, position):
+        """ Sets the position of the actuator for a given device
+        """
+        return await self._command(f'SSP{device},{position}')
+
+
+    async def clear(self):
+        """ Clears the device parameters, sets the number of devices to zero
+        """
+        return await self._command('CLR')
+
+
+    async def save(self):
+        """ Saves the current parameters to EEPROM, returns when the controller is done
+        """
+        if not await self._command('SAV'):
+            return False
+        return await self._wait_for_save()
+
+
+    async def get_preset(self, preset):
+        """ Gets a preset as a dictionary (see Shutter.get_preset)
+        """
+        resp = await self._query(f'GPS{preset}')
+        if not self._check_prefix(resp, f'PS{preset}='):
+            return {}
+        return Shutter._parse_preset(resp)
+
+
+    async def get_presets(self):
+        """ Gets all presets as a list of dictionaries, the queries are pipelined
+        """
+        return list(await asyncio.gather(*[self.get_preset(p) for p in range(MAXPRESETS)]))
+
+
+    async def load_preset(self, preset):
+        """ Replaces all shutters by a stored preset, returns True on success
+        """
+        return await self._command(f'LPS{preset}')
+
+
+    async def store_preset(self, preset, name):
+        """ Stores the current shutters as a preset, returns when the controller is done
+        """
+        if not await self._command(f'SPS{preset},{name}'):
+            return False
+        return await self._wait_for_save()
+
+
+    async def get_save_status(self):
+        """ Gets the progress of the EEPROM save (see Shutter.get_save_status)
+        """
+        resp = await self._query('GSV')
+        if not self._check_prefix(resp, 'SV='):
+            return {}
+        return Shutter._parse_save_status(resp)
+
+
+    async def get_latency(self):
+        """ Gets the digital input edge-to-actuation latency statistics (see Shutter.get_latency)
+        """
+        resp = await self._query('GLT')
+        if not self._check_prefix(resp, 'LT='):
+            return {}
+        numbers = [int(n) for n in resp[3:].split(',')]
+        return dict(zip(['count', 'last_us', 'min_us', 'max_us'], numbers))
+
+
+    async def clear_latency(self):
+        """ Resets the latency statistics
+        """
+        return await self._command('CLT')
+
+
+    async def get_stats(self, channel):
+        """ Gets a timing histogram (see Shutter.get_stats)
+        """
+        if isinstance(channel, str):
+            channel = STATS_CHANNELS.index(channel)
+        resp = await self._query(f'GPF{channel}')
+        if resp is None:
+            return {}
+        return Shutter._parse_stats(channel, resp)
+
+
+    async def clear_stats(self):
+        """ Resets all timing histograms
+        """
+        return await self._command('CPF')
+
+
+    async def subscribe_events(self):
+        """ Starts the state-change events (needs SERIALEVENTS in the Arduino code)
+
+        The events are queued as Event(device, state, source, time_ms) tuples, read them
+        with next_event.
+        """
+        return await self._command('EVT1')
+
+
+    async def unsubscribe_events(self):
+        """ Stops the state-change events; queued events can still be read
+        """
+        return await self._command('EVT0')
+
+
+    async def next_event(self):
+        """ Waits for the next state-change event
+        """
+        return await self._events.get()
+
+
+    def get_call_latency(self, opcode=None):
+        """ Gets the round-trip times of the calls so far
+
+        Measured from writing the command to receiving its reply, so the time a call waits
+        for space in the receive buffer is not included.
+        Arguments:
+          opcode: three-letter command (like 'GST'), None for all
+        Returns a dictionary with count, last_ms, min_ms, max_ms and mean_ms, for opcode None
+          a dictionary {opcode: statistics}.
+        """
+        if opcode is None:
+            return {op: self.get_call_latency(op) for op in self._latency}
+        count, last, low, high, total = self._latency.get(opcode, (0, 0, 0, 0, 0))
+        return {'count': count, 'last_ms': last*1e3, 'min_ms': low*1e3,
+                'max_ms': high*1e3, 'mean_ms': total/count*1e3 if count else 0}
+
+
+    async def _command(self, cmd):
+        """ Sends a command that is answered with 'OK'
+
+        Returns True on success.
+        """
+        resp = await self._query(cmd)
+        if resp!='OK':
+            if resp is not None:
+                logging.error(f"Invalid response to '{cmd}'. Expected 'OK', got '{resp}'.")
+            return False
+        return True
+
+
+    async def _query(self, cmd):
+        """ Sends a command and waits for its reply line, None on timeout or closed port
+        """
+        if self._fd is None:
+            logging.error('Port not open.')
+            return
+        data = cmd.encode() + b'\n'
+        async with self._window:
+            await self._window.wait_for(
+                lambda: self._syncing is None
+                        and (self._in_flight==0 or self._in_flight+len(data)<=BATCH_WINDOW))
+            if self._fd is None:
+                return
+            future = self._loop.create_future()
+            # queue and write in one step so the replies match the order of the futures
+            self._pending.append((future, cmd[:3], len(data), time.perf_counter()))
+            self._in_flight += len(data)
+            self._write(data)
+        try:
+            return await asyncio.wait_for(future, self._timeout)
+        except asyncio.TimeoutError:
+            logging.error(f"No response to '{cmd}'.")
+            if self._syncing is None and self._fd is not None:
+                self._resync()
+            return
+
+
+    def _resync(self):
+        """ Gets the replies in step again after a timeout
+
+        The reply may be lost (a dropped line, a reset controller) or only late, so the
+        next line cannot be matched to a call. All unanswered calls return None, new calls
+        wait, and every line up to the reply to an '*IDN?' is dropped. The port is closed
+        if that reply does not come either.
+        """
+        self._fail_pending()
+        self._syncing = self._loop.create_future()
+        self._write(b'\n*IDN?\n')  # the newline ends a command the controller got only in part
+
+        async def wait_for_id():
+            try:
+                await asyncio.wait_for(asyncio.shield(self._syncing), self._timeout)
+            except asyncio.TimeoutError:
+                logging.error(f'{self._port} does not answer, closing it.')
+                await self.close()
+            self._syncing = None
+            self._free_window(0)
+        self._loop.create_task(wait_for_id())
+
+
+    async def _wait_for_save(self):
+        """ Polls the save status until the controller has written the EEPROM
+        """
+        deadline = self._loop.time() + SAVE_TIMEOUT_S
+        while True:
+            status = await self.get_save_status()
+            if not status:
+                return False
+            if not status['running']:
+                return True
+            if self._loop.time() > deadline:
+                logging.error('Save did not finish.')
+                return False
+            await asyncio.sleep(SAVE_POLL_S)
+
+
+    def _check_prefix(self, resp, prefix):
+        """ Returns True if the reply starts with prefix
+        """
+        if resp is None:
+            return False
+        if not resp.startswith(prefix):
+            logging.error(f"Invalid response. Expected '{prefix}...', got '{resp}'.")
+            return False
+        return True
+
+
+    def _write(self, data):
+        """ Writes without blocking; what does not fit the port is written when it's ready
+        """
+        self._wbuf += data
+        if len(self._wbuf)==len(data):
+            self._on_writable()
+
+
+    def _on_writable(self):
+        try:
+            n = os.write(self._fd, self._wbuf)
+        except BlockingIOError:
+            n = 0
+        except OSError as e:
+            logging.error(f'Could not write to {self._port}: {e}')
+            self._loop.create_task(self.close())
+            return
+        del self._wbuf[:n]
+        if self._wbuf:
+            self._loop.add_writer(self._fd, self._on_writable)
+        else:
+            self._loop.remove_writer(self._fd)
+
+
+    def _on_readable(self):
+        try:
+            data = os.read(self._fd, 256)
+        except BlockingIOError:
+            return
+        except OSError as e:
+            data = b''
+            logging.error(f'Could not read from {self._port}: {e}')
+        if not data:
+            self._loop.create_task(self.close())
+            return
+        self._rbuf += data
+        while True:
+            end = self._rbuf.find(b'\n')
+            if end<0:
+                break
+            line = self._rbuf[:end].decode(errors='replace').rstrip('\r')
+            del self._rbuf[:end+1]
+            self._on_line(line)
+
+
+    def _on_line(self, line):
+        """ Hands a reply line to the oldest unanswered call, queues event lines
+        """
+        if line.startswith('!'):
+            event = Shutter._parse_event(line)
+            if event:
+                self._events.put_nowait(event)
+            return
+        if self._syncing is not None:
+            if line.startswith('Arduino Uno Shutter') and not self._syncing.done():
+                self._syncing.set_result(True)
+            return
+        if not self._pending:
+            logging.error(f"Unexpected line '{line}'.")
+            return
+        future, opcode, length, sent = self._pending.popleft()
+        self._record_latency(opcode, time.perf_counter()-sent)
+        if not future.done():
+            future.set_result(line)
+        self._free_window(length)
+
+
+    def _record_latency(self, opcode, seconds):
+        count, _, low, high, total = self._latency.get(opcode, (0, 0, seconds, seconds, 0))
+        self._latency[opcode] = (count+1, seconds, min(low, seconds), max(high, seconds),
+                                 total+seconds)
+
+
+    def _free_window(self, length):
+        self._in_flight -= length
+        async def notify():
+            async with self._window:
+                self._window.notify_all()
+        self._loop.create_task(notify())
+
+
+    def _fail_pending(self):
+        while self._pending:
+            future = self._pending.popleft()[0]
+            if not future.done():
+                future.set_result(None)
+        self._in_flight = 0
+        self._free_window(0)